@@ -37,6 +37,20 @@ const char *program_bug_address = "<software@alluris.de>";
 static char do_exit = 0;
 static int verbose_flag;
 
+// set by --framed, -s writes frames with this device id
+static int frame_device = -1;
+// set by --compress
+static enum liballuris_frame_format frame_format = LIBALLURIS_FRAME_INT24;
+// set by --format, how -s prints the values
+static enum liballuris_output_format output_format = LIBALLURIS_OUTPUT_RAW;
+static int output_digits = 0;
+
+#ifndef _WIN32
+// set by --capture, the values of -s go to this file instead of stdout
+static const char* capture_path = NULL;
+static struct liballuris_capture_header capture_info;
+#endif
+
 void usage ()
 {
   printf ("Usage: %s [OPTION]...\n", program_name);
@@ -56,6 +70,18 @@ Generic Alluris device control\n\
       --start                Start\n\
       --stop                 Stop\n\
   -s, --sample=NUM           Capture NUM values (Inf if NUM==0)\n\
+      --capture=FILE         Write the values of following -s to FILE in\n\
+                             the liballuris capture format instead of stdout.\n\
+                             Use it before --start to record digits and unit\n\
+      --framed[=ID]          Write the values of following -s to stdout as\n\
+                             frames of packed 24bit values with sequence\n\
+                             number, device ID (default 0) and checksum\n\
+      --compress             Like --framed but the values are compressed\n\
+                             lossless, about 1 byte per value for slow forces\n\
+      --format=FMT           Print the values of following -s as 'raw'\n\
+                             integers (default), 'csv' or 'tsv' fixed-point\n\
+                             numbers or 'binary' int32. Use it before --start\n\
+                             to read the digits for csv and tsv\n\
   -v, --value                Get single value without starting streaming\n\
 \n\
  Tare:\n\
@@ -107,8 +133,10 @@ Generic Alluris device control\n\
                              V5.04.007 and --digits in newer versions.\n\
       --keypress=KEY         Sim. keypress. Bit 0=S1, 1=S2, 2=S3, 3=long_press.\n\
                              For ex. 12 => long press of S3\n\
+      --latency              Print latency percentiles in ms and error\n\
+                             counters of all commands sent so far\n\
       --power-off            Power off the device\n\
-      --read-memory=ADR      Read adr 0..999 or -1 for whole memory\n\
+      --read-memory=ADR      Read adr 0..999 or -1 for all stored values\n\
       --set-digout=MASK      Set state of the 3 digital outputs = MASK\n\
                              (firmware >= V4.03.008/V5.03.008)\n\
       --set-keylock=V        Lock (V=1) or unlock (V=0) keys. Power-off with S1\n\
@@ -130,7 +158,7 @@ void termination_handler (int signum)
   do_exit = 1;
 }
 
-static int print_multiple (libusb_device_handle *dev_handle, int num)
+static int print_multiple (libusb_context* ctx, libusb_device_handle *dev_handle, int num)
 {
   // check if measurement is running
   struct liballuris_state state;
@@ -144,32 +172,137 @@ static int print_multiple (libusb_device_handle *dev_handle, int num)
             block_size = 19;
 
           int tempx[block_size];
+          double t[block_size];
+          double t_prev = -1;
+
+          struct liballuris_sample_stats stats_before, stats_after;
+          ret = liballuris_get_sample_stats (dev_handle, &stats_before);
+          if (ret)
+            return ret;
+
+          struct liballuris_frame_writer* frames = NULL;
+          struct liballuris_formatter* fmt = NULL;
+          if (frame_device >= 0)
+            ret = liballuris_frame_writer_new (stdout, frame_format, frame_device, DEFAULT_FRAME_SAMPLES, &frames);
+          else
+            ret = liballuris_formatter_new (stdout, output_format, 1,
+                                            (output_format == LIBALLURIS_OUTPUT_RAW)? NULL : &output_digits, &fmt);
+          if (ret)
+            return ret;
+
+#ifndef _WIN32
+          struct liballuris_capture* cap = NULL;
+          if (capture_path)
+            {
+              ret = liballuris_capture_create (capture_path, &capture_info, &cap);
+              if (ret)
+                {
+                  if (frames)
+                    liballuris_frame_writer_free (frames);
+                  if (fmt)
+                    liballuris_formatter_free (fmt);
+                  return ret;
+                }
+            }
+#endif
 
-          // enable streaming
-          ret = liballuris_cyclic_measurement (dev_handle, 1, block_size);
+          // read in a background thread so a slow stdout doesn't delay the device
+          struct liballuris_reader* reader;
+          ret = liballuris_reader_start (ctx, dev_handle, block_size, DEFAULT_READER_CAPACITY, &reader);
+          if (ret)
+            {
+#ifndef _WIN32
+              if (cap)
+                liballuris_capture_close (cap);
+#endif
+              if (frames)
+                liballuris_frame_writer_free (frames);
+              if (fmt)
+                liballuris_formatter_free (fmt);
+              return ret;
+            }
 
           int cnt = 0;
           // if num==0, read until sigint or sigterm
           while (!do_exit && !ret && (!num || num > cnt))
             {
-              //printf ("polling %i, %i left\n", block_size, num);
-              ret = liballuris_poll_measurement (dev_handle, tempx, block_size);
+              // same worst case as liballuris_poll_measurement (19 values at 10Hz)
+              size_t actual;
+              ret = liballuris_reader_read_timestamped (reader, tempx, t, block_size, &actual, 3600);
               if (ret == LIBUSB_SUCCESS)
                 {
-                  int k = 0;
-                  while (k < block_size && (cnt < num || !num))
+                  if (num && actual > (size_t) (num - cnt))
+                    actual = num - cnt;
+
+                  // the timestamps skip the samples the device didn't send
+                  double rate = liballuris_reader_get_sample_rate (reader);
+                  size_t j;
+                  for (j = 0; j < actual; t_prev = t[j++])
+                    if (t_prev >= 0 && rate > 0 && (t[j] - t_prev) * rate > 1.5)
+                      fprintf (stderr, "Warning: about %.0f value(s) missing before value #%zu\n",
+                               (t[j] - t_prev) * rate - 1, cnt + j + 1);
+#ifndef _WIN32
+                  if (cap)
                     {
-                      printf ("%i\n", tempx[k++]);
-                      cnt++;
+                      ret = liballuris_capture_append (cap, tempx, actual);
+                      cnt += actual;
+                      continue;
                     }
+#endif
+                  if (frames)
+                    {
+                      ret = liballuris_frame_writer_write (frames, tempx, actual);
+                      cnt += actual;
+                      fflush (stdout);
+                      continue;
+                    }
+                  // one write per block
+                  ret = liballuris_formatter_write (fmt, tempx, actual);
+                  if (! ret)
+                    ret = liballuris_formatter_flush (fmt);
+                  cnt += actual;
                   fflush (stdout);
                 }
-              else
-                return ret;
             }
 
-          // disable streaming
-          ret = liballuris_cyclic_measurement (dev_handle, 0, block_size);
+          // values of an incomplete frame
+          if (frames)
+            {
+              int frames_ret = liballuris_frame_writer_free (frames);
+              if (! ret)
+                ret = frames_ret;
+              fflush (stdout);
+            }
+          if (fmt)
+            liballuris_formatter_free (fmt);
+
+          if (liballuris_reader_get_overflows (reader))
+            fprintf (stderr, "Warning: %lu value(s) dropped, output was too slow\n", liballuris_reader_get_overflows (reader));
+
+          // stop reader and disable streaming
+          int close_ret = liballuris_reader_stop (reader);
+          if (! ret)
+            ret = close_ret;
+
+          if (! liballuris_get_sample_stats (dev_handle, &stats_after))
+            {
+              if (stats_after.gaps > stats_before.gaps)
+                fprintf (stderr, "Warning: %lu gap(s) with %lu missing value(s), the host didn't poll the device in time\n",
+                         stats_after.gaps - stats_before.gaps, stats_after.missing - stats_before.missing);
+              if (stats_after.malformed > stats_before.malformed)
+                fprintf (stderr, "Warning: %lu malformed block(s) discarded\n", stats_after.malformed - stats_before.malformed);
+            }
+
+#ifndef _WIN32
+          if (cap)
+            {
+              close_ret = liballuris_capture_close (cap);
+              if (! ret)
+                ret = close_ret;
+              if (verbose_flag)
+                printf ("Wrote %i values to '%s'\n", cnt, capture_path);
+            }
+#endif
         }
       else
         {
@@ -205,6 +338,168 @@ int get_base10_int (const char *p, int* value)
   return 0;
 }
 
+/*
+ * Consecutive getter options are collected and sent pipelined,
+ * see liballuris_batch_run. This saves a round trip per option.
+ */
+#define MAX_PENDING_GETTERS 32
+
+struct pending_getter
+{
+  int c;
+  int option_index;
+  int index[2];
+  int value;
+  enum liballuris_unit unit;
+  enum liballuris_measurement_mode mode;
+  char str[2][21];
+};
+
+int is_pipelined_getter (int c)
+{
+  switch (c)
+    {
+    case 'n':
+    case 'p':
+    case 'v':
+    case 1021:
+    case 1023:
+    case 1025:
+    case 1027:
+    case 1031:
+    case 1033:
+    case 1040:
+    case 1041:
+    case 1042:
+    case 1043:
+    case 1061:
+    case 1062:
+    case 1063:
+    case 1064:
+    case 1065:
+      return 1;
+    }
+  return 0;
+}
+
+int queue_getter (struct liballuris_batch* b, struct pending_getter* g)
+{
+  g->index[1] = -1;
+  switch (g->c)
+    {
+    case 'n': // neg-peak
+      g->index[0] = liballuris_batch_get_neg_peak (b, &g->value);
+      break;
+    case 'p': // pos-peak
+      g->index[0] = liballuris_batch_get_pos_peak (b, &g->value);
+      break;
+    case 'v': // read one sample
+      g->index[0] = liballuris_batch_get_value (b, &g->value);
+      break;
+    case 1021: // get-auto-stop
+      g->index[0] = liballuris_batch_get_autostop (b, &g->value);
+      break;
+    case 1023: // get-lower-limit
+      g->index[0] = liballuris_batch_get_lower_limit (b, &g->value);
+      break;
+    case 1025: // get-upper-limit
+      g->index[0] = liballuris_batch_get_upper_limit (b, &g->value);
+      break;
+    case 1027: // get-mode
+      g->index[0] = liballuris_batch_get_mode (b, &g->mode);
+      break;
+    case 1031: // get-unit
+      g->index[0] = liballuris_batch_get_unit (b, &g->unit);
+      break;
+    case 1033: // get-peak-level
+      g->index[0] = liballuris_batch_get_peak_level (b, &g->value);
+      break;
+    case 1040: // digits
+      g->index[0] = liballuris_batch_get_digits (b, &g->value);
+      break;
+    case 1041: // fmax
+      g->index[0] = liballuris_batch_get_F_max (b, &g->value);
+      break;
+    case 1042: // resolution
+      g->index[0] = liballuris_batch_get_resolution (b, &g->value);
+      break;
+    case 1043: // variant
+      g->index[0] = liballuris_batch_get_variant (b, g->str[0], 10);
+      break;
+    case 1061: // get-digin
+      g->index[0] = liballuris_batch_get_digin (b, &g->value);
+      break;
+    case 1062: // get-digout
+      g->index[0] = liballuris_batch_get_digout (b, &g->value);
+      break;
+    case 1063: // get-firmware
+      g->index[0] = liballuris_batch_get_firmware (b, 0, g->str[0], 21);
+      if (g->index[0] >= 0)
+        g->index[1] = liballuris_batch_get_firmware (b, 1, g->str[1], 21);
+      return (g->index[1] < 0)? g->index[1] : 0;
+    case 1064: // get-mem-count
+      g->index[0] = liballuris_batch_get_mem_count (b, &g->value);
+      break;
+    case 1065: // get-next-cal-date
+      g->index[0] = liballuris_batch_get_next_calibration_date (b, &g->value);
+      break;
+    }
+  return (g->index[0] < 0)? g->index[0] : 0;
+}
+
+void print_getter (struct pending_getter* g)
+{
+  switch (g->c)
+    {
+    case 1027: // get-mode
+      printf ("%i\n", g->mode);
+      break;
+    case 1031: // get-unit
+      printf ("%s\n", liballuris_unit_enum2str (g->unit));
+      break;
+    case 1043: // variant
+      printf ("%s\n", g->str[0]);
+      break;
+    case 1063: // get-firmware
+      printf ("%s;%s\n", g->str[0], g->str[1]);
+      break;
+    default:
+      printf ("%i\n", g->value);
+    }
+}
+
+/*
+ * Run all pending getters and print their results in command line order
+ * up to the first failing one. c and option_index are set to this option.
+ */
+int run_pending_getters (libusb_device_handle* h, struct pending_getter* pending, int num, int *c, int *option_index)
+{
+  struct liballuris_batch* b = NULL;
+  int r = liballuris_batch_new (h, DEFAULT_PIPELINE_DEPTH, &b);
+  int k;
+  for (k = 0; k < num && ! r; k++)
+    r = queue_getter (b, pending + k);
+  if (! r)
+    liballuris_batch_run (b);
+
+  for (k = 0; k < num && ! r; k++)
+    {
+      struct pending_getter* g = pending + k;
+      r = liballuris_batch_status (b, g->index[0]);
+      if (! r && g->index[1] >= 0)
+        r = liballuris_batch_status (b, g->index[1]);
+      if (! r)
+        print_getter (g);
+      else
+        {
+          *c = g->c;
+          *option_index = g->option_index;
+        }
+    }
+  liballuris_batch_free (b);
+  return r;
+}
+
 static struct option const long_options[] =
 {
   {"verbose", no_argument, &verbose_flag, 1},
@@ -262,6 +557,11 @@ static struct option const long_options[] =
   {"help", no_argument, NULL, 1074},
   {"disable-motor", no_argument, NULL, 1075},
   {"enable-motor", no_argument, NULL, 1076},
+  {"latency", no_argument, NULL, 1077},
+  {"capture", required_argument, NULL, 1078},
+  {"framed", optional_argument, NULL, 1079},
+  {"compress", no_argument, NULL, 1080},
+  {"format", required_argument, NULL, 1081},
   {"version", no_argument, NULL, 'V'},
 
   {NULL, 0, NULL, 0}
@@ -307,12 +607,26 @@ main (int argc, char **argv)
   /* getopt_long stores the option index here. */
   int option_index;
 
+  struct pending_getter pending[MAX_PENDING_GETTERS];
+  int num_pending = 0;
+
   while (! do_exit && ! r)
     {
       option_index = -1;
       c = getopt_long (argc, argv, "b:lS:nps:vtVd:",
                        long_options, &option_index);
 
+      if (num_pending && (! is_pipelined_getter (c) || num_pending == MAX_PENDING_GETTERS))
+        {
+          r = run_pending_getters (h, pending, num_pending, &c, &option_index);
+          num_pending = 0;
+          if (r)
+            {
+              optarg = NULL;
+              break;
+            }
+        }
+
       /* Detect the end of the options. */
       if (c == -1)
         break;
@@ -322,7 +636,7 @@ main (int argc, char **argv)
           int tmp_debug;
           r = get_base10_int (optarg, &tmp_debug);
           if (! r)
-            liballuris_debug_level = tmp_debug;
+            r = liballuris_set_context_debug_level (ctx, tmp_debug);
           continue;
         }
 
@@ -346,6 +660,14 @@ main (int argc, char **argv)
             break;
         }
 
+      if (is_pipelined_getter (c))
+        {
+          pending[num_pending].c = c;
+          pending[num_pending].option_index = option_index;
+          num_pending++;
+          continue;
+        }
+
       switch (c)
         {
         case 0:
@@ -362,37 +684,17 @@ main (int argc, char **argv)
 
           if (h)
             {
-              //printf ("libusb_release_interface\n");
-              libusb_release_interface (h, 0);
-
-              //printf ("libusb_close\n");
-              libusb_close (h);
+              liballuris_close_device (h);
 
               h = 0;
             }
           r = liballuris_open_if_not_opened (ctx, optarg, &h);
           break;
 
-        case 'n': // neg-peak
-        {
-          int value;
-          r = liballuris_get_neg_peak (h, &value);
-          if (r == LIBUSB_SUCCESS)
-            printf ("%i\n", value);
-          break;
-        }
-
-        case 'p': // pos-peak
-        {
-          int value;
-          r = liballuris_get_pos_peak (h, &value);
-          if (r == LIBUSB_SUCCESS)
-            printf ("%i\n", value);
-          break;
-        }
-
         case 1000: // start
           r = liballuris_start_measurement (h);
+          if (! r && verbose_flag)
+            printf ("Measurement running after %.1f ms\n", liballuris_get_start_latency (h));
           break;
 
         case 1001: // stop
@@ -408,7 +710,7 @@ main (int argc, char **argv)
               if (num_samples >= 0)
                 {
                   //printf ("num_samples=%i\n", num_samples);
-                  r = print_multiple (h, num_samples);
+                  r = print_multiple (ctx, h, num_samples);
                   //printf ("print_multiple returned %i\n", r);
                 }
               else
@@ -419,15 +721,6 @@ main (int argc, char **argv)
             }
           break;
         }
-        case 'v': // read one sample
-        {
-          int value;
-          r = liballuris_get_value (h, &value);
-          if (r == LIBUSB_SUCCESS)
-            printf ("%i\n", value);
-          break;
-        }
-
         case 1010: // clear-neg
           r = liballuris_clear_neg_peak (h);
           break;
@@ -443,15 +736,6 @@ main (int argc, char **argv)
           r = liballuris_restore_factory_defaults (h);
           break;
 
-        case 1021: // get-auto-stop
-        {
-          int value;
-          r = liballuris_get_autostop (h, &value);
-          if (r == LIBUSB_SUCCESS)
-            printf ("%i\n", value);
-          break;
-        }
-
         case 1022: // set-auto-stop
         {
           int value;
@@ -461,15 +745,6 @@ main (int argc, char **argv)
           break;
         }
 
-        case 1023: // get-lower-limit
-        {
-          int value;
-          r = liballuris_get_lower_limit (h, &value);
-          if (r == LIBUSB_SUCCESS)
-            printf ("%i\n", value);
-          break;
-        }
-
         case 1024: // set-lower-limit
         {
           int value;
@@ -479,15 +754,6 @@ main (int argc, char **argv)
           break;
         }
 
-        case 1025: // get-upper-limit
-        {
-          int value;
-          r = liballuris_get_upper_limit (h, &value);
-          if (r == LIBUSB_SUCCESS)
-            printf ("%i\n", value);
-          break;
-        }
-
         case 1026: // set-upper-limit
         {
           int value;
@@ -497,15 +763,6 @@ main (int argc, char **argv)
           break;
         }
 
-        case 1027: // get-mode
-        {
-          enum liballuris_measurement_mode r_mode;
-          r = liballuris_get_mode (h, &r_mode);
-          if (r == LIBUSB_SUCCESS)
-            printf ("%i\n", r_mode);
-          break;
-        }
-
         case 1028: // set-mode
         {
           int value;
@@ -539,15 +796,6 @@ main (int argc, char **argv)
           break;
         }
 
-        case 1031: // get-unit
-        {
-          enum liballuris_unit r_unit;
-          r = liballuris_get_unit (h, &r_unit);
-          if (r == LIBUSB_SUCCESS)
-            printf ("%s\n", liballuris_unit_enum2str (r_unit));
-          break;
-        }
-
         case 1032: // set-unit
         {
           enum liballuris_unit r_unit = liballuris_unit_str2enum (optarg);
@@ -555,15 +803,6 @@ main (int argc, char **argv)
           break;
         }
 
-        case 1033: // get-peak-level
-        {
-          int value;
-          r = liballuris_get_peak_level (h, &value);
-          if (r == LIBUSB_SUCCESS)
-            printf ("%i\n", value);
-          break;
-        }
-
         case 1034: // set-peak-level
         {
           int value;
@@ -573,96 +812,10 @@ main (int argc, char **argv)
           break;
         }
 
-        case 1040: // digits
-        {
-          int value;
-          r = liballuris_get_digits (h, &value);
-          if (r == LIBUSB_SUCCESS)
-            printf ("%i\n", value);
-          break;
-        }
-
-        case 1041: // fmax
-        {
-          int value;
-          r = liballuris_get_F_max (h, &value);
-          if (r == LIBUSB_SUCCESS)
-            printf ("%i\n", value);
-          break;
-        }
-
-        case 1042: // resolution
-        {
-          int value;
-          r = liballuris_get_resolution (h, &value);
-          if (r == LIBUSB_SUCCESS)
-            printf ("%i\n", value);
-          break;
-        }
-
-        case 1043: // variant
-        {
-          char variant_buf[10];
-          r = liballuris_get_variant (h, variant_buf, 10);
-          if (r == LIBUSB_SUCCESS)
-            printf ("%s\n", variant_buf);
-          break;
-        }
-
         case 1060: // delete-memory
           r = liballuris_delete_memory (h);
           break;
 
-        case 1061: // get-digin
-        {
-          int value;
-          r = liballuris_get_digin (h, &value);
-          if (r == LIBUSB_SUCCESS)
-            printf ("%i\n", value);
-          break;
-        }
-
-        case 1062: // get-digout
-        {
-          int value;
-          r = liballuris_get_digout (h, &value);
-          if (r == LIBUSB_SUCCESS)
-            printf ("%i\n", value);
-          break;
-        }
-
-        case 1063: // get-firmware
-        {
-          char firmware_buf[21];
-          r = liballuris_get_firmware (h, 0, firmware_buf, 21);
-          if (r == LIBUSB_SUCCESS)
-            {
-              printf ("%s;", firmware_buf);
-              r = liballuris_get_firmware (h, 1, firmware_buf, 21);
-              if (r == LIBUSB_SUCCESS)
-                printf ("%s\n", firmware_buf);
-            }
-          break;
-        }
-
-        case 1064: // get-mem-count
-        {
-          int value;
-          r = liballuris_get_mem_count (h, &value);
-          if (r == LIBUSB_SUCCESS)
-            printf ("%i\n", value);
-          break;
-        }
-
-        case 1065: // get-next-cal-date
-        {
-          int value;
-          r = liballuris_get_next_calibration_date (h, &value);
-          if (r == LIBUSB_SUCCESS)
-            printf ("%i\n", value);
-          break;
-        }
-
         case 1066: // get-stats
         {
           int stats[6];
@@ -696,21 +849,20 @@ main (int argc, char **argv)
         {
           int value;
           r = get_base10_int (optarg, &value);
-          if (r == LIBUSB_SUCCESS)
+          if (r == LIBUSB_SUCCESS && value == -1)
             {
-              int start_adr = value;
-              int stop_adr = value;
-              if (value == -1)
-                {
-                  start_adr = 0;
-                  stop_adr = 999;
-                }
-              while (start_adr <= stop_adr)
-                {
-                  r = liballuris_read_memory (h, start_adr++, &value);
-                  if (r == LIBUSB_SUCCESS)
-                    printf ("%i\n", value);
-                }
+              // pipelined up to the number of stored values
+              int mem[1000];
+              size_t actual, k;
+              r = liballuris_read_memory_range (h, 0, mem, 1000, &actual);
+              for (k = 0; k < actual; k++)
+                printf ("%i\n", mem[k]);
+            }
+          else if (r == LIBUSB_SUCCESS)
+            {
+              r = liballuris_read_memory (h, value, &value);
+              if (r == LIBUSB_SUCCESS)
+                printf ("%i\n", value);
             }
           break;
         }
@@ -767,6 +919,59 @@ main (int argc, char **argv)
           break;
         }
 
+        case 1077: // latency
+          liballuris_print_command_stats (stdout, h);
+          break;
+
+        case 1078: // capture
+#ifndef _WIN32
+          // digits and unit can only be read while the measurement is stopped
+          r = liballuris_capture_describe (h, &capture_info);
+          if (! r)
+            capture_path = optarg;
+#else
+          fprintf (stderr, "Error: --capture isn't supported on Windows\n");
+          r = LIBALLURIS_OUT_OF_RANGE;
+#endif
+          break;
+
+        case 1079: // framed
+          frame_device = 0;
+          if (optarg)
+            {
+              r = get_base10_int (optarg, &frame_device);
+              if (! r && (frame_device < 0 || frame_device > 255))
+                {
+                  fprintf (stderr, "Error: ID(=%i) has to be 0..255\n", frame_device);
+                  r = LIBALLURIS_OUT_OF_RANGE;
+                }
+            }
+          break;
+
+        case 1080: // compress
+          frame_format = LIBALLURIS_FRAME_DELTA;
+          if (frame_device < 0)
+            frame_device = 0;
+          break;
+
+        case 1081: // format
+          output_format = liballuris_output_str2enum (optarg);
+          if ((int) output_format == -1)
+            {
+              fprintf (stderr, "Error: Unknown format '%s', use raw, csv, tsv or binary\n", optarg);
+              r = LIBALLURIS_OUT_OF_RANGE;
+            }
+          else if (output_format == LIBALLURIS_OUTPUT_CSV || output_format == LIBALLURIS_OUTPUT_TSV)
+            {
+              // digits can only be read while the measurement is stopped
+              if (liballuris_get_digits (h, &output_digits))
+                {
+                  fprintf (stderr, "Warning: digits unknown while measuring, printing integers\n");
+                  output_digits = 0;
+                }
+            }
+          break;
+
         case 'V': // version
           printf ("%s version %s, Copyright (c) 2015-2016 Alluris GmbH & Co. KG\n",
                   program_name,
@@ -817,13 +1022,10 @@ main (int argc, char **argv)
 
   if (h)
     {
-      //printf ("libusb_release_interface\n");
-      libusb_release_interface (h, 0);
-
-      //printf ("libusb_close\n");
-      libusb_close (h);
+      liballuris_close_device (h);
     }
 
+  liballuris_release_registry (ctx);
   libusb_exit (ctx);
   return r;
 }
@@ -0,0 +1,134 @@
+/*
+
+Copyright (C) 2015-2020 Alluris GmbH & Co. KG <weber@alluris.de>
+
+calibration_bench -- inventory audit of the calibration data of many gauges
+with one flash read per word compared with the pipelined and cached
+liballuris_get_calibration
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  See ../COPYING
+If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * Usage: calibration_bench [NUM_GAUGES [RTT_MS]]
+ *
+ * Every audit opens each gauge, reads calibration date, uncertainty and
+ * calibration number and closes it again. "single" reads the 25 flash words
+ * one round trip each like liballuris did before. The second audit with
+ * liballuris_get_calibration is served from the cache after one round trip
+ * comparing the calibration date. Before the last audit all gauges are
+ * recalibrated, it has to read the new blocks.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <liballuris.h>
+#include "sim_libusb.h"
+
+static int read_single (libusb_device_handle *h, struct liballuris_calibration *cal)
+{
+  unsigned short words[25];
+  int k, r = 0;
+  for (k = 0; k < 25 && ! r; k++)
+    r = liballuris_read_flash (h, k, words + k);
+  if (! r)
+    {
+      cal->date = words[0];
+      memcpy (&cal->uncertainty, words + 1, sizeof (cal->uncertainty));
+      memcpy (cal->number, words + 5, 40);
+      cal->number[40] = 0;
+    }
+  return r;
+}
+
+static int same (const struct liballuris_calibration *a, const struct liballuris_calibration *b)
+{
+  return a->date == b->date && a->uncertainty == b->uncertainty && ! strcmp (a->number, b->number);
+}
+
+static int audit (libusb_context *ctx, int n, int single, struct liballuris_calibration *cal, double *elapsed)
+{
+  int k, r = 0;
+  *elapsed = 0;
+  for (k = 0; k < n && ! r; k++)
+    {
+      char id[20];
+      libusb_device_handle *h = NULL;
+      snprintf (id, sizeof (id), "%i,%i", 1 + k / 100, 2 + k % 100);
+      r = liballuris_open_if_not_opened (ctx, id, &h);
+      if (r)
+        break;
+      double t = sim_now ();
+      r = (single)? read_single (h, cal) : liballuris_get_calibration (h, cal);
+      *elapsed += sim_now () - t;
+      liballuris_close_device (h);
+    }
+  return r;
+}
+
+int main (int argc, char **argv)
+{
+  int n = (argc > 1)? atoi (argv[1]) : 40;
+  double rtt = ((argc > 2)? atof (argv[2]) : 2.0) / 1e3;
+
+  libusb_context *ctx;
+  sim_set_num_devices (n);
+  sim_set_rtt (rtt);
+  int r = libusb_init (&ctx);
+  if (r)
+    {
+      fprintf (stderr, "Error: %s\n", liballuris_error_name (r));
+      return EXIT_FAILURE;
+    }
+
+  printf ("# %i gauges, round trip time %.2fms\n", n, rtt * 1e3);
+  printf ("%-12s %10s %10s\n", "#method", "audit_ms", "ms/gauge");
+
+  const char *names[] = {"single", "range", "cached", "recalibrated"};
+  struct liballuris_calibration cal[4];
+  int k;
+  for (k = 0; k < 4 && ! r; k++)
+    {
+      double elapsed;
+      if (k == 3)
+        sim_set_calibration_date (cal[2].date + 365);
+      r = audit (ctx, n, k == 0, cal + k, &elapsed);
+      if (! r)
+        printf ("%-12s %10.1f %10.2f\n", names[k], 1e3 * elapsed, 1e3 * elapsed / n);
+    }
+
+  if (! r && (! same (cal, cal + 1) || ! same (cal, cal + 2)))
+    {
+      fprintf (stderr, "Error: calibration data differs\n");
+      r = -1;
+    }
+  else if (! r && cal[3].date != cal[2].date + 365)
+    {
+      fprintf (stderr, "Error: stale calibration data after recalibration\n");
+      r = -1;
+    }
+  else if (! r)
+    printf ("# %s, uncertainty %g, date %i\n", cal[2].number, cal[2].uncertainty, cal[2].date);
+
+  if (r)
+    fprintf (stderr, "Error: %s\n", liballuris_error_name (r));
+
+  liballuris_clear_calibration_cache (ctx);
+  liballuris_release_registry (ctx);
+  libusb_exit (ctx);
+  return (r)? EXIT_FAILURE : EXIT_SUCCESS;
+}
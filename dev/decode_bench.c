@@ -0,0 +1,117 @@
+/*
+
+Copyright (C) 2015-2020 Alluris GmbH & Co. KG <weber@alluris.de>
+
+decode_bench -- CPU time per sample of liballuris_poll_measurement compared
+with the former receive path (256 byte bounce buffer, memcpy into the reply
+buffer and memcpy based decoding of every value)
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  See ../COPYING
+If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * Usage: decode_bench [NUM_BLOCKS [BLOCK_LEN]]
+ *
+ * The simulated gauge runs without realtime, so a sample block is ready
+ * whenever it is polled and only the host side CPU time is measured.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <liballuris.h>
+#include "sim_libusb.h"
+
+// receive and decode path of liballuris up to version 0.4.0
+static int legacy_char_to_int24 (unsigned char* in)
+{
+  int ret = 0;
+  memcpy (&ret, in, 3);
+  if (ret > 8388607)
+    ret = ret- 16777216;
+  return ret;
+}
+
+static int legacy_poll_measurement (libusb_device_handle *dev_handle, int* buf, size_t length)
+{
+  size_t len = 5 + length * 3;
+  unsigned char in_buf[len];
+  unsigned char tmp_in_buf[DEFAULT_RECV_BUF_LEN];
+  int actual;
+
+  int ret = libusb_interrupt_transfer (dev_handle, 0x81 | LIBUSB_ENDPOINT_IN, tmp_in_buf, DEFAULT_RECV_BUF_LEN, &actual, 3600);
+  memcpy (in_buf, tmp_in_buf, len);
+  size_t k;
+  for (k=0; k<length; k++)
+    buf[k] = legacy_char_to_int24 (in_buf + 5 + k*3);
+  return ret;
+}
+
+int main (int argc, char **argv)
+{
+  long num_blocks = (argc > 1)? atol (argv[1]) : 2000000;
+  size_t len = (argc > 2)? (size_t) atoi (argv[2]) : 19;
+
+  libusb_context *ctx;
+  libusb_device_handle *h = NULL;
+  sim_set_realtime (0);
+  int r = libusb_init (&ctx);
+  if (! r)
+    r = liballuris_open_if_not_opened (ctx, NULL, &h);
+  if (! r)
+    r = liballuris_start_measurement (h);
+  if (! r)
+    r = liballuris_cyclic_measurement (h, 1, len);
+  if (r)
+    {
+      fprintf (stderr, "Error: %s\n", liballuris_error_name (r));
+      return EXIT_FAILURE;
+    }
+
+  int buf[len];
+  long k;
+  long checksum = 0;
+
+  double t = sim_cpu_time ();
+  for (k = 0; k < num_blocks && ! r; k++)
+    {
+      r = legacy_poll_measurement (h, buf, len);
+      checksum += buf[len - 1];
+    }
+  double t_legacy = sim_cpu_time () - t;
+
+  t = sim_cpu_time ();
+  for (k = 0; k < num_blocks && ! r; k++)
+    {
+      r = liballuris_poll_measurement (h, buf, len);
+      checksum += buf[len - 1];
+    }
+  double t_direct = sim_cpu_time () - t;
+
+  liballuris_cyclic_measurement (h, 0, len);
+  if (r)
+    fprintf (stderr, "Error: %s\n", liballuris_error_name (r));
+
+  double n = (double) num_blocks * len;
+  printf ("# %ld blocks of %zu values (checksum %ld)\n", num_blocks, len, checksum);
+  printf ("%-8s %10s\n", "#path", "ns/value");
+  printf ("%-8s %10.2f\n", "legacy", 1e9 * t_legacy / n);
+  printf ("%-8s %10.2f\n", "direct", 1e9 * t_direct / n);
+
+  liballuris_close_device (h);
+  liballuris_release_registry (ctx);
+  libusb_exit (ctx);
+  return (r)? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,153 @@
+/*
+
+Copyright (C) 2015-2020 Alluris GmbH & Co. KG <weber@alluris.de>
+
+demux_bench -- sample loss of cyclic measurements while commands are sent,
+with the former receive path which discarded ID_SAMPLE packets and with the
+packet demultiplexer
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  See ../COPYING
+If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * Usage: demux_bench [DURATION_S [BLOCK_LEN [COMMAND_INTERVAL_MS]]]
+ *
+ * Every COMMAND_INTERVAL_MS the positive peak is queried while the gauge
+ * streams at 900Hz. Gaps are detected with the running sample index.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <liballuris.h>
+#include "sim_libusb.h"
+
+// command path of liballuris up to version 0.4.0: up to 3 ID_SAMPLE packets are discarded
+static int legacy_get_pos_peak (libusb_device_handle *h, int *peak)
+{
+  unsigned char out_buf[3] = {0x46, 3, 4};
+  unsigned char in_buf[DEFAULT_RECV_BUF_LEN];
+  int actual;
+  int r = libusb_interrupt_transfer (h, 0x01 | LIBUSB_ENDPOINT_OUT, out_buf, 3, &actual, DEFAULT_SEND_TIMEOUT);
+  int sample_ignore_cnt = 3;
+  do
+    r = libusb_interrupt_transfer (h, 0x81 | LIBUSB_ENDPOINT_IN, in_buf, DEFAULT_RECV_BUF_LEN, &actual, DEFAULT_RECEIVE_TIMEOUT);
+  while (! r && sample_ignore_cnt-- > 0 && in_buf[0] == 0x02);
+  if (! r && in_buf[0] != 0x46)
+    return LIBALLURIS_MALFORMED_REPLY;
+  *peak = in_buf[3] | (in_buf[4] << 8) | (in_buf[5] << 16);
+  return r;
+}
+
+static int bench_poll (libusb_device_handle *h, double duration, size_t len, double interval, int legacy)
+{
+  struct sim_result res = {0, 0, 0, 0, 0};
+  unsigned long commands = 0;
+  int buf[len];
+  int expected = -1;
+  unsigned long lost = liballuris_get_lost_blocks (h);
+
+  int r = liballuris_cyclic_measurement (h, 1, len);
+  double end = sim_now () + duration;
+  double next_cmd = sim_now () + interval;
+  while (! r && sim_now () < end)
+    {
+      r = liballuris_poll_measurement (h, buf, len);
+      if (! r)
+        sim_account (&res, 0, buf, len, &expected);
+      if (! r && sim_now () >= next_cmd)
+        {
+          int peak;
+          r = (legacy)? legacy_get_pos_peak (h, &peak) : liballuris_get_pos_peak (h, &peak);
+          commands++;
+          next_cmd += interval;
+        }
+    }
+  liballuris_cyclic_measurement (h, 0, len);
+
+  sim_print_result ((legacy)? "poll legacy" : "poll demux", &res, " %8lu %8lu", commands, liballuris_get_lost_blocks (h) - lost);
+  return r;
+}
+
+static int bench_stream (libusb_context *ctx, libusb_device_handle *h, double duration, size_t len, double interval)
+{
+  struct sim_result res = {0, 0, 0, 0, 0};
+  unsigned long commands = 0;
+  struct liballuris_stream *stream;
+  int buf[len];
+  int expected = -1;
+  unsigned long lost = liballuris_get_lost_blocks (h);
+
+  int r = liballuris_stream_open (ctx, h, len, DEFAULT_STREAM_TRANSFERS, &stream);
+  double end = sim_now () + duration;
+  double next_cmd = sim_now () + interval;
+  while (! r && sim_now () < end)
+    {
+      r = liballuris_stream_read (stream, buf, len, 3600);
+      if (! r)
+        sim_account (&res, 0, buf, len, &expected);
+      if (! r && sim_now () >= next_cmd)
+        {
+          struct liballuris_state state;
+          r = liballuris_read_state (h, &state, DEFAULT_RECEIVE_TIMEOUT);
+          commands++;
+          next_cmd += interval;
+        }
+    }
+  if (! r)
+    r = liballuris_stream_close (stream);
+
+  sim_print_result ("stream demux", &res, " %8lu %8lu", commands, liballuris_get_lost_blocks (h) - lost);
+  return r;
+}
+
+int main (int argc, char **argv)
+{
+  double duration = (argc > 1)? atof (argv[1]) : 3.0;
+  size_t len = (argc > 2)? (size_t) atoi (argv[2]) : 4;
+  double interval = ((argc > 3)? atof (argv[3]) : 10.0) / 1e3;
+
+  libusb_context *ctx;
+  libusb_device_handle *h = NULL;
+  int r = libusb_init (&ctx);
+  if (! r)
+    r = liballuris_open_if_not_opened (ctx, NULL, &h);
+  if (! r)
+    r = liballuris_set_mode (h, LIBALLURIS_MODE_PEAK);
+  if (! r)
+    r = liballuris_start_measurement (h);
+  if (r)
+    {
+      fprintf (stderr, "Error: %s\n", liballuris_error_name (r));
+      return EXIT_FAILURE;
+    }
+
+  printf ("# %.1fs at 900Hz, block length %zu, one command every %.0fms\n", duration, len, interval * 1e3);
+  printf ("%-12s %8s %8s %8s %8s\n", "#method", "samples", "missing", "commands", "lost");
+
+  r = bench_poll (h, duration, len, interval, 1);
+  if (! r)
+    r = bench_poll (h, duration, len, interval, 0);
+  if (! r)
+    r = bench_stream (ctx, h, duration, len, interval);
+
+  if (r)
+    fprintf (stderr, "Error: %s\n", liballuris_error_name (r));
+
+  liballuris_close_device (h);
+  liballuris_release_registry (ctx);
+  libusb_exit (ctx);
+  return (r)? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,120 @@
+/*
+
+Copyright (C) 2015-2020 Alluris GmbH & Co. KG <weber@alluris.de>
+
+enumeration_bench -- time to list all gauges with serial numbers when the
+gauges are probed one after another compared with
+liballuris_get_device_list, with and without a hung gauge
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  See ../COPYING
+If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * Usage: enumeration_bench [NUM_GAUGES [RTT_MS]]
+ *
+ * "sequential" opens every gauge and reads product and serial number with
+ * the default timeouts, like liballuris_get_device_list did before. Every
+ * run starts with an empty registry. The hung gauge is the first one.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <liballuris.h>
+#include "sim_libusb.h"
+
+#define MAX_GAUGES 64
+
+static int list_sequential (libusb_context *ctx, int *listed)
+{
+  libusb_device **devs;
+  ssize_t cnt = libusb_get_device_list (ctx, &devs);
+  ssize_t k;
+  *listed = 0;
+  for (k = 0; k < cnt; k++)
+    {
+      libusb_device_handle *h;
+      char product[35], serial[30];
+      if (libusb_open (devs[k], &h))
+        continue;
+      if (! libusb_claim_interface (h, 0))
+        {
+          libusb_get_string_descriptor_ascii (h, 2, (unsigned char *) product, sizeof (product));
+          liballuris_get_serial_number (h, serial, sizeof (serial));
+          (*listed)++;
+        }
+      liballuris_close_device (h);
+    }
+  libusb_free_device_list (devs, 1);
+  return 0;
+}
+
+static int list_registry (libusb_context *ctx, int *listed)
+{
+  struct alluris_device_description devs[MAX_GAUGES];
+  liballuris_release_registry (ctx);
+  *listed = liballuris_get_device_list (ctx, devs, MAX_GAUGES, 1);
+  liballuris_free_device_list (devs, MAX_GAUGES);
+  return (*listed < 0)? *listed : 0;
+}
+
+int main (int argc, char **argv)
+{
+  int n = (argc > 1)? atoi (argv[1]) : 16;
+  double rtt = ((argc > 2)? atof (argv[2]) : 2.0) / 1e3;
+  if (n < 1 || n > MAX_GAUGES)
+    {
+      fprintf (stderr, "Error: NUM_GAUGES has to be 1..%i\n", MAX_GAUGES);
+      return EXIT_FAILURE;
+    }
+
+  libusb_context *ctx;
+  sim_set_num_devices (n);
+  sim_set_rtt (rtt);
+  int r = libusb_init (&ctx);
+
+  // the hung gauge reports its timeouts on stderr
+  if (! r && ! freopen ("/dev/null", "w", stderr))
+    r = -1;
+
+  printf ("# %i gauges, round trip time %.2fms\n", n, rtt * 1e3);
+  printf ("%-12s %-12s %8s %10s\n", "#gauges", "method", "listed", "ms");
+
+  int hung;
+  for (hung = 0; hung < 2 && ! r; hung++)
+    {
+      sim_set_mute (0, hung);
+      int listed;
+      double t = sim_now ();
+      r = list_sequential (ctx, &listed);
+      t = sim_now () - t;
+      printf ("%-12s %-12s %8i %10.1f\n", (hung)? "one hung" : "healthy", "sequential", listed, 1e3 * t);
+
+      if (! r)
+        {
+          t = sim_now ();
+          r = list_registry (ctx, &listed);
+          t = sim_now () - t;
+          printf ("%-12s %-12s %8i %10.1f\n", (hung)? "one hung" : "healthy", "concurrent", listed, 1e3 * t);
+        }
+    }
+
+  if (r)
+    printf ("Error: %s\n", liballuris_error_name (r));
+
+  liballuris_release_registry (ctx);
+  libusb_exit (ctx);
+  return (r)? EXIT_FAILURE : EXIT_SUCCESS;
+}
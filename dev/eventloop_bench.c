@@ -0,0 +1,170 @@
+/*
+
+Copyright (C) 2015-2020 Alluris GmbH & Co. KG <weber@alluris.de>
+
+eventloop_bench -- capture from many gauges on one thread, blocking polls in
+turn compared with streams driven from a poll() based event loop
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  See ../COPYING
+If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * Usage: eventloop_bench [NUM_GAUGES [DURATION_S [BLOCK_LEN]]]
+ *
+ *
+ * All gauges stream at 900Hz. Gaps are detected with the running sample
+ * index which the simulated gauges send as value.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <liballuris.h>
+#include "sim_libusb.h"
+
+static long context_switches (void)
+{
+  struct rusage ru;
+  getrusage (RUSAGE_SELF, &ru);
+  return ru.ru_nvcsw + ru.ru_nivcsw;
+}
+
+static void print_result (const char *name, const struct sim_result *res, double cpu, long csw)
+{
+  sim_print_result (name, res, " %12.2f %8ld", 1e6 * cpu / (res->samples? res->samples : 1), csw);
+}
+
+static int bench_round_robin (libusb_device_handle **h, int n, double duration, size_t len)
+{
+  struct sim_result res = {0, 0, 0, 0, 0};
+  int buf[len];
+  int expected[n];
+  int k, r = 0;
+
+  for (k = 0; k < n && ! r; k++)
+    {
+      expected[k] = -1;
+      r = liballuris_cyclic_measurement (h[k], 1, len);
+    }
+
+  double t = sim_cpu_time ();
+  long csw = context_switches ();
+  double end = sim_now () + duration;
+  while (! r && sim_now () < end)
+    for (k = 0; k < n && ! r; k++)
+      {
+        r = liballuris_poll_measurement (h[k], buf, len);
+        if (! r)
+          sim_account (&res, k, buf, len, &expected[k]);
+      }
+  double cpu = sim_cpu_time () - t;
+  csw = context_switches () - csw;
+
+  for (k = 0; k < n; k++)
+    liballuris_cyclic_measurement (h[k], 0, len);
+
+  print_result ("round robin", &res, cpu, csw);
+  return r;
+}
+
+static int bench_event_loop (libusb_context *ctx, libusb_device_handle **h, int n, double duration, size_t len)
+{
+  struct sim_result res = {0, 0, 0, 0, 0};
+  struct liballuris_stream *streams[n];
+  struct pollfd fds[64];
+  int buf[len];
+  int expected[n];
+  int k, r = 0;
+
+  for (k = 0; k < n && ! r; k++)
+    {
+      expected[k] = -1;
+      r = liballuris_stream_open (ctx, h[k], len, DEFAULT_STREAM_TRANSFERS, &streams[k]);
+    }
+  int num_fds = liballuris_get_pollfds (ctx, fds, 64);
+  if (num_fds < 0)
+    r = num_fds;
+
+  double t = sim_cpu_time ();
+  long csw = context_switches ();
+  double end = sim_now () + duration;
+  while (! r && sim_now () < end)
+    {
+      if (poll (fds, num_fds, liballuris_get_next_timeout (ctx)) < 0)
+        break;
+      r = liballuris_handle_events (ctx);
+      for (k = 0; k < n && ! r; k++)
+        while (! r && liballuris_stream_pending (streams[k]))
+          {
+            r = liballuris_stream_read (streams[k], buf, len, 0);
+            if (! r)
+              sim_account (&res, k, buf, len, &expected[k]);
+          }
+    }
+  double cpu = sim_cpu_time () - t;
+  csw = context_switches () - csw;
+
+  for (k = 0; k < n; k++)
+    liballuris_stream_close (streams[k]);
+
+  print_result ("event loop", &res, cpu, csw);
+  return r;
+}
+
+int main (int argc, char **argv)
+{
+  int n = (argc > 1)? atoi (argv[1]) : 8;
+  double duration = (argc > 2)? atof (argv[2]) : 3.0;
+  size_t len = (argc > 3)? (size_t) atoi (argv[3]) : 4;
+
+  libusb_context *ctx;
+  libusb_device_handle *h[n];
+  int k;
+  sim_set_num_devices (n);
+  int r = libusb_init (&ctx);
+  for (k = 0; k < n && ! r; k++)
+    {
+      char id[20];
+      snprintf (id, sizeof (id), "%i,%i", 1 + k / 100, 2 + k % 100);
+      h[k] = NULL;
+      r = liballuris_open_if_not_opened (ctx, id, &h[k]);
+      if (! r)
+        r = liballuris_set_mode (h[k], LIBALLURIS_MODE_PEAK);
+      if (! r)
+        r = liballuris_start_measurement (h[k]);
+    }
+  if (r)
+    {
+      fprintf (stderr, "Error: %s\n", liballuris_error_name (r));
+      return EXIT_FAILURE;
+    }
+
+  printf ("# %i gauges, %.1fs at 900Hz, block length %zu\n", n, duration, len);
+  printf ("%-12s %8s %8s %12s %8s\n", "#method", "samples", "missing", "cpu_us/smpl", "ctx_sw");
+
+  r = bench_round_robin (h, n, duration, len);
+  if (! r)
+    r = bench_event_loop (ctx, h, n, duration, len);
+
+  if (r)
+    fprintf (stderr, "Error: %s\n", liballuris_error_name (r));
+
+  for (k = 0; k < n; k++)
+    liballuris_close_device (h[k]);
+  liballuris_release_registry (ctx);
+  libusb_exit (ctx);
+  return (r)? EXIT_FAILURE : EXIT_SUCCESS;
+}
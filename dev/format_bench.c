@@ -0,0 +1,171 @@
+/*
+
+Copyright (C) 2015-2020 Alluris GmbH & Co. KG <weber@alluris.de>
+
+format_bench -- printing samples with printf per value compared with
+liballuris_formatter
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  See ../COPYING
+If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * Usage: format_bench [NUM_SAMPLES]
+ *
+ * The output goes to /dev/null. "printf" is printf ("%i\n") per sample and
+ * fflush per block of 19 like gadc -s did, "printf rows" is printf ("%8i%c")
+ * per value of rows of 8 gauges like examples/multi_FMI.c did. The formatter
+ * is flushed per block of 19 rows or, for replaying files, only when its
+ * buffer is full. The values are forces of about 5 digits, fixed-point with
+ * 2 decimal places for csv and tsv. Before timing, the text of the formatter
+ * is compared with snprintf.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <liballuris.h>
+
+#define BLOCK 19
+#define GAUGES 8
+
+static double now (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1.0e9;
+}
+
+static int check (enum liballuris_output_format format, int digits, int v)
+{
+  char *text;
+  size_t size;
+  FILE *f = open_memstream (&text, &size);
+  struct liballuris_formatter *fmt;
+  if (! f || liballuris_formatter_new (f, format, 1, &digits, &fmt))
+    return -1;
+  liballuris_formatter_write (fmt, &v, 1);
+  liballuris_formatter_free (fmt);
+  fclose (f);
+
+  char expected[40];
+  if (v == LIBALLURIS_GROUP_MISSING)
+    snprintf (expected, sizeof (expected), "%s\n", (format == LIBALLURIS_OUTPUT_RAW)? "-" : "");
+  else if (! digits)
+    snprintf (expected, sizeof (expected), "%i\n", v);
+  else
+    {
+      long long scale = 1, a = (v < 0)? - (long long) v : v;
+      int k;
+      for (k = 0; k < digits; k++)
+        scale *= 10;
+      snprintf (expected, sizeof (expected), "%s%lli.%0*lli\n", (v < 0)? "-" : "", a / scale, digits, a % scale);
+    }
+  int r = strcmp (text, expected);
+  if (r)
+    fprintf (stderr, "Error: %i with %i digits is '%s' instead of '%s'\n", v, digits, text, expected);
+  free (text);
+  return r;
+}
+
+static int check_all (void)
+{
+  int special[] = {0, 1, -1, 9, 10, 99, 100, -100, 12345, -5, 2147483647, -2147483647, LIBALLURIS_GROUP_MISSING};
+  int k, digits, r = 0;
+  srand (1);
+  for (digits = 0; digits < 10 && ! r; digits++)
+    {
+      for (k = 0; k < (int) (sizeof (special) / sizeof (special[0])) && ! r; k++)
+        r = check (LIBALLURIS_OUTPUT_RAW, digits, special[k]) || check (LIBALLURIS_OUTPUT_CSV, digits, special[k]);
+      for (k = 0; k < 10000 && ! r; k++)
+        r = check (LIBALLURIS_OUTPUT_TSV, digits, rand () - RAND_MAX / 2);
+    }
+  return r;
+}
+
+static void print_result (const char *name, size_t n, double t)
+{
+  printf ("%-22s %12.1f\n", name, n / t / 1e6);
+}
+
+int main (int argc, char **argv)
+{
+  size_t n = (argc > 1)? (size_t) atol (argv[1]) : 10000000;
+  n -= n % (BLOCK * GAUGES);
+  int *values = malloc (n * sizeof (int));
+  FILE *out = fopen ("/dev/null", "w");
+  if (! values || ! out || check_all ())
+    return EXIT_FAILURE;
+
+  size_t k, j;
+  srand (1);
+  for (k = 0; k < n; k++)
+    values[k] = 25000 + rand () % 20000 - 10000;
+
+  printf ("# %zu samples to /dev/null\n", n);
+  printf ("%-22s %12s\n", "#method", "MSamples/s");
+
+  double t = now ();
+  for (k = 0; k < n; k += BLOCK)
+    {
+      for (j = 0; j < BLOCK; j++)
+        fprintf (out, "%i\n", values[k + j]);
+      fflush (out);
+    }
+  print_result ("printf", n, now () - t);
+
+  t = now ();
+  for (k = 0; k < n; k += BLOCK * GAUGES)
+    {
+      for (j = 0; j < BLOCK * GAUGES; j++)
+        fprintf (out, "%8i%c", values[k + j], ((j + 1) % GAUGES)? ' ' : '\n');
+      fflush (out);
+    }
+  print_result ("printf rows", n, now () - t);
+
+  const char *names[] = {"raw", "csv", "tsv", "binary"};
+  int digits[GAUGES] = {2, 2, 2, 2, 2, 2, 2, 2};
+  int format, per_block;
+  for (format = 0; format < 4; format++)
+    for (per_block = 1; per_block >= 0; per_block--)
+      {
+        struct liballuris_formatter *fmt;
+        size_t columns = (format == LIBALLURIS_OUTPUT_RAW && per_block)? 1 : GAUGES;
+        size_t chunk = (per_block)? BLOCK * columns : 4096;
+        if (liballuris_formatter_new (out, format, columns, (format == LIBALLURIS_OUTPUT_RAW)? NULL : digits, &fmt))
+          return EXIT_FAILURE;
+        t = now ();
+        for (k = 0; k < n; k += chunk)
+          {
+            liballuris_formatter_write (fmt, values + k, (n - k < chunk)? n - k : chunk);
+            if (per_block)
+              {
+                liballuris_formatter_flush (fmt);
+                fflush (out);
+              }
+          }
+        liballuris_formatter_free (fmt);
+        fflush (out);
+        char name[40];
+        snprintf (name, sizeof (name), "%s%s %s", names[format], (columns == 1)? "" : " rows",
+                  (per_block)? "per block" : "replay");
+        print_result (name, n, now () - t);
+      }
+
+  fclose (out);
+  free (values);
+  return EXIT_SUCCESS;
+}
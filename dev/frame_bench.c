@@ -0,0 +1,185 @@
+/*
+
+Copyright (C) 2015-2020 Alluris GmbH & Co. KG <weber@alluris.de>
+
+frame_bench -- size and speed of the framed stream formats compared with the
+ASCII and int32 output of fstream, and recovery from corrupted bytes
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  See ../COPYING
+If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * Usage: frame_bench [NUM_SAMPLES]
+ *
+ * "force" is a slow 0.3Hz sine of 20000 digits with +-8 digits noise at 900Hz,
+ * "idle" a constant with the noise, "noise" random 24bit values and
+ * "extremes" alternating INT32_MIN and INT32_MAX to check the wrap around.
+ * For the recovery test one random bit in every 10000 (or 1000) bytes of the
+ * int24 frames is flipped. "recovered" counts the values in intact frames
+ * found by liballuris_frame_decode, "wrong" the decoded values which differ
+ * from the sent ones.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include <liballuris.h>
+
+static double now (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1.0e9;
+}
+
+static size_t encode_all (const int *values, size_t n, enum liballuris_frame_format format, unsigned char **out)
+{
+  size_t size;
+  FILE *f = open_memstream ((char **) out, &size);
+  struct liballuris_frame_writer *w;
+  if (! f || liballuris_frame_writer_new (f, format, 0, DEFAULT_FRAME_SAMPLES, &w))
+    return 0;
+  // in blocks like from the device
+  size_t k;
+  for (k = 0; k < n; k += 19)
+    liballuris_frame_writer_write (w, values + k, (n - k < 19)? n - k : 19);
+  liballuris_frame_writer_free (w);
+  fclose (f);
+  return size;
+}
+
+// decoded values are put at their position in the sent stream
+static size_t decode_all (const unsigned char *in, size_t size, size_t n, int *values, char *seen,
+                          size_t *wrong, const int *sent)
+{
+  size_t pos = 0, consumed, recovered = 0;
+  struct liballuris_frame_info info;
+  int buf[LIBALLURIS_FRAME_MAX_SAMPLES];
+  *wrong = 0;
+  while (liballuris_frame_decode (in + pos, size - pos, &info, buf, LIBALLURIS_FRAME_MAX_SAMPLES,
+                                  &consumed) == LIBALLURIS_SUCCESS)
+    {
+      size_t first = (size_t) info.sequence * DEFAULT_FRAME_SAMPLES, k;
+      for (k = 0; k < info.count && first + k < n; k++)
+        {
+          if (sent && buf[k] != sent[first + k])
+            (*wrong)++;
+          if (values)
+            values[first + k] = buf[k];
+          if (seen)
+            seen[first + k] = 1;
+        }
+      recovered += info.count;
+      pos += consumed;
+    }
+  return recovered;
+}
+
+static void make_signal (int *values, size_t n, int signal)
+{
+  size_t k;
+  srand (1);
+  for (k = 0; k < n; k++)
+    if (signal == 0)
+      values[k] = (int) (20000 * sin (k * 2 * M_PI * 0.3 / 900)) + rand () % 17 - 8;
+    else if (signal == 1)
+      values[k] = 1234 + rand () % 17 - 8;
+    else if (signal == 2)
+      values[k] = rand () % 0x1000000 - 0x800000;
+    else
+      values[k] = (k & 1)? INT32_MAX : INT32_MIN;
+}
+
+int main (int argc, char **argv)
+{
+  size_t n = (argc > 1)? (size_t) atol (argv[1]) : 10000000;
+  int *values = malloc (n * sizeof (int));
+  int *decoded = malloc (n * sizeof (int));
+  char *seen = malloc (n);
+  if (! values || ! decoded || ! seen)
+    return EXIT_FAILURE;
+
+  const char *signals[] = {"force", "idle", "noise", "extremes"};
+  printf ("# %zu samples, %i samples per frame\n", n, DEFAULT_FRAME_SAMPLES);
+  printf ("%-10s %-8s %14s %12s %12s\n", "#signal", "format", "bytes/sample", "encode_MS/s", "decode_MS/s");
+
+  int sig;
+  size_t k;
+  for (sig = 0; sig < 4; sig++)
+    {
+      make_signal (values, n, sig);
+      size_t ascii = 0;
+      for (k = 0; k < n; k++)
+        {
+          char tmp[16];
+          ascii += snprintf (tmp, sizeof (tmp), "%i\n", values[k]);
+        }
+      printf ("%-10s %-8s %14.3f %12s %12s\n", signals[sig], "ascii", (double) ascii / n, "-", "-");
+      printf ("%-10s %-8s %14.3f %12s %12s\n", signals[sig], "int32", 4.0, "-", "-");
+
+      int format;
+      for (format = (sig == 3); format < 2; format++)
+        {
+          unsigned char *frames;
+          double t = now ();
+          size_t size = encode_all (values, n, format, &frames);
+          double t_enc = now () - t;
+          size_t wrong;
+          t = now ();
+          size_t recovered = decode_all (frames, size, n, decoded, NULL, &wrong, NULL);
+          double t_dec = now () - t;
+          if (recovered != n || memcmp (values, decoded, n * sizeof (int)))
+            {
+              fprintf (stderr, "Error: decoded values differ\n");
+              return EXIT_FAILURE;
+            }
+          printf ("%-10s %-8s %14.3f %12.1f %12.1f\n", signals[sig], (format)? "delta" : "int24",
+                  (double) size / n, n / t_enc / 1e6, n / t_dec / 1e6);
+          free (frames);
+        }
+    }
+
+  unsigned char *frames;
+  make_signal (values, n, 0);
+  size_t size = encode_all (values, n, LIBALLURIS_FRAME_INT24, &frames);
+  unsigned char *corrupted = malloc (size);
+  if (! corrupted)
+    return EXIT_FAILURE;
+  printf ("\n%-12s %12s %12s %12s\n", "#corruption", "flipped", "recovered_%", "wrong");
+  int every[] = {10000, 1000};
+  for (k = 0; k < 2; k++)
+    {
+      size_t j, flipped = 0, wrong;
+      memcpy (corrupted, frames, size);
+      for (j = 0; j + every[k] <= size; j += every[k], flipped++)
+        corrupted[j + rand () % every[k]] ^= 1 << (rand () % 8);
+      memset (seen, 0, n);
+      decode_all (corrupted, size, n, NULL, seen, &wrong, values);
+      size_t ok = 0;
+      for (j = 0; j < n; j++)
+        ok += seen[j];
+      printf ("1/%-10i %12zu %12.2f %12zu\n", every[k], flipped, 100.0 * ok / n, wrong);
+    }
+
+  free (values);
+  free (decoded);
+  free (seen);
+  free (frames);
+  free (corrupted);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,127 @@
+/*
+
+Copyright (C) 2015-2020 Alluris GmbH & Co. KG <weber@alluris.de>
+
+gap_bench -- samples missing in a stream compared with the gaps detected
+from the arrival times
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  See ../COPYING
+If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * Usage: gap_bench [DURATION_S]
+ *
+ * The consumer reads the stream itself and stalls for a different time
+ * every second, so the device discards blocks. The true gaps are taken
+ * from the running sample index which the simulated gauge sends as value.
+ * A block is counted as wrong if the reported number of missing samples
+ * differs from the true one.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <liballuris.h>
+#include "sim_libusb.h"
+
+#define BLOCK_LEN 19
+
+static const double stalls_ms[] = {30, 80, 150, 300, 45, 900, 120, 1600};
+#define NUM_STALLS (sizeof (stalls_ms) / sizeof (stalls_ms[0]))
+
+static int bench (libusb_context *ctx, libusb_device_handle *h, int ratio, double duration)
+{
+  struct liballuris_stream *stream;
+  int buf[BLOCK_LEN];
+  int expected = -1;
+  unsigned long true_gaps = 0, true_missing = 0, reported_missing = 0, wrong = 0, blocks = 0;
+  struct liballuris_sample_stats before, after;
+
+  int r = liballuris_set_data_ratio (h, ratio);
+  if (! r)
+    r = liballuris_get_sample_stats (h, &before);
+  if (! r)
+    r = liballuris_stream_open (ctx, h, BLOCK_LEN, DEFAULT_STREAM_TRANSFERS, &stream);
+  double end = sim_now () + duration;
+  double next_stall = sim_now () + 0.5;
+  size_t k = 0;
+  while (! r && sim_now () < end)
+    {
+      struct liballuris_block_info info;
+      r = liballuris_stream_read_timestamped (stream, buf, NULL, &info, BLOCK_LEN, 3600);
+      if (r)
+        break;
+      unsigned long missing = (expected >= 0)? (unsigned long) (buf[0] - expected) : 0;
+      expected = buf[BLOCK_LEN - 1] + 1;
+      if (missing)
+        true_gaps++;
+      true_missing += missing;
+      reported_missing += info.missing;
+      wrong += (missing != info.missing);
+      blocks++;
+
+      if (sim_now () >= next_stall)
+        {
+          usleep (stalls_ms[k++ % NUM_STALLS] * 1e3);
+          next_stall += 1.0;
+        }
+    }
+  if (! r)
+    r = liballuris_stream_close (stream);
+  if (! r)
+    r = liballuris_get_sample_stats (h, &after);
+
+  if (! r)
+    printf ("%5i %8lu %8lu %8lu %8lu %8lu %8lu\n", ratio, blocks, true_gaps, after.gaps - before.gaps,
+            true_missing, reported_missing, wrong);
+  return r;
+}
+
+int main (int argc, char **argv)
+{
+  double duration = (argc > 1)? atof (argv[1]) : 8.0;
+
+  libusb_context *ctx;
+  libusb_device_handle *h = NULL;
+  sim_set_clock_error (0, 120);
+  int r = libusb_init (&ctx);
+  if (! r)
+    r = liballuris_open_if_not_opened (ctx, NULL, &h);
+  if (! r)
+    r = liballuris_set_mode (h, LIBALLURIS_MODE_PEAK);
+  if (! r)
+    r = liballuris_start_measurement (h);
+  if (r)
+    {
+      fprintf (stderr, "Error: %s\n", liballuris_error_name (r));
+      return EXIT_FAILURE;
+    }
+
+  printf ("# %.1fs per data ratio, block length %i, device clock +120ppm, consumer stalls every second\n", duration, BLOCK_LEN);
+  printf ("%5s %8s %8s %8s %8s %8s %8s\n", "#ratio", "blocks", "gaps", "detected", "missing", "reported", "wrong");
+
+  int ratios[] = {1, 3, 10};
+  size_t j;
+  for (j = 0; j < sizeof (ratios) / sizeof (ratios[0]) && ! r; j++)
+    r = bench (ctx, h, ratios[j], duration);
+
+  if (r)
+    fprintf (stderr, "Error: %s\n", liballuris_error_name (r));
+
+  liballuris_close_device (h);
+  liballuris_release_registry (ctx);
+  libusb_exit (ctx);
+  return (r)? EXIT_FAILURE : EXIT_SUCCESS;
+}
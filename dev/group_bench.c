@@ -0,0 +1,235 @@
+/*
+
+Copyright (C) 2015-2020 Alluris GmbH & Co. KG <weber@alluris.de>
+
+group_bench -- streaming from many gauges with the busy poll loop of
+examples/multi_FMI.c compared with liballuris_group_start
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  See ../COPYING
+If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * Usage: group_bench [DURATION_S [BLOCK_LEN]]
+ *
+ * "busy poll" calls liballuris_poll_measurement_no_wait for every gauge
+ * which has no block yet until all have one, like examples/multi_FMI.c did.
+ * All gauges stream at 900Hz. Missing samples are counted with the running
+ * sample index which the simulated gauges send as value. The lag is the
+ * time from the completion of the last sample of a row until the consumer
+ * has the row, its maximum is taken over all gauges.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <liballuris.h>
+#include "sim_libusb.h"
+
+#define MAX_GAUGES 64
+
+struct bench_result
+{
+  unsigned long rows;
+  unsigned long missing;
+  double lag_sum;
+  unsigned long lag_cnt;
+  double max_lag;
+};
+
+static void account (struct bench_result *res, int v, long *expected)
+{
+  if (v == LIBALLURIS_GROUP_MISSING)
+    {
+      res->missing++;
+      if (*expected >= 0)
+        (*expected)++;
+      return;
+    }
+  if (*expected >= 0 && v > *expected)
+    res->missing += v - *expected;
+  *expected = v + 1;
+}
+
+static void account_lag (struct bench_result *res, int k, int v)
+{
+  if (v == LIBALLURIS_GROUP_MISSING)
+    return;
+  double lag = sim_now () - sim_sample_time (k, v);
+  res->lag_sum += lag;
+  res->lag_cnt++;
+  if (lag > res->max_lag)
+    res->max_lag = lag;
+}
+
+static void print_result (int n, const char *name, const struct bench_result *res, double cpu, double wall)
+{
+  printf ("%7i %-12s %8lu %8lu %8.1f %10.2f %10.2f\n", n, name, res->rows, res->missing, 100 * cpu / wall,
+          1e3 * res->lag_sum / (res->lag_cnt? res->lag_cnt : 1), 1e3 * res->max_lag);
+}
+
+static int bench_busy_poll (libusb_device_handle **h, int n, double duration, size_t len)
+{
+  struct bench_result res;
+  int tempx[n][len];
+  char valid[n];
+  long expected[n];
+  int k, r = 0;
+  memset (&res, 0, sizeof (res));
+
+  for (k = 0; k < n && ! r; k++)
+    {
+      expected[k] = -1;
+      r = liballuris_cyclic_measurement (h[k], 1, len);
+    }
+
+  double cpu = sim_cpu_time ();
+  double start = sim_now ();
+  double end = start + duration;
+  while (! r && sim_now () < end)
+    {
+      int all;
+      memset (valid, 0, n);
+      do
+        {
+          all = 1;
+          for (k = 0; k < n && ! r; k++)
+            if (! valid[k])
+              {
+                size_t act;
+                r = liballuris_poll_measurement_no_wait (h[k], tempx[k], len, &act);
+                if (r == LIBUSB_ERROR_TIMEOUT)
+                  r = 0;
+                valid[k] = (act == len);
+                all &= valid[k];
+              }
+        }
+      while (! all && ! r);
+
+      size_t i;
+      for (i = 0; i < len && ! r; i++)
+        for (k = 0; k < n; k++)
+          account (&res, tempx[k][i], &expected[k]);
+      for (k = 0; k < n && ! r; k++)
+        account_lag (&res, k, tempx[k][len - 1]);
+      res.rows += len;
+    }
+  cpu = sim_cpu_time () - cpu;
+  double wall = sim_now () - start;
+
+  for (k = 0; k < n; k++)
+    liballuris_cyclic_measurement (h[k], 0, len);
+
+  if (! r)
+    print_result (n, "busy poll", &res, cpu, wall);
+  return r;
+}
+
+static int bench_group (libusb_context *ctx, libusb_device_handle **h, int n, double duration, size_t len)
+{
+  struct bench_result res;
+  struct liballuris_group *group;
+  int rows[len * n];
+  long expected[n];
+  int k, r;
+  memset (&res, 0, sizeof (res));
+  for (k = 0; k < n; k++)
+    expected[k] = -1;
+
+  r = liballuris_group_start (ctx, h, n, len, DEFAULT_GROUP_CAPACITY, &group);
+  double cpu = sim_cpu_time ();
+  double start = sim_now ();
+  double end = start + duration;
+  while (! r && sim_now () < end)
+    {
+      size_t actual, i;
+      r = liballuris_group_read (group, rows, len, &actual, 1000);
+      for (i = 0; i < actual; i++)
+        for (k = 0; k < n; k++)
+          account (&res, rows[i * n + k], &expected[k]);
+      if (! r)
+        for (k = 0; k < n; k++)
+          account_lag (&res, k, rows[(actual - 1) * n + k]);
+      res.rows += actual;
+    }
+  cpu = sim_cpu_time () - cpu;
+  double wall = sim_now () - start;
+
+  if (! r)
+    {
+      struct liballuris_group_stats stats;
+      double max_lag = 0;
+      liballuris_group_get_stats (group, &stats);
+      for (k = 0; k < n; k++)
+        {
+          struct liballuris_group_device_stats ds;
+          liballuris_group_get_device_stats (group, k, &ds);
+          if (ds.max_lag > max_lag)
+            max_lag = ds.max_lag;
+        }
+      print_result (n, "group", &res, cpu, wall);
+      printf ("# engine thread: %.1f%% CPU, %.1f wakeups/s, max lag until queued %.2fms\n",
+              100 * stats.cpu_time / stats.elapsed, stats.wakeups / stats.elapsed, 1e3 * max_lag);
+    }
+  int stop_ret = liballuris_group_stop (group);
+  return (r)? r : stop_ret;
+}
+
+int main (int argc, char **argv)
+{
+  double duration = (argc > 1)? atof (argv[1]) : 2.0;
+  size_t len = (argc > 2)? (size_t) atoi (argv[2]) : 19;
+  int sizes[] = {8, 32};
+
+  printf ("# %.1fs per method at 900Hz, block length %zu\n", duration, len);
+  printf ("%7s %-12s %8s %8s %8s %10s %10s\n", "#gauges", "method", "rows", "missing", "cpu_%", "lag_ms", "max_lag_ms");
+
+  int r = 0;
+  size_t j;
+  for (j = 0; j < sizeof (sizes) / sizeof (sizes[0]) && ! r; j++)
+    {
+      int n = sizes[j];
+      libusb_context *ctx;
+      libusb_device_handle *h[MAX_GAUGES];
+      int k;
+      sim_set_num_devices (n);
+      r = libusb_init (&ctx);
+      for (k = 0; k < n && ! r; k++)
+        {
+          char id[20];
+          snprintf (id, sizeof (id), "%i,%i", 1 + k / 100, 2 + k % 100);
+          h[k] = NULL;
+          r = liballuris_open_if_not_opened (ctx, id, &h[k]);
+          if (! r)
+            r = liballuris_set_mode (h[k], LIBALLURIS_MODE_PEAK);
+          if (! r)
+            r = liballuris_start_measurement (h[k]);
+        }
+
+      if (! r)
+        r = bench_busy_poll (h, n, duration, len);
+      if (! r)
+        r = bench_group (ctx, h, n, duration, len);
+
+      for (k = 0; k < n; k++)
+        liballuris_close_device (h[k]);
+      liballuris_release_registry (ctx);
+      libusb_exit (ctx);
+    }
+
+  if (r)
+    fprintf (stderr, "Error: %s\n", liballuris_error_name (r));
+  return (r)? EXIT_FAILURE : EXIT_SUCCESS;
+}
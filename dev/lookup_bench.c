@@ -0,0 +1,137 @@
+/*
+
+Copyright (C) 2015-2020 Alluris GmbH & Co. KG <weber@alluris.de>
+
+lookup_bench -- listing and opening gauges by serial number or bus id on a
+host with hundreds of gauges
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  See ../COPYING
+If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * Usage: lookup_bench [RTT_MS]
+ *
+ * "list" is liballuris_get_device_array with serial numbers, cold with an
+ * empty registry and warm afterwards. "scan" opens every gauge once by
+ * searching the listed devices for its serial number, which is how an
+ * application had to do it without the registry. "serial" and "bus,dev"
+ * open every gauge once through liballuris. Opening a device is free in
+ * the simulation here, so the times are lookup costs.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <liballuris.h>
+#include "sim_libusb.h"
+
+static void serial_of (int k, char *buf, size_t len)
+{
+  snprintf (buf, len, "P.%i", 12345 + k);
+}
+
+static int open_scan (libusb_context *ctx, int k, libusb_device_handle **h)
+{
+  char serial[20];
+  struct alluris_device_description *devs;
+  serial_of (k, serial, sizeof (serial));
+  ssize_t cnt = liballuris_get_device_array (ctx, &devs, 1);
+  ssize_t j;
+  int r = (cnt < 0)? cnt : LIBUSB_ERROR_NOT_FOUND;
+  for (j = 0; j < cnt && r == LIBUSB_ERROR_NOT_FOUND; j++)
+    if (! strcmp (devs[j].serial_number, serial))
+      r = libusb_open (devs[j].dev, h);
+  liballuris_free_device_array (devs);
+  return r;
+}
+
+static int open_all (libusb_context *ctx, int n, int method, double *elapsed)
+{
+  int k, r = 0;
+  double t = sim_now ();
+  for (k = 0; k < n && ! r; k++)
+    {
+      libusb_device_handle *h = NULL;
+      char serial[20];
+      serial_of (k, serial, sizeof (serial));
+      if (method == 0)
+        r = open_scan (ctx, k, &h);
+      else if (method == 1)
+        r = liballuris_open_device (ctx, serial, &h);
+      else
+        r = liballuris_open_device_with_id (ctx, 1 + k / 100, 2 + k % 100, &h);
+      if (! r)
+        libusb_close (h);
+    }
+  *elapsed = sim_now () - t;
+  return r;
+}
+
+static int list (libusb_context *ctx, int n, double *elapsed)
+{
+  struct alluris_device_description *devs;
+  double t = sim_now ();
+  ssize_t cnt = liballuris_get_device_array (ctx, &devs, 1);
+  *elapsed = sim_now () - t;
+  int r = (cnt < 0)? cnt : 0;
+  if (cnt >= 0 && cnt != n)
+    {
+      fprintf (stderr, "Error: listed %zi of %i gauges\n", cnt, n);
+      r = -1;
+    }
+  liballuris_free_device_array (devs);
+  return r;
+}
+
+int main (int argc, char **argv)
+{
+  double rtt = ((argc > 1)? atof (argv[1]) : 2.0) / 1e3;
+  int sizes[] = {8, 64, 256};
+
+  sim_set_rtt (rtt);
+  sim_set_open_time (0);
+  printf ("# round trip time %.2fms, opening is free\n", rtt * 1e3);
+  printf ("%8s %-12s %10s %12s\n", "#gauges", "method", "ms", "us/gauge");
+
+  int r = 0;
+  size_t j;
+  for (j = 0; j < sizeof (sizes) / sizeof (sizes[0]) && ! r; j++)
+    {
+      int n = sizes[j];
+      libusb_context *ctx;
+      sim_set_num_devices (n);
+      r = libusb_init (&ctx);
+      if (r)
+        break;
+
+      const char *names[] = {"list cold", "list warm", "scan", "serial", "bus,dev"};
+      int m;
+      for (m = 0; m < 5 && ! r; m++)
+        {
+          double t;
+          r = (m < 2)? list (ctx, n, &t) : open_all (ctx, n, m - 2, &t);
+          if (! r)
+            printf ("%8i %-12s %10.2f %12.2f\n", n, names[m], 1e3 * t, 1e6 * t / n);
+        }
+
+      liballuris_release_registry (ctx);
+      libusb_exit (ctx);
+    }
+
+  if (r)
+    fprintf (stderr, "Error: %s\n", liballuris_error_name (r));
+  return (r)? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,126 @@
+/*
+
+Copyright (C) 2015-2020 Alluris GmbH & Co. KG <weber@alluris.de>
+
+memory_bench -- download of the measurement memory with one round trip per
+address compared with liballuris_read_memory_range
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  See ../COPYING
+If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * Usage: memory_bench [RTT_MS]
+ *
+ * "all single" is what gadc --read-memory -1 did before: 1000 addresses,
+ * one liballuris_read_memory each.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <liballuris.h>
+#include "sim_libusb.h"
+
+static int check (const int *mem, size_t n)
+{
+  size_t k;
+  for (k = 0; k < n; k++)
+    if (mem[k] != (int) k * 10)
+      {
+        fprintf (stderr, "Error: address %zu read %i\n", k, mem[k]);
+        return -1;
+      }
+  return 0;
+}
+
+static int read_single (libusb_device_handle *h, int num, int *mem, size_t *actual)
+{
+  int r = 0;
+  for (*actual = 0; (int) *actual < num && ! r; (*actual)++)
+    r = liballuris_read_memory (h, *actual, mem + *actual);
+  return r;
+}
+
+int main (int argc, char **argv)
+{
+  double rtt = ((argc > 1)? atof (argv[1]) : 2.0) / 1e3;
+
+  libusb_context *ctx;
+  libusb_device_handle *h = NULL;
+  sim_set_rtt (rtt);
+  int r = libusb_init (&ctx);
+  if (! r)
+    r = liballuris_open_if_not_opened (ctx, NULL, &h);
+  if (r)
+    {
+      fprintf (stderr, "Error: %s\n", liballuris_error_name (r));
+      return EXIT_FAILURE;
+    }
+
+  printf ("# round trip time %.2fms\n", rtt * 1e3);
+  printf ("%-10s %-12s %10s %10s\n", "#stored", "method", "values", "ms");
+
+  int counts[] = {20, 200, 1000};
+  size_t j;
+  for (j = 0; j < sizeof (counts) / sizeof (counts[0]) && ! r; j++)
+    {
+      int mem[1000];
+      size_t actual = 0;
+      sim_set_mem_count (counts[j]);
+
+      double t = sim_now ();
+      r = read_single (h, 1000, mem, &actual);
+      t = sim_now () - t;
+      if (! r)
+        {
+          r = check (mem, counts[j]);
+          printf ("%-10i %-12s %10zu %10.1f\n", counts[j], "all single", actual, 1e3 * t);
+        }
+
+      if (! r)
+        {
+          t = sim_now ();
+          r = read_single (h, counts[j], mem, &actual);
+          t = sim_now () - t;
+        }
+      if (! r)
+        {
+          r = check (mem, counts[j]);
+          printf ("%-10i %-12s %10zu %10.1f\n", counts[j], "used single", actual, 1e3 * t);
+        }
+
+      if (! r)
+        {
+          t = sim_now ();
+          r = liballuris_read_memory_range (h, 0, mem, 1000, &actual);
+          t = sim_now () - t;
+        }
+      if (! r)
+        {
+          r = check (mem, actual);
+          if (actual != (size_t) counts[j])
+            r = -1;
+          printf ("%-10i %-12s %10zu %10.1f\n", counts[j], "range", actual, 1e3 * t);
+        }
+    }
+
+  if (r)
+    fprintf (stderr, "Error: %s\n", liballuris_error_name (r));
+
+  liballuris_close_device (h);
+  liballuris_release_registry (ctx);
+  libusb_exit (ctx);
+  return (r)? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,167 @@
+/*
+
+Copyright (C) 2015-2020 Alluris GmbH & Co. KG <weber@alluris.de>
+
+pipeline_bench -- time to read the start-up parameters of a gauge with the
+single getters compared with a pipelined liballuris_batch
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  See ../COPYING
+If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * Usage: pipeline_bench [REPETITIONS [RTT_MS]]
+ *
+ * 12 parameters are read, like the start-up script of a test station does.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <liballuris.h>
+#include "sim_libusb.h"
+
+struct params
+{
+  char serial[20];
+  char firmware[20];
+  char variant[20];
+  int cal_date;
+  int digits;
+  int resolution;
+  int fmax;
+  enum liballuris_measurement_mode mode;
+  enum liballuris_unit unit;
+  int mem_count;
+  int peak_level;
+  int autostop;
+};
+
+static int read_single (libusb_device_handle *h, struct params *p)
+{
+  int r = liballuris_get_serial_number (h, p->serial, sizeof (p->serial));
+  if (! r)
+    r = liballuris_get_firmware (h, 0, p->firmware, sizeof (p->firmware));
+  if (! r)
+    r = liballuris_get_variant (h, p->variant, sizeof (p->variant));
+  if (! r)
+    r = liballuris_get_next_calibration_date (h, &p->cal_date);
+  if (! r)
+    r = liballuris_get_digits (h, &p->digits);
+  if (! r)
+    r = liballuris_get_resolution (h, &p->resolution);
+  if (! r)
+    r = liballuris_get_F_max (h, &p->fmax);
+  if (! r)
+    r = liballuris_get_mode (h, &p->mode);
+  if (! r)
+    r = liballuris_get_unit (h, &p->unit);
+  if (! r)
+    r = liballuris_get_mem_count (h, &p->mem_count);
+  if (! r)
+    r = liballuris_get_peak_level (h, &p->peak_level);
+  if (! r)
+    r = liballuris_get_autostop (h, &p->autostop);
+  return r;
+}
+
+static int queue_batch (struct liballuris_batch *b, struct params *p)
+{
+  liballuris_batch_get_serial_number (b, p->serial, sizeof (p->serial));
+  liballuris_batch_get_firmware (b, 0, p->firmware, sizeof (p->firmware));
+  liballuris_batch_get_variant (b, p->variant, sizeof (p->variant));
+  liballuris_batch_get_next_calibration_date (b, &p->cal_date);
+  liballuris_batch_get_digits (b, &p->digits);
+  liballuris_batch_get_resolution (b, &p->resolution);
+  liballuris_batch_get_F_max (b, &p->fmax);
+  liballuris_batch_get_mode (b, &p->mode);
+  liballuris_batch_get_unit (b, &p->unit);
+  liballuris_batch_get_mem_count (b, &p->mem_count);
+  liballuris_batch_get_peak_level (b, &p->peak_level);
+  return liballuris_batch_get_autostop (b, &p->autostop);
+}
+
+static int bench_batch (libusb_device_handle *h, int reps, int depth, struct params *p, double *elapsed)
+{
+  struct liballuris_batch *b;
+  int r = liballuris_batch_new (h, depth, &b);
+  if (r)
+    return r;
+  r = queue_batch (b, p);
+  if (r > 0)
+    r = 0;
+
+  double t = sim_now ();
+  int k;
+  for (k = 0; k < reps && ! r; k++)
+    r = liballuris_batch_run (b);
+  *elapsed = sim_now () - t;
+
+  liballuris_batch_free (b);
+  return r;
+}
+
+int main (int argc, char **argv)
+{
+  int reps = (argc > 1)? atoi (argv[1]) : 50;
+  double rtt = ((argc > 2)? atof (argv[2]) : 2.0) / 1e3;
+
+  libusb_context *ctx;
+  libusb_device_handle *h = NULL;
+  sim_set_rtt (rtt);
+  int r = libusb_init (&ctx);
+  if (! r)
+    r = liballuris_open_if_not_opened (ctx, NULL, &h);
+  if (r)
+    {
+      fprintf (stderr, "Error: %s\n", liballuris_error_name (r));
+      return EXIT_FAILURE;
+    }
+
+  struct params single, batched;
+  double t = sim_now ();
+  int k;
+  for (k = 0; k < reps && ! r; k++)
+    r = read_single (h, &single);
+  double t_single = sim_now () - t;
+
+  printf ("# %i x 12 parameters, round trip time %.2fms\n", reps, rtt * 1e3);
+  printf ("%-12s %10s\n", "#method", "ms/gauge");
+  printf ("%-12s %10.3f\n", "single", 1e3 * t_single / reps);
+
+  int depths[] = {1, DEFAULT_PIPELINE_DEPTH, 12};
+  for (k = 0; k < 3 && ! r; k++)
+    {
+      double elapsed = 0;
+      r = bench_batch (h, reps, depths[k], &batched, &elapsed);
+      char name[20];
+      snprintf (name, sizeof (name), "batch x%i", depths[k]);
+      printf ("%-12s %10.3f\n", name, 1e3 * elapsed / reps);
+    }
+
+  if (! r && (strcmp (single.serial, batched.serial) || strcmp (single.variant, batched.variant)
+              || single.fmax != batched.fmax || single.unit != batched.unit))
+    {
+      fprintf (stderr, "Error: batch results differ from single getters\n");
+      r = -1;
+    }
+  if (r)
+    fprintf (stderr, "Error: %s\n", liballuris_error_name (r));
+
+  liballuris_close_device (h);
+  liballuris_release_registry (ctx);
+  libusb_exit (ctx);
+  return (r)? EXIT_FAILURE : EXIT_SUCCESS;
+}
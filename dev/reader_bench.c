@@ -0,0 +1,139 @@
+/*
+
+Copyright (C) 2015-2020 Alluris GmbH & Co. KG <weber@alluris.de>
+
+reader_bench -- samples lost by a consumer with long output stalls when it
+reads the stream itself compared with the background reader
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  See ../COPYING
+If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * Usage: reader_bench [DURATION_S [STALL_MS]]
+ *
+ * Every second the consumer stalls for STALL_MS to emulate a disk which
+ * flushes its cache. Gaps are detected with the running sample index
+ * which the simulated gauge sends as value.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <liballuris.h>
+#include "sim_libusb.h"
+
+#define BLOCK_LEN 19
+
+static void stall (double *next_stall, double stall_s)
+{
+  if (sim_now () >= *next_stall)
+    {
+      usleep (stall_s * 1e6);
+      *next_stall += 1.0;
+    }
+}
+
+static int bench_stream (libusb_context *ctx, libusb_device_handle *h, double duration, double stall_s)
+{
+  struct sim_result res = {0, 0, 0, 0, 0};
+  unsigned long overflows = 0;
+  struct liballuris_stream *stream;
+  int buf[BLOCK_LEN];
+  int expected = -1;
+
+  int r = liballuris_stream_open (ctx, h, BLOCK_LEN, DEFAULT_STREAM_TRANSFERS, &stream);
+  double end = sim_now () + duration;
+  double next_stall = sim_now () + 0.5;
+  while (! r && sim_now () < end)
+    {
+      r = liballuris_stream_read (stream, buf, BLOCK_LEN, 3600);
+      if (! r)
+        sim_account (&res, 0, buf, BLOCK_LEN, &expected);
+      stall (&next_stall, stall_s);
+    }
+  if (! r)
+    {
+      overflows = liballuris_stream_get_overflows (stream) * BLOCK_LEN;
+      r = liballuris_stream_close (stream);
+    }
+
+  sim_print_result ("stream", &res, " %10lu", overflows);
+  return r;
+}
+
+static int bench_reader (libusb_context *ctx, libusb_device_handle *h, double duration, double stall_s)
+{
+  struct sim_result res = {0, 0, 0, 0, 0};
+  unsigned long overflows = 0;
+  struct liballuris_reader *reader;
+  int buf[BLOCK_LEN];
+  int expected = -1;
+
+  int r = liballuris_reader_start (ctx, h, BLOCK_LEN, DEFAULT_READER_CAPACITY, &reader);
+  double end = sim_now () + duration;
+  double next_stall = sim_now () + 0.5;
+  while (! r && sim_now () < end)
+    {
+      size_t actual;
+      r = liballuris_reader_read (reader, buf, BLOCK_LEN, &actual, 3600);
+      if (! r)
+        sim_account (&res, 0, buf, actual, &expected);
+      stall (&next_stall, stall_s);
+    }
+  if (! r)
+    {
+      overflows = liballuris_reader_get_overflows (reader);
+      r = liballuris_reader_stop (reader);
+    }
+
+  sim_print_result ("reader", &res, " %10lu", overflows);
+  return r;
+}
+
+int main (int argc, char **argv)
+{
+  double duration = (argc > 1)? atof (argv[1]) : 3.0;
+  double stall_s = ((argc > 2)? atof (argv[2]) : 500.0) / 1e3;
+
+  libusb_context *ctx;
+  libusb_device_handle *h = NULL;
+  int r = libusb_init (&ctx);
+  if (! r)
+    r = liballuris_open_if_not_opened (ctx, NULL, &h);
+  if (! r)
+    r = liballuris_set_mode (h, LIBALLURIS_MODE_PEAK);
+  if (! r)
+    r = liballuris_start_measurement (h);
+  if (r)
+    {
+      fprintf (stderr, "Error: %s\n", liballuris_error_name (r));
+      return EXIT_FAILURE;
+    }
+
+  printf ("# %.1fs at 900Hz, block length %i, consumer stalls %.0fms every second\n", duration, BLOCK_LEN, stall_s * 1e3);
+  printf ("%-12s %8s %8s %10s\n", "#method", "samples", "missing", "overflows");
+
+  r = bench_stream (ctx, h, duration, stall_s);
+  if (! r)
+    r = bench_reader (ctx, h, duration, stall_s);
+
+  if (r)
+    fprintf (stderr, "Error: %s\n", liballuris_error_name (r));
+
+  liballuris_close_device (h);
+  liballuris_release_registry (ctx);
+  libusb_exit (ctx);
+  return (r)? EXIT_FAILURE : EXIT_SUCCESS;
+}
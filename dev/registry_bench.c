@@ -0,0 +1,147 @@
+/*
+
+Copyright (C) 2015-2020 Alluris GmbH & Co. KG <weber@alluris.de>
+
+registry_bench -- time to open a gauge by serial number or bus id with
+the device registry compared with a full bus scan, and the number of
+times a gauge used by another process is opened meanwhile
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  See ../COPYING
+If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * Usage: registry_bench [NUM_GAUGES [RTT_MS]]
+ *
+ * "scan" lists all gauges with serial numbers and opens the match, which is
+ * what every liballuris_open_device did before the registry. "cold" starts
+ * with an empty registry like a new gadc process, "warm" opens again in the
+ * same process. Gauge 0 is claimed by another process, the target is the
+ * last gauge except for "first" which opens the first free gauge. "replug"
+ * unplugs the last gauge, checks that it isn't found anymore and opens it
+ * again after it was plugged in, the registry follows the hotplug events.
+ * "rescan" opens by serial without hotplug support in libusb, so the registry
+ * is compared with libusb_get_device_list on every lookup.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <liballuris.h>
+#include "sim_libusb.h"
+
+#define MAX_GAUGES 64
+
+static int open_scan (libusb_context *ctx, const char *serial, libusb_device_handle **h)
+{
+  struct alluris_device_description devs[MAX_GAUGES];
+  int cnt = liballuris_get_device_list (ctx, devs, MAX_GAUGES, 1);
+  int k, r = LIBUSB_ERROR_NOT_FOUND;
+  for (k = 0; k < cnt && r; k++)
+    if (! strcmp (devs[k].serial_number, serial))
+      r = libusb_open (devs[k].dev, h);
+  liballuris_free_device_list (devs, MAX_GAUGES);
+  return r;
+}
+
+static int run (libusb_context *ctx, const char *name, int method, int n, int cold)
+{
+  char serial[20];
+  snprintf (serial, sizeof (serial), "P.%i", 12345 + n - 1);
+
+  if (cold)
+    liballuris_release_registry (ctx);
+  unsigned long opens = sim_opens (0);
+  libusb_device_handle *h = NULL;
+  double t = sim_now ();
+  int r;
+  if (method == 0)
+    r = open_scan (ctx, serial, &h);
+  else if (method == 1)
+    r = liballuris_open_device (ctx, serial, &h);
+  else if (method == 2)
+    r = liballuris_open_device (ctx, NULL, &h);
+  else
+    r = liballuris_open_device_with_id (ctx, 1 + (n - 1) / 100, 2 + (n - 1) % 100, &h);
+  t = sim_now () - t;
+  if (! r)
+    {
+      printf ("%-14s %10.2f %12lu\n", name, 1e3 * t, sim_opens (0) - opens);
+      libusb_close (h);
+    }
+  return r;
+}
+
+int main (int argc, char **argv)
+{
+  int n = (argc > 1)? atoi (argv[1]) : 16;
+  double rtt = ((argc > 2)? atof (argv[2]) : 2.0) / 1e3;
+  if (n < 2 || n > MAX_GAUGES)
+    {
+      fprintf (stderr, "Error: NUM_GAUGES has to be 2..%i\n", MAX_GAUGES);
+      return EXIT_FAILURE;
+    }
+
+  libusb_context *ctx;
+  sim_set_num_devices (n);
+  sim_set_rtt (rtt);
+  sim_set_claimed_elsewhere (0, 1);
+  int r = libusb_init (&ctx);
+
+  printf ("# %i gauges, round trip time %.2fms, open %.2fms\n", n, rtt * 1e3, 1.0);
+  printf ("%-14s %10s %12s\n", "#method", "ms", "foreign_opens");
+
+  if (! r)
+    r = run (ctx, "scan", 0, n, 1);
+  if (! r)
+    r = run (ctx, "serial cold", 1, n, 1);
+  if (! r)
+    r = run (ctx, "serial warm", 1, n, 0);
+  if (! r)
+    r = run (ctx, "first cold", 2, n, 1);
+  if (! r)
+    r = run (ctx, "bus,dev cold", 3, n, 1);
+  if (! r)
+    {
+      char serial[20];
+      libusb_device_handle *h = NULL;
+      snprintf (serial, sizeof (serial), "P.%i", 12345 + n - 1);
+      sim_set_num_devices (n - 1);
+      if (liballuris_open_device (ctx, serial, &h) != LIBUSB_ERROR_NOT_FOUND)
+        {
+          fprintf (stderr, "Error: unplugged gauge %s still found\n", serial);
+          r = LIBUSB_ERROR_OTHER;
+          if (h)
+            libusb_close (h);
+        }
+      sim_set_num_devices (n);
+    }
+  if (! r)
+    r = run (ctx, "replug", 1, n, 0);
+  if (! r)
+    {
+      sim_set_hotplug (0);
+      r = run (ctx, "rescan cold", 1, n, 1);
+    }
+  if (! r)
+    r = run (ctx, "rescan warm", 1, n, 0);
+
+  if (r)
+    fprintf (stderr, "Error: %s\n", liballuris_error_name (r));
+
+  liballuris_release_registry (ctx);
+  libusb_exit (ctx);
+  return (r)? EXIT_FAILURE : EXIT_SUCCESS;
+}
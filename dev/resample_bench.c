@@ -0,0 +1,188 @@
+/*
+
+Copyright (C) 2015-2020 Alluris GmbH & Co. KG <weber@alluris.de>
+
+resample_bench -- alignment of the samples of several gauges with drifting
+sample clocks in rows of liballuris_group_read compared with
+liballuris_group_read_resampled
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  See ../COPYING
+If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * Usage: resample_bench [DURATION_S [NUM_GAUGES [PPM]]]
+ *
+ * The sample clocks of the gauges deviate evenly between -PPM and +PPM,
+ * all stream at 900Hz. The simulated gauges send the running sample index
+ * as value, so the true completion time of every value in a row is known,
+ * also for an interpolated value. The error of a value is its true time
+ * minus the mean true time of its row, given in sample periods. "index"
+ * rows put the samples with the same index side by side, "resampled" rows
+ * are interpolated at common host times. Latency is the time from the
+ * grid time of a resampled row until the consumer has it.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <liballuris.h>
+#include "sim_libusb.h"
+
+#define MAX_GAUGES 64
+#define ROWS 32
+
+struct bench_result
+{
+  unsigned long rows;
+  unsigned long missing;
+  double err_sq;
+  unsigned long err_cnt;
+  double max_err;
+  double latency;
+  double max_latency;
+};
+
+static double true_time (int k, double v)
+{
+  int i = (int) floor (v);
+  double t = sim_sample_time (k, i);
+  return t + (v - i) * (sim_sample_time (k, i + 1) - t);
+}
+
+static void account_row (struct bench_result *res, const double *v, int n)
+{
+  double t[n], mean = 0;
+  int k, cnt = 0;
+  for (k = 0; k < n; k++)
+    if (isnan (v[k]))
+      res->missing++;
+    else
+      {
+        t[cnt] = true_time (k, v[k]);
+        mean += t[cnt++];
+      }
+  res->rows++;
+  if (cnt < 2)
+    return;
+  mean /= cnt;
+  for (k = 0; k < cnt; k++)
+    {
+      double e = fabs (t[k] - mean) * 900.0;
+      res->err_sq += e * e;
+      res->err_cnt++;
+      if (e > res->max_err)
+        res->max_err = e;
+    }
+}
+
+static void print_result (const char *name, const struct bench_result *res)
+{
+  printf ("%-10s %8lu %8lu %10.4f %10.4f %12.1f %12.1f\n", name, res->rows, res->missing,
+          sqrt (res->err_sq / (res->err_cnt? res->err_cnt : 1)), res->max_err,
+          1e3 * res->latency / (res->rows? res->rows : 1), 1e3 * res->max_latency);
+}
+
+static int bench (libusb_context *ctx, libusb_device_handle **h, int n, double duration, int resampled)
+{
+  struct bench_result res;
+  struct liballuris_group *group;
+  int irows[ROWS * n];
+  double rows[ROWS * n], t[ROWS];
+  int r;
+  memset (&res, 0, sizeof (res));
+
+  r = liballuris_group_start (ctx, h, n, 19, DEFAULT_GROUP_CAPACITY, &group);
+  double end = sim_now () + duration;
+  while (! r && sim_now () < end)
+    {
+      size_t actual, i;
+      if (resampled)
+        r = liballuris_group_read_resampled (group, rows, t, ROWS, &actual, 1000);
+      else
+        {
+          r = liballuris_group_read (group, irows, ROWS, &actual, 1000);
+          for (i = 0; i < actual * n; i++)
+            rows[i] = (irows[i] == LIBALLURIS_GROUP_MISSING)? NAN : irows[i];
+        }
+      double now = sim_now ();
+      for (i = 0; i < actual; i++)
+        {
+          account_row (&res, rows + i * n, n);
+          if (resampled)
+            {
+              res.latency += now - t[i];
+              if (now - t[i] > res.max_latency)
+                res.max_latency = now - t[i];
+            }
+        }
+    }
+  int stop_ret = liballuris_group_stop (group);
+  if (! r)
+    print_result ((resampled)? "resampled" : "index", &res);
+  return (r)? r : stop_ret;
+}
+
+int main (int argc, char **argv)
+{
+  double duration = (argc > 1)? atof (argv[1]) : 10.0;
+  int n = (argc > 2)? atoi (argv[2]) : 4;
+  double ppm = (argc > 3)? atof (argv[3]) : 150.0;
+  if (n < 2 || n > MAX_GAUGES)
+    {
+      fprintf (stderr, "Error: NUM_GAUGES has to be 2..%i\n", MAX_GAUGES);
+      return EXIT_FAILURE;
+    }
+
+  printf ("# %i gauges at 900Hz, clock errors -%.0f..%.0fppm, %.1fs per method\n", n, ppm, ppm, duration);
+  printf ("%-10s %8s %8s %10s %10s %12s %12s\n", "#method", "rows", "missing", "rms_err", "max_err",
+          "latency_ms", "max_lat_ms");
+
+  int r = 0, m;
+  for (m = 0; m < 2 && ! r; m++)
+    {
+      libusb_context *ctx;
+      libusb_device_handle *h[MAX_GAUGES];
+      int k;
+      sim_set_num_devices (n);
+      for (k = 0; k < n; k++)
+        sim_set_clock_error (k, ppm * (2.0 * k / (n - 1) - 1));
+      r = libusb_init (&ctx);
+      for (k = 0; k < n && ! r; k++)
+        {
+          char id[20];
+          snprintf (id, sizeof (id), "%i,%i", 1 + k / 100, 2 + k % 100);
+          h[k] = NULL;
+          r = liballuris_open_if_not_opened (ctx, id, &h[k]);
+          if (! r)
+            r = liballuris_set_mode (h[k], LIBALLURIS_MODE_PEAK);
+          if (! r)
+            r = liballuris_start_measurement (h[k]);
+        }
+
+      if (! r)
+        r = bench (ctx, h, n, duration, m);
+
+      for (k = 0; k < n; k++)
+        liballuris_close_device (h[k]);
+      liballuris_release_registry (ctx);
+      libusb_exit (ctx);
+    }
+
+  if (r)
+    fprintf (stderr, "Error: %s\n", liballuris_error_name (r));
+  return (r)? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,136 @@
+/*
+
+Copyright (C) 2015-2020 Alluris GmbH & Co. KG <weber@alluris.de>
+
+session_bench -- round trips a converter needs per capture to scale values,
+querying the properties with the single getters compared with a cached
+liballuris_device session
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  See ../COPYING
+If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * Usage: session_bench [CAPTURES]
+ *
+ * Each capture reads digits, resolution, F_max, unit and variant before
+ * scaling one block of values. The cache is checked against liballuris_set_unit.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <liballuris.h>
+#include "sim_libusb.h"
+
+#define BLOCK_LEN 19
+
+static int capture_single (libusb_device_handle *h, double *out)
+{
+  int digits, resolution, fmax, k;
+  enum liballuris_unit unit;
+  char variant[20];
+  int r = liballuris_get_digits (h, &digits);
+  if (! r)
+    r = liballuris_get_resolution (h, &resolution);
+  if (! r)
+    r = liballuris_get_F_max (h, &fmax);
+  if (! r)
+    r = liballuris_get_unit (h, &unit);
+  if (! r)
+    r = liballuris_get_variant (h, variant, sizeof (variant));
+  for (k = 0; k < BLOCK_LEN && ! r; k++)
+    {
+      double v = k;
+      int d;
+      for (d = 0; d < digits; d++)
+        v /= 10;
+      out[k] = v;
+    }
+  return r;
+}
+
+static int capture_session (struct liballuris_device *dev, double *out)
+{
+  int resolution, fmax, k;
+  enum liballuris_unit unit;
+  char variant[20];
+  int r = liballuris_device_get_resolution (dev, &resolution);
+  if (! r)
+    r = liballuris_device_get_F_max (dev, &fmax);
+  if (! r)
+    r = liballuris_device_get_unit (dev, &unit);
+  if (! r)
+    r = liballuris_device_get_variant (dev, variant, sizeof (variant));
+  for (k = 0; k < BLOCK_LEN && ! r; k++)
+    r = liballuris_device_scale (dev, k, out + k);
+  return r;
+}
+
+int main (int argc, char **argv)
+{
+  int captures = (argc > 1)? atoi (argv[1]) : 100;
+
+  libusb_context *ctx;
+  struct liballuris_device *dev = NULL;
+  double out[BLOCK_LEN];
+  int k;
+  int r = libusb_init (&ctx);
+  if (! r)
+    r = liballuris_device_open (ctx, NULL, &dev);
+  if (r)
+    {
+      fprintf (stderr, "Error: %s\n", liballuris_error_name (r));
+      return EXIT_FAILURE;
+    }
+  libusb_device_handle *h = liballuris_device_handle (dev);
+
+  printf ("# %i captures, properties for scaling queried per capture\n", captures);
+  printf ("%-12s %12s %12s\n", "#method", "trips/capt", "ms/capt");
+
+  unsigned long trips = sim_out_transfers (0);
+  double t = sim_now ();
+  for (k = 0; k < captures && ! r; k++)
+    r = capture_single (h, out);
+  printf ("%-12s %12.2f %12.3f\n", "single", (double) (sim_out_transfers (0) - trips) / captures,
+          1e3 * (sim_now () - t) / captures);
+
+  trips = sim_out_transfers (0);
+  t = sim_now ();
+  for (k = 0; k < captures && ! r; k++)
+    r = capture_session (dev, out);
+  printf ("%-12s %12.2f %12.3f\n", "session", (double) (sim_out_transfers (0) - trips) / captures,
+          1e3 * (sim_now () - t) / captures);
+
+  // the cache has to follow set calls on the raw handle
+  enum liballuris_unit unit;
+  if (! r)
+    r = liballuris_set_unit (h, LIBALLURIS_UNIT_kg);
+  if (! r)
+    r = liballuris_device_get_unit (dev, &unit);
+  if (! r && unit != LIBALLURIS_UNIT_kg)
+    {
+      fprintf (stderr, "Error: cached unit %s wasn't invalidated\n", liballuris_unit_enum2str (unit));
+      r = -1;
+    }
+
+  if (r)
+    fprintf (stderr, "Error: %s\n", liballuris_error_name (r));
+
+  liballuris_device_close (dev);
+  liballuris_release_registry (ctx);
+  libusb_exit (ctx);
+  return (r)? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,1143 @@
+/*
+
+Copyright (C) 2015-2020 Alluris GmbH & Co. KG <weber@alluris.de>
+
+Software stand-in for Alluris gauges behind the libusb-1.0 API.
+
+This file is part of liballuris.
+
+Liballuris is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Liballuris is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with liballuris. See ../COPYING.LESSER
+If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#include "sim_libusb.h"
+
+#define SIM_MAX_DEVICES 256
+#define SIM_REPLY_QUEUE 64
+#define SIM_PACKET_LEN 64
+
+struct sim_packet
+{
+  unsigned char buf[SIM_PACKET_LEN];
+  int len;
+  double ready;                 // time the packet is available at the host
+};
+
+// a transfer submitted with libusb_submit_transfer
+struct sim_pending
+{
+  struct libusb_transfer *t;
+  struct sim_pending *next;
+};
+
+struct sim_gauge
+{
+  int index;
+  int measuring;
+  double measuring_since;       // start command takes some time until measuring
+  int mode;
+  int ratio;
+  int unit;
+  int mem_mode;
+  int digout;
+  int autostop;
+  int peak_level;
+  int upper_limit;
+  int lower_limit;
+  int mute;                     // hung firmware, commands get no reply
+  double clock_error;           // relative deviation of the sample clock
+
+  int streaming;
+  int block_len;
+  double t0;                    // time streaming was enabled
+  unsigned long next_block;     // index of the next generated block
+  double sample_offset;         // sample index at t0
+
+  // endpoint buffer of the device, holds one sample block
+  int slot_full;
+  struct sim_packet slot;
+  unsigned long dropped;
+
+  struct sim_packet replies[SIM_REPLY_QUEUE];
+  int rhead;
+  int rcount;
+  double busy_until;
+  unsigned long out_transfers;
+
+  struct sim_pending *in_queue; // queued IN transfers (FIFO)
+};
+
+struct libusb_device
+{
+  int index;
+  int claimed_elsewhere;        // interface claimed by another process
+  unsigned long opens;
+  struct sim_gauge g;
+};
+
+struct libusb_device_handle
+{
+  struct libusb_device *dev;
+};
+
+struct libusb_context
+{
+  int dummy;
+};
+
+static struct libusb_context sim_ctx;
+static struct libusb_device sim_devices[SIM_MAX_DEVICES];
+static int sim_num_devices = 1;
+static double sim_bus_latency = 0.9e-3;
+static double sim_processing_time = 0.2e-3;
+static int sim_realtime = 1;
+static int sim_fw[3] = {5, 4, 10};      // major, minor, patch
+static int sim_mem_count = 20;          // values in the measurement memory
+static double sim_open_time = 1e-3;     // libusb_open and libusb_claim_interface
+static unsigned short sim_cal_date = 7532; // flash word 0, days since 1.1.2000
+static int sim_hotplug = 1;
+static libusb_hotplug_callback_fn sim_hotplug_cb; // one registered callback at a time
+static void *sim_hotplug_data;
+static libusb_context *sim_hotplug_ctx;
+static int sim_reported_devices;        // devices the hotplug callback knows about
+static struct sim_pending *sim_done;    // completed transfers, callbacks pending
+
+// all gauges share one lock, released while sleeping and while running callbacks
+static pthread_mutex_t sim_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// sleep with sim_lock released
+static void sim_unlocked_sleep_until (double t);
+
+void sim_set_num_devices (int n)
+{
+  if (n < 0)
+    n = 0;
+  if (n > SIM_MAX_DEVICES)
+    n = SIM_MAX_DEVICES;
+  sim_num_devices = n;
+}
+
+// 90% of the round trip time is spent on the bus, 10% in the firmware
+void sim_set_rtt (double seconds)
+{
+  sim_bus_latency = seconds * 0.45;
+  sim_processing_time = seconds * 0.1;
+}
+
+// without realtime a sample block is ready whenever the host reads
+void sim_set_realtime (int on)
+{
+  sim_realtime = on;
+}
+
+// firmware <= V5.04.010 answers BUSY to state queries while starting
+void sim_set_firmware (int major, int minor, int patch)
+{
+  sim_fw[0] = major;
+  sim_fw[1] = minor;
+  sim_fw[2] = patch;
+}
+
+void sim_set_mute (int device, int on)
+{
+  if (device >= 0 && device < SIM_MAX_DEVICES)
+    {
+      pthread_mutex_lock (&sim_lock);
+      sim_devices[device].g.mute = on;
+      pthread_mutex_unlock (&sim_lock);
+    }
+}
+
+void sim_set_clock_error (int device, double ppm)
+{
+  if (device >= 0 && device < SIM_MAX_DEVICES)
+    sim_devices[device].g.clock_error = ppm * 1e-6;
+}
+
+void sim_set_claimed_elsewhere (int device, int on)
+{
+  if (device >= 0 && device < SIM_MAX_DEVICES)
+    sim_devices[device].claimed_elsewhere = on;
+}
+
+void sim_set_hotplug (int on)
+{
+  sim_hotplug = on;
+}
+
+void sim_set_open_time (double seconds)
+{
+  sim_open_time = seconds;
+}
+
+// recalibration of all gauges, days since 1.1.2000
+void sim_set_calibration_date (unsigned short date)
+{
+  sim_cal_date = date;
+}
+
+unsigned long sim_opens (int device)
+{
+  if (device < 0 || device >= SIM_MAX_DEVICES)
+    return 0;
+  pthread_mutex_lock (&sim_lock);
+  unsigned long ret = sim_devices[device].opens;
+  pthread_mutex_unlock (&sim_lock);
+  return ret;
+}
+
+void sim_set_mem_count (int n)
+{
+  sim_mem_count = (n < 0)? 0 : (n > 1000)? 1000 : n;
+}
+
+static int sim_old_firmware (void)
+{
+  return sim_fw[1] * 1000 + sim_fw[2] <= 4010;
+}
+
+double sim_now (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1.0e9;
+}
+
+static void sim_sleep_until (double t)
+{
+  double d = t - sim_now ();
+  if (d <= 0)
+    return;
+  struct timespec ts;
+  ts.tv_sec = (time_t) d;
+  ts.tv_nsec = (long) ((d - ts.tv_sec) * 1.0e9);
+  while (nanosleep (&ts, &ts) && errno == EINTR)
+    ;
+}
+
+static void sim_unlocked_sleep_until (double t)
+{
+  pthread_mutex_unlock (&sim_lock);
+  sim_sleep_until (t);
+  pthread_mutex_lock (&sim_lock);
+}
+
+static double sim_rate (struct sim_gauge *g)
+{
+  double rate = (g->mode == 0)? 10.0 : 900.0;
+  if (g->ratio > 1)
+    rate /= g->ratio;
+  return rate * (1 + g->clock_error);
+}
+
+double sim_sample_time (int device, int sample_index)
+{
+  struct sim_gauge *g = &sim_devices[device].g;
+  return g->t0 + (sample_index - g->sample_offset + 1) / sim_rate (g);
+}
+
+// add a block of samples of device, expected is the next sample index or -1 before the first block
+void sim_account (struct sim_result *res, int device, const int *buf, size_t len, int *expected)
+{
+  double latency = sim_now () - sim_sample_time (device, buf[len - 1]);
+  if (*expected >= 0 && buf[0] != *expected)
+    res->missing += buf[0] - *expected;
+  *expected = buf[len - 1] + 1;
+
+  res->blocks++;
+  res->samples += len;
+  res->latency_sum += latency;
+  if (latency > res->latency_max)
+    res->latency_max = latency;
+}
+
+// one row with name, samples and missing samples followed by the columns in format
+void sim_print_result (const char *name, const struct sim_result *res, const char *format, ...)
+{
+  va_list ap;
+  printf ("%-12s %8lu %8lu", name, res->samples, res->missing);
+  va_start (ap, format);
+  vprintf (format, ap);
+  va_end (ap);
+  printf ("\n");
+}
+
+// CPU time of the process in seconds, all threads
+double sim_cpu_time (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_PROCESS_CPUTIME_ID, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1.0e9;
+}
+
+unsigned long sim_dropped_blocks (int device)
+{
+  return sim_devices[device].g.dropped;
+}
+
+unsigned long sim_out_transfers (int device)
+{
+  return sim_devices[device].g.out_transfers;
+}
+
+static void put_int24 (unsigned char *p, int v)
+{
+  p[0] = v & 0xFF;
+  p[1] = (v >> 8) & 0xFF;
+  p[2] = (v >> 16) & 0xFF;
+}
+
+// content of the calibration flash, see liballuris_get_calibration_number
+static unsigned short sim_flash_word (int adr)
+{
+  static const char cal_number[40] = "D-K-15099-01-00-2020-08-15";
+  if (adr == 0)
+    return sim_cal_date;
+  if (adr >= 1 && adr <= 4)
+    {
+      double u = 0.05;
+      unsigned short w[4];
+      memcpy (w, &u, sizeof (u));
+      return w[adr - 1];
+    }
+  if (adr >= 5 && adr <= 24)
+    {
+      unsigned short w;
+      memcpy (&w, cal_number + (adr - 5) * 2, 2);
+      return w;
+    }
+  return 0xFFFF;
+}
+
+static void sim_update_measuring (struct sim_gauge *g, double now)
+{
+  if (g->measuring_since > 0 && now >= g->measuring_since)
+    {
+      g->measuring = 1;
+      g->measuring_since = 0;
+    }
+}
+
+// build the reply for a command, returns the reply length (0 = no reply)
+static int sim_command (struct sim_gauge *g, const unsigned char *out, int len, unsigned char *in, double now)
+{
+  int busy = g->measuring || g->measuring_since > 0;
+  unsigned char cmd = out[0];
+  int arg = (len > 2)? out[2] : 0;
+
+  in[0] = cmd;
+  in[2] = arg;
+  switch (cmd)
+    {
+    case 0x01: // cyclic measurement
+      if (arg == 2)
+        {
+          g->streaming = 1;
+          g->block_len = out[3];
+          g->t0 = now;
+          g->sample_offset = g->next_block * (double) g->block_len;
+          g->next_block = 0;
+          g->slot_full = 0;
+          in[1] = 4;
+          in[3] = out[3];
+          return 4;
+        }
+      g->streaming = 0;
+      g->slot_full = 0;
+      return 0;
+
+    case 0x08: // info
+    {
+      int v = -1;
+      in[1] = 6;
+      switch (arg)
+        {
+        case 0:
+        case 1:
+          in[3] = sim_fw[2];
+          in[4] = sim_fw[1];
+          in[5] = sim_fw[0];
+          return 6;
+        case 2:
+          v = 500;
+          break;
+        case 3:
+          v = 1;
+          break;
+        case 4:
+          v = 0x0002;
+          break;
+        case 5:
+          v = sim_mem_count;
+          break;
+        case 6:
+          if (busy)
+            {
+              in[3] = in[4] = 0xFF;
+              in[5] = 0;
+              return 6;
+            }
+          // serial P.12345, P.12346, ...
+          in[3] = (12345 + g->index) & 0xFF;
+          in[4] = (12345 + g->index) >> 8;
+          in[5] = 'P' - 'A';
+          return 6;
+        case 7:
+          v = 2108;
+          break;
+        case 15:
+          v = 1;
+          break;
+        case 16:
+          v = 1;
+          break;
+        }
+      if (busy && arg != 15)
+        v = -1;
+      put_int24 (in + 3, v);
+      return 6;
+    }
+
+    case 0x46: // value, peaks and state
+    {
+      int v = 0;
+      in[1] = 6;
+      if (arg == 2 && g->measuring_since > 0 && sim_old_firmware ())
+        v = 0xFFFFFF;
+      else if (arg == 2)
+        {
+          v = (g->measuring)? (1 << 23) : 0;
+          if (g->mode)
+            v |= 1 << 3;
+        }
+      else if (arg == 3)
+        v = (int) ((now - g->t0) * sim_rate (g)) & 0x7FFFFF;
+      else if (arg == 4)
+        v = 123;
+      else if (arg == 5)
+        v = -123;
+      put_int24 (in + 3, v);
+      return 6;
+    }
+
+    case 0x72: // read flash
+    {
+      unsigned short w = sim_flash_word (out[2] | (out[3] << 8));
+      in[1] = 6;
+      in[3] = 0;
+      in[4] = w & 0xFF;
+      in[5] = w >> 8;
+      return 6;
+    }
+
+    case 0x06: // read memory
+    {
+      int adr = out[2] | (out[3] << 8);
+      in[1] = 5;
+      put_int24 (in + 2, (adr < sim_mem_count)? adr * 10 : 0);
+      return 5;
+    }
+
+    case 0x09: // memory statistics
+      in[1] = 20;
+      memset (in + 2, 0, 18);
+      return 20;
+
+    case 0x1C: // start/stop
+      if (arg && ! g->measuring)
+        g->measuring_since = now + 0.25;
+      else if (! arg)
+        {
+          g->measuring = 0;
+          g->measuring_since = 0;
+        }
+      in[1] = 3;
+      return 3;
+
+    case 0x18: // set limit
+      if (arg == 0)
+        g->upper_limit = out[3] | (out[4] << 8) | (out[5] << 16);
+      else
+        g->lower_limit = out[3] | (out[4] << 8) | (out[5] << 16);
+      memcpy (in + 3, out + 3, 3);
+      in[1] = 6;
+      return 6;
+
+    case 0x19: // get limit
+      in[1] = 6;
+      put_int24 (in + 3, (arg == 0)? g->upper_limit : g->lower_limit);
+      return 6;
+
+    case 0x04:
+      g->mode = arg;
+      break;
+    case 0x05:
+      in[2] = g->mode;
+      break;
+    case 0x1A:
+      g->unit = arg;
+      break;
+    case 0x1B:
+      in[2] = g->unit;
+      break;
+    case 0x1D:
+      g->mem_mode = arg;
+      break;
+    case 0x1E:
+      in[2] = g->mem_mode;
+      break;
+    case 0x21:
+      g->digout = arg;
+      break;
+    case 0x22:
+      in[2] = g->digout;
+      break;
+    case 0x27:
+      in[2] = 0;
+      break;
+    case 0x30:
+      g->ratio = arg;
+      break;
+    case 0x31:
+      g->peak_level = arg;
+      break;
+    case 0x32:
+      in[2] = g->peak_level;
+      break;
+    case 0x33:
+      g->autostop = arg;
+      break;
+    case 0x34:
+      in[2] = g->autostop;
+      break;
+    case 0x13: // power off
+      return 0;
+    default:
+      break;
+    }
+  in[1] = 3;
+  return 3;
+}
+
+static void sim_queue_reply (struct sim_gauge *g, const unsigned char *out, int len)
+{
+  double now = sim_now ();
+  struct sim_packet p;
+
+  g->out_transfers++;
+  if (g->mute)
+    return;
+  sim_update_measuring (g, now);
+  p.len = sim_command (g, out, len, p.buf, now);
+  if (p.len == 0)
+    return;
+
+  // commands are processed sequentially by the firmware
+  double start = now + sim_bus_latency;
+  if (start < g->busy_until)
+    start = g->busy_until;
+  g->busy_until = start + sim_processing_time;
+  p.ready = g->busy_until + sim_bus_latency;
+
+  if (g->rcount == SIM_REPLY_QUEUE)
+    {
+      fprintf (stderr, "sim_libusb: reply queue overflow\n");
+      return;
+    }
+  g->replies[(g->rhead + g->rcount++) % SIM_REPLY_QUEUE] = p;
+}
+
+static double sim_next_block_time (struct sim_gauge *g)
+{
+  if (! g->streaming || ! g->measuring || ! sim_realtime)
+    return 1e300;
+  return g->t0 + (g->next_block + 1) * g->block_len / sim_rate (g);
+}
+
+static void sim_make_block (struct sim_gauge *g, struct sim_packet *p)
+{
+  int k;
+  int first = (int) (g->sample_offset + g->next_block * g->block_len);
+  p->len = 5 + 3 * g->block_len;
+  p->ready = sim_next_block_time (g);
+  memset (p->buf, 0, 5);
+  p->buf[0] = 0x02;
+  p->buf[1] = p->len;
+  for (k = 0; k < g->block_len; k++)
+    put_int24 (p->buf + 5 + 3 * k, (first + k) & 0x7FFFFF);
+  g->next_block++;
+}
+
+static void sim_complete (struct sim_pending *p, enum libusb_transfer_status status, const struct sim_packet *pkt)
+{
+  p->t->status = status;
+  p->t->actual_length = 0;
+  if (pkt)
+    {
+      int n = (pkt->len < p->t->length)? pkt->len : p->t->length;
+      memcpy (p->t->buffer, pkt->buf, n);
+      p->t->actual_length = n;
+    }
+
+  // append to done list
+  p->next = NULL;
+  struct sim_pending **pp = &sim_done;
+  while (*pp)
+    pp = &(*pp)->next;
+  *pp = p;
+}
+
+// hand a packet to the oldest queued IN transfer, returns 0 if none is queued
+static int sim_deliver (struct sim_gauge *g, const struct sim_packet *pkt)
+{
+  struct sim_pending *p = g->in_queue;
+  if (! p)
+    return 0;
+  g->in_queue = p->next;
+  sim_complete (p, LIBUSB_TRANSFER_COMPLETED, pkt);
+  return 1;
+}
+
+/*
+ * Process everything the device did until now. Queued IN transfers receive
+ * packets as soon as they are available, otherwise replies wait in the
+ * reply queue and sample blocks in the endpoint buffer (or get dropped).
+ */
+static void sim_advance (struct sim_gauge *g, double now)
+{
+  sim_update_measuring (g, now);
+  for (;;)
+    {
+      // pending packets which are already available
+      if (g->in_queue && g->slot_full
+          && (! g->rcount || g->slot.ready <= g->replies[g->rhead].ready))
+        {
+          sim_deliver (g, &g->slot);
+          g->slot_full = 0;
+          continue;
+        }
+      if (g->in_queue && g->rcount && g->replies[g->rhead].ready <= now)
+        {
+          sim_deliver (g, &g->replies[g->rhead]);
+          g->rhead = (g->rhead + 1) % SIM_REPLY_QUEUE;
+          g->rcount--;
+          continue;
+        }
+
+      double tb = sim_next_block_time (g);
+      if (tb > now)
+        break;
+
+      struct sim_packet pkt;
+      sim_make_block (g, &pkt);
+      if (! sim_deliver (g, &pkt))
+        {
+          if (g->slot_full)
+            g->dropped++;
+          else
+            {
+              g->slot = pkt;
+              g->slot_full = 1;
+            }
+        }
+    }
+}
+
+static double sim_next_event (struct sim_gauge *g)
+{
+  double t = sim_next_block_time (g);
+  if (g->rcount && g->replies[g->rhead].ready < t)
+    t = g->replies[g->rhead].ready;
+  if (g->measuring_since > 0 && g->measuring_since < t)
+    t = g->measuring_since;
+  return t;
+}
+
+/****************************************************************************************/
+/* libusb API */
+
+int libusb_init (libusb_context **ctx)
+{
+  if (ctx)
+    *ctx = &sim_ctx;
+  return LIBUSB_SUCCESS;
+}
+
+void libusb_exit (libusb_context *ctx)
+{
+  (void) ctx;
+}
+
+const char *libusb_error_name (int errcode)
+{
+  switch (errcode)
+    {
+    case LIBUSB_SUCCESS:
+      return "LIBUSB_SUCCESS";
+    case LIBUSB_ERROR_IO:
+      return "LIBUSB_ERROR_IO";
+    case LIBUSB_ERROR_INVALID_PARAM:
+      return "LIBUSB_ERROR_INVALID_PARAM";
+    case LIBUSB_ERROR_ACCESS:
+      return "LIBUSB_ERROR_ACCESS";
+    case LIBUSB_ERROR_NO_DEVICE:
+      return "LIBUSB_ERROR_NO_DEVICE";
+    case LIBUSB_ERROR_NOT_FOUND:
+      return "LIBUSB_ERROR_NOT_FOUND";
+    case LIBUSB_ERROR_BUSY:
+      return "LIBUSB_ERROR_BUSY";
+    case LIBUSB_ERROR_TIMEOUT:
+      return "LIBUSB_ERROR_TIMEOUT";
+    case LIBUSB_ERROR_OVERFLOW:
+      return "LIBUSB_ERROR_OVERFLOW";
+    case LIBUSB_ERROR_PIPE:
+      return "LIBUSB_ERROR_PIPE";
+    case LIBUSB_ERROR_INTERRUPTED:
+      return "LIBUSB_ERROR_INTERRUPTED";
+    case LIBUSB_ERROR_NO_MEM:
+      return "LIBUSB_ERROR_NO_MEM";
+    case LIBUSB_ERROR_NOT_SUPPORTED:
+      return "LIBUSB_ERROR_NOT_SUPPORTED";
+    }
+  return "LIBUSB_ERROR_OTHER";
+}
+
+ssize_t libusb_get_device_list (libusb_context *ctx, libusb_device ***list)
+{
+  (void) ctx;
+  libusb_device **l = calloc (sim_num_devices + 1, sizeof (libusb_device *));
+  int k;
+  for (k = 0; k < sim_num_devices; k++)
+    {
+      sim_devices[k].index = k;
+      sim_devices[k].g.index = k;
+      l[k] = &sim_devices[k];
+    }
+  *list = l;
+  return sim_num_devices;
+}
+
+void libusb_free_device_list (libusb_device **list, int unref_devices)
+{
+  (void) unref_devices;
+  free (list);
+}
+
+libusb_device *libusb_ref_device (libusb_device *dev)
+{
+  return dev;
+}
+
+void libusb_unref_device (libusb_device *dev)
+{
+  (void) dev;
+}
+
+int libusb_get_device_descriptor (libusb_device *dev, struct libusb_device_descriptor *desc)
+{
+  (void) dev;
+  memset (desc, 0, sizeof (*desc));
+  desc->idVendor = 0x04d8;
+  desc->idProduct = 0xfc30;
+  desc->iProduct = 2;
+  return LIBUSB_SUCCESS;
+}
+
+uint8_t libusb_get_bus_number (libusb_device *dev)
+{
+  return 1 + dev->index / 100;
+}
+
+uint8_t libusb_get_device_address (libusb_device *dev)
+{
+  return 2 + dev->index % 100;
+}
+
+int libusb_open (libusb_device *dev, libusb_device_handle **dev_handle)
+{
+  pthread_mutex_lock (&sim_lock);
+  dev->opens++;
+  sim_unlocked_sleep_until (sim_now () + sim_open_time);
+  pthread_mutex_unlock (&sim_lock);
+
+  libusb_device_handle *h = malloc (sizeof (libusb_device_handle));
+  if (! h)
+    return LIBUSB_ERROR_NO_MEM;
+  h->dev = dev;
+  *dev_handle = h;
+  return LIBUSB_SUCCESS;
+}
+
+void libusb_close (libusb_device_handle *dev_handle)
+{
+  free (dev_handle);
+}
+
+libusb_device *libusb_get_device (libusb_device_handle *dev_handle)
+{
+  return dev_handle->dev;
+}
+
+int libusb_claim_interface (libusb_device_handle *dev_handle, int interface_number)
+{
+  (void) interface_number;
+  return (dev_handle->dev->claimed_elsewhere)? LIBUSB_ERROR_BUSY : LIBUSB_SUCCESS;
+}
+
+int libusb_release_interface (libusb_device_handle *dev_handle, int interface_number)
+{
+  (void) dev_handle;
+  (void) interface_number;
+  return LIBUSB_SUCCESS;
+}
+
+int libusb_get_string_descriptor_ascii (libusb_device_handle *dev_handle, uint8_t desc_index, unsigned char *data, int length)
+{
+  (void) dev_handle;
+  (void) desc_index;
+  // control transfer
+  sim_sleep_until (sim_now () + 2 * sim_bus_latency);
+  return snprintf ((char *) data, length, "FMI-S Force-Gauge");
+}
+
+int libusb_interrupt_transfer (libusb_device_handle *dev_handle, unsigned char endpoint, unsigned char *data, int length, int *actual_length, unsigned int timeout)
+{
+  struct sim_gauge *g = &dev_handle->dev->g;
+  *actual_length = 0;
+
+  pthread_mutex_lock (&sim_lock);
+  if (! (endpoint & LIBUSB_ENDPOINT_IN))
+    {
+      sim_queue_reply (g, data, length);
+      *actual_length = length;
+      pthread_mutex_unlock (&sim_lock);
+      return LIBUSB_SUCCESS;
+    }
+
+  int ret;
+  double deadline = sim_now () + ((timeout)? timeout / 1.0e3 : 1e9);
+  for (;;)
+    {
+      double now = sim_now ();
+      sim_advance (g, now);
+      if (! sim_realtime && g->streaming && g->measuring && ! g->slot_full && ! g->rcount)
+        {
+          sim_make_block (g, &g->slot);
+          g->slot.ready = now;
+          g->slot_full = 1;
+        }
+
+      const struct sim_packet *pkt = NULL;
+      if (g->slot_full && (! g->rcount || g->slot.ready <= g->replies[g->rhead].ready))
+        {
+          pkt = &g->slot;
+          g->slot_full = 0;
+        }
+      else if (g->rcount && g->replies[g->rhead].ready <= now)
+        {
+          pkt = &g->replies[g->rhead];
+          g->rhead = (g->rhead + 1) % SIM_REPLY_QUEUE;
+          g->rcount--;
+        }
+
+      if (pkt)
+        {
+          ret = LIBUSB_ERROR_OVERFLOW;
+          if (pkt->len <= length)
+            {
+              memcpy (data, pkt->buf, pkt->len);
+              *actual_length = pkt->len;
+              ret = LIBUSB_SUCCESS;
+            }
+          break;
+        }
+
+      if (now >= deadline)
+        {
+          ret = LIBUSB_ERROR_TIMEOUT;
+          break;
+        }
+
+      // other threads may queue commands meanwhile, don't oversleep
+      double next = sim_next_event (g);
+      if (next > now + 1e-3)
+        next = now + 1e-3;
+      sim_unlocked_sleep_until ((next < deadline)? next : deadline);
+    }
+  pthread_mutex_unlock (&sim_lock);
+  return ret;
+}
+
+struct libusb_transfer *libusb_alloc_transfer (int iso_packets)
+{
+  (void) iso_packets;
+  return calloc (1, sizeof (struct libusb_transfer));
+}
+
+void libusb_free_transfer (struct libusb_transfer *transfer)
+{
+  free (transfer);
+}
+
+int libusb_submit_transfer (struct libusb_transfer *transfer)
+{
+  struct sim_gauge *g = &transfer->dev_handle->dev->g;
+  struct sim_pending *p = malloc (sizeof (struct sim_pending));
+  if (! p)
+    return LIBUSB_ERROR_NO_MEM;
+  p->t = transfer;
+  p->next = NULL;
+
+  pthread_mutex_lock (&sim_lock);
+  if (! (transfer->endpoint & LIBUSB_ENDPOINT_IN))
+    {
+      sim_queue_reply (g, transfer->buffer, transfer->length);
+      struct sim_packet out;
+      out.len = transfer->length;
+      memcpy (out.buf, transfer->buffer, (out.len < SIM_PACKET_LEN)? out.len : SIM_PACKET_LEN);
+      sim_complete (p, LIBUSB_TRANSFER_COMPLETED, &out);
+      pthread_mutex_unlock (&sim_lock);
+      return LIBUSB_SUCCESS;
+    }
+
+  // the device may have produced packets before this transfer was queued
+  sim_advance (g, sim_now ());
+  struct sim_pending **pp = &g->in_queue;
+  while (*pp)
+    pp = &(*pp)->next;
+  *pp = p;
+  sim_advance (g, sim_now ());
+  pthread_mutex_unlock (&sim_lock);
+  return LIBUSB_SUCCESS;
+}
+
+int libusb_cancel_transfer (struct libusb_transfer *transfer)
+{
+  struct sim_gauge *g = &transfer->dev_handle->dev->g;
+  int ret = LIBUSB_ERROR_NOT_FOUND;
+  pthread_mutex_lock (&sim_lock);
+  struct sim_pending **pp = &g->in_queue;
+  while (*pp)
+    {
+      if ((*pp)->t == transfer)
+        {
+          struct sim_pending *p = *pp;
+          *pp = p->next;
+          sim_complete (p, LIBUSB_TRANSFER_CANCELLED, NULL);
+          ret = LIBUSB_SUCCESS;
+          break;
+        }
+      pp = &(*pp)->next;
+    }
+  pthread_mutex_unlock (&sim_lock);
+  return ret;
+}
+
+// report devices added or removed with sim_set_num_devices, called like libusb from event handling
+static void sim_deliver_hotplug (void)
+{
+  for (;;)
+    {
+      int k = -1;
+      libusb_hotplug_event event = LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED;
+      pthread_mutex_lock (&sim_lock);
+      libusb_hotplug_callback_fn cb = sim_hotplug_cb;
+      if (cb && sim_reported_devices < sim_num_devices)
+        {
+          k = sim_reported_devices++;
+          sim_devices[k].index = k;
+          sim_devices[k].g.index = k;
+        }
+      else if (cb && sim_reported_devices > sim_num_devices)
+        {
+          k = --sim_reported_devices;
+          event = LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT;
+        }
+      pthread_mutex_unlock (&sim_lock);
+      if (k < 0)
+        return;
+      cb (sim_hotplug_ctx, &sim_devices[k], event, sim_hotplug_data);
+    }
+}
+
+int libusb_handle_events_timeout_completed (libusb_context *ctx, struct timeval *tv, int *completed)
+{
+  (void) ctx;
+  sim_deliver_hotplug ();
+  double deadline = sim_now () + tv->tv_sec + tv->tv_usec / 1.0e6;
+  pthread_mutex_lock (&sim_lock);
+  for (;;)
+    {
+      double now = sim_now ();
+      double next = deadline;
+      int k;
+      for (k = 0; k < sim_num_devices; k++)
+        {
+          struct sim_gauge *g = &sim_devices[k].g;
+          if (! g->in_queue)
+            continue;
+          sim_advance (g, now);
+          double t = sim_next_event (g);
+          if (t < next)
+            next = t;
+        }
+
+      if (sim_done)
+        {
+          // detach list first, callbacks may submit new transfers
+          struct sim_pending *p = sim_done;
+          sim_done = NULL;
+          pthread_mutex_unlock (&sim_lock);
+          while (p)
+            {
+              struct sim_pending *n = p->next;
+              struct libusb_transfer *t = p->t;
+              free (p);
+              t->callback (t);
+              p = n;
+            }
+          return LIBUSB_SUCCESS;
+        }
+
+      if ((completed && *completed) || now >= deadline)
+        break;
+
+      // other threads may submit transfers meanwhile, don't oversleep
+      if (next > now + 1e-3)
+        next = now + 1e-3;
+      sim_unlocked_sleep_until (next);
+    }
+  pthread_mutex_unlock (&sim_lock);
+  return LIBUSB_SUCCESS;
+}
+
+int libusb_handle_events_timeout (libusb_context *ctx, struct timeval *tv)
+{
+  return libusb_handle_events_timeout_completed (ctx, tv, NULL);
+}
+
+int libusb_handle_events_completed (libusb_context *ctx, int *completed)
+{
+  struct timeval tv = {60, 0};
+  return libusb_handle_events_timeout_completed (ctx, &tv, completed);
+}
+
+int libusb_handle_events (libusb_context *ctx)
+{
+  return libusb_handle_events_completed (ctx, NULL);
+}
+
+/*
+ * The simulated gauges have no file descriptors. Instead libusb_get_next_timeout
+ * reports the time until the next packet is due, so an event loop which sleeps
+ * in poll() for this timeout wakes up like on fd activity.
+ */
+const struct libusb_pollfd **libusb_get_pollfds (libusb_context *ctx)
+{
+  (void) ctx;
+  return calloc (1, sizeof (struct libusb_pollfd *));
+}
+
+void libusb_free_pollfds (const struct libusb_pollfd **pollfds)
+{
+  free ((void *) pollfds);
+}
+
+int libusb_pollfds_handle_timeouts (libusb_context *ctx)
+{
+  (void) ctx;
+  return 0;
+}
+
+int libusb_get_next_timeout (libusb_context *ctx, struct timeval *tv)
+{
+  (void) ctx;
+  double now = sim_now ();
+  double next = 1e300;
+  int k;
+  pthread_mutex_lock (&sim_lock);
+  for (k = 0; k < sim_num_devices; k++)
+    {
+      struct sim_gauge *g = &sim_devices[k].g;
+      if (! g->in_queue)
+        continue;
+      sim_advance (g, now);
+      double t = sim_next_event (g);
+      if (t < next)
+        next = t;
+    }
+  if (sim_done)
+    next = now;
+  pthread_mutex_unlock (&sim_lock);
+  if (next >= 1e300)
+    return 0;
+
+  double d = (next > now)? next - now : 0;
+  tv->tv_sec = (long) d;
+  tv->tv_usec = (long) ((d - tv->tv_sec) * 1.0e6);
+  return 1;
+}
+
+int libusb_has_capability (uint32_t capability)
+{
+  return capability == LIBUSB_CAP_HAS_CAPABILITY || (capability == LIBUSB_CAP_HAS_HOTPLUG && sim_hotplug);
+}
+
+// devices arrive or leave with sim_set_num_devices, see sim_deliver_hotplug
+int libusb_hotplug_register_callback (libusb_context *ctx, int events, int flags, int vendor_id, int product_id, int dev_class,
+                                      libusb_hotplug_callback_fn cb_fn, void *user_data, libusb_hotplug_callback_handle *callback_handle)
+{
+  (void) product_id;
+  (void) dev_class;
+  if (! sim_hotplug)
+    return LIBUSB_ERROR_NOT_SUPPORTED;
+  if (callback_handle)
+    *callback_handle = 1;
+  if ((flags & LIBUSB_HOTPLUG_ENUMERATE) && (events & LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED)
+      && (vendor_id == LIBUSB_HOTPLUG_MATCH_ANY || vendor_id == 0x04d8))
+    {
+      int k;
+      for (k = 0; k < sim_num_devices; k++)
+        {
+          sim_devices[k].index = k;
+          sim_devices[k].g.index = k;
+          if (cb_fn (ctx, &sim_devices[k], LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED, user_data))
+            break;
+        }
+    }
+  pthread_mutex_lock (&sim_lock);
+  sim_hotplug_cb = cb_fn;
+  sim_hotplug_data = user_data;
+  sim_hotplug_ctx = ctx;
+  sim_reported_devices = sim_num_devices;
+  pthread_mutex_unlock (&sim_lock);
+  return LIBUSB_SUCCESS;
+}
+
+void libusb_hotplug_deregister_callback (libusb_context *ctx, libusb_hotplug_callback_handle callback_handle)
+{
+  (void) ctx;
+  (void) callback_handle;
+  pthread_mutex_lock (&sim_lock);
+  sim_hotplug_cb = NULL;
+  pthread_mutex_unlock (&sim_lock);
+}
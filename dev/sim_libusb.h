@@ -0,0 +1,85 @@
+/*
+
+Copyright (C) 2015-2020 Alluris GmbH & Co. KG <weber@alluris.de>
+
+Software stand-in for Alluris gauges behind the libusb-1.0 API.
+
+This file is part of liballuris.
+
+Liballuris is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Liballuris is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with liballuris. See ../COPYING.LESSER
+If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * sim_libusb.c implements the subset of libusb-1.0 used by liballuris and
+ * answers like a FMI gauge. Link it instead of -lusb-1.0 to benchmark
+ * liballuris without hardware.
+ *
+ * Each simulated gauge
+ * - replies to commands after a configurable round trip time
+ * - generates one sample every 1/900s (1/10s in mode 0), the sample value
+ *   is the running sample index so that gaps are visible to the consumer
+ * - holds at most one sample block in its endpoint buffer, newer blocks
+ *   are dropped as long as the host doesn't fetch the pending one
+ * - starts measuring 250ms after the start command, with firmware
+ *   <= V5.04.010 (default) state queries answer BUSY meanwhile
+ * - ignores all commands while muted, like a gauge with hung firmware
+ * - has a sample clock which deviates by a configurable error in ppm
+ * - stores value 10 * adr at the used addresses of the measurement memory
+ * - takes some time to open, may be claimed by another process
+ *
+ * The libusb functions may be called from several threads, the sim_set_*
+ * functions only before the threads are started.
+ */
+
+#ifndef sim_libusb_h
+#define sim_libusb_h
+
+#include <libusb-1.0/libusb.h>
+
+void sim_set_num_devices (int n);
+void sim_set_rtt (double seconds);
+void sim_set_realtime (int on);
+void sim_set_firmware (int major, int minor, int patch);
+void sim_set_mute (int device, int on);
+void sim_set_clock_error (int device, double ppm);
+void sim_set_mem_count (int n);
+void sim_set_claimed_elsewhere (int device, int on);
+void sim_set_hotplug (int on);
+void sim_set_open_time (double seconds);
+void sim_set_calibration_date (unsigned short date);
+
+double sim_now (void);
+double sim_sample_time (int device, int sample_index);
+unsigned long sim_dropped_blocks (int device);
+unsigned long sim_out_transfers (int device);
+unsigned long sim_opens (int device);
+
+/* samples a bench received in blocks of consecutive sample indices, see sim_account */
+struct sim_result
+{
+  unsigned long blocks;
+  unsigned long samples;
+  unsigned long missing;        // samples skipped between blocks
+  double latency_sum;           // seconds from sampling of the last sample of a block to its reception
+  double latency_max;
+};
+
+void sim_account (struct sim_result *res, int device, const int *buf, size_t len, int *expected);
+void sim_print_result (const char *name, const struct sim_result *res, const char *format, ...)
+__attribute__ ((format (printf, 3, 4)));
+double sim_cpu_time (void);
+
+#endif
@@ -0,0 +1,114 @@
+/*
+
+Copyright (C) 2015-2020 Alluris GmbH & Co. KG <weber@alluris.de>
+
+simd_bench -- throughput of liballuris_decode_int24 with the decoder
+selected for this CPU compared with the scalar loop on a long byte stream
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  See ../COPYING
+If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * Usage: simd_bench [NUM_VALUES [REPEAT]]
+ *
+ * Before timing, every length up to 64 values at every byte offset
+ * is compared with the scalar loop. The check reads from the end of a
+ * malloc'ed buffer so valgrind would catch reads beyond the input.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <liballuris.h>
+#include "sim_libusb.h"
+
+// same as char_to_int24 in liballuris.c
+static void scalar_decode (const unsigned char* in, int* out, size_t length)
+{
+  size_t k;
+  for (k = 0; k < length; k++)
+    {
+      int v = in[k*3] | (in[k*3 + 1] << 8) | (in[k*3 + 2] << 16);
+      out[k] = (v ^ 0x800000) - 0x800000;
+    }
+}
+
+static int check (void)
+{
+  int errors = 0;
+  size_t len, off;
+  for (len = 0; len <= 64; len++)
+    for (off = 0; off < 4; off++)
+      {
+        unsigned char *in = malloc (len * 3 + off + 1);
+        unsigned char *p = in + off + 1;
+        int expected[len + 1], got[len + 1];
+        size_t k;
+        for (k = 0; k < len * 3; k++)
+          p[k] = rand ();
+        got[len] = 0x5a5a5a5a;
+        scalar_decode (p, expected, len);
+        liballuris_decode_int24 (p, got, len);
+        if (memcmp (expected, got, len * sizeof (int)) || got[len] != 0x5a5a5a5a)
+          errors++;
+        free (in);
+      }
+  return errors;
+}
+
+int main (int argc, char **argv)
+{
+  size_t num = (argc > 1)? (size_t) atol (argv[1]) : 4000000;
+  if (num < 1)
+    num = 1;
+  int repeat = (argc > 2)? atoi (argv[2]) : 50;
+
+  int errors = check ();
+
+  unsigned char *in = malloc (num * 3);
+  int *out = malloc (num * sizeof (int));
+  size_t k;
+  for (k = 0; k < num * 3; k++)
+    in[k] = rand ();
+
+  long checksum = 0;
+  int j;
+  double t = sim_cpu_time ();
+  for (j = 0; j < repeat; j++)
+    {
+      scalar_decode (in, out, num);
+      checksum += out[j % num];
+    }
+  double t_scalar = sim_cpu_time () - t;
+
+  t = sim_cpu_time ();
+  for (j = 0; j < repeat; j++)
+    {
+      liballuris_decode_int24 (in, out, num);
+      checksum -= out[j % num];
+    }
+  double t_simd = sim_cpu_time () - t;
+
+  double n = (double) num * repeat;
+  printf ("# %d x %zu values, %i check errors (checksum %ld)\n", repeat, num, errors, checksum);
+  printf ("%-8s %10s %10s\n", "#decoder", "ns/value", "MB/s");
+  printf ("%-8s %10.3f %10.0f\n", "scalar", 1e9 * t_scalar / n, 3e-6 * n / t_scalar);
+  printf ("%-8s %10.3f %10.0f\n", liballuris_decoder_name (), 1e9 * t_simd / n, 3e-6 * n / t_simd);
+
+  free (in);
+  free (out);
+  return (errors || checksum)? EXIT_FAILURE : EXIT_SUCCESS;
+}
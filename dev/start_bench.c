@@ -0,0 +1,124 @@
+/*
+
+Copyright (C) 2015-2020 Alluris GmbH & Co. KG <weber@alluris.de>
+
+start_bench -- sequential start of several gauges with the former fixed
+600ms sleep compared with liballuris_start_measurement which polls the state
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  See ../COPYING
+If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * Usage: start_bench [NUM_GAUGES]
+ *
+ * The simulated gauges measure 250ms after the start command.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <liballuris.h>
+#include "sim_libusb.h"
+
+// start sequence of liballuris up to version 0.4.0
+static int legacy_start_measurement (libusb_device_handle *dev_handle)
+{
+  unsigned char out_buf[3] = {0x1C, 3, 1};
+  unsigned char in_buf[DEFAULT_RECV_BUF_LEN];
+  int actual;
+
+  int ret = libusb_interrupt_transfer (dev_handle, 0x01, out_buf, sizeof (out_buf), &actual, DEFAULT_SEND_TIMEOUT);
+  if (! ret)
+    ret = libusb_interrupt_transfer (dev_handle, 0x81, in_buf, sizeof (in_buf), &actual, DEFAULT_RECEIVE_TIMEOUT);
+  if (ret)
+    return ret;
+
+  usleep (600e3);
+  struct liballuris_state state;
+  ret = liballuris_read_state (dev_handle, &state, 3000);
+  if (! ret && ! state.measuring)
+    ret = LIBALLURIS_TIMEOUT;
+  return ret;
+}
+
+static int run (libusb_context *ctx, int n, int legacy, const char *name)
+{
+  libusb_device_handle *h[n];
+  double latency = 0;
+  int k, r = 0;
+
+  for (k = 0; k < n && ! r; k++)
+    {
+      char id[20];
+      snprintf (id, sizeof (id), "%i,%i", 1 + k / 100, 2 + k % 100);
+      h[k] = NULL;
+      r = liballuris_open_if_not_opened (ctx, id, &h[k]);
+    }
+
+  double t = sim_now ();
+  for (k = 0; k < n && ! r; k++)
+    {
+      double t_start = sim_now ();
+      r = (legacy)? legacy_start_measurement (h[k]) : liballuris_start_measurement (h[k]);
+      latency += sim_now () - t_start;
+    }
+  t = sim_now () - t;
+
+  for (k = 0; k < n; k++)
+    if (h[k])
+      {
+        liballuris_stop_measurement (h[k]);
+        liballuris_close_device (h[k]);
+      }
+
+  if (! r)
+    printf ("%-20s %12.1f %12.1f\n", name, 1e3 * latency / n, 1e3 * t);
+  return r;
+}
+
+int main (int argc, char **argv)
+{
+  int n = (argc > 1)? atoi (argv[1]) : 8;
+
+  libusb_context *ctx;
+  sim_set_num_devices (n);
+  int r = libusb_init (&ctx);
+  if (r)
+    {
+      fprintf (stderr, "Error: %s\n", liballuris_error_name (r));
+      return EXIT_FAILURE;
+    }
+
+  printf ("# sequential start of %i gauges, measuring 250ms after start command\n", n);
+  printf ("%-20s %12s %12s\n", "#method", "ms/gauge", "total_ms");
+
+  sim_set_firmware (5, 4, 10);
+  r = run (ctx, n, 1, "legacy V5.04.010");
+  if (! r)
+    r = run (ctx, n, 0, "polled V5.04.010");
+
+  sim_set_firmware (5, 5, 3);
+  if (! r)
+    r = run (ctx, n, 1, "legacy V5.05.003");
+  if (! r)
+    r = run (ctx, n, 0, "polled V5.05.003");
+
+  if (r)
+    fprintf (stderr, "Error: %s\n", liballuris_error_name (r));
+
+  liballuris_release_registry (ctx);
+  libusb_exit (ctx);
+  return (r)? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,91 @@
+/*
+
+Copyright (C) 2015-2020 Alluris GmbH & Co. KG <weber@alluris.de>
+
+stats_bench -- host CPU time per command with the always-on latency
+histograms compared with timing through debug prints (debug level 1)
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  See ../COPYING
+If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * Usage: stats_bench [NUM_COMMANDS]
+ *
+ * The simulated gauge replies without round trip time, so only the host side
+ * CPU time is measured. The debug output goes to /dev/null.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <liballuris.h>
+#include "sim_libusb.h"
+
+static int run (libusb_device_handle *h, long num, double *t)
+{
+  int v, r = 0;
+  long k;
+  *t = sim_cpu_time ();
+  for (k = 0; k < num && ! r; k++)
+    r = liballuris_get_value (h, &v);
+  *t = sim_cpu_time () - *t;
+  return r;
+}
+
+int main (int argc, char **argv)
+{
+  long num = (argc > 1)? atol (argv[1]) : 200000;
+
+  libusb_context *ctx;
+  libusb_device_handle *h = NULL;
+  sim_set_rtt (0);
+  int r = libusb_init (&ctx);
+  if (! r)
+    r = liballuris_open_if_not_opened (ctx, NULL, &h);
+  if (r)
+    {
+      fprintf (stderr, "Error: %s\n", liballuris_error_name (r));
+      return EXIT_FAILURE;
+    }
+
+  double t_stats, t_debug;
+  r = run (h, num, &t_stats);
+
+  if (! r && freopen ("/dev/null", "w", stderr))
+    {
+      liballuris_set_context_debug_level (ctx, 1);
+      r = run (h, num, &t_debug);
+      liballuris_set_context_debug_level (ctx, -1);
+    }
+
+  struct liballuris_command_stats st;
+  if (! r)
+    r = liballuris_get_command_stats (h, 0x46, &st);
+  if (r)
+    {
+      printf ("Error: %s\n", liballuris_error_name (r));
+      return EXIT_FAILURE;
+    }
+
+  printf ("# %ld x get_value, %lu recorded\n", num, st.replies);
+  printf ("%-16s %10s\n", "#timing", "us/command");
+  printf ("%-16s %10.3f\n", "histograms", 1e6 * t_stats / num);
+  printf ("%-16s %10.3f\n", "+debug prints", 1e6 * t_debug / num);
+
+  liballuris_close_device (h);
+  liballuris_release_registry (ctx);
+  libusb_exit (ctx);
+  return EXIT_SUCCESS;
+}
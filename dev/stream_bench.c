@@ -0,0 +1,138 @@
+/*
+
+Copyright (C) 2015-2020 Alluris GmbH & Co. KG <weber@alluris.de>
+
+stream_bench -- compare liballuris_poll_measurement with the asynchronous
+streaming engine against the software gauge in sim_libusb.c
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  See ../COPYING
+If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * Usage: stream_bench [DURATION_S [BLOCK_LEN [STALL_MS]]]
+ *
+ * Every 100ms the consumer stalls for STALL_MS to emulate a slow sink.
+ * Latency is measured from the completion of a block in the device until
+ * the consumer gets it. Gaps are detected with the running sample index
+ * which the simulated gauge sends as value.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <liballuris.h>
+#include "sim_libusb.h"
+
+static void stall (double *next_stall, double stall_s)
+{
+  if (sim_now () >= *next_stall)
+    {
+      usleep (stall_s * 1e6);
+      *next_stall += 0.1;
+    }
+}
+
+static void print_result (const char *name, const struct sim_result *res)
+{
+  sim_print_result (name, res, " %8lu %10.3f %10.3f", res->blocks,
+                    1e3 * res->latency_sum / (res->blocks? res->blocks : 1), 1e3 * res->latency_max);
+}
+
+static int bench_poll (libusb_device_handle *h, double duration, size_t len, double stall_s)
+{
+  struct sim_result res = {0, 0, 0, 0, 0};
+  int buf[len];
+  int expected = -1;
+
+  int r = liballuris_cyclic_measurement (h, 1, len);
+  double end = sim_now () + duration;
+  double next_stall = sim_now () + 0.1;
+  while (! r && sim_now () < end)
+    {
+      r = liballuris_poll_measurement (h, buf, len);
+      if (! r)
+        sim_account (&res, 0, buf, len, &expected);
+      stall (&next_stall, stall_s);
+    }
+  liballuris_cyclic_measurement (h, 0, len);
+
+  print_result ("poll", &res);
+  return r;
+}
+
+static int bench_stream (libusb_context *ctx, libusb_device_handle *h, double duration, size_t len, double stall_s, int num_transfers)
+{
+  struct sim_result res = {0, 0, 0, 0, 0};
+  struct liballuris_stream *stream;
+  int buf[len];
+  int expected = -1;
+
+  int r = liballuris_stream_open (ctx, h, len, num_transfers, &stream);
+  double end = sim_now () + duration;
+  double next_stall = sim_now () + 0.1;
+  while (! r && sim_now () < end)
+    {
+      r = liballuris_stream_read (stream, buf, len, 3600);
+      if (! r)
+        sim_account (&res, 0, buf, len, &expected);
+      stall (&next_stall, stall_s);
+    }
+  if (! r)
+    r = liballuris_stream_close (stream);
+
+  char name[20];
+  snprintf (name, sizeof (name), "stream x%i", num_transfers);
+  print_result (name, &res);
+  return r;
+}
+
+int main (int argc, char **argv)
+{
+  double duration = (argc > 1)? atof (argv[1]) : 3.0;
+  size_t len = (argc > 2)? (size_t) atoi (argv[2]) : 4;
+  double stall_s = ((argc > 3)? atof (argv[3]) : 20.0) / 1e3;
+
+  libusb_context *ctx;
+  libusb_device_handle *h = NULL;
+  int r = libusb_init (&ctx);
+  if (! r)
+    r = liballuris_open_if_not_opened (ctx, NULL, &h);
+  if (! r)
+    r = liballuris_set_mode (h, LIBALLURIS_MODE_PEAK);
+  if (! r)
+    r = liballuris_start_measurement (h);
+  if (r)
+    {
+      fprintf (stderr, "Error: %s\n", liballuris_error_name (r));
+      return EXIT_FAILURE;
+    }
+
+  printf ("# %.1fs at 900Hz, block length %zu, consumer stalls %.0fms every 100ms\n", duration, len, stall_s * 1e3);
+  printf ("%-12s %8s %8s %8s %10s %10s\n", "#method", "samples", "missing", "blocks", "lat_ms", "max_ms");
+
+  r = bench_poll (h, duration, len, stall_s);
+  if (! r)
+    r = bench_stream (ctx, h, duration, len, stall_s, 1);
+  if (! r)
+    r = bench_stream (ctx, h, duration, len, stall_s, DEFAULT_STREAM_TRANSFERS);
+
+  if (r)
+    fprintf (stderr, "Error: %s\n", liballuris_error_name (r));
+
+  liballuris_close_device (h);
+  liballuris_release_registry (ctx);
+  libusb_exit (ctx);
+  return (r)? EXIT_FAILURE : EXIT_SUCCESS;
+}
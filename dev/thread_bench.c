@@ -0,0 +1,228 @@
+/*
+
+Copyright (C) 2015-2020 Alluris GmbH & Co. KG <weber@alluris.de>
+
+thread_bench -- commands to many gauges from one thread compared with one
+thread per gauge, and commands from several threads on the same handle
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  See ../COPYING
+If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * Usage: thread_bench [NUM_GAUGES [NUM_COMMANDS]]
+ *
+ *
+ * The shared handle test polls samples in one thread while other threads
+ * send commands on the same handle. Without serialization replies and
+ * samples would be mixed up and show as errors or missing samples.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <liballuris.h>
+#include "sim_libusb.h"
+
+#define SHARED_CMD_THREADS 3
+
+struct worker
+{
+  libusb_device_handle *h;
+  int num_commands;
+  enum liballuris_measurement_mode mode;    // expected mode
+  unsigned long errors;
+  volatile int *stop;
+
+  // sample thread only
+  size_t len;
+  unsigned long samples;
+  unsigned long missing;
+};
+
+static void *command_worker (void *arg)
+{
+  struct worker *w = arg;
+  int k;
+  for (k = 0; k < w->num_commands; k++)
+    {
+      enum liballuris_measurement_mode mode;
+      int r = liballuris_get_mode (w->h, &mode);
+      if (r || mode != w->mode)
+        w->errors++;
+      int v;
+      r = liballuris_get_value (w->h, &v);
+      if (r)
+        w->errors++;
+    }
+  return NULL;
+}
+
+static void *sample_worker (void *arg)
+{
+  struct worker *w = arg;
+  int buf[w->len];
+  int expected = -1;
+  while (! *w->stop)
+    {
+      int r = liballuris_poll_measurement (w->h, buf, w->len);
+      if (r)
+        {
+          w->errors++;
+          continue;
+        }
+      if (expected >= 0 && buf[0] != expected)
+        w->missing += buf[0] - expected;
+      expected = buf[w->len - 1] + 1;
+      w->samples += w->len;
+    }
+  return NULL;
+}
+
+static void print_result (const char *name, int threads, unsigned long commands, double t, unsigned long errors)
+{
+  printf ("%-12s %8i %9lu %10.1f %10.0f %7lu\n", name, threads, commands, 1e3 * t, commands / t, errors);
+}
+
+static int bench_control (libusb_device_handle **h, int n, int num_commands)
+{
+  struct worker w[n];
+  pthread_t threads[n];
+  unsigned long errors = 0;
+  int k;
+
+  for (k = 0; k < n; k++)
+    {
+      w[k].h = h[k];
+      w[k].num_commands = num_commands;
+      w[k].mode = LIBALLURIS_MODE_PEAK;
+      w[k].errors = 0;
+    }
+
+  double t = sim_now ();
+  for (k = 0; k < n; k++)
+    command_worker (&w[k]);
+  t = sim_now () - t;
+  for (k = 0; k < n; k++)
+    errors += w[k].errors;
+  print_result ("sequential", 1, 2UL * n * num_commands, t, errors);
+
+  errors = 0;
+  t = sim_now ();
+  for (k = 0; k < n; k++)
+    {
+      w[k].errors = 0;
+      if (pthread_create (&threads[k], NULL, command_worker, &w[k]))
+        return LIBUSB_ERROR_OTHER;
+    }
+  for (k = 0; k < n; k++)
+    {
+      pthread_join (threads[k], NULL);
+      errors += w[k].errors;
+    }
+  t = sim_now () - t;
+  print_result ("per gauge", n, 2UL * n * num_commands, t, errors);
+  return LIBALLURIS_SUCCESS;
+}
+
+static int bench_shared (libusb_device_handle *h, int num_commands, size_t len)
+{
+  struct worker cmd[SHARED_CMD_THREADS];
+  struct worker smp;
+  pthread_t threads[SHARED_CMD_THREADS + 1];
+  volatile int stop = 0;
+  unsigned long errors = 0;
+  int k;
+
+  int r = liballuris_cyclic_measurement (h, 1, len);
+  if (r)
+    return r;
+
+  smp.h = h;
+  smp.len = len;
+  smp.samples = smp.missing = smp.errors = 0;
+  smp.stop = &stop;
+
+  double t = sim_now ();
+  if (pthread_create (&threads[SHARED_CMD_THREADS], NULL, sample_worker, &smp))
+    return LIBUSB_ERROR_OTHER;
+  for (k = 0; k < SHARED_CMD_THREADS; k++)
+    {
+      cmd[k].h = h;
+      cmd[k].num_commands = num_commands;
+      cmd[k].mode = LIBALLURIS_MODE_PEAK;
+      cmd[k].errors = 0;
+      if (pthread_create (&threads[k], NULL, command_worker, &cmd[k]))
+        return LIBUSB_ERROR_OTHER;
+    }
+  for (k = 0; k < SHARED_CMD_THREADS; k++)
+    {
+      pthread_join (threads[k], NULL);
+      errors += cmd[k].errors;
+    }
+  t = sim_now () - t;
+  stop = 1;
+  pthread_join (threads[SHARED_CMD_THREADS], NULL);
+  liballuris_cyclic_measurement (h, 0, len);
+
+  print_result ("shared", SHARED_CMD_THREADS + 1, 2UL * SHARED_CMD_THREADS * num_commands, t, errors + smp.errors);
+  printf ("# shared handle: %lu samples polled meanwhile, %lu missing\n", smp.samples, smp.missing);
+  return LIBALLURIS_SUCCESS;
+}
+
+int main (int argc, char **argv)
+{
+  int n = (argc > 1)? atoi (argv[1]) : 8;
+  int num_commands = (argc > 2)? atoi (argv[2]) : 100;
+  size_t len = 19;
+
+  libusb_context *ctx;
+  libusb_device_handle *h[n];
+  int k;
+  sim_set_num_devices (n);
+  int r = libusb_init (&ctx);
+  for (k = 0; k < n && ! r; k++)
+    {
+      char id[20];
+      snprintf (id, sizeof (id), "%i,%i", 1 + k / 100, 2 + k % 100);
+      h[k] = NULL;
+      r = liballuris_open_if_not_opened (ctx, id, &h[k]);
+      if (! r)
+        r = liballuris_set_mode (h[k], LIBALLURIS_MODE_PEAK);
+      if (! r)
+        r = liballuris_start_measurement (h[k]);
+    }
+  if (r)
+    {
+      fprintf (stderr, "Error: %s\n", liballuris_error_name (r));
+      return EXIT_FAILURE;
+    }
+
+  printf ("# %i gauges, %i x (get_mode, get_value) per thread\n", n, num_commands);
+  printf ("%-12s %8s %9s %10s %10s %7s\n", "#method", "threads", "commands", "time_ms", "cmd/s", "errors");
+
+  r = bench_control (h, n, num_commands);
+  if (! r)
+    r = bench_shared (h[0], num_commands, len);
+
+  if (r)
+    fprintf (stderr, "Error: %s\n", liballuris_error_name (r));
+
+  for (k = 0; k < n; k++)
+    liballuris_close_device (h[k]);
+  liballuris_release_registry (ctx);
+  libusb_exit (ctx);
+  return (r)? EXIT_FAILURE : EXIT_SUCCESS;
+}
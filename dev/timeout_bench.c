@@ -0,0 +1,117 @@
+/*
+
+Copyright (C) 2015-2020 Alluris GmbH & Co. KG <weber@alluris.de>
+
+timeout_bench -- time until commands to a hung gauge fail with fixed
+timeouts, adaptive timeouts and adaptive timeouts with fast-fail
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  See ../COPYING
+If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * Usage: timeout_bench [NUM_COMMANDS]
+ *
+ * NUM_COMMANDS mixed getters are sent to learn the round trip times and
+ * again to count spurious timeouts. Then the gauge is muted and 10 commands
+ * are sent with each policy (only one with fixed timeouts, it takes 4s).
+ * Two of them have no learned timeout yet.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <liballuris.h>
+#include "sim_libusb.h"
+
+// the first 4 types are learned, get_autostop only used with the muted gauge
+static int mixed_command (libusb_device_handle *h, int k, int types)
+{
+  int v;
+  enum liballuris_measurement_mode mode;
+  switch (k % types)
+    {
+    case 0:
+      return liballuris_get_value (h, &v);
+    case 1:
+      return liballuris_get_mode (h, &mode);
+    case 2:
+      return liballuris_get_peak_level (h, &v);
+    case 3:
+      return liballuris_get_digout (h, &v);
+    default:
+      return liballuris_get_autostop (h, &v);
+    }
+}
+
+static void dead_gauge (libusb_device_handle *h, const char *name, int num)
+{
+  int k, failed = 0;
+  sim_set_mute (0, 1);
+  double t = sim_now ();
+  for (k = 0; k < num; k++)
+    if (mixed_command (h, k, 5))
+      failed++;
+  t = sim_now () - t;
+  sim_set_mute (0, 0);
+
+  // the gauge is back, the next command has to succeed
+  liballuris_clear_RX (h, 10);
+  int recovered = ! mixed_command (h, 0, 1);
+  printf ("%-12s %8i %8i %12.1f %10s\n", name, num, failed, 1e3 * t / num, (recovered)? "yes" : "no");
+}
+
+int main (int argc, char **argv)
+{
+  int num = (argc > 1)? atoi (argv[1]) : 400;
+
+  libusb_context *ctx;
+  libusb_device_handle *h = NULL;
+  int r = libusb_init (&ctx);
+  if (! r)
+    r = liballuris_open_if_not_opened (ctx, NULL, &h);
+  if (r)
+    {
+      fprintf (stderr, "Error: %s\n", liballuris_error_name (r));
+      return EXIT_FAILURE;
+    }
+
+  int k, errors = 0;
+  for (k = 0; k < num; k++)
+    if (mixed_command (h, k, 4))
+      errors++;
+
+  liballuris_set_timeout_policy (h, 1, DEFAULT_RECEIVE_TIMEOUT, 0);
+  for (k = 0; k < num; k++)
+    if (mixed_command (h, k, 4))
+      errors++;
+
+  printf ("# %i commands to learn, %i with adaptive timeouts: %i errors\n", num, num, errors);
+  printf ("# learned timeouts: get_value %u ms, get_mode %u ms, get_peak_level %u ms, get_digout %u ms\n",
+          liballuris_get_adaptive_timeout (h, 0x46), liballuris_get_adaptive_timeout (h, 0x05),
+          liballuris_get_adaptive_timeout (h, 0x32), liballuris_get_adaptive_timeout (h, 0x22));
+
+  printf ("%-12s %8s %8s %12s %10s\n", "#policy", "commands", "failed", "ms/command", "recovered");
+  liballuris_set_timeout_policy (h, 0, DEFAULT_RECEIVE_TIMEOUT, 0);
+  dead_gauge (h, "fixed", 1);
+  liballuris_set_timeout_policy (h, 1, DEFAULT_RECEIVE_TIMEOUT, 0);
+  dead_gauge (h, "adaptive", 10);
+  liballuris_set_timeout_policy (h, 1, DEFAULT_RECEIVE_TIMEOUT, 1);
+  dead_gauge (h, "fast-fail", 10);
+
+  liballuris_close_device (h);
+  liballuris_release_registry (ctx);
+  libusb_exit (ctx);
+  return (errors)? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,143 @@
+/*
+
+Copyright (C) 2015-2020 Alluris GmbH & Co. KG <weber@alluris.de>
+
+timestamp_bench -- error of the sample timestamps of
+liballuris_stream_read_timestamped compared with counting samples at the
+nominal rate from the first block, for a gauge with a deviating clock
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  See ../COPYING
+If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * Usage: timestamp_bench [DURATION_S [PPM]]
+ *
+ * The simulated gauge sends the running sample index as value, so the true
+ * completion time of every sample is known. Errors are evaluated over the
+ * second half of each run, after the estimator settled.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <liballuris.h>
+#include "sim_libusb.h"
+
+#define BLOCK_LEN 19
+
+struct error_stats
+{
+  unsigned long n;
+  double sum;
+  double max;
+};
+
+static void account (struct error_stats *e, double err)
+{
+  if (err < 0)
+    err = -err;
+  e->n++;
+  e->sum += err;
+  if (err > e->max)
+    e->max = err;
+}
+
+static int run (libusb_context *ctx, libusb_device_handle *h, int ratio, double duration, double ppm)
+{
+  struct error_stats naive = {0, 0, 0}, fitted = {0, 0, 0};
+  struct liballuris_stream *stream;
+  int buf[BLOCK_LEN];
+  double t[BLOCK_LEN];
+  double nominal = 900.0 / ratio;
+  double t_first = -1;
+  int first = 0;
+
+  int r = liballuris_set_data_ratio (h, ratio);
+  if (! r)
+    r = liballuris_stream_open (ctx, h, BLOCK_LEN, DEFAULT_STREAM_TRANSFERS, &stream);
+  double start = sim_now ();
+  double end = start + duration;
+  while (! r && sim_now () < end)
+    {
+      struct liballuris_block_info info;
+      r = liballuris_stream_read_timestamped (stream, buf, t, &info, BLOCK_LEN, 3600);
+      if (r)
+        break;
+      if (t_first < 0)
+        {
+          t_first = info.arrival;
+          first = buf[BLOCK_LEN - 1];
+        }
+      if (sim_now () < start + duration / 2)
+        continue;
+
+      int k;
+      for (k = 0; k < BLOCK_LEN; k++)
+        {
+          double truth = sim_sample_time (0, buf[k]);
+          account (&naive, t_first + (buf[k] - first) / nominal - truth);
+          account (&fitted, t[k] - truth);
+        }
+    }
+  double rate = liballuris_stream_get_sample_rate (stream);
+  if (! r)
+    r = liballuris_stream_close (stream);
+
+  if (! r)
+    {
+      double true_rate = nominal * (1 + ppm * 1e-6);
+      printf ("%-8i %-10s %10.3f %10.3f %14.1f\n", ratio, "nominal", 1e3 * naive.sum / naive.n, 1e3 * naive.max, 0.0);
+      printf ("%-8i %-10s %10.3f %10.3f %14.1f\n", ratio, "estimated", 1e3 * fitted.sum / fitted.n, 1e3 * fitted.max,
+              1e6 * (rate - true_rate) / true_rate);
+    }
+  return r;
+}
+
+int main (int argc, char **argv)
+{
+  double duration = (argc > 1)? atof (argv[1]) : 10.0;
+  double ppm = (argc > 2)? atof (argv[2]) : 300.0;
+
+  libusb_context *ctx;
+  libusb_device_handle *h = NULL;
+  sim_set_clock_error (0, ppm);
+  int r = libusb_init (&ctx);
+  if (! r)
+    r = liballuris_open_if_not_opened (ctx, NULL, &h);
+  if (! r)
+    r = liballuris_set_mode (h, LIBALLURIS_MODE_PEAK);
+  if (! r)
+    r = liballuris_start_measurement (h);
+  if (r)
+    {
+      fprintf (stderr, "Error: %s\n", liballuris_error_name (r));
+      return EXIT_FAILURE;
+    }
+
+  printf ("# %.1fs per run, gauge clock off by %.0f ppm, block length %i\n", duration, ppm, BLOCK_LEN);
+  printf ("%-8s %-10s %10s %10s %14s\n", "#ratio", "timestamps", "mean_ms", "max_ms", "rate_err_ppm");
+
+  r = run (ctx, h, 1, duration, ppm);
+  if (! r)
+    r = run (ctx, h, 3, duration, ppm);
+
+  if (r)
+    fprintf (stderr, "Error: %s\n", liballuris_error_name (r));
+
+  liballuris_close_device (h);
+  liballuris_release_registry (ctx);
+  libusb_exit (ctx);
+  return (r)? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,72 @@
+/*
+
+Copyright (C) 2015-2020 Alluris GmbH & Co. KG <weber@alluris.de>
+
+capture_dump -- print the header and values of a capture file
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  See ../COPYING
+If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <stdio.h>
+#include <time.h>
+#include "liballuris.h"
+
+/*
+ * Usage: capture_dump FILE [FIRST [NUM]]
+ *
+ * Capture files are written by "gadc --capture=FILE -s NUM" or "fstream -f FILE".
+ * The file is mapped, so printing a few values from the end of a long
+ * capture doesn't read the values before them.
+ */
+
+int main (int argc, char** argv)
+{
+  if (argc < 2 || argc > 4)
+    {
+      fprintf (stderr, "Usage: %s FILE [FIRST [NUM]]\n", argv[0]);
+      return EXIT_FAILURE;
+    }
+
+  struct liballuris_capture* cap;
+  int r = liballuris_capture_open (argv[1], &cap);
+  if (r)
+    return EXIT_FAILURE;
+
+  const struct liballuris_capture_header* h = liballuris_capture_get_header (cap);
+  size_t count;
+  const int32_t* values = liballuris_capture_get_records (cap, &count);
+
+  time_t t = h->start_time_ns / 1000000000;
+  char start[40];
+  strftime (start, sizeof (start), "%Y-%m-%d %H:%M:%S UTC", gmtime (&t));
+
+  printf ("# serial     %s\n", h->serial);
+  printf ("# start      %s\n", start);
+  printf ("# digits     %i\n", h->digits);
+  printf ("# unit       %s\n", (h->unit >= 0)? liballuris_unit_enum2str (h->unit) : "unknown");
+  printf ("# mode       %i\n", h->mode);
+  printf ("# data ratio %i\n", h->data_ratio);
+  printf ("# values     %zu\n", count);
+
+  size_t first = (argc > 2)? (size_t) atol (argv[2]) : 0;
+  size_t num = (argc > 3)? (size_t) atol (argv[3]) : count;
+  size_t k;
+  for (k = first; k < count && k - first < num; k++)
+    printf ("%i\n", values[k]);
+
+  liballuris_capture_close (cap);
+  return EXIT_SUCCESS;
+}
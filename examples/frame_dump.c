@@ -0,0 +1,110 @@
+/*
+
+Copyright (C) 2015-2020 Alluris GmbH & Co. KG <weber@alluris.de>
+
+frame_dump -- print the values of a framed stream
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  See ../COPYING
+If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <stdio.h>
+#include "liballuris.h"
+
+/*
+ * Usage: frame_dump [-d] [FILE]
+ *
+ * Framed streams are written by "gadc --framed -s NUM" or "fstream -p",
+ * compressed ones by "gadc --compress -s NUM" or "fstream -z".
+ * FILE defaults to stdin, for example
+ *   nc -q0 localhost 9000 -c "./fstream -p" | ./frame_dump
+ * Corrupted or lost bytes and frames are reported on stderr and the
+ * values of the following intact frames are printed. With -d every
+ * value is prefixed with the device of its frame.
+ */
+
+int main (int argc, char** argv)
+{
+  char with_device = (argc > 1 && ! strcmp (argv[1], "-d"));
+  int arg = 1 + with_device;
+  if (argc > arg + 1)
+    {
+      fprintf (stderr, "Usage: %s [-d] [FILE]\n", argv[0]);
+      return EXIT_FAILURE;
+    }
+
+  FILE* in = (argc > arg)? fopen (argv[arg], "rb") : stdin;
+  if (! in)
+    {
+      perror (argv[arg]);
+      return EXIT_FAILURE;
+    }
+
+  // holds the largest frame, so a bogus header can't stall the search
+  static unsigned char buf[2 * (LIBALLURIS_FRAME_HEADER_SIZE + 3 * LIBALLURIS_FRAME_MAX_SAMPLES
+                                + LIBALLURIS_FRAME_TRAILER_SIZE)];
+  int values[LIBALLURIS_FRAME_MAX_SAMPLES];
+  long long next_sequence[256];
+  unsigned long frames = 0, lost = 0, skipped = 0;
+  size_t fill = 0, n;
+  memset (next_sequence, -1, sizeof (next_sequence));
+
+  while ((n = fread (buf + fill, 1, sizeof (buf) - fill, in)) > 0)
+    {
+      fill += n;
+      size_t pos = 0, consumed;
+      struct liballuris_frame_info info;
+      while (liballuris_frame_decode (buf + pos, fill - pos, &info, values,
+                                      LIBALLURIS_FRAME_MAX_SAMPLES, &consumed) == LIBALLURIS_SUCCESS)
+        {
+          if (info.skipped)
+            fprintf (stderr, "Warning: skipped %zu corrupted byte(s) before frame %u\n", info.skipped, info.sequence);
+          skipped += info.skipped;
+
+          long long* next = next_sequence + info.device;
+          if (*next >= 0 && info.sequence != (uint32_t) *next)
+            {
+              uint32_t gap = info.sequence - (uint32_t) *next;
+              fprintf (stderr, "Warning: %u frame(s) of device %u lost before frame %u\n",
+                       gap, info.device, info.sequence);
+              lost += gap;
+            }
+          *next = (uint32_t) (info.sequence + 1);
+          frames++;
+
+          int k;
+          for (k = 0; k < info.count; k++)
+            if (with_device)
+              printf ("%u %i\n", info.device, values[k]);
+            else
+              printf ("%i\n", values[k]);
+          pos += consumed;
+        }
+      // bytes which can't start a frame anymore
+      pos += consumed;
+      skipped += consumed;
+
+      memmove (buf, buf + pos, fill - pos);
+      fill -= pos;
+    }
+
+  if (fill)
+    fprintf (stderr, "Warning: %zu byte(s) of an incomplete frame at the end\n", fill);
+  fprintf (stderr, "# %lu frame(s), %lu lost, %lu byte(s) skipped\n", frames, lost, skipped);
+
+  if (in != stdin)
+    fclose (in);
+  return EXIT_SUCCESS;
+}
@@ -4,7 +4,8 @@ Copyright (C) 2015 Alluris GmbH & Co. KG <weber@alluris.de>
 
 fstream -- f(ast)stream(ing)
 
-Capture values in peak mode with 900Hz and output it as ASCII or binary int32
+Capture values in peak mode with 900Hz and output it as ASCII, binary int32
+or frames of packed int24 or compressed values
 
 This program is free software: you can redistribute it and/or modify
 it under the terms of the GNU General Public License as published by
@@ -30,6 +31,15 @@ If not, see <http://www.gnu.org/licenses/>.
  * Save the output to a file or pipe it to some program to evaluate it.
  * Use nc -q0 localhost 9000 -c "./fstream -b" to send it via TCP
  *
+ * "./fstream -p" writes frames of DEFAULT_FRAME_SAMPLES packed 24bit values
+ * with sequence number and checksum instead, see liballuris_frame_encode.
+ * It needs 20% less bandwidth than -b and a receiver can resynchronise after
+ * lost bytes, see frame_dump.c. "./fstream -z" writes lossless compressed
+ * frames, see liballuris_frame_writer_new
+ *
+ * "./fstream -f FILE" writes a capture file instead which also records
+ * digits, unit, mode, serial and start time, see capture_dump.c
+ *
  * For an example using GNU Octave see fstream_serv.m
  *
  * For an example using GNU Radio Companion see fstream_recv.grc
@@ -38,6 +48,9 @@ If not, see <http://www.gnu.org/licenses/>.
 int main(int argc, char** argv)
 {
   char bin = (argc == 2 && !strcmp (argv [1], "-b"));
+  char framed = (argc == 2 && !strcmp (argv [1], "-p"));
+  char compressed = (argc == 2 && !strcmp (argv [1], "-z"));
+  const char* capture_path = (argc == 3 && !strcmp (argv [1], "-f"))? argv[2] : NULL;
 
   libusb_context* ctx;
   libusb_device_handle* h;
@@ -76,22 +89,63 @@ int main(int argc, char** argv)
   // FIXME: check if measurement is running before
   // enabling data stream. Abort if device is idle
 
-  // enable streaming
-  liballuris_cyclic_measurement (h, 1, block_size);
+  struct liballuris_capture* cap = NULL;
+  if (capture_path)
+    {
+      struct liballuris_capture_header info;
+      r = liballuris_capture_describe (h, &info);
+      if (! r)
+        r = liballuris_capture_create (capture_path, &info, &cap);
+      if (r)
+        {
+          fprintf (stderr, "Couldn't create capture file: %s\n", liballuris_error_name (r));
+          return EXIT_FAILURE;
+        }
+    }
+
+  struct liballuris_frame_writer* frames = NULL;
+  if (framed || compressed)
+    {
+      r = liballuris_frame_writer_new (stdout, (compressed)? LIBALLURIS_FRAME_DELTA : LIBALLURIS_FRAME_INT24,
+                                       0, DEFAULT_FRAME_SAMPLES, &frames);
+      if (r)
+        {
+          fprintf (stderr, "Couldn't create frame writer: %s\n", liballuris_error_name (r));
+          return EXIT_FAILURE;
+        }
+    }
+
+  // enable streaming, a background thread reads the device so
+  // a slow pipe or disk doesn't delay it
+  struct liballuris_reader* reader;
+  r = liballuris_reader_start (ctx, h, block_size, DEFAULT_READER_CAPACITY, &reader);
+  if (r)
+    {
+      fprintf (stderr, "Couldn't start reader: %s\n", liballuris_error_name (r));
+      return EXIT_FAILURE;
+    }
 
-  int k;
+  size_t k;
   do
     {
-      int r = liballuris_poll_measurement (h, tempx, block_size);
+      size_t actual;
+      r = liballuris_reader_read (reader, tempx, block_size, &actual, 100);
       if (r == LIBUSB_SUCCESS)
         {
-          if (bin)
-            fwrite (tempx, 4, block_size, stdout);
+          if (cap)
+            liballuris_capture_append (cap, tempx, actual);
+          else if (frames)
+            liballuris_frame_writer_write (frames, tempx, actual);
+          else if (bin)
+            fwrite (tempx, 4, actual, stdout);
           else
-            for (k=0; k < block_size; ++k)
+            for (k=0; k < actual; ++k)
               printf ("%i\n", tempx[k]);
-          fflush (stdout);
+          if (! cap)
+            fflush (stdout);
         }
+      else if (r != LIBUSB_ERROR_TIMEOUT)
+        break;
 
       tret = poll (&fds, 1, 0);
       reply = 0;
@@ -100,13 +154,23 @@ int main(int argc, char** argv)
     }
   while (reply != 'c');
 
+  if (liballuris_reader_get_overflows (reader))
+    fprintf (stderr, "Warning: %lu value(s) dropped\n", liballuris_reader_get_overflows (reader));
+
+  if (frames)
+    {
+      liballuris_frame_writer_free (frames);
+      fflush (stdout);
+    }
+
   // disable streaming
-  liballuris_cyclic_measurement (h, 0, block_size);
+  liballuris_reader_stop (reader);
+  if (cap)
+    liballuris_capture_close (cap);
 
   // empty read remaining data
   liballuris_clear_RX (h, 500);
 
-  libusb_release_interface (h, 0);
-  libusb_close (h);
+  liballuris_close_device (h);
   return EXIT_SUCCESS;
 }
@@ -8,6 +8,7 @@
 #include <signal.h>
 #include <errno.h>
 #include <assert.h>
+#include <math.h>
 #include <liballuris.h>
 
 static char do_exit = 0;
@@ -19,22 +20,25 @@ void termination_handler (int signum)
   do_exit = 1;
 }
 
-int all (char* p, int len)
+// round v * scale to the nearest integer
+static int to_fixed (double v, double scale)
 {
-  int k;
-  for (k=0; k<len; ++k)
-    if (!p[k])
-      return 0;
-
-  return 1;
+  v *= scale;
+  return (int) ((v < 0)? v - 0.5 : v + 0.5);
 }
 
 int
 main (int argc, char **argv)
 {
   liballuris_debug_level = 0;
-  (void) argc;
-  (void) argv;
+
+  // output format of the rows: raw, csv, tsv or binary
+  enum liballuris_output_format format = (argc > 1)? liballuris_output_str2enum (argv[1]) : LIBALLURIS_OUTPUT_RAW;
+  if (argc > 2 || (int) format == -1)
+    {
+      fprintf (stderr, "Usage: %s [raw|csv|tsv|binary]\n", argv[0]);
+      return EXIT_FAILURE;
+    }
 
   if (signal (SIGINT, termination_handler) == SIG_IGN)
     signal (SIGINT, SIG_IGN);
@@ -56,9 +60,15 @@ main (int argc, char **argv)
     }
 
   // Check available devices
-#define MULTI_MAX_NUM_DEVICES 8
-  struct alluris_device_description alluris_devs[MULTI_MAX_NUM_DEVICES];
-  ssize_t cnt = liballuris_get_device_list (ctx, alluris_devs, MULTI_MAX_NUM_DEVICES, 1);
+  struct alluris_device_description* alluris_devs;
+  ssize_t cnt = liballuris_get_device_array (ctx, &alluris_devs, 1);
+  if (cnt < 0)
+    {
+      fprintf (stderr, "Error: Couldn't list devices: %s\n", liballuris_error_name (cnt));
+      liballuris_release_registry (ctx);
+      libusb_exit (ctx);
+      return EXIT_FAILURE;
+    }
 
 
   // print header with bus and device address
@@ -112,8 +122,11 @@ main (int argc, char **argv)
   fflush (stream_bus_device_adress_buffer);
   fflush (stream_serial_buffer);
 
-  printf ("# %s %zu\n", bus_device_adress_buffer, size_bus_device_adress_buffer);
-  printf ("# %s %zu\n", serial_buffer, size_serial_buffer);
+  if (format != LIBALLURIS_OUTPUT_BINARY)
+    {
+      printf ("# %s %zu\n", bus_device_adress_buffer, size_bus_device_adress_buffer);
+      printf ("# %s %zu\n", serial_buffer, size_serial_buffer);
+    }
 
   fclose (stream_bus_device_adress_buffer);
   free (bus_device_adress_buffer);
@@ -151,97 +164,129 @@ main (int argc, char **argv)
   //if (do_sleep)
   //  usleep (3e6);
 
-  // recheck that measurment is running, start streaming
+  // recheck that measurment is running
   size_t block_size = 19;
-  for (k=0; k < cnt; k++)
+  for (k=0; k < cnt && ! do_exit; k++)
     {
       struct liballuris_state state;
       r = liballuris_read_state (handles[k], &state, 3000);
 
-      if (r == LIBUSB_SUCCESS)
+      if (r == LIBUSB_SUCCESS && ! state.measuring)
         {
-          if (state.measuring)
-            {
-              // enable streaming
-              r = liballuris_cyclic_measurement (handles[k], 1, block_size);
-              if (r)
-                {
-                  fprintf (stderr, "Error: Couldn't start streaming on device %i : %s\n", k, liballuris_error_name (r));
-                  do_exit = 1;
-                }
-            }
-          else
-            {
-              fprintf (stderr, "Error: Device %i is still not running...\n", k);
-              do_exit = 1;
-            }
+          fprintf (stderr, "Error: Device %i is still not running...\n", k);
+          do_exit = 1;
+        }
+    }
+
+  // stream from all devices, the engine thread sleeps until a block arrives
+  struct liballuris_group* group = NULL;
+  if (! do_exit)
+    {
+      r = liballuris_group_start (ctx, handles, cnt, block_size, DEFAULT_GROUP_CAPACITY, &group);
+      if (r)
+        {
+          fprintf (stderr, "Error: Couldn't start streaming: %s\n", liballuris_error_name (r));
+          do_exit = 1;
         }
     }
 
-  //poll all devices
   int num = 2500000;
   int row_cnt = 0;
+  double rows [block_size * cnt];
+  double t [block_size];
+  double t0 = 0;
+
+  // time in 0.1ms and the values with one decimal place as fixed-point numbers
+  int out [block_size * (cnt + 1)];
+  int digits [cnt + 1];
+  struct liballuris_formatter* fmt = NULL;
+  digits[0] = 4;
+  for (k = 0; k < cnt; k++)
+    digits[k + 1] = 1;
+  if (! do_exit)
+    {
+      r = liballuris_formatter_new (stdout, format, cnt + 1, digits, &fmt);
+      if (r)
+        {
+          fprintf (stderr, "Error: Couldn't create formatter: %s\n", liballuris_error_name (r));
+          do_exit = 1;
+        }
+    }
 
-  int tempx [cnt][block_size];
-  char dvalid [cnt];
-
-  do
+  // the device clocks drift apart, so resample all channels at common host times
+  while (row_cnt < num && !do_exit)
     {
-      memset (dvalid, 0, cnt);
+      size_t actual;
+      r = liballuris_group_read_resampled (group, rows, t, block_size, &actual, 1000);
+      if (r == LIBUSB_ERROR_TIMEOUT)
+        continue;
+      if (r)
+        {
+          fprintf (stderr, "Error: Couldn't read rows: %s\n", liballuris_error_name (r));
+          break;
+        }
+      if (! row_cnt)
+        t0 = t[0];
 
-      do
+      // display
+      for (size_t i = 0; i < actual; ++i)
         {
-          for (k=0; k < cnt; k++)
+          int* o = out + i * (cnt + 1);
+          o[0] = to_fixed (t[i] - t0, 1e4);
+          for (k = 0; k < cnt; k++)
             {
-              size_t act;
-              r = liballuris_poll_measurement_no_wait (handles[k], tempx[k], block_size, &act);
-              //printf ("k=%i act=%i\n", k, act);
-              if (act == block_size)
-                dvalid[k] = 1;
-
-              //printf (" %i", dvalid[k]);
+              double v = rows[i * cnt + k];
+              o[k + 1] = (isnan (v))? LIBALLURIS_GROUP_MISSING : to_fixed (v, 10);
             }
-          //printf ("\n");
         }
-      while (!all (dvalid, cnt) && !do_exit);
+      r = liballuris_formatter_write (fmt, out, actual * (cnt + 1));
+      if (! r)
+        r = liballuris_formatter_flush (fmt);
+      fflush (stdout);
+      if (r)
+        break;
+      row_cnt += actual;
+    }
 
-      // display
-      if (! do_exit)
-        {
-          for (size_t i = 0; i < block_size; ++i)
-            for (k = 0; k < cnt; k++)
-              printf ("%8i%c", tempx[k][i], (k < (cnt - 1))? ' ':'\n');
+  if (fmt)
+    liballuris_formatter_free (fmt);
 
-          row_cnt += block_size;
+  if (group)
+    {
+      struct liballuris_group_stats stats;
+      liballuris_group_get_stats (group, &stats);
+      fprintf (stderr, "# %llu rows in %.1fs, engine thread %.1f%% CPU, %llu rows dropped\n",
+               stats.rows, stats.elapsed, 100 * stats.cpu_time / stats.elapsed, stats.dropped_rows);
+      for (k=0; k < cnt; k++)
+        {
+          struct liballuris_group_device_stats ds;
+          liballuris_group_get_device_stats (group, k, &ds);
+          fprintf (stderr, "# device %i: %llu missing, lag %.2fms, max lag %.2fms\n",
+                   k, ds.missing, 1e3 * ds.lag, 1e3 * ds.max_lag);
         }
 
+      // disables streaming
+      r = liballuris_group_stop (group);
+      if (r)
+        fprintf (stderr, "Error: Couldn't stop streaming: %s\n", liballuris_error_name (r));
     }
-  while (row_cnt < num && !do_exit);
 
-  // stop all devices
+  // close all devices
   for (k=0; k < cnt; k++)
     {
-      // disable streaming
-      r = liballuris_cyclic_measurement (handles[k], 0, 19);
-      if (r)
-        fprintf (stderr, "Error: Couldn't disable streaming: %s\n", liballuris_error_name (r));
-
       liballuris_clear_RX (handles[k], 100);
 
       //r = liballuris_stop_measurement (handles[k]);
       //if (r)
       //  fprintf (stderr, "Error: Couldn't stop device: %s\n", liballuris_error_name (r));
 
-      //printf ("libusb_release_interface\n");
-      libusb_release_interface (handles[k], 0);
-
-      //printf ("libusb_close\n");
-      libusb_close (handles[k]);
+      liballuris_close_device (handles[k]);
     }
 
   // free device list
-  liballuris_free_device_list (alluris_devs, MULTI_MAX_NUM_DEVICES);
+  liballuris_free_device_array (alluris_devs);
 
+  liballuris_release_registry (ctx);
   libusb_exit (ctx);
   return r;
 }
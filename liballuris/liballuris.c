@@ -25,10 +25,22 @@ If not, see <http://www.gnu.org/licenses/>.
  * \brief Implementation of generic Alluris device driver
 */
 
+#include <time.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 #include "liballuris.h"
 
 int liballuris_debug_level;
 
+static int handle_debug_level (libusb_device_handle* dev_handle);
+
 // minimum length of "in" is 2 bytes
 static unsigned short char_to_uint16 (unsigned char* in)
 {
@@ -38,20 +50,131 @@ static unsigned short char_to_uint16 (unsigned char* in)
 }
 
 // minimum length of "in" is 3 bytes
-static int char_to_uint24 (unsigned char* in)
+static inline int char_to_int24 (const unsigned char* in)
 {
-  int ret = 0;
-  memcpy (&ret, in, 3);
-  return ret;
+  // assemble little-endian uint24 and sign extend without branch
+  int ret = in[0] | (in[1] << 8) | (in[2] << 16);
+  return (ret ^ 0x800000) - 0x800000;
 }
 
-// minimum length of "in" is 3 bytes
-static int char_to_int24 (unsigned char* in)
+// decode length packed int24 values one at a time, fallback for all CPUs
+static void decode_int24_scalar (const unsigned char* in, int* out, size_t length)
 {
-  int ret = char_to_uint24 (in);
-  if (ret > 8388607)     // 2**23-1
-    ret = ret- 16777216; // 2**24
-  return ret;
+  size_t k;
+  for (k=0; k < length; k++)
+    out[k] = char_to_int24 (in + k*3);
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define HAVE_SIMD_DECODER 1
+
+/*
+ * Move the 3 bytes of each value into the upper 3 bytes of a 32bit lane,
+ * the arithmetic shift right by 8 then sign extends.
+ */
+#define INT24_SHUFFLE_MASK \
+  -1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11
+
+// 4 values per 16 byte load, the loads may not read beyond in + length*3
+__attribute__ ((target ("ssse3")))
+static void decode_int24_ssse3 (const unsigned char* in, int* out, size_t length)
+{
+  const __m128i mask = _mm_setr_epi8 (INT24_SHUFFLE_MASK);
+  size_t k = 0;
+  for (; k + 6 <= length; k += 4)
+    {
+      __m128i v = _mm_loadu_si128 ((const __m128i*) (in + k*3));
+      v = _mm_srai_epi32 (_mm_shuffle_epi8 (v, mask), 8);
+      _mm_storeu_si128 ((__m128i*) (out + k), v);
+    }
+  decode_int24_scalar (in + k*3, out + k, length - k);
+}
+
+/*
+ * 8 values per two 16 byte loads. The tail must not be passed to
+ * decode_int24_ssse3: its legacy SSE encoding after dirty upper AVX state
+ * costs more than the whole block.
+ */
+__attribute__ ((target ("avx2")))
+static void decode_int24_avx2 (const unsigned char* in, int* out, size_t length)
+{
+  const __m256i mask = _mm256_setr_epi8 (INT24_SHUFFLE_MASK, INT24_SHUFFLE_MASK);
+  size_t k = 0;
+  for (; k + 10 <= length; k += 8)
+    {
+      __m128i lo = _mm_loadu_si128 ((const __m128i*) (in + k*3));
+      __m128i hi = _mm_loadu_si128 ((const __m128i*) (in + k*3 + 12));
+      __m256i v = _mm256_inserti128_si256 (_mm256_castsi128_si256 (lo), hi, 1);
+      v = _mm256_srai_epi32 (_mm256_shuffle_epi8 (v, mask), 8);
+      _mm256_storeu_si256 ((__m256i*) (out + k), v);
+    }
+  if (k + 6 <= length)
+    {
+      __m128i v = _mm_loadu_si128 ((const __m128i*) (in + k*3));
+      v = _mm_srai_epi32 (_mm_shuffle_epi8 (v, _mm256_castsi256_si128 (mask)), 8);
+      _mm_storeu_si128 ((__m128i*) (out + k), v);
+      k += 4;
+    }
+  _mm256_zeroupper ();
+  decode_int24_scalar (in + k*3, out + k, length - k);
+}
+#endif
+
+//! Internal decoder selected by CPU dispatch, see select_decoder
+static void (*decode_int24_impl) (const unsigned char* in, int* out, size_t length) = decode_int24_scalar;
+static const char* decode_int24_name = "scalar";
+static pthread_once_t decoder_once = PTHREAD_ONCE_INIT;
+
+//! Internal function to select the fastest decoder the CPU supports
+static void select_decoder (void)
+{
+#ifdef HAVE_SIMD_DECODER
+  __builtin_cpu_init ();
+  if (__builtin_cpu_supports ("avx2"))
+    {
+      decode_int24_impl = decode_int24_avx2;
+      decode_int24_name = "avx2";
+    }
+  else if (__builtin_cpu_supports ("ssse3"))
+    {
+      decode_int24_impl = decode_int24_ssse3;
+      decode_int24_name = "ssse3";
+    }
+#endif
+}
+
+// decode length packed int24 values from "in" directly into "out"
+static void decode_int24_block (const unsigned char* in, int* out, size_t length)
+{
+  pthread_once (&decoder_once, select_decoder);
+  decode_int24_impl (in, out, length);
+}
+
+/*!
+ * \brief Decode packed 24bit signed little-endian values to int
+ *
+ * This is the format of the values in sample blocks, for example of raw captures.
+ * Uses SSSE3 or AVX2 if the CPU supports it, see \ref liballuris_decoder_name.
+ *
+ * \param[in] in length * 3 bytes
+ * \param[out] out output location for length values
+ * \param[in] length number of values
+ */
+void liballuris_decode_int24 (const unsigned char* in, int* out, size_t length)
+{
+  decode_int24_block (in, out, length);
+}
+
+/*!
+ * \brief Name of the decoder used by \ref liballuris_decode_int24
+ *
+ * \return "avx2", "ssse3" or "scalar"
+ */
+const char* liballuris_decoder_name (void)
+{
+  pthread_once (&decoder_once, select_decoder);
+  return decode_int24_name;
 }
 
 /*!
@@ -157,1070 +280,6365 @@ static void print_buffer (unsigned char* buf, int len)
   fprintf (stderr, "\n");
 }
 
-//! Internal send and receive wrapper around libusb_interrupt_transfer
-static int liballuris_interrupt_transfer (libusb_device_handle* dev_handle,
-    const char* funcname,
-    unsigned char *out_buf,
-    int send_len,
-    unsigned int send_timeout,
-    unsigned char *in_buf,
-    int reply_len,
-    unsigned int receive_timeout)
+//! Internal send wrapper around libusb_interrupt_transfer
+static int liballuris_send (libusb_device_handle* dev_handle,
+                            const char* funcname,
+                            unsigned char *out_buf,
+                            int send_len,
+                            unsigned int send_timeout)
 {
   int actual;
-  int r = 0;
-  struct timeval t1, t2;
 
-  if (reply_len > DEFAULT_RECV_BUF_LEN)
+  // check length in out_buf
+  assert (out_buf[1] == send_len);
+
+  int r = libusb_interrupt_transfer (dev_handle, (0x1 | LIBUSB_ENDPOINT_OUT), out_buf, send_len, &actual, send_timeout);
+
+  if (r == LIBUSB_SUCCESS && handle_debug_level (dev_handle) > 1)
     {
-      fprintf (stderr, "Error: Reply len %i > receive buffer len %i. This looks like a programming error.\n", reply_len, DEFAULT_RECV_BUF_LEN);
-      exit (-1);
+      fprintf (stderr, "DEBUG-INFO: %s sent %2i/%2i bytes: ", funcname, actual, send_len);
+      print_buffer (out_buf, actual);
     }
 
-  if (send_len > 0)
+  if (r != LIBUSB_SUCCESS || actual != send_len)
     {
-      // check length in out_buf
-      assert (out_buf[1] == send_len);
-
-      if (liballuris_debug_level)
-        gettimeofday (&t1, NULL);
-
-      r = libusb_interrupt_transfer (dev_handle, (0x1 | LIBUSB_ENDPOINT_OUT), out_buf, send_len, &actual, send_timeout);
-
-      if (liballuris_debug_level)
-        {
-          gettimeofday (&t2, NULL);
-          double diff = (t2.tv_sec - t1.tv_sec) + (t2.tv_usec - t1.tv_usec)/1.0e6;
-          fprintf (stderr, "DEBUG-INFO: %s send  took %f s\n", funcname, diff);
-        }
+      fprintf(stderr, "Write error in '%s': '%s', wrote %i of %i bytes.\n", funcname, libusb_error_name(r), actual, send_len);
+      return r;
+    }
+  return r;
+}
 
-      if (liballuris_debug_level > 1 && r == LIBUSB_SUCCESS)
-        {
-          fprintf (stderr, "DEBUG-INFO: %s sent %2i/%2i bytes: ", funcname, actual, send_len);
-          print_buffer (out_buf, actual);
-        }
+/*!
+ * \brief Internal receive wrapper around libusb_interrupt_transfer
+ *
+ * Receives one packet directly into buf which has to hold \ref DEFAULT_RECV_BUF_LEN bytes.
+ * Callers decode from buf without further copies.
+ */
+static int liballuris_receive (libusb_device_handle* dev_handle,
+                               const char* funcname,
+                               unsigned char *buf,
+                               int *actual,
+                               unsigned int receive_timeout)
+{
+  int r = libusb_interrupt_transfer (dev_handle, 0x81 | LIBUSB_ENDPOINT_IN, buf, DEFAULT_RECV_BUF_LEN, actual, receive_timeout);
 
-      if (r != LIBUSB_SUCCESS || actual != send_len)
-        {
-          fprintf(stderr, "Write error in '%s': '%s', wrote %i of %i bytes.\n", funcname, libusb_error_name(r), actual, send_len);
-          return r;
-        }
+  if (r == LIBUSB_SUCCESS && handle_debug_level (dev_handle) > 1)
+    {
+      fprintf (stderr, "DEBUG-INFO: %s recv %2i/%2i bytes: ", funcname, *actual, DEFAULT_RECV_BUF_LEN);
+      print_buffer (buf, *actual);
     }
 
-  if (reply_len > 0)
+  if (r != LIBUSB_SUCCESS)
     {
-      unsigned char tmp_in_buf[DEFAULT_RECV_BUF_LEN];
-      // ID_SAMPLE bis zu 3 mal ignorieren, falls ein anderes Kommando gesendet wurde
-      int sample_ignore_cnt = 3;
-      do
-        {
-          //~ if (sample_ignore_cnt < 3)
-            //~ printf ("retry...\n");
-          if (liballuris_debug_level)
-            gettimeofday (&t1, NULL);
-
-          r = libusb_interrupt_transfer (dev_handle, 0x81 | LIBUSB_ENDPOINT_IN, tmp_in_buf, DEFAULT_RECV_BUF_LEN, &actual, receive_timeout);
-
-          if (liballuris_debug_level)
-            {
-              gettimeofday (&t2, NULL);
-              double diff = (t2.tv_sec - t1.tv_sec) + (t2.tv_usec - t1.tv_usec)/1.0e6;
-              fprintf (stderr, "DEBUG-INFO: %s reply took %f s\n", funcname, diff);
-            }
-
-          if (liballuris_debug_level > 1 && r == LIBUSB_SUCCESS)
-            {
-              fprintf (stderr, "DEBUG-INFO: %s recv %2i/%2i bytes: ", funcname, actual, DEFAULT_RECV_BUF_LEN);
-              print_buffer (in_buf, actual);
-            }
-
-          if (r != LIBUSB_SUCCESS)
-            {
-              if (r == LIBUSB_ERROR_OVERFLOW)
-                {
-                  if (liballuris_debug_level)
-                    fprintf (stderr, "DEBUG-INFO: LIBUSB_ERROR_OVERFLOW in '%s': expected max. %i bytes but got more.\n", funcname, DEFAULT_RECV_BUF_LEN);
-
-                  // Attention! You can't rely that data was written in in_buf
-                  // See: http://libusb.sourceforge.net/api-1.0/libusb_packetoverflow.html
-                }
-              else
-                fprintf(stderr, "Read error in '%s': '%s', tried to read %i, got %i bytes.\n", funcname, libusb_error_name(r), DEFAULT_RECV_BUF_LEN, actual);
-
-              return r;
-            }
-        }
-      // ID_SAMPLE bis zu sample_ignore_cnt mal igorieren/verwerfen wenn nicht gewünscht (falls streaming aktiv ist)
-      while (sample_ignore_cnt-- > 0 && tmp_in_buf[0] == 0x02 && send_len > 0);
-
-      if (send_len > 0              // nur dann ist out_buf[0] valide
-          && (tmp_in_buf[0] != out_buf[0] ||  tmp_in_buf[1] != reply_len))
+      if (r == LIBUSB_ERROR_OVERFLOW)
         {
-          fprintf(stderr, "Error: Malformed reply. Check physical connection and EMI.\n");
-          fprintf(stderr, "(send_cmd=0x%02X != recv_cmd=0x%02X) || (recv_len=%i != reply_len=%i),\n", out_buf[0], tmp_in_buf[0], tmp_in_buf[1], reply_len);
+          if (handle_debug_level (dev_handle))
+            fprintf (stderr, "DEBUG-INFO: LIBUSB_ERROR_OVERFLOW in '%s': expected max. %i bytes but got more.\n", funcname, DEFAULT_RECV_BUF_LEN);
 
-          return LIBALLURIS_MALFORMED_REPLY;
+          // Attention! You can't rely that data was written in buf
+          // See: http://libusb.sourceforge.net/api-1.0/libusb_packetoverflow.html
         }
-
-      memcpy (in_buf, tmp_in_buf, reply_len);
-  }
+      else
+        fprintf(stderr, "Read error in '%s': '%s', tried to read %i, got %i bytes.\n", funcname, libusb_error_name(r), DEFAULT_RECV_BUF_LEN, *actual);
+    }
   return r;
 }
 
 /****************************************************************************************/
+/*
+ * Packet demultiplexer
+ *
+ * Command replies and ID_SAMPLE (0x02) packets share the interrupt IN endpoint.
+ * Packets which arrive while the library waits for something else are routed
+ * into queues of the handle instead of being discarded:
+ * - ID_SAMPLE packets received while waiting for a reply are queued and returned
+ *   by the next liballuris_poll_measurement (or passed to an open stream)
+ * - replies received by the transfers of an open stream are queued for the
+ *   command waiting for them
+ */
+
+//! Maximum packet size of the interrupt endpoints
+#define PACKET_LEN 64
+
+//! Number of command replies queued per handle
+#define REPLY_QUEUE_LEN 8
+
+//! Properties in struct device_cache
+enum cache_property
+{
+  CACHE_DIGITS     = 0x01,
+  CACHE_RESOLUTION = 0x02,
+  CACHE_F_MAX      = 0x04,
+  CACHE_UNIT       = 0x08,
+  CACHE_VARIANT    = 0x10,
+  CACHE_FIRMWARE   = 0x20,
+  CACHE_SERIAL     = 0x40,
+  CACHE_FW_VERSION = 0x80,        //!< numeric firmware version, see cached_firmware_version
+  CACHE_NUM_PROPERTIES = 8        //!< number of commands to fetch all properties
+};
+
+//! Internal cache of static device properties, see \ref liballuris_device_open
+struct device_cache
+{
+  unsigned int valid;             //!< mask of enum cache_property
+  int digits;
+  int resolution;
+  int F_max;
+  enum liballuris_unit unit;
+  char variant[20];
+  char firmware[2][21];
+  char serial[20];
+  int fw_version;                 //!< communication processor, see FIRMWARE_VERSION
+};
+
+//! Adaptive timeouts are used after this many replies to a command
+#define RTT_MIN_SAMPLES 8
+//! The histogram is halved when it holds this many replies, recent round trips dominate
+#define RTT_HISTORY 1024
+//! Percentile of the round trip time used for the adaptive timeout
+#define RTT_PERCENTILE 0.99
+//! Adaptive timeout = RTT_TIMEOUT_FACTOR * upper end of the percentile bucket
+#define RTT_TIMEOUT_FACTOR 4
+
+//! Internal histogram of the recent round trip times of one command for adaptive timeouts
+struct rtt_histogram
+{
+  unsigned int count[LATENCY_BUCKETS];
+  unsigned int total;
+};
+
+//! Internal copy of a received packet
+struct packet
+{
+  int len;
+  unsigned char buf[PACKET_LEN];
+};
 
 /*!
- * \brief List accessible alluris devices
- *
- * The product field in alluris_device_description is filled via the USB descriptor.
- * After this the device is opened and the serial_number is read from the device.
- * Thus this function only lists devices where the application has sufficient rights to open
- * and read from the device. Check permissions if a device isn't returned.
+ * \brief Internal state of a device handle, created on first use
  *
- * The retrieved list has to be freed with \ref liballuris_free_device_list before the application exits.
- * \param[in] ctx pointer to libusb context
- * \param[out] alluris_devs pointer to storage for the device list
- * \param[in] length number of elements in alluris_devs
- * \param[in] read_serial try to read the serial from devices
- * \return 0 if successful else \ref liballuris_error
- * \sa liballuris_free_device_list
+ * cmd_lock serializes the commands on the handle and is held while waiting for replies.
+ * queue_lock protects the queues, the stream and the counters. It is only held shortly
+ * because stream callbacks for this handle may run in any thread which handles libusb events.
  */
-int liballuris_get_device_list (libusb_context* ctx, struct alluris_device_description* alluris_devs, size_t length, char read_serial)
+struct handle_state
 {
-  size_t k = 0;
-  for (k=0; k<length; ++k)
-    alluris_devs[k].dev = NULL;
+  libusb_device_handle* dev_handle;
+  pthread_mutex_t cmd_lock;                  //!< recursive, see LOCK_HANDLE
+  pthread_mutex_t queue_lock;
+  struct liballuris_stream* stream;          //!< open stream or NULL
+  struct packet samples[SAMPLE_QUEUE_LEN];   //!< ID_SAMPLE packets received while waiting for replies
+  size_t sample_head;
+  size_t sample_count;
+  struct packet replies[REPLY_QUEUE_LEN];    //!< replies received by the transfers of the stream
+  size_t reply_head;
+  size_t reply_count;
+  unsigned long lost_blocks;                 //!< ID_SAMPLE packets dropped because a queue was full
+  struct liballuris_sample_stats sample_stats; //!< validity and gaps of ID_SAMPLE packets, dropped is lost_blocks
+  struct device_cache cache;                 //!< static properties
+  double start_latency;                      //!< seconds from start command until measuring, see liballuris_get_start_latency
+  struct rtt_histogram rtt[256];             //!< recent round trip times per command byte
+  struct liballuris_command_stats stats[256]; //!< per command byte since open, protected by queue_lock
+  unsigned char late_replies[256];           //!< replies per command byte expected after a timeout
+  unsigned int timeout_ceiling;              //!< see liballuris_set_timeout_policy
+  char adaptive_timeouts;
+  char fast_fail;
+  char unresponsive;                         //!< the last command timed out
+  int data_ratio;                            //!< last value set with liballuris_set_data_ratio, -1 if unknown
+  char calibration_checked;                  //!< the cached calibration block was compared with the gauge
+  struct liballuris_context* context;        //!< context of liballuris_open_*, NULL for other handles
+  struct handle_state* next;
+};
 
-  size_t num_alluris_devices = 0;
-  libusb_device **devs;
-  if (liballuris_debug_level)
-    fprintf (stderr, "DEBUG-INFO: Searching for compatible USB devices...\n");
-
-  ssize_t cnt = libusb_get_device_list (ctx, &devs);
-  if (cnt > 0)
-    {
-      libusb_device *dev;
-      int i = 0;
-      while ((dev = devs[i++]) != NULL)
-        {
-          struct libusb_device_descriptor desc;
-          int r = libusb_get_device_descriptor (dev, &desc);
-          if (r < 0)
-            {
-              fprintf (stderr, "failed to get device descriptor: %s", libusb_error_name(r));
-              continue;
-            }
+/*!
+ * \brief Internal table of the handle states
+ *
+ * Lookups only take the read lock, so calls on different handles
+ * don't serialize each other.
+ */
+static struct
+{
+  pthread_rwlock_t lock;
+  struct handle_state* handles;
+} handle_table = {PTHREAD_RWLOCK_INITIALIZER, NULL};
 
-          if (liballuris_debug_level)
-            fprintf (stderr, "DEBUG-INFO: desc.idVendor = 0x%04X, desc.idProduct = 0x%04X", desc.idVendor, desc.idProduct);
+//! Internal number of contexts with their own debug level, see liballuris_set_context_debug_level
+static atomic_int own_debug_levels;
 
-          //check for compatible devices
-          // FMIS or TTT
-          if (desc.idVendor == 0x04d8 && (desc.idProduct == 0xfc30 || desc.idProduct == 0xf25e) )
-            {
+static struct liballuris_context* context_get (libusb_context* ctx, int create);
+static int context_debug_level (struct liballuris_context* lc);
+static void clear_calibrations (struct liballuris_context* lc);
+static int stream_push_block (struct liballuris_stream* stream, const unsigned char* buf, int len);
+static int stream_handle_events (struct liballuris_stream* stream, double timeout);
 
-              if (liballuris_debug_level)
-                fprintf (stderr, " (compatible)\n");
+//! Internal monotonic clock in seconds
+static double monotonic_time (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1.0e9;
+}
 
-              alluris_devs[num_alluris_devices].dev = dev;
+//! Internal absolute CLOCK_MONOTONIC time timeout milliseconds from now for pthread_cond_timedwait
+static void cond_deadline (unsigned int timeout, struct timespec* deadline)
+{
+  clock_gettime (CLOCK_MONOTONIC, deadline);
+  deadline->tv_sec += timeout / 1000;
+  deadline->tv_nsec += (timeout % 1000) * 1000000L;
+  if (deadline->tv_nsec >= 1000000000L)
+    {
+      deadline->tv_sec++;
+      deadline->tv_nsec -= 1000000000L;
+    }
+}
 
-              //open device
-              libusb_device_handle* h;
-              r = libusb_open (dev, &h);
-              if (r == LIBUSB_SUCCESS)
-                {
-                  r = libusb_claim_interface (h, 0);
-                  if (r == LIBUSB_SUCCESS)
-                    {
-
-                      if(desc.iProduct)
-                        r = libusb_get_string_descriptor_ascii(h, desc.iProduct, (unsigned char*)alluris_devs[num_alluris_devices].product, sizeof (alluris_devs[0].product));
-                      else
-                        strncpy (alluris_devs[num_alluris_devices].product, "No product information available", sizeof (alluris_devs[0].product));
-
-                      if (read_serial)
-                        {
-                          // get serial number from device
-                          r = liballuris_get_serial_number (h, alluris_devs[num_alluris_devices].serial_number, sizeof (alluris_devs[0].serial_number));
-                          if (r == LIBALLURIS_DEVICE_BUSY)
-                            // measurement is running, serial cannot be read
-                            strcpy (alluris_devs[num_alluris_devices].serial_number, "*BUSY*");
-                        }
-
-                      num_alluris_devices++;
-                      libusb_release_interface (h, 0);
-                      libusb_close (h);
-                    }
-                  else if (LIBUSB_ERROR_BUSY)
-                    {
-                      // On GNU/Linux this is raised if the device is already in use
-                      // for example from another application
-                    }
-                  else
-                    fprintf (stderr, "liballuris_get_device_list: Couldn't claim interface: %s\n", libusb_error_name(r));
+//! Internal sleep with fractional seconds
+static void sleep_seconds (double t)
+{
+  if (t > 0)
+    usleep (t * 1e6);
+}
 
-                }
-              else
-                fprintf (stderr, "liballuris_get_device_list: Couldn't open device: %s\n", libusb_error_name(r));
-            }
-          else
-            {
-              if (liballuris_debug_level)
-                fprintf (stderr, "\n");
-              // unref non Alluris device
-              libusb_unref_device (dev);
-            }
+//! Internal search in the handle table, the caller holds handle_table.lock
+static struct handle_state* find_handle_state (libusb_device_handle* dev_handle)
+{
+  struct handle_state* s;
+  for (s = handle_table.handles; s; s = s->next)
+    if (s->dev_handle == dev_handle)
+      return s;
+  return NULL;
+}
 
-          if (num_alluris_devices == length)
-            break; // maximum number of devices reached
+//! Internal lookup of the state of dev_handle, returns NULL if out of memory
+static struct handle_state* get_handle_state (libusb_device_handle* dev_handle)
+{
+  pthread_rwlock_rdlock (&handle_table.lock);
+  struct handle_state* s = find_handle_state (dev_handle);
+  pthread_rwlock_unlock (&handle_table.lock);
+  if (s)
+    return s;
+
+  pthread_rwlock_wrlock (&handle_table.lock);
+  // another thread may have created it in the meantime
+  s = find_handle_state (dev_handle);
+  if (! s)
+    {
+      s = calloc (1, sizeof (struct handle_state));
+      if (s)
+        {
+          pthread_mutexattr_t attr;
+          pthread_mutexattr_init (&attr);
+          pthread_mutexattr_settype (&attr, PTHREAD_MUTEX_RECURSIVE);
+          pthread_mutex_init (&s->cmd_lock, &attr);
+          pthread_mutexattr_destroy (&attr);
+          pthread_mutex_init (&s->queue_lock, NULL);
+
+          s->dev_handle = dev_handle;
+          s->timeout_ceiling = DEFAULT_RECEIVE_TIMEOUT;
+          s->data_ratio = -1;
+          s->next = handle_table.handles;
+          handle_table.handles = s;
         }
     }
-  libusb_free_device_list (devs, 0);
-  return num_alluris_devices;
+  pthread_rwlock_unlock (&handle_table.lock);
+  return s;
 }
 
-/*!
- * \brief Free list filled from get_alluris_device_list
- */
-void liballuris_free_device_list (struct alluris_device_description* alluris_devs, size_t length)
+//! Internal debug level of a handle state, NULL falls back to liballuris_debug_level
+static int state_debug_level (struct handle_state* s)
 {
-  size_t k = 0;
-  for (k=0; k < length; ++k)
-    if (alluris_devs[k].dev)
-      {
-        libusb_unref_device (alluris_devs[k].dev);
-        alluris_devs[k].dev = NULL;
-      }
+  return context_debug_level ((s)? s->context : NULL);
 }
 
-void liballuris_print_device_list (FILE *sink, libusb_context* ctx)
+//! Internal debug level of the context dev_handle was opened with
+static int handle_debug_level (libusb_device_handle* dev_handle)
 {
-  // list accessible devices and exit
-  // FIXME: document that a running measurement prohibits reading the serial_number
+  // no lookup as long as all contexts use liballuris_debug_level
+  if (! atomic_load_explicit (&own_debug_levels, memory_order_relaxed))
+    return liballuris_debug_level;
+  return state_debug_level (get_handle_state (dev_handle));
+}
 
-  struct alluris_device_description alluris_devs[MAX_NUM_DEVICES];
-  ssize_t cnt = liballuris_get_device_list (ctx, alluris_devs, MAX_NUM_DEVICES, 1);
+//! Internal function to remember the context a handle was opened with
+static void bind_handle (libusb_device_handle* dev_handle, struct liballuris_context* lc)
+{
+  struct handle_state* s = get_handle_state (dev_handle);
+  if (s)
+    s->context = lc;
+}
 
-  int k;
-  fprintf (sink, "#Num; Bus; Dev; Product;                   Serial\n");
-  for (k=0; k < cnt; k++)
-    fprintf (sink, " %03i; %03d; %03d; %-25s; %s\n", k+1,
-             libusb_get_bus_number(alluris_devs[k].dev),
-             libusb_get_device_address(alluris_devs[k].dev),
-             alluris_devs[k].product,
-             alluris_devs[k].serial_number);
+//! Internal function to release the state of dev_handle, no other thread may use the handle
+static void free_handle_state (libusb_device_handle* dev_handle)
+{
+  struct handle_state* s = NULL;
+  struct handle_state** ps;
+  pthread_rwlock_wrlock (&handle_table.lock);
+  for (ps = &handle_table.handles; *ps; ps = &(*ps)->next)
+    if ((*ps)->dev_handle == dev_handle)
+      {
+        s = *ps;
+        *ps = s->next;
+        break;
+      }
+  pthread_rwlock_unlock (&handle_table.lock);
 
-  if (!cnt)
-    fprintf (stderr, "Error: No accessible device found\n");
+  if (s)
+    {
+      pthread_mutex_destroy (&s->cmd_lock);
+      pthread_mutex_destroy (&s->queue_lock);
+      free (s);
+    }
+}
 
-  // free device list
-  liballuris_free_device_list (alluris_devs, MAX_NUM_DEVICES);
+//! Internal function to take the command lock of dev_handle, see LOCK_HANDLE
+static struct handle_state* lock_handle (libusb_device_handle* dev_handle)
+{
+  struct handle_state* s = get_handle_state (dev_handle);
+  if (s)
+    pthread_mutex_lock (&s->cmd_lock);
+  return s;
 }
 
-/*!
- * \brief Open device with specified serial_number or the first available if NULL
- * \param[in] ctx pointer to libusb context
- * \param[in] serial_number of device or NULL
- * \param[out] h storage for handle to communicate with the device
- * \return 0 if successful else \ref liballuris_error
- */
-int liballuris_open_device (libusb_context* ctx, const char* serial_number, libusb_device_handle** h)
+//! Internal cleanup handler of LOCK_HANDLE
+static void unlock_handle (struct handle_state** s)
 {
-  libusb_device *dev = NULL;
-  struct alluris_device_description alluris_devs[MAX_NUM_DEVICES];
-  int cnt = liballuris_get_device_list (ctx, alluris_devs, MAX_NUM_DEVICES, (serial_number != NULL));
+  if (*s)
+    pthread_mutex_unlock (&(*s)->cmd_lock);
+}
 
-  if (liballuris_debug_level)
-    fprintf (stderr, "DEBUG-INFO: liballuris_open_device: found %i device(s)\n", cnt);
+/*
+ * Serialize commands on dev_handle until the enclosing block is left.
+ * The lock is recursive, functions which call other liballuris functions
+ * keep the handle for the whole sequence. Uses the GCC/clang cleanup attribute
+ * so that early returns release the lock.
+ */
+#define LOCK_HANDLE(dev_handle) \
+  struct handle_state* handle_lock_ __attribute__ ((cleanup (unlock_handle))) = lock_handle (dev_handle)
+
+//! Internal function to drop cached properties after they were changed
+static void invalidate_cache (libusb_device_handle* dev_handle, unsigned int mask)
+{
+  LOCK_HANDLE (dev_handle);
+  if (handle_lock_)
+    handle_lock_->cache.valid &= ~mask;
+}
 
-  if (cnt >= 1)
+//! Internal F_max query, F_max never changes so it is only read once per handle
+static int cached_F_max (libusb_device_handle* dev_handle, int* fmax)
+{
+  LOCK_HANDLE (dev_handle);
+  struct handle_state* s = handle_lock_;
+  if (s && (s->cache.valid & CACHE_F_MAX))
     {
-      if (serial_number == NULL)
-        dev = alluris_devs[0].dev;
-      else
-        for (int k = 0; k < cnt; k++)
-          if (! strncmp (serial_number, alluris_devs[k].serial_number, sizeof (alluris_devs[0].serial_number)))
-            dev = alluris_devs[k].dev;
+      *fmax = s->cache.F_max;
+      return LIBALLURIS_SUCCESS;
     }
 
-  if (! dev)
-    //no device found
-    return LIBUSB_ERROR_NOT_FOUND;
-
-  int ret = libusb_open (dev, h);
-  liballuris_free_device_list (alluris_devs, MAX_NUM_DEVICES);
+  int ret = liballuris_get_F_max (dev_handle, fmax);
+  if (! ret && s)
+    {
+      s->cache.F_max = *fmax;
+      s->cache.valid |= CACHE_F_MAX;
+    }
   return ret;
 }
 
+//! Numeric firmware version for comparisons, for example FIRMWARE_VERSION (5, 4, 10) for "V5.04.010"
+#define FIRMWARE_VERSION(major, minor, patch) ((major) * 100000 + (minor) * 1000 + (patch))
 
 /*!
- * \brief Open device with specified bus and device id.
- * \param[in] ctx pointer to libusb context
- * \param[in] bus id of device
- * \param[in] device id of device
- * \param[out] h storage for handle to communicate with the device
- * \return 0 if successful else \ref liballuris_error
+ * \brief Internal query of the communication processor firmware, cached
+ *
+ * Both processors are released together, the communication processor
+ * also answers while measuring.
  */
-int liballuris_open_device_with_id (libusb_context* ctx, int bus, int device, libusb_device_handle** h)
+static int cached_firmware_version (libusb_device_handle* dev_handle, int* version)
 {
-  libusb_device *dev = NULL;
-  struct alluris_device_description alluris_devs[MAX_NUM_DEVICES];
-  int cnt = liballuris_get_device_list (ctx, alluris_devs, MAX_NUM_DEVICES, 0);
-
-  if (cnt >= 1)
+  LOCK_HANDLE (dev_handle);
+  struct handle_state* s = handle_lock_;
+  if (s && (s->cache.valid & CACHE_FW_VERSION))
     {
-      for (int k = 0; k < cnt; k++)
-        if (   libusb_get_bus_number (alluris_devs[k].dev) == bus
-               && libusb_get_device_address (alluris_devs[k].dev) == device)
-          dev = alluris_devs[k].dev;
+      *version = s->cache.fw_version;
+      return LIBALLURIS_SUCCESS;
     }
 
-  if (! dev)
-    //no device found
-    return LIBUSB_ERROR_NOT_FOUND;
+  char buf[21];
+  int major, minor, patch;
+  int ret = liballuris_get_firmware (dev_handle, 0, buf, sizeof (buf));
+  if (ret)
+    return ret;
+  if (sscanf (buf, "V%i.%i.%i", &major, &minor, &patch) != 3)
+    return LIBALLURIS_MALFORMED_REPLY;
 
-  int ret = libusb_open (dev, h);
-  liballuris_free_device_list (alluris_devs, MAX_NUM_DEVICES);
+  *version = FIRMWARE_VERSION (major, minor, patch);
+  if (s)
+    {
+      s->cache.fw_version = *version;
+      s->cache.valid |= CACHE_FW_VERSION;
+    }
   return ret;
 }
 
-/*!
- * \brief Check if a device is already connected (h != 0) and connect else
- *
- * If serial_or_bus_id contains one dot (.), it's considered as a serial number
- * for example L.12345, if it contains a comma (,) serial_or_bus_id is considered to
- * be bus_id,device_id pair.
- * \param[in] ctx pointer to libusb context
- * \param[in] serial_or_bus_id serial or bus_id,device_id or NULL
- * \return 0 if successful else \ref liballuris_error
- */
+//! Internal function to append a packet to a ring of packets, returns 0 if the ring is full
+static int packet_push (struct packet* ring, size_t ring_len, size_t head, size_t* count, const unsigned char* buf, int len)
+{
+  if (*count == ring_len)
+    return 0;
+  struct packet* p = ring + (head + *count) % ring_len;
+  p->len = (len < PACKET_LEN)? len : PACKET_LEN;
+  memcpy (p->buf, buf, p->len);
+  (*count)++;
+  return 1;
+}
 
-int liballuris_open_if_not_opened (libusb_context* ctx, const char* serial_or_bus_id, libusb_device_handle** h)
+//! Internal check of an ID_SAMPLE header, byte 1 holds the packet length
+static int sample_header_ok (const unsigned char* buf, int len)
 {
-  //printf ("liballuris_open_if_not_opened h=%x\n", *h);
+  return len >= 5 && buf[0] == 0x02 && buf[1] == len && (len - 5) % 3 == 0;
+}
 
-  int r = 0;
-  if (! *h)
+//! Internal function to count a polled ID_SAMPLE packet, returns 0 if it is malformed
+static int sample_count_block (libusb_device_handle* dev_handle, const unsigned char* buf, int len)
+{
+  int ok = sample_header_ok (buf, len);
+  struct handle_state* s = get_handle_state (dev_handle);
+  if (s)
     {
-      if (! serial_or_bus_id) //connect to first available device
+      pthread_mutex_lock (&s->queue_lock);
+      if (ok)
+        s->sample_stats.blocks++;
+      else
+        s->sample_stats.malformed++;
+      pthread_mutex_unlock (&s->queue_lock);
+    }
+  if (! ok)
+    fprintf (stderr, "Error: Malformed ID_SAMPLE header %02x %02x with %i bytes\n", buf[0], buf[1], len);
+  return ok;
+}
+
+//! Internal function to route a received packet to the sample or reply queue
+static void dispatch_packet (struct handle_state* s, const unsigned char* buf, int len)
+{
+  pthread_mutex_lock (&s->queue_lock);
+  if (len > 0 && buf[0] == 0x02)
+    {
+      int ok = (s->stream)? stream_push_block (s->stream, buf, len)
+               : packet_push (s->samples, SAMPLE_QUEUE_LEN, s->sample_head, &s->sample_count, buf, len);
+      if (! ok)
+        s->lost_blocks++;
+    }
+  else if (len > 0)
+    {
+      if (! packet_push (s->replies, REPLY_QUEUE_LEN, s->reply_head, &s->reply_count, buf, len))
+        fprintf (stderr, "Error: reply queue full, discarded reply 0x%02x\n", buf[0]);
+    }
+  pthread_mutex_unlock (&s->queue_lock);
+}
+
+//! Internal function to take the oldest queued sample packet, returns 0 if none is queued
+static int pop_sample (struct handle_state* s, unsigned char* buf, int* actual)
+{
+  if (! s)
+    return 0;
+  pthread_mutex_lock (&s->queue_lock);
+  int ret = (s->sample_count > 0);
+  if (ret)
+    {
+      struct packet* p = s->samples + s->sample_head;
+      memcpy (buf, p->buf, p->len);
+      *actual = p->len;
+      s->sample_head = (s->sample_head + 1) % SAMPLE_QUEUE_LEN;
+      s->sample_count--;
+    }
+  pthread_mutex_unlock (&s->queue_lock);
+  return ret;
+}
+
+/*!
+ * \brief Internal function to receive the next command reply
+ *
+ * ID_SAMPLE packets which arrive in the meantime are queued. If a stream is open
+ * its transfers receive all packets, the libusb events are processed until the
+ * stream callback queued a reply.
+ */
+static int receive_reply (libusb_device_handle* dev_handle,
+                          const char* funcname,
+                          unsigned char *buf,
+                          int *actual,
+                          unsigned int receive_timeout)
+{
+  struct handle_state* s = get_handle_state (dev_handle);
+  if (! s)
+    return LIBUSB_ERROR_NO_MEM;
+
+  double deadline = monotonic_time () + receive_timeout / 1.0e3;
+  for (;;)
+    {
+      double remaining = deadline - monotonic_time ();
+      pthread_mutex_lock (&s->queue_lock);
+      struct liballuris_stream* stream = s->stream;
+      int have_reply = (s->reply_count > 0);
+      if (have_reply)
         {
-          r = liballuris_open_device (ctx, serial_or_bus_id, h);
-          if (r)
-            {
-              fprintf (stderr, "Error: Couldn't open device: %s\n", liballuris_error_name (r));
-            }
+          struct packet* p = s->replies + s->reply_head;
+          memcpy (buf, p->buf, p->len);
+          *actual = p->len;
+          s->reply_head = (s->reply_head + 1) % REPLY_QUEUE_LEN;
+          s->reply_count--;
         }
-      else //bus,device or serial
-        {
-          // decide whether it's a serial number or a bus,device pair
-          const char* pc = strchr (serial_or_bus_id, ',');
-          if (pc)
-            {
-              // split "Bus,Device"
-              char *endptr, *endptr2 = NULL;
-              int bus = strtol (serial_or_bus_id, &endptr, 10);
-              if (endptr == serial_or_bus_id)
-                {
-                  fprintf (stderr, "Error: Couldn't find bus_id in '%s'\n", serial_or_bus_id);
-                  return LIBALLURIS_PARSE_ERROR;
-                }
-              if (*endptr != ',')
-                {
-                  fprintf (stderr, "Error: Wrong delimiter '%c', please use ',' instead\n", *endptr);
-                  return LIBALLURIS_PARSE_ERROR;
-                }
-              int device = strtol (++endptr, &endptr2, 10);
-              if (endptr2 == endptr)
-                {
-                  fprintf (stderr, "Error: Couldn't find device_id in '%s'\n", serial_or_bus_id);
-                  return LIBALLURIS_PARSE_ERROR;
-                }
+      pthread_mutex_unlock (&s->queue_lock);
 
-              r = liballuris_open_device_with_id (ctx, bus, device, h);
-              if (r)
-                {
-                  fprintf (stderr, "Error: Couldn't open device with bus=%i and device=%i: %s\n", bus, device, liballuris_error_name (r));
-                }
-            }
-          else // serial
-            {
-              r = liballuris_open_device (ctx, serial_or_bus_id, h);
-              if (r)
-                {
-                  fprintf (stderr, "Error: Couldn't open device with serial='%s': %s\n", serial_or_bus_id, liballuris_error_name (r));
-                }
-            }
+      if (have_reply)
+        return LIBUSB_SUCCESS;
+      if (remaining <= 0)
+        {
+          fprintf (stderr, "Read error in '%s': '%s'\n", funcname, libusb_error_name (LIBUSB_ERROR_TIMEOUT));
+          return LIBUSB_ERROR_TIMEOUT;
         }
 
-      if (*h)
+      // the stream can't be closed meanwhile, the caller holds the command lock
+      if (stream)
         {
-          r = libusb_claim_interface (*h, 0);
+          int r = stream_handle_events (stream, remaining);
           if (r)
-            {
-              fprintf (stderr, "Error: Couldn't claim interface: %s\n", liballuris_error_name (r));
-            }
+            return r;
+        }
+      else
+        {
+          // a timeout of 0 would block forever
+          unsigned int timeout = remaining * 1.0e3;
+          int r = liballuris_receive (dev_handle, funcname, buf, actual, (timeout)? timeout : 1);
+          if (r)
+            return r;
+          dispatch_packet (s, buf, *actual);
         }
     }
-  //printf ("open_if_not_opened h=%x\n", *h);
-  return r;
 }
 
-/*!
- * \brief Clear receive buffer
- *
- * Try to read 64 bytes from receive endpoint to clear the USB receive queue after some error.
- * There is no error if a timeout occurs.
- * \param[in] dev_handle a handle for the device to communicate with
- * \param[in] timeout read timeout
- */
-void liballuris_clear_RX (libusb_device_handle* dev_handle, unsigned int timeout)
+//! Internal mapping of a latency in seconds to its histogram bucket
+static int latency_bucket (double t)
 {
-  unsigned char data[64];
-  int actual;
-  int r = libusb_interrupt_transfer (dev_handle, 0x81 | LIBUSB_ENDPOINT_IN, data, 64, &actual, timeout);
+  int k = 0;
+  double upper = LATENCY_BUCKET_BASE / 1.0e3;
+  while (k < LATENCY_BUCKETS - 1 && t > upper)
+    {
+      k++;
+      upper *= 2;
+    }
+  return k;
+}
 
-  if (liballuris_debug_level)
-    fprintf (stderr, "DEBUG-INFO: clear_RX: libusb_interrupt_transfer returned '%s', actual = %i\n", libusb_error_name(r), actual);
+//! Internal function to add a round trip time in seconds to the histogram of cmd
+static void rtt_add (struct handle_state* s, unsigned char cmd, double rtt)
+{
+  struct rtt_histogram* h = s->rtt + cmd;
+  int k = latency_bucket (rtt);
+
+  if (h->total >= RTT_HISTORY)
+    {
+      int i;
+      h->total = 0;
+      for (i=0; i < LATENCY_BUCKETS; i++)
+        {
+          h->count[i] /= 2;
+          h->total += h->count[i];
+        }
+    }
+  h->count[k]++;
+  h->total++;
+}
+
+//! Internal function to calculate the adaptive timeout in milliseconds, 0 if not enough replies yet
+static unsigned int rtt_timeout (const struct rtt_histogram* h)
+{
+  if (h->total < RTT_MIN_SAMPLES)
+    return 0;
+
+  unsigned int t = RTT_TIMEOUT_FACTOR * liballuris_latency_percentile (h->count, RTT_PERCENTILE);
+  return (t < MIN_ADAPTIVE_TIMEOUT)? MIN_ADAPTIVE_TIMEOUT : t;
+}
+
+//! Internal function to record the latencies in seconds of a completed command
+static void stats_add (struct handle_state* s, unsigned char cmd, double send, double reply)
+{
+  struct liballuris_command_stats* st = s->stats + cmd;
+  pthread_mutex_lock (&s->queue_lock);
+  st->replies++;
+  st->send[latency_bucket (send)]++;
+  st->reply[latency_bucket (reply)]++;
+  st->total[latency_bucket (send + reply)]++;
+  pthread_mutex_unlock (&s->queue_lock);
+}
+
+//! Internal function to increment an error counter in s->stats
+static void stats_error (struct handle_state* s, unsigned long* counter)
+{
+  pthread_mutex_lock (&s->queue_lock);
+  (*counter)++;
+  pthread_mutex_unlock (&s->queue_lock);
 }
 
 /*!
- * \brief Query the serial number
- *
- * Return the serial number of the device which is also laser-engraved on the back.
- * For example "P.25412"
- *
- * Query the serial number is only possible if the measurement is not running,
- * else LIBALLURIS_DEVICE_BUSY is returned.
+ * \brief Estimate a percentile from a latency histogram
  *
- * \param[in] dev_handle a handle for the device to communicate with
- * \param[out] buf output location for the serial number. Only populated if the return code is 0.
- * \param[in] length length of buffer in bytes
- * \return 0 if successful else \ref liballuris_error. LIBALLURIS_DEVICE_BUSY if measurement is running
+ * \param[in] histogram LATENCY_BUCKETS counts, for example \ref liballuris_command_stats total
+ * \param[in] p percentile 0..1, for example 0.99
+ * \return upper end of the bucket which contains the percentile in milliseconds, 0 if empty
  */
-int liballuris_get_serial_number (libusb_device_handle *dev_handle, char* buf, size_t length)
+double liballuris_latency_percentile (const unsigned int* histogram, double p)
 {
-  unsigned char out_buf[3];
-  unsigned char in_buf[6];
+  unsigned long total = 0, sum = 0;
+  int k;
+  for (k=0; k < LATENCY_BUCKETS; k++)
+    total += histogram[k];
+  if (! total)
+    return 0;
 
-  out_buf[0] = 0x08;
-  out_buf[1] = 3;
-  out_buf[2] = 6;
-  int ret = liballuris_interrupt_transfer (dev_handle, __FUNCTION__,
-            out_buf, sizeof (out_buf), DEFAULT_SEND_TIMEOUT,
-            in_buf, sizeof (in_buf), DEFAULT_RECEIVE_TIMEOUT);
-  if (ret == LIBALLURIS_SUCCESS)
+  double upper = LATENCY_BUCKET_BASE;
+  for (k=0; k < LATENCY_BUCKETS - 1; k++, upper *= 2)
     {
-      unsigned short tmp = char_to_uint16 (in_buf + 3);
-      if (tmp == 65535)
-        return LIBALLURIS_DEVICE_BUSY;
-      else
-        snprintf (buf, length, "%c.%i", in_buf[5] + 'A', tmp);
+      sum += histogram[k];
+      if (sum >= p * total)
+        break;
     }
-  return ret;
+  return upper;
 }
 
 /*!
- * \brief Query firmware version
+ * \brief Query latency histograms and error counters of a command type
  *
- * The returned string in buf is for example "V5.03.009"
- * If the measurement is running, the firmware can't be read from the measurement processor
- * and "V255.255.255" is returned instead.
- *
- * Since firmware V5.05.003 the measurement processor firmware can no longer
- * been read separately and will always return V0.255.255
+ * Every command sent with dev_handle is timed, the counters start when
+ * the handle is opened. Bucket k of the histograms counts latencies up to
+ * \ref LATENCY_BUCKET_BASE * 2^k milliseconds, the last bucket everything above.
+ * Use it to find gauges and cables which degrade over time.
  *
  * \param[in] dev_handle a handle for the device to communicate with
- * \param[in] dev 0=USB communication processor, 1=measurement processor
- * \param[out] buf output location for the firmware string. Only populated if the return code is 0.
- * \param[in] length length of buffer in bytes
- * \return 0 if successful else \ref liballuris_error.
+ * \param[in] cmd command byte, for example 0x46 for \ref liballuris_get_value
+ * \param[out] stats output location
+ * \return 0 if successful else \ref liballuris_error
+ * \sa liballuris_print_command_stats
  */
-int liballuris_get_firmware (libusb_device_handle *dev_handle, int dev, char* buf, size_t length)
+int liballuris_get_command_stats (libusb_device_handle* dev_handle, unsigned char cmd, struct liballuris_command_stats* stats)
 {
-  unsigned char out_buf[3];
-  unsigned char in_buf[6];
-
-  if (dev < 0 || dev > 1)
-    return LIBALLURIS_OUT_OF_RANGE;
+  struct handle_state* s = get_handle_state (dev_handle);
+  if (! s)
+    return LIBUSB_ERROR_NO_MEM;
+  pthread_mutex_lock (&s->queue_lock);
+  *stats = s->stats[cmd];
+  pthread_mutex_unlock (&s->queue_lock);
+  return LIBALLURIS_SUCCESS;
+}
 
-  out_buf[0] = 0x08;
-  out_buf[1] = 3;
-  out_buf[2] = dev;
-  int ret = liballuris_interrupt_transfer (dev_handle, __FUNCTION__,
-            out_buf, sizeof (out_buf), DEFAULT_SEND_TIMEOUT,
-            in_buf, sizeof (in_buf), DEFAULT_RECEIVE_TIMEOUT);
-  if (ret == LIBALLURIS_SUCCESS)
-    snprintf (buf, length, "V%i.%02i.%03i", in_buf[5], in_buf[4], in_buf[3]);
-  return ret;
+//! Reset the latency histograms and error counters of all commands, see \ref liballuris_get_command_stats
+void liballuris_reset_command_stats (libusb_device_handle* dev_handle)
+{
+  struct handle_state* s = get_handle_state (dev_handle);
+  if (! s)
+    return;
+  pthread_mutex_lock (&s->queue_lock);
+  memset (s->stats, 0, sizeof (s->stats));
+  pthread_mutex_unlock (&s->queue_lock);
 }
 
 /*!
- * \brief Query next calibration date
+ * \brief Print a summary of the statistics of all commands sent with dev_handle
  *
- * The returned int v is YYMM for example "1502" for February 2015
- * If the measurement is running, the next calibration date can't be read from the measurement processor
- * and LIBALLURIS_DEVICE_BUSY is returned instead.
+ * One line per command byte with error counters and the median and
+ * 99th percentile of the send, reply and total latency in milliseconds.
  *
+ * \param[in] sink output stream, for example stdout
  * \param[in] dev_handle a handle for the device to communicate with
- * \param[out] v output location for the next calibration date. Only populated if the return code is 0.
- * \return 0 if successful else \ref liballuris_error.
+ * \sa liballuris_get_command_stats
  */
-int liballuris_get_next_calibration_date (libusb_device_handle *dev_handle, int* v)
+void liballuris_print_command_stats (FILE *sink, libusb_device_handle* dev_handle)
 {
-  unsigned char out_buf[3];
-  unsigned char in_buf[6];
-
-  out_buf[0] = 0x08;
-  out_buf[1] = 3;
-  out_buf[2] = 7;
-  int ret = liballuris_interrupt_transfer (dev_handle, __FUNCTION__,
-            out_buf, sizeof (out_buf), DEFAULT_SEND_TIMEOUT,
-            in_buf, sizeof (in_buf), DEFAULT_RECEIVE_TIMEOUT);
-  if (ret == LIBALLURIS_SUCCESS)
+  int cmd;
+  fprintf (sink, "%-4s %8s %6s %6s %6s %6s %8s %8s %8s %8s %8s %8s\n", "#cmd", "replies",
+           "sndErr", "tmout", "malf", "late", "snd_p50", "snd_p99", "rpl_p50", "rpl_p99", "tot_p50", "tot_p99");
+  for (cmd=0; cmd < 256; cmd++)
     {
-      *v = char_to_int24 (in_buf + 3);
-      if (*v == -1)
-        return LIBALLURIS_DEVICE_BUSY;
+      struct liballuris_command_stats st;
+      if (liballuris_get_command_stats (dev_handle, cmd, &st))
+        return;
+      if (! st.replies && ! st.send_errors && ! st.timeouts && ! st.malformed && ! st.late_replies)
+        continue;
+
+      fprintf (sink, "0x%02X %8lu %6lu %6lu %6lu %6lu %8.2f %8.2f %8.2f %8.2f %8.2f %8.2f\n", cmd, st.replies,
+               st.send_errors, st.timeouts, st.malformed, st.late_replies,
+               liballuris_latency_percentile (st.send, 0.5), liballuris_latency_percentile (st.send, 0.99),
+               liballuris_latency_percentile (st.reply, 0.5), liballuris_latency_percentile (st.reply, 0.99),
+               liballuris_latency_percentile (st.total, 0.5), liballuris_latency_percentile (st.total, 0.99));
     }
-  return ret;
 }
 
-int liballuris_read_flash (libusb_device_handle *dev_handle, int adr, unsigned short *v)
+//! Internal function to apply the timeout policy of the handle to the timeout requested by the caller
+static unsigned int command_timeout (struct handle_state* s, unsigned char cmd, unsigned int timeout)
 {
-  unsigned char out_buf[4];
-  unsigned char in_buf[6];
-
-  out_buf[0] = 0x72;
-  out_buf[1] = 4;
-  out_buf[2] = adr & 0xFF;
-  out_buf[3] = adr >> 8;
-  int ret = liballuris_interrupt_transfer (dev_handle, __FUNCTION__,
-            out_buf, sizeof (out_buf), DEFAULT_SEND_TIMEOUT,
-            in_buf, sizeof (in_buf), DEFAULT_RECEIVE_TIMEOUT);
-  if (ret == LIBALLURIS_SUCCESS)
+  if (timeout > s->timeout_ceiling)
+    timeout = s->timeout_ceiling;
+  if (s->adaptive_timeouts)
     {
-      *v  = in_buf[5] << 8;
-      *v += in_buf[4];
+      unsigned int learned = rtt_timeout (s->rtt + cmd);
+      if (learned && learned < timeout)
+        timeout = learned;
     }
-  return ret;
+  // probe an unresponsive device shortly instead of waiting for every command
+  if (s->fast_fail && s->unresponsive && timeout > MIN_ADAPTIVE_TIMEOUT)
+    timeout = MIN_ADAPTIVE_TIMEOUT;
+  return timeout;
 }
 
 /*!
- * \brief Query calibration date
- * Since firmware 5.04.005
- * The returned int v is days since year 2000
+ * \brief Configure the timeouts of commands on dev_handle
+ *
+ * The round trip time of every command type is recorded. With adaptive timeouts a command
+ * waits at most RTT_TIMEOUT_FACTOR times the 99th percentile of its recent round trip times,
+ * but at least \ref MIN_ADAPTIVE_TIMEOUT. Until enough replies are recorded the
+ * ceiling applies. In fast-fail mode a device whose last command timed out gets only
+ * \ref MIN_ADAPTIVE_TIMEOUT to answer until it replies again, so a dead device
+ * fails every further command within milliseconds.
+ *
+ * A reply which arrives after its command timed out is discarded when the next command waits.
+ * Before a command with the same command byte is sent again, its late replies are awaited
+ * for at most the timeout of that command, so it can't take the stale reply as its own.
  *
  * \param[in] dev_handle a handle for the device to communicate with
- * \param[out] v output location for the calibration date. May be partially populated if the return code is != 0.
- * \return 0 if successful else \ref liballuris_error.
+ * \param[in] adaptive 1 = learn timeouts from round trip times, 0 = fixed timeouts (default)
+ * \param[in] ceiling upper limit of all timeouts in milliseconds, default \ref DEFAULT_RECEIVE_TIMEOUT
+ * \param[in] fast_fail 1 = enable fast-fail mode, 0 = disable (default)
+ * \return 0 if successful else \ref liballuris_error
  */
-int liballuris_get_calibration_date (libusb_device_handle *dev_handle, unsigned short* v)
+int liballuris_set_timeout_policy (libusb_device_handle* dev_handle, char adaptive, unsigned int ceiling, char fast_fail)
 {
-  // see liballuris_get_calibration_number for flash organisation
-  return liballuris_read_flash (dev_handle, 0, v);
+  if (ceiling < MIN_ADAPTIVE_TIMEOUT)
+    return LIBALLURIS_OUT_OF_RANGE;
+
+  LOCK_HANDLE (dev_handle);
+  if (! handle_lock_)
+    return LIBUSB_ERROR_NO_MEM;
+  handle_lock_->adaptive_timeouts = adaptive;
+  handle_lock_->timeout_ceiling = ceiling;
+  handle_lock_->fast_fail = fast_fail;
+  return LIBALLURIS_SUCCESS;
 }
 
-//! Since firmware 5.04.005
-int liballuris_get_calibration_number (libusb_device_handle *dev_handle, char* buf, size_t length)
+/*!
+ * \brief Query the adaptive timeout of a command
+ *
+ * \param[in] dev_handle a handle for the device to communicate with
+ * \param[in] cmd command byte, for example 0x46 for \ref liballuris_get_value
+ * \return timeout in milliseconds, 0 if not enough replies were recorded yet
+ * \sa liballuris_set_timeout_policy
+ */
+unsigned int liballuris_get_adaptive_timeout (libusb_device_handle* dev_handle, unsigned char cmd)
 {
-  // PIC flash organisation
-  // word adr; word value (16bit)
-  // 0       ; cal_date, days since 1.1.2000, unsigned short
-  // 1..4    ; uncertainty, double
-  // 5..24   ; calibration_number as char[40]
-
-  if (length > 40)
-    length = 40;
-  // needs to be multiple of 2bytes (words)
-  if (length % 2)
-    return LIBALLURIS_OUT_OF_RANGE;
-
-  unsigned int k, ret;
-  unsigned short *p = (unsigned short *) buf;
-  for (k=0; k<length/2; ++k)
-    {
-      ret = liballuris_read_flash (dev_handle, k + 5, p++);
-      if (ret != LIBALLURIS_SUCCESS)
-        break;
-    }
-  return ret;
+  LOCK_HANDLE (dev_handle);
+  return (handle_lock_)? rtt_timeout (handle_lock_->rtt + cmd) : 0;
 }
 
-//! Since firmware 5.04.005
-int liballuris_get_uncertainty (libusb_device_handle *dev_handle, double* v)
+/*!
+ * \brief Query the number of lost sample blocks
+ *
+ * ID_SAMPLE packets which arrive while a command waits for its reply are queued
+ * for up to \ref SAMPLE_QUEUE_LEN blocks until \ref liballuris_poll_measurement fetches them.
+ * With an open stream they are passed to the stream queue.
+ * This counter is incremented for every block dropped because the queue was full.
+ *
+ * \param[in] dev_handle a handle for the device to communicate with
+ * \return number of dropped blocks since the device was opened
+ * \sa liballuris_stream_get_overflows
+ */
+unsigned long liballuris_get_lost_blocks (libusb_device_handle* dev_handle)
 {
-  // see liballuris_get_calibration_number for flash organisation
-  int k, ret;
-  unsigned short *p = (unsigned short *) v;
-  for (k=0; k<4; ++k)
-    {
-      ret = liballuris_read_flash (dev_handle, k + 1, p++);
-      if (ret != LIBALLURIS_SUCCESS)
-        break;
-    }
+  struct handle_state* s = get_handle_state (dev_handle);
+  if (! s)
+    return 0;
+  pthread_mutex_lock (&s->queue_lock);
+  unsigned long ret = s->lost_blocks;
+  pthread_mutex_unlock (&s->queue_lock);
   return ret;
 }
 
 /*!
- * \brief Query the number of digits for the interpretation of the raw fixed-point numbers
- *
- * All liballuris_get_* functions return fixed-point numbers or strings. This function queries the number
- * of digits after the radix point. For example if \ref liballuris_get_value returns 123 and digits returns 1
- * the real value is 12.3. Use \ref liballuris_get_unit to get a meaningful measurement.
+ * \brief Query the integrity counters of the received ID_SAMPLE blocks
  *
- * Query this value is only possible if the measurement is not running,
- * else LIBALLURIS_DEVICE_BUSY is returned.
+ * Blocks are counted when a stream receives them or when \ref liballuris_poll_measurement
+ * returns them. Gaps can only be detected with an open stream.
  *
  * \param[in] dev_handle a handle for the device to communicate with
- * \param[out] v output location for the returned number of digits. Only populated if the return code is 0.
+ * \param[out] stats output location for the counters since the device was opened
  * \return 0 if successful else \ref liballuris_error
- * \sa liballuris_get_value
+ * \sa liballuris_stream_read_timestamped
  */
-int liballuris_get_digits (libusb_device_handle *dev_handle, int* v)
+int liballuris_get_sample_stats (libusb_device_handle* dev_handle, struct liballuris_sample_stats* stats)
 {
-  unsigned char out_buf[3];
-  unsigned char in_buf[6];
+  struct handle_state* s = get_handle_state (dev_handle);
+  if (! s)
+    return LIBUSB_ERROR_NO_MEM;
+  pthread_mutex_lock (&s->queue_lock);
+  *stats = s->sample_stats;
+  stats->dropped = s->lost_blocks;
+  pthread_mutex_unlock (&s->queue_lock);
+  return LIBALLURIS_SUCCESS;
+}
+
+/*!
+ * \brief Internal function to consume the late replies to cmd before it is sent again
+ *
+ * Replies only carry the command byte, so a late reply couldn't be told apart from the
+ * reply to the next command with the same byte, for example two different ID_INFO queries.
+ * Late replies to other commands which arrive meanwhile are discarded too. If no reply
+ * arrives within timeout the late replies to cmd are considered lost.
+ */
+static void drain_late_replies (libusb_device_handle* dev_handle,
+                                const char* funcname,
+                                struct handle_state* s,
+                                unsigned char cmd,
+                                unsigned int timeout)
+{
+  while (s->late_replies[cmd])
+    {
+      unsigned char buf[DEFAULT_RECV_BUF_LEN];
+      int actual;
+      if (receive_reply (dev_handle, funcname, buf, &actual, timeout) != LIBUSB_SUCCESS)
+        {
+          s->late_replies[cmd] = 0;
+          return;
+        }
+      if (s->late_replies[buf[0]])
+        {
+          s->late_replies[buf[0]]--;
+          stats_error (s, &s->stats[buf[0]].late_replies);
+          if (state_debug_level (s))
+            fprintf (stderr, "DEBUG-INFO: %s discarded late reply 0x%02x\n", funcname, buf[0]);
+        }
+      else if (state_debug_level (s))
+        fprintf (stderr, "DEBUG-INFO: %s discarded unexpected reply 0x%02x\n", funcname, buf[0]);
+    }
+}
+
+//! Internal send and receive wrapper around libusb_interrupt_transfer
+static int liballuris_interrupt_transfer (libusb_device_handle* dev_handle,
+    const char* funcname,
+    unsigned char *out_buf,
+    int send_len,
+    unsigned int send_timeout,
+    unsigned char *in_buf,
+    int reply_len,
+    unsigned int receive_timeout)
+{
+  int actual;
+  int r = 0;
+
+  if (reply_len > DEFAULT_RECV_BUF_LEN)
+    {
+      fprintf (stderr, "Error: Reply len %i > receive buffer len %i. This looks like a programming error.\n", reply_len, DEFAULT_RECV_BUF_LEN);
+      return LIBUSB_ERROR_INVALID_PARAM;
+    }
+
+  // send and receive of one command must not interleave with other threads
+  LOCK_HANDLE (dev_handle);
+  struct handle_state* s = handle_lock_;
+  unsigned char cmd = (send_len > 0)? out_buf[0] : 0;
+  if (s && send_len > 0)
+    {
+      receive_timeout = command_timeout (s, cmd, receive_timeout);
+      send_timeout = command_timeout (s, cmd, send_timeout);
+      if (reply_len > 0)
+        drain_late_replies (dev_handle, funcname, s, cmd, receive_timeout);
+    }
+
+  double t0 = monotonic_time ();
+  if (send_len > 0)
+    {
+      r = liballuris_send (dev_handle, funcname, out_buf, send_len, send_timeout);
+      if (r != LIBUSB_SUCCESS)
+        {
+          if (s)
+            stats_error (s, &s->stats[cmd].send_errors);
+          return r;
+        }
+    }
+  double t1 = monotonic_time ();
+
+  if (reply_len > 0)
+    {
+      unsigned char tmp_in_buf[DEFAULT_RECV_BUF_LEN];
+      double deadline = t0 + receive_timeout / 1.0e3;
+      for (;;)
+        {
+          // a timeout of 0 would block forever
+          double remaining = deadline - monotonic_time ();
+          unsigned int timeout = (remaining > 0)? remaining * 1.0e3 : 0;
+
+          // ID_SAMPLE packets in between are queued by the demultiplexer
+          r = receive_reply (dev_handle, funcname, tmp_in_buf, &actual, (timeout)? timeout : 1);
+          if (r == LIBUSB_ERROR_TIMEOUT && s && send_len > 0)
+            {
+              s->unresponsive = 1;
+              if (s->late_replies[cmd] < 255)
+                s->late_replies[cmd]++;
+              stats_error (s, &s->stats[cmd].timeouts);
+            }
+          if (r != LIBUSB_SUCCESS)
+            return r;
+
+          // reply to another command which timed out before, the ones to cmd were drained
+          if (s && send_len > 0 && tmp_in_buf[0] != cmd && s->late_replies[tmp_in_buf[0]])
+            {
+              s->late_replies[tmp_in_buf[0]]--;
+              stats_error (s, &s->stats[tmp_in_buf[0]].late_replies);
+              if (state_debug_level (s))
+                fprintf (stderr, "DEBUG-INFO: %s discarded late reply 0x%02x\n", funcname, tmp_in_buf[0]);
+              continue;
+            }
+          break;
+        }
+
+      double t2 = monotonic_time ();
+      if (state_debug_level (s))
+        fprintf (stderr, "DEBUG-INFO: %s send took %f s, reply took %f s\n", funcname, t1 - t0, t2 - t1);
+
+      if (s && send_len > 0)
+        {
+          s->unresponsive = 0;
+          if (tmp_in_buf[0] == cmd)
+            rtt_add (s, cmd, t2 - t0);
+        }
+
+      if (send_len > 0              // nur dann ist out_buf[0] valide
+          && (tmp_in_buf[0] != out_buf[0] ||  tmp_in_buf[1] != reply_len))
+        {
+          if (s)
+            stats_error (s, &s->stats[cmd].malformed);
+          fprintf(stderr, "Error: Malformed reply. Check physical connection and EMI.\n");
+          fprintf(stderr, "(send_cmd=0x%02X != recv_cmd=0x%02X) || (recv_len=%i != reply_len=%i),\n", out_buf[0], tmp_in_buf[0], tmp_in_buf[1], reply_len);
+
+          return LIBALLURIS_MALFORMED_REPLY;
+        }
+
+      // command replies are only a few bytes long
+      memcpy (in_buf, tmp_in_buf, reply_len);
+      if (s && send_len > 0)
+        stats_add (s, cmd, t1 - t0, t2 - t1);
+    }
+  else if (s && send_len > 0)
+    stats_add (s, cmd, t1 - t0, 0);
+  return r;
+}
+
+/****************************************************************************************/
+
+/*
+ * Device registry
+ *
+ * Compatible devices are kept per libusb context with their product string and
+ * serial number, which are read once when first needed. With hotplug support
+ * (see libusb_has_capability) the registry is updated by libusb hotplug callbacks,
+ * else it is compared with libusb_get_device_list on every lookup. Devices are
+ * only opened to read missing strings, so devices used by other processes
+ * aren't disturbed once they are known. The registry holds references to the
+ * devices and the hotplug callback of its context until liballuris_release_registry.
+ */
+
+//! Internal flags of struct registry_entry
+enum registry_valid
+{
+  REGISTRY_PRODUCT = 0x01,
+  REGISTRY_SERIAL  = 0x02
+};
+
+//! Number of hash buckets of the registry indexes
+#define REGISTRY_BUCKETS 256
+
+//! Internal registered device
+struct registry_entry
+{
+  libusb_device* dev;             //!< referenced
+  uint8_t bus;
+  uint8_t address;
+  uint8_t iProduct;               //!< index of the product string descriptor
+  unsigned int valid;             //!< mask of enum registry_valid
+  char product[35];
+  char serial_number[30];
+  char seen;                      //!< found by the last libusb_get_device_list
+  struct registry_entry* next;
+  struct registry_entry** pprev;  //!< next field pointing to this entry
+  struct registry_entry* next_id;     //!< chain of the bus/address index
+  struct registry_entry* next_serial; //!< chain of the serial number index
+};
+
+//! Internal registry of one libusb context
+struct device_registry
+{
+  struct liballuris_context* context; //!< owner
+  pthread_mutex_t lock;           //!< protects entries and indexes, taken by the hotplug callback
+  char started;                   //!< devices were looked up once
+  char hotplug;                   //!< callbacks registered
+  libusb_hotplug_callback_handle callback;
+  struct registry_entry* entries; //!< in order of arrival
+  struct registry_entry** tail;   //!< next field of the last entry
+  struct registry_entry* by_id[REGISTRY_BUCKETS];
+  struct registry_entry* by_serial[REGISTRY_BUCKETS]; //!< entries with valid serial number
+};
+
+/*!
+ * \brief Internal state of one libusb context
+ *
+ * The device registry, the calibration cache and the debug level belong to
+ * the libusb context they are used with, NULL is the default context of libusb.
+ * Created on first use, released with \ref liballuris_release_registry.
+ */
+struct liballuris_context
+{
+  libusb_context* ctx;
+  int debug_level;                        //!< -1 follows liballuris_debug_level
+  struct device_registry registry;
+  pthread_mutex_t calibration_lock;
+  struct calibration_entry* calibrations; //!< calibration blocks by serial number
+  struct liballuris_context* next;
+};
+
+static struct
+{
+  pthread_mutex_t lock;
+  struct liballuris_context* contexts;
+} contexts = {PTHREAD_MUTEX_INITIALIZER, NULL};
+
+//! Internal lookup of the state of ctx, with create it is made if missing, returns NULL if out of memory
+static struct liballuris_context* context_get (libusb_context* ctx, int create)
+{
+  pthread_mutex_lock (&contexts.lock);
+  struct liballuris_context* lc = contexts.contexts;
+  while (lc && lc->ctx != ctx)
+    lc = lc->next;
+
+  if (! lc && create && (lc = calloc (1, sizeof (struct liballuris_context))))
+    {
+      lc->ctx = ctx;
+      lc->debug_level = -1;
+      lc->registry.context = lc;
+      lc->registry.tail = &lc->registry.entries;
+      pthread_mutex_init (&lc->registry.lock, NULL);
+      pthread_mutex_init (&lc->calibration_lock, NULL);
+      lc->next = contexts.contexts;
+      contexts.contexts = lc;
+    }
+  pthread_mutex_unlock (&contexts.lock);
+  return lc;
+}
+
+//! Internal debug level of a context, NULL for handles not opened with liballuris_open_*
+static int context_debug_level (struct liballuris_context* lc)
+{
+  return (lc && lc->debug_level >= 0)? lc->debug_level : liballuris_debug_level;
+}
+
+//! Internal check for FMIS or TTT
+static int is_compatible (const struct libusb_device_descriptor* desc)
+{
+  return desc->idVendor == 0x04d8 && (desc->idProduct == 0xfc30 || desc->idProduct == 0xf25e);
+}
+
+//! Internal hash bucket of a bus/address pair
+static unsigned int registry_id_hash (int bus, int address)
+{
+  return (bus * 131 + address) % REGISTRY_BUCKETS;
+}
+
+//! Internal hash bucket of a serial number (FNV-1a)
+static unsigned int registry_serial_hash (const char* serial_number, size_t len)
+{
+  uint32_t h = 2166136261u;
+  size_t k;
+  for (k=0; k < len && serial_number[k]; k++)
+    h = (h ^ (unsigned char) serial_number[k]) * 16777619u;
+  return h % REGISTRY_BUCKETS;
+}
+
+//! Internal lookup of a registered device, call with reg->lock held
+static struct registry_entry* registry_find_dev (struct device_registry* reg, libusb_device* dev)
+{
+  struct registry_entry* e = reg->by_id[registry_id_hash (libusb_get_bus_number (dev),
+                                        libusb_get_device_address (dev))];
+  while (e && e->dev != dev)
+    e = e->next_id;
+  return e;
+}
+
+//! Internal lookup by bus and address, call with reg->lock held
+static struct registry_entry* registry_find_id (struct device_registry* reg, int bus, int address)
+{
+  struct registry_entry* e = reg->by_id[registry_id_hash (bus, address)];
+  while (e && ! (e->bus == bus && e->address == address))
+    e = e->next_id;
+  return e;
+}
+
+//! Internal lookup by serial number, call with reg->lock held
+static struct registry_entry* registry_find_serial (struct device_registry* reg, const char* serial_number)
+{
+  struct registry_entry* e = reg->by_serial[registry_serial_hash (serial_number, sizeof (e->serial_number))];
+  while (e && strncmp (serial_number, e->serial_number, sizeof (e->serial_number)))
+    e = e->next_serial;
+  return e;
+}
+
+//! Internal function to unlink e from a hash chain
+static void registry_unchain (struct registry_entry** head, struct registry_entry* e, int serial)
+{
+  while (*head && *head != e)
+    head = (serial)? &(*head)->next_serial : &(*head)->next_id;
+  if (*head)
+    *head = (serial)? e->next_serial : e->next_id;
+}
+
+//! Internal function to append a device to the registry if it's compatible, takes reg->lock
+static void registry_add (struct device_registry* reg, libusb_device* dev)
+{
+  struct libusb_device_descriptor desc;
+  int r = libusb_get_device_descriptor (dev, &desc);
+  if (r < 0)
+    {
+      fprintf (stderr, "failed to get device descriptor: %s", libusb_error_name(r));
+      return;
+    }
+  if (context_debug_level (reg->context))
+    fprintf (stderr, "DEBUG-INFO: desc.idVendor = 0x%04X, desc.idProduct = 0x%04X%s\n",
+             desc.idVendor, desc.idProduct, (is_compatible (&desc))? " (compatible)" : "");
+  if (! is_compatible (&desc))
+    return;
+
+  pthread_mutex_lock (&reg->lock);
+  struct registry_entry* e = registry_find_dev (reg, dev);
+  if (e)
+    e->seen = 1;
+  else if ((e = calloc (1, sizeof (struct registry_entry))))
+    {
+      e->dev = libusb_ref_device (dev);
+      e->bus = libusb_get_bus_number (dev);
+      e->address = libusb_get_device_address (dev);
+      e->iProduct = desc.iProduct;
+      e->seen = 1;
+
+      e->pprev = reg->tail;
+      *reg->tail = e;
+      reg->tail = &e->next;
+      struct registry_entry** head = reg->by_id + registry_id_hash (e->bus, e->address);
+      e->next_id = *head;
+      *head = e;
+    }
+  pthread_mutex_unlock (&reg->lock);
+}
+
+//! Internal function to drop a device from the registry, call with reg->lock held
+static void registry_remove (struct device_registry* reg, struct registry_entry* e)
+{
+  *e->pprev = e->next;
+  if (e->next)
+    e->next->pprev = e->pprev;
+  else
+    reg->tail = e->pprev;
+  registry_unchain (reg->by_id + registry_id_hash (e->bus, e->address), e, 0);
+  if (e->valid & REGISTRY_SERIAL)
+    registry_unchain (reg->by_serial + registry_serial_hash (e->serial_number, sizeof (e->serial_number)), e, 1);
+  libusb_unref_device (e->dev);
+  free (e);
+}
+
+//! Internal hotplug callback, may run in any thread which handles the events of reg->ctx
+static int LIBUSB_CALL registry_hotplug_cb (libusb_context* ctx, libusb_device* dev, libusb_hotplug_event event, void* user_data)
+{
+  (void) ctx;
+  struct device_registry* reg = user_data;
+  if (event == LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED)
+    registry_add (reg, dev);
+  else
+    {
+      pthread_mutex_lock (&reg->lock);
+      struct registry_entry* e = registry_find_dev (reg, dev);
+      if (e)
+        registry_remove (reg, e);
+      pthread_mutex_unlock (&reg->lock);
+    }
+  return 0;
+}
+
+//! Internal function to compare the registry with the devices libusb lists
+static void registry_rescan (struct device_registry* reg)
+{
+  if (context_debug_level (reg->context))
+    fprintf (stderr, "DEBUG-INFO: Searching for compatible USB devices...\n");
+
+  libusb_device** devs;
+  ssize_t cnt = libusb_get_device_list (reg->context->ctx, &devs);
+  if (cnt < 0)
+    return;
+
+  struct registry_entry* e;
+  pthread_mutex_lock (&reg->lock);
+  for (e = reg->entries; e; e = e->next)
+    e->seen = 0;
+  pthread_mutex_unlock (&reg->lock);
+
+  ssize_t k;
+  for (k=0; k < cnt; k++)
+    registry_add (reg, devs[k]);
+  libusb_free_device_list (devs, 1);
+
+  pthread_mutex_lock (&reg->lock);
+  struct registry_entry* next;
+  for (e = reg->entries; e; e = next)
+    {
+      next = e->next;
+      if (! e->seen)
+        registry_remove (reg, e);
+    }
+  pthread_mutex_unlock (&reg->lock);
+}
+
+//! Internal function to find or create the registry of ctx and bring it up to date
+static struct device_registry* registry_get (libusb_context* ctx)
+{
+  struct liballuris_context* lc = context_get (ctx, 1);
+  if (! lc)
+    return NULL;
+
+  struct device_registry* reg = &lc->registry;
+  pthread_mutex_lock (&contexts.lock);
+  if (! reg->started)
+    {
+      reg->started = 1;
+      // reports the present devices before it returns
+      if (libusb_has_capability (LIBUSB_CAP_HAS_HOTPLUG))
+        reg->hotplug = ! libusb_hotplug_register_callback (ctx,
+                       LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED | LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT,
+                       LIBUSB_HOTPLUG_ENUMERATE, 0x04d8, LIBUSB_HOTPLUG_MATCH_ANY, LIBUSB_HOTPLUG_MATCH_ANY,
+                       registry_hotplug_cb, reg, &reg->callback);
+    }
+  pthread_mutex_unlock (&contexts.lock);
+
+  if (reg->hotplug)
+    {
+      // deliver pending hotplug events without waiting
+      struct timeval tv = {0, 0};
+      libusb_handle_events_timeout_completed (ctx, &tv, NULL);
+    }
+  else
+    registry_rescan (reg);
+  return reg;
+}
+
+/*!
+ * \brief Internal function to copy the registry entries
+ *
+ * The copies hold a reference to their device, release them with registry_free_copy.
+ * The devices are opened without holding the registry lock.
+ */
+static ssize_t registry_copy (struct device_registry* reg, struct registry_entry** copy)
+{
+  pthread_mutex_lock (&reg->lock);
+  ssize_t n = 0;
+  struct registry_entry* e;
+  for (e = reg->entries; e; e = e->next)
+    n++;
+  *copy = malloc ((n + 1) * sizeof (struct registry_entry));
+  if (*copy)
+    for (e = reg->entries, n = 0; e; e = e->next, n++)
+      {
+        (*copy)[n] = *e;
+        libusb_ref_device (e->dev);
+      }
+  pthread_mutex_unlock (&reg->lock);
+  return (*copy)? n : LIBUSB_ERROR_NO_MEM;
+}
+
+//! Internal lookup of a device with known serial number, the result is referenced
+static libusb_device* registry_ref_serial (struct device_registry* reg, const char* serial_number)
+{
+  pthread_mutex_lock (&reg->lock);
+  struct registry_entry* e = registry_find_serial (reg, serial_number);
+  libusb_device* dev = (e)? libusb_ref_device (e->dev) : NULL;
+  pthread_mutex_unlock (&reg->lock);
+  return dev;
+}
+
+//! Internal function to release a copy from registry_copy
+static void registry_free_copy (struct registry_entry* copy, ssize_t n)
+{
+  ssize_t k;
+  for (k=0; k < n; k++)
+    if (copy[k].dev)
+      libusb_unref_device (copy[k].dev);
+  free (copy);
+}
+
+/*!
+ * \brief Internal function to read the missing strings of a registered device
+ *
+ * The device is opened and claimed shortly. The strings read are stored in e and the registry.
+ * \return 0 if successful, LIBALLURIS_DEVICE_BUSY if the serial can't be read while measuring
+ */
+static int registry_describe (struct device_registry* reg, struct registry_entry* e, char read_serial)
+{
+  libusb_device_handle* h;
+  int r = libusb_open (e->dev, &h);
+  if (r)
+    {
+      fprintf (stderr, "liballuris_get_device_list: Couldn't open device: %s\n", libusb_error_name(r));
+      return r;
+    }
+  r = libusb_claim_interface (h, 0);
+  if (r)
+    {
+      // LIBUSB_ERROR_BUSY on GNU/Linux if the device is in use by another application
+      if (r != LIBUSB_ERROR_BUSY)
+        fprintf (stderr, "liballuris_get_device_list: Couldn't claim interface: %s\n", libusb_error_name(r));
+      libusb_close (h);
+      return r;
+    }
+
+  if (! (e->valid & REGISTRY_PRODUCT))
+    {
+      int len = (e->iProduct)? libusb_get_string_descriptor_ascii (h, e->iProduct, (unsigned char*) e->product,
+                sizeof (e->product)) : 0;
+      // a failed read is only listed with the fallback and tried again with the next lookup
+      if (len < 0 || ! e->iProduct)
+        strncpy (e->product, "No product information available", sizeof (e->product));
+      if (len >= 0)
+        e->valid |= REGISTRY_PRODUCT;
+    }
+  if (read_serial && ! (e->valid & REGISTRY_SERIAL))
+    {
+      bind_handle (h, reg->context);
+      // a hung device must not hold up the enumeration
+      liballuris_set_timeout_policy (h, 0, ENUMERATION_TIMEOUT, 0);
+      r = liballuris_get_serial_number (h, e->serial_number, sizeof (e->serial_number));
+      if (! r)
+        e->valid |= REGISTRY_SERIAL;
+    }
+  liballuris_close_device (h);
+
+  pthread_mutex_lock (&reg->lock);
+  struct registry_entry* dst = registry_find_dev (reg, e->dev);
+  if (dst)
+    {
+      if (e->valid & REGISTRY_PRODUCT)
+        memcpy (dst->product, e->product, sizeof (dst->product));
+      if ((e->valid & REGISTRY_SERIAL) && ! (dst->valid & REGISTRY_SERIAL))
+        {
+          memcpy (dst->serial_number, e->serial_number, sizeof (dst->serial_number));
+          struct registry_entry** head = reg->by_serial
+                                         + registry_serial_hash (dst->serial_number, sizeof (dst->serial_number));
+          dst->next_serial = *head;
+          *head = dst;
+        }
+      dst->valid |= e->valid;
+    }
+  pthread_mutex_unlock (&reg->lock);
+  return r;
+}
+
+//! Internal entries to describe and their results, shared by the describe_thread workers
+struct describe_jobs
+{
+  struct device_registry* reg;
+  struct registry_entry* copy;
+  ssize_t cnt;
+  char read_serial;
+  int* ret;
+  atomic_size_t next;             //!< next entry to look at
+};
+
+//! Internal check whether registry_describe has to read strings of e
+static int registry_incomplete (const struct registry_entry* e, char read_serial)
+{
+  return ! (e->valid & REGISTRY_PRODUCT) || (read_serial && ! (e->valid & REGISTRY_SERIAL));
+}
+
+//! Internal worker function which runs registry_describe for the incomplete entries
+static void* describe_thread (void* arg)
+{
+  struct describe_jobs* jobs = arg;
+  size_t k;
+  while ((k = atomic_fetch_add (&jobs->next, 1)) < (size_t) jobs->cnt)
+    if (registry_incomplete (jobs->copy + k, jobs->read_serial))
+      jobs->ret[k] = registry_describe (jobs->reg, jobs->copy + k, jobs->read_serial);
+  return NULL;
+}
+
+/*!
+ * \brief Internal function to read the missing strings of all copied entries concurrently
+ *
+ * Up to \ref ENUMERATION_THREADS devices are queried at the same time, each with its own
+ * deadline, see \ref ENUMERATION_TIMEOUT. So the enumeration of a few devices takes as long
+ * as the slowest device instead of the sum of all.
+ * \param[out] ret result of registry_describe per entry, 0 if the entry was complete
+ */
+static void registry_describe_all (struct device_registry* reg, struct registry_entry* copy, ssize_t cnt,
+                                   char read_serial, int* ret)
+{
+  struct describe_jobs jobs = {reg, copy, cnt, read_serial, ret, 0};
+  pthread_t threads[ENUMERATION_THREADS];
+  int num_threads = 0, incomplete = 0;
+  ssize_t k;
+  for (k=0; k < cnt; k++)
+    {
+      ret[k] = LIBALLURIS_SUCCESS;
+      incomplete += registry_incomplete (copy + k, read_serial);
+    }
+
+  // the calling thread works too, also if no thread could be started
+  while (num_threads < ENUMERATION_THREADS - 1 && num_threads < incomplete - 1
+         && ! pthread_create (threads + num_threads, NULL, describe_thread, &jobs))
+    num_threads++;
+  describe_thread (&jobs);
+  while (num_threads)
+    pthread_join (threads[--num_threads], NULL);
+}
+
+/*!
+ * \brief List accessible alluris devices in a list of the needed size
+ *
+ * The product field in alluris_device_description is filled via the USB descriptor.
+ * After this the device is opened and the serial_number is read from the device.
+ * Thus this function only lists devices where the application has sufficient rights to open
+ * and read from the device. Check permissions if a device isn't returned.
+ *
+ * Product and serial number are cached per device, see \ref liballuris_release_registry.
+ * A known device is listed without opening it again, also if another application uses it meanwhile.
+ * Unknown devices are queried concurrently. A device which doesn't send its serial number
+ * within \ref ENUMERATION_TIMEOUT is listed with serial number "*ERROR*".
+ *
+ * The list is terminated by an element with dev == NULL and has to be freed
+ * with \ref liballuris_free_device_array.
+ * \param[in] ctx pointer to libusb context
+ * \param[out] list storage for the pointer to the allocated list
+ * \param[in] read_serial try to read the serial from devices
+ * \return number of devices in list if successful else \ref liballuris_error
+ * \sa liballuris_free_device_array
+ */
+ssize_t liballuris_get_device_array (libusb_context* ctx, struct alluris_device_description** list, char read_serial)
+{
+  *list = NULL;
+  struct device_registry* reg = registry_get (ctx);
+  if (! reg)
+    return LIBUSB_ERROR_NO_MEM;
+  struct registry_entry* copy;
+  ssize_t cnt = registry_copy (reg, &copy);
+  if (cnt < 0)
+    return cnt;
+
+  int* status = malloc ((cnt + 1) * sizeof (int));
+  struct alluris_device_description* devs = calloc (cnt + 1, sizeof (struct alluris_device_description));
+  if (! status || ! devs)
+    {
+      free (status);
+      free (devs);
+      registry_free_copy (copy, cnt);
+      return LIBUSB_ERROR_NO_MEM;
+    }
+  registry_describe_all (reg, copy, cnt, read_serial, status);
+
+  ssize_t num_alluris_devices = 0;
+  ssize_t i;
+  for (i=0; i < cnt; i++)
+    {
+      struct registry_entry* e = copy + i;
+      // not accessible
+      if (! (e->valid & REGISTRY_PRODUCT) && ! e->product[0])
+        continue;
+
+      struct alluris_device_description* d = devs + num_alluris_devices++;
+      d->dev = e->dev;
+      e->dev = NULL;
+      memcpy (d->product, e->product, sizeof (d->product));
+      if (e->valid & REGISTRY_SERIAL)
+        memcpy (d->serial_number, e->serial_number, sizeof (d->serial_number));
+      else if (read_serial && status[i] == LIBALLURIS_DEVICE_BUSY)
+        // measurement is running, serial cannot be read
+        strcpy (d->serial_number, "*BUSY*");
+      else if (read_serial)
+        strcpy (d->serial_number, "*ERROR*");
+      else
+        d->serial_number[0] = 0;
+    }
+  free (status);
+  registry_free_copy (copy, cnt);
+  *list = devs;
+  return num_alluris_devices;
+}
+
+/*!
+ * \brief Free list from liballuris_get_device_array
+ *
+ * Releases the references to the devices and the list itself.
+ * \param[in] list as returned by \ref liballuris_get_device_array, may be NULL
+ */
+void liballuris_free_device_array (struct alluris_device_description* list)
+{
+  struct alluris_device_description* d;
+  for (d = list; d && d->dev; d++)
+    libusb_unref_device (d->dev);
+  free (list);
+}
+
+/*!
+ * \brief List accessible alluris devices into a caller supplied array
+ *
+ * Like \ref liballuris_get_device_array but at most length devices are listed.
+ * Unused elements of alluris_devs are set to dev == NULL.
+ *
+ * The retrieved list has to be freed with \ref liballuris_free_device_list before the application exits.
+ * \param[in] ctx pointer to libusb context
+ * \param[out] alluris_devs pointer to storage for the device list
+ * \param[in] length number of elements in alluris_devs
+ * \param[in] read_serial try to read the serial from devices
+ * \return number of listed devices if successful else \ref liballuris_error
+ * \sa liballuris_free_device_list
+ */
+int liballuris_get_device_list (libusb_context* ctx, struct alluris_device_description* alluris_devs, size_t length, char read_serial)
+{
+  size_t k = 0;
+  for (k=0; k<length; ++k)
+    alluris_devs[k].dev = NULL;
+
+  struct alluris_device_description* list;
+  ssize_t cnt = liballuris_get_device_array (ctx, &list, read_serial);
+  if (cnt < 0)
+    return cnt;
+
+  for (k=0; k < (size_t) cnt && k < length; k++)
+    {
+      alluris_devs[k] = list[k];
+      list[k].dev = NULL;
+    }
+  // unref the devices which didn't fit
+  for (; k < (size_t) cnt; k++)
+    libusb_unref_device (list[k].dev);
+  free (list);
+  return (cnt < (ssize_t) length)? cnt : (ssize_t) length;
+}
+
+/*!
+ * \brief Release the liballuris state of a libusb context
+ *
+ * Deregisters the hotplug callback, drops the references to the devices, the cached
+ * calibration blocks and the debug level of ctx. This has to be called before libusb_exit
+ * if liballuris_get_device_list, liballuris_get_device_array, one of the liballuris_open_*
+ * functions or liballuris_set_context_debug_level was used with ctx. Else the device
+ * references leak and a later context at the same address would find the state of the
+ * freed one. Handles still open on ctx fall back to liballuris_debug_level and the
+ * calibration cache of the default context.
+ *
+ * \param[in] ctx pointer to libusb context
+ */
+void liballuris_release_registry (libusb_context* ctx)
+{
+  pthread_mutex_lock (&contexts.lock);
+  struct liballuris_context** plc = &contexts.contexts;
+  while (*plc && (*plc)->ctx != ctx)
+    plc = &(*plc)->next;
+  struct liballuris_context* lc = *plc;
+  if (lc)
+    *plc = lc->next;
+  pthread_mutex_unlock (&contexts.lock);
+  if (! lc)
+    return;
+
+  struct handle_state* s;
+  pthread_rwlock_wrlock (&handle_table.lock);
+  for (s = handle_table.handles; s; s = s->next)
+    if (s->context == lc)
+      s->context = NULL;
+  pthread_rwlock_unlock (&handle_table.lock);
+  if (lc->debug_level >= 0)
+    atomic_fetch_sub (&own_debug_levels, 1);
+
+  struct device_registry* reg = &lc->registry;
+  if (reg->hotplug)
+    libusb_hotplug_deregister_callback (ctx, reg->callback);
+  pthread_mutex_lock (&reg->lock);
+  while (reg->entries)
+    registry_remove (reg, reg->entries);
+  pthread_mutex_unlock (&reg->lock);
+  pthread_mutex_destroy (&reg->lock);
+
+  clear_calibrations (lc);
+  pthread_mutex_destroy (&lc->calibration_lock);
+  free (lc);
+}
+
+/*!
+ * \brief Free list filled from get_alluris_device_list
+ */
+void liballuris_free_device_list (struct alluris_device_description* alluris_devs, size_t length)
+{
+  size_t k = 0;
+  for (k=0; k < length; ++k)
+    if (alluris_devs[k].dev)
+      {
+        libusb_unref_device (alluris_devs[k].dev);
+        alluris_devs[k].dev = NULL;
+      }
+}
+
+void liballuris_print_device_list (FILE *sink, libusb_context* ctx)
+{
+  // list accessible devices and exit
+  // FIXME: document that a running measurement prohibits reading the serial_number
+
+  struct alluris_device_description* alluris_devs;
+  ssize_t cnt = liballuris_get_device_array (ctx, &alluris_devs, 1);
+
+  int k;
+  fprintf (sink, "#Num; Bus; Dev; Product;                   Serial\n");
+  for (k=0; k < cnt; k++)
+    fprintf (sink, " %03i; %03d; %03d; %-25s; %s\n", k+1,
+             libusb_get_bus_number(alluris_devs[k].dev),
+             libusb_get_device_address(alluris_devs[k].dev),
+             alluris_devs[k].product,
+             alluris_devs[k].serial_number);
+
+  if (!cnt)
+    fprintf (stderr, "Error: No accessible device found\n");
+  else if (cnt < 0)
+    fprintf (stderr, "Error: Couldn't list devices: %s\n", liballuris_error_name (cnt));
+
+  // free device list
+  liballuris_free_device_array (alluris_devs);
+}
+
+/*!
+ * \brief Open device with specified serial_number or the first available if NULL
+ *
+ * Registered devices with known serial number are opened directly. Else all devices
+ * with unknown serial number are queried concurrently like in \ref liballuris_get_device_list.
+ * Without serial_number the first device which can be claimed is opened.
+ *
+ * \param[in] ctx pointer to libusb context
+ * \param[in] serial_number of device or NULL
+ * \param[out] h storage for handle to communicate with the device
+ * \return 0 if successful else \ref liballuris_error
+ */
+int liballuris_open_device (libusb_context* ctx, const char* serial_number, libusb_device_handle** h)
+{
+  struct device_registry* reg = registry_get (ctx);
+  if (! reg)
+    return LIBUSB_ERROR_NO_MEM;
+
+  // known serial number, no need to look at the other devices
+  libusb_device* dev = (serial_number)? registry_ref_serial (reg, serial_number) : NULL;
+  if (dev)
+    {
+      int ret = libusb_open (dev, h);
+      libusb_unref_device (dev);
+      if (! ret)
+        bind_handle (*h, reg->context);
+      return ret;
+    }
+
+  struct registry_entry* copy;
+  ssize_t cnt = registry_copy (reg, &copy);
+  if (cnt < 0)
+    return cnt;
+
+  if (context_debug_level (reg->context))
+    fprintf (stderr, "DEBUG-INFO: liballuris_open_device: found %zi device(s)\n", cnt);
+
+  int ret = LIBUSB_ERROR_NOT_FOUND;
+  ssize_t k;
+  if (! serial_number)
+    {
+      // skip devices which are used by other applications
+      for (k=0; k < cnt && ret; k++)
+        if (! (ret = libusb_open (copy[k].dev, h)))
+          {
+            ret = libusb_claim_interface (*h, 0);
+            if (ret)
+              libusb_close (*h);
+            else
+              libusb_release_interface (*h, 0);
+          }
+      if (ret)
+        ret = LIBUSB_ERROR_NOT_FOUND;
+    }
+  else
+    {
+      int* status = malloc ((cnt + 1) * sizeof (int));
+      if (status)
+        {
+          registry_describe_all (reg, copy, cnt, 1, status);
+          free (status);
+          dev = registry_ref_serial (reg, serial_number);
+        }
+      else
+        ret = LIBUSB_ERROR_NO_MEM;
+      if (dev)
+        {
+          ret = libusb_open (dev, h);
+          libusb_unref_device (dev);
+        }
+    }
+
+  registry_free_copy (copy, cnt);
+  if (! ret)
+    bind_handle (*h, reg->context);
+  return ret;
+}
+
+
+/*!
+ * \brief Open device with specified bus and device id.
+ *
+ * Other devices aren't opened.
+ *
+ * \param[in] ctx pointer to libusb context
+ * \param[in] bus id of device
+ * \param[in] device id of device
+ * \param[out] h storage for handle to communicate with the device
+ * \return 0 if successful else \ref liballuris_error
+ */
+int liballuris_open_device_with_id (libusb_context* ctx, int bus, int device, libusb_device_handle** h)
+{
+  struct device_registry* reg = registry_get (ctx);
+  if (! reg)
+    return LIBUSB_ERROR_NO_MEM;
+
+  pthread_mutex_lock (&reg->lock);
+  struct registry_entry* e = registry_find_id (reg, bus, device);
+  libusb_device* dev = (e)? libusb_ref_device (e->dev) : NULL;
+  pthread_mutex_unlock (&reg->lock);
+
+  //no device found
+  int ret = LIBUSB_ERROR_NOT_FOUND;
+  if (dev)
+    {
+      ret = libusb_open (dev, h);
+      libusb_unref_device (dev);
+      if (! ret)
+        bind_handle (*h, reg->context);
+    }
+  return ret;
+}
+
+/*!
+ * \brief Check if a device is already connected (h != 0) and connect else
+ *
+ * If serial_or_bus_id contains one dot (.), it's considered as a serial number
+ * for example L.12345, if it contains a comma (,) serial_or_bus_id is considered to
+ * be bus_id,device_id pair.
+ * \param[in] ctx pointer to libusb context
+ * \param[in] serial_or_bus_id serial or bus_id,device_id or NULL
+ * \return 0 if successful else \ref liballuris_error
+ */
+
+int liballuris_open_if_not_opened (libusb_context* ctx, const char* serial_or_bus_id, libusb_device_handle** h)
+{
+  //printf ("liballuris_open_if_not_opened h=%x\n", *h);
+
+  int r = 0;
+  if (! *h)
+    {
+      if (! serial_or_bus_id) //connect to first available device
+        {
+          r = liballuris_open_device (ctx, serial_or_bus_id, h);
+          if (r)
+            {
+              fprintf (stderr, "Error: Couldn't open device: %s\n", liballuris_error_name (r));
+            }
+        }
+      else //bus,device or serial
+        {
+          // decide whether it's a serial number or a bus,device pair
+          const char* pc = strchr (serial_or_bus_id, ',');
+          if (pc)
+            {
+              // split "Bus,Device"
+              char *endptr, *endptr2 = NULL;
+              int bus = strtol (serial_or_bus_id, &endptr, 10);
+              if (endptr == serial_or_bus_id)
+                {
+                  fprintf (stderr, "Error: Couldn't find bus_id in '%s'\n", serial_or_bus_id);
+                  return LIBALLURIS_PARSE_ERROR;
+                }
+              if (*endptr != ',')
+                {
+                  fprintf (stderr, "Error: Wrong delimiter '%c', please use ',' instead\n", *endptr);
+                  return LIBALLURIS_PARSE_ERROR;
+                }
+              int device = strtol (++endptr, &endptr2, 10);
+              if (endptr2 == endptr)
+                {
+                  fprintf (stderr, "Error: Couldn't find device_id in '%s'\n", serial_or_bus_id);
+                  return LIBALLURIS_PARSE_ERROR;
+                }
+
+              r = liballuris_open_device_with_id (ctx, bus, device, h);
+              if (r)
+                {
+                  fprintf (stderr, "Error: Couldn't open device with bus=%i and device=%i: %s\n", bus, device, liballuris_error_name (r));
+                }
+            }
+          else // serial
+            {
+              r = liballuris_open_device (ctx, serial_or_bus_id, h);
+              if (r)
+                {
+                  fprintf (stderr, "Error: Couldn't open device with serial='%s': %s\n", serial_or_bus_id, liballuris_error_name (r));
+                }
+            }
+        }
+
+      if (*h)
+        {
+          r = libusb_claim_interface (*h, 0);
+          if (r)
+            {
+              fprintf (stderr, "Error: Couldn't claim interface: %s\n", liballuris_error_name (r));
+            }
+        }
+    }
+  //printf ("open_if_not_opened h=%x\n", *h);
+  return r;
+}
+
+/*!
+ * \brief Release the interface and close a device opened with liballuris_open_*
+ *
+ * Also frees the queues of the packet demultiplexer, a later handle with
+ * the same address must not inherit them. Use this instead of libusb_close.
+ * No other thread may use the handle anymore.
+ *
+ * \param[in] h handle to close
+ */
+void liballuris_close_device (libusb_device_handle* h)
+{
+  free_handle_state (h);
+  libusb_release_interface (h, 0);
+  libusb_close (h);
+}
+
+/*!
+ * \brief Clear receive buffer
+ *
+ * Try to read 64 bytes from receive endpoint to clear the USB receive queue after some error.
+ * There is no error if a timeout occurs.
+ * \param[in] dev_handle a handle for the device to communicate with
+ * \param[in] timeout read timeout
+ */
+void liballuris_clear_RX (libusb_device_handle* dev_handle, unsigned int timeout)
+{
+  unsigned char data[64];
+  int actual;
+  LOCK_HANDLE (dev_handle);
+
+  // replies to timed out commands are dropped here too
+  if (handle_lock_)
+    memset (handle_lock_->late_replies, 0, sizeof (handle_lock_->late_replies));
+  int r = libusb_interrupt_transfer (dev_handle, 0x81 | LIBUSB_ENDPOINT_IN, data, 64, &actual, timeout);
+
+  if (state_debug_level (handle_lock_))
+    fprintf (stderr, "DEBUG-INFO: clear_RX: libusb_interrupt_transfer returned '%s', actual = %i\n", libusb_error_name(r), actual);
+}
+
+/*!
+ * \brief Query the serial number
+ *
+ * Return the serial number of the device which is also laser-engraved on the back.
+ * For example "P.25412"
+ *
+ * Query the serial number is only possible if the measurement is not running,
+ * else LIBALLURIS_DEVICE_BUSY is returned.
+ *
+ * \param[in] dev_handle a handle for the device to communicate with
+ * \param[out] buf output location for the serial number. Only populated if the return code is 0.
+ * \param[in] length length of buffer in bytes
+ * \return 0 if successful else \ref liballuris_error. LIBALLURIS_DEVICE_BUSY if measurement is running
+ */
+int liballuris_get_serial_number (libusb_device_handle *dev_handle, char* buf, size_t length)
+{
+  unsigned char out_buf[3];
+  unsigned char in_buf[6];
+
+  out_buf[0] = 0x08;
+  out_buf[1] = 3;
+  out_buf[2] = 6;
+  int ret = liballuris_interrupt_transfer (dev_handle, __FUNCTION__,
+            out_buf, sizeof (out_buf), DEFAULT_SEND_TIMEOUT,
+            in_buf, sizeof (in_buf), DEFAULT_RECEIVE_TIMEOUT);
+  if (ret == LIBALLURIS_SUCCESS)
+    {
+      unsigned short tmp = char_to_uint16 (in_buf + 3);
+      if (tmp == 65535)
+        return LIBALLURIS_DEVICE_BUSY;
+      else
+        snprintf (buf, length, "%c.%i", in_buf[5] + 'A', tmp);
+    }
+  return ret;
+}
+
+/*!
+ * \brief Query firmware version
+ *
+ * The returned string in buf is for example "V5.03.009"
+ * If the measurement is running, the firmware can't be read from the measurement processor
+ * and "V255.255.255" is returned instead.
+ *
+ * Since firmware V5.05.003 the measurement processor firmware can no longer
+ * been read separately and will always return V0.255.255
+ *
+ * \param[in] dev_handle a handle for the device to communicate with
+ * \param[in] dev 0=USB communication processor, 1=measurement processor
+ * \param[out] buf output location for the firmware string. Only populated if the return code is 0.
+ * \param[in] length length of buffer in bytes
+ * \return 0 if successful else \ref liballuris_error.
+ */
+int liballuris_get_firmware (libusb_device_handle *dev_handle, int dev, char* buf, size_t length)
+{
+  unsigned char out_buf[3];
+  unsigned char in_buf[6];
+
+  if (dev < 0 || dev > 1)
+    return LIBALLURIS_OUT_OF_RANGE;
+
+  out_buf[0] = 0x08;
+  out_buf[1] = 3;
+  out_buf[2] = dev;
+  int ret = liballuris_interrupt_transfer (dev_handle, __FUNCTION__,
+            out_buf, sizeof (out_buf), DEFAULT_SEND_TIMEOUT,
+            in_buf, sizeof (in_buf), DEFAULT_RECEIVE_TIMEOUT);
+  if (ret == LIBALLURIS_SUCCESS)
+    snprintf (buf, length, "V%i.%02i.%03i", in_buf[5], in_buf[4], in_buf[3]);
+  return ret;
+}
+
+/*!
+ * \brief Query next calibration date
+ *
+ * The returned int v is YYMM for example "1502" for February 2015
+ * If the measurement is running, the next calibration date can't be read from the measurement processor
+ * and LIBALLURIS_DEVICE_BUSY is returned instead.
+ *
+ * \param[in] dev_handle a handle for the device to communicate with
+ * \param[out] v output location for the next calibration date. Only populated if the return code is 0.
+ * \return 0 if successful else \ref liballuris_error.
+ */
+int liballuris_get_next_calibration_date (libusb_device_handle *dev_handle, int* v)
+{
+  unsigned char out_buf[3];
+  unsigned char in_buf[6];
+
+  out_buf[0] = 0x08;
+  out_buf[1] = 3;
+  out_buf[2] = 7;
+  int ret = liballuris_interrupt_transfer (dev_handle, __FUNCTION__,
+            out_buf, sizeof (out_buf), DEFAULT_SEND_TIMEOUT,
+            in_buf, sizeof (in_buf), DEFAULT_RECEIVE_TIMEOUT);
+  if (ret == LIBALLURIS_SUCCESS)
+    {
+      *v = char_to_int24 (in_buf + 3);
+      if (*v == -1)
+        return LIBALLURIS_DEVICE_BUSY;
+    }
+  return ret;
+}
+
+int liballuris_read_flash (libusb_device_handle *dev_handle, int adr, unsigned short *v)
+{
+  unsigned char out_buf[4];
+  unsigned char in_buf[6];
+
+  out_buf[0] = 0x72;
+  out_buf[1] = 4;
+  out_buf[2] = adr & 0xFF;
+  out_buf[3] = adr >> 8;
+  int ret = liballuris_interrupt_transfer (dev_handle, __FUNCTION__,
+            out_buf, sizeof (out_buf), DEFAULT_SEND_TIMEOUT,
+            in_buf, sizeof (in_buf), DEFAULT_RECEIVE_TIMEOUT);
+  if (ret == LIBALLURIS_SUCCESS)
+    {
+      *v  = in_buf[5] << 8;
+      *v += in_buf[4];
+    }
+  return ret;
+}
+
+/*!
+ * \brief Read consecutive flash words
+ *
+ * The requests are pipelined with \ref DEFAULT_PIPELINE_DEPTH in flight, see \ref liballuris_batch_run.
+ *
+ * \param[in] dev_handle a handle for the device to communicate with
+ * \param[in] adr first word address
+ * \param[out] buf output location for length words. Only populated if the return code is 0.
+ * \param[in] length number of words
+ * \return 0 if successful else \ref liballuris_error
+ * \sa liballuris_read_flash
+ */
+int liballuris_read_flash_range (libusb_device_handle *dev_handle, int adr, unsigned short* buf, size_t length)
+{
+  if (adr < 0 || adr + length > 0x10000)
+    return LIBALLURIS_OUT_OF_RANGE;
+
+  struct liballuris_batch* batch;
+  int ret = liballuris_batch_new (dev_handle, DEFAULT_PIPELINE_DEPTH, &batch);
+  if (ret)
+    return ret;
+  size_t k;
+  for (k=0; k < length; k++)
+    {
+      int index = liballuris_batch_read_flash (batch, adr + k, buf + k);
+      if (index < 0)
+        {
+          liballuris_batch_free (batch);
+          return index;
+        }
+    }
+  ret = liballuris_batch_run (batch);
+  liballuris_batch_free (batch);
+  return ret;
+}
+
+/*
+ * PIC flash organisation, since firmware 5.04.005
+ * word adr; word value (16bit)
+ * 0       ; cal_date, days since 1.1.2000, unsigned short
+ * 1..4    ; uncertainty, double
+ * 5..24   ; calibration_number as char[40]
+ */
+
+//! Number of flash words in the calibration block
+#define CALIBRATION_WORDS 25
+
+//! Internal calibration block of one gauge
+struct calibration_entry
+{
+  char serial[20];
+  unsigned short words[CALIBRATION_WORDS];
+  struct calibration_entry* next;
+};
+
+//! Internal serial number query, the serial number never changes so it is only read once per handle
+static int cached_serial_number (libusb_device_handle* dev_handle, char* buf, size_t length)
+{
+  LOCK_HANDLE (dev_handle);
+  struct handle_state* s = handle_lock_;
+  if (! s || ! (s->cache.valid & CACHE_SERIAL))
+    {
+      char serial[20];
+      int ret = liballuris_get_serial_number (dev_handle, serial, sizeof (serial));
+      if (ret)
+        return ret;
+      if (! s)
+        {
+          snprintf (buf, length, "%s", serial);
+          return LIBALLURIS_SUCCESS;
+        }
+      strcpy (s->cache.serial, serial);
+      s->cache.valid |= CACHE_SERIAL;
+    }
+  snprintf (buf, length, "%s", s->cache.serial);
+  return LIBALLURIS_SUCCESS;
+}
+
+/*!
+ * \brief Internal function to fetch the calibration block from the cache or from flash
+ *
+ * The calibration block only changes at recalibration, it survives closing and
+ * reopening the device. It is cached by serial number in the context the handle was
+ * opened with, other handles use the cache of the default context. The first use on
+ * a handle reads the calibration date back, a recalibrated gauge has a new one.
+ */
+static int calibration_block (libusb_device_handle* dev_handle, unsigned short* words)
+{
+  LOCK_HANDLE (dev_handle);
+  struct handle_state* s = handle_lock_;
+
+  // without serial number (for example while measuring) the block isn't cached
+  char serial[20];
+  int have_serial = ! cached_serial_number (dev_handle, serial, sizeof (serial));
+  struct liballuris_context* lc = NULL;
+  if (have_serial)
+    lc = (s && s->context)? s->context : context_get (NULL, 1);
+  struct calibration_entry* e = NULL;
+  if (lc)
+    {
+      pthread_mutex_lock (&lc->calibration_lock);
+      for (e = lc->calibrations; e && strcmp (e->serial, serial); e = e->next);
+      if (e)
+        memcpy (words, e->words, sizeof (e->words));
+      pthread_mutex_unlock (&lc->calibration_lock);
+    }
+  if (e)
+    {
+      if (s && s->calibration_checked)
+        return LIBALLURIS_SUCCESS;
+      unsigned short date;
+      int ret = liballuris_read_flash (dev_handle, 0, &date);
+      if (ret)
+        return ret;
+      if (date == words[0])
+        {
+          if (s)
+            s->calibration_checked = 1;
+          return LIBALLURIS_SUCCESS;
+        }
+    }
+
+  int ret = liballuris_read_flash_range (dev_handle, 0, words, CALIBRATION_WORDS);
+  if (ret || ! lc)
+    return ret;
+  if (s)
+    s->calibration_checked = 1;
+
+  // the entry may have been dropped by liballuris_clear_calibration_cache meanwhile
+  pthread_mutex_lock (&lc->calibration_lock);
+  for (e = lc->calibrations; e && strcmp (e->serial, serial); e = e->next);
+  if (! e && (e = calloc (1, sizeof (struct calibration_entry))))
+    {
+      strcpy (e->serial, serial);
+      e->next = lc->calibrations;
+      lc->calibrations = e;
+    }
+  if (e)
+    memcpy (e->words, words, sizeof (e->words));
+  pthread_mutex_unlock (&lc->calibration_lock);
+  return ret;
+}
+
+/*!
+ * \brief Query the calibration block
+ * Since firmware 5.04.005
+ *
+ * The block is read with one pipelined \ref liballuris_read_flash_range and cached
+ * by serial number per libusb context until \ref liballuris_clear_calibration_cache.
+ * The first call on a handle compares the calibration date of the cached block with
+ * the gauge (one flash word) and reads the block again if it differs.
+ *
+ * \param[in] dev_handle a handle for the device to communicate with
+ * \param[out] cal output location. Only populated if the return code is 0.
+ * \return 0 if successful else \ref liballuris_error.
+ */
+int liballuris_get_calibration (libusb_device_handle *dev_handle, struct liballuris_calibration* cal)
+{
+  unsigned short words[CALIBRATION_WORDS];
+  int ret = calibration_block (dev_handle, words);
+  if (ret == LIBALLURIS_SUCCESS)
+    {
+      cal->date = words[0];
+      memcpy (&cal->uncertainty, words + 1, sizeof (cal->uncertainty));
+      memcpy (cal->number, words + 5, 40);
+      cal->number[40] = 0;
+    }
+  return ret;
+}
+
+//! Internal function to drop the cached calibration blocks of a context
+static void clear_calibrations (struct liballuris_context* lc)
+{
+  pthread_mutex_lock (&lc->calibration_lock);
+  while (lc->calibrations)
+    {
+      struct calibration_entry* e = lc->calibrations;
+      lc->calibrations = e->next;
+      free (e);
+    }
+  pthread_mutex_unlock (&lc->calibration_lock);
+}
+
+/*!
+ * \brief Drop the cached calibration blocks of a libusb context, for example after a recalibration
+ *
+ * \param[in] ctx pointer to libusb context, NULL also covers handles not opened with liballuris_open_*
+ */
+void liballuris_clear_calibration_cache (libusb_context* ctx)
+{
+  struct liballuris_context* lc = context_get (ctx, 0);
+  if (lc)
+    clear_calibrations (lc);
+}
+
+/*!
+ * \brief Query calibration date
+ * Since firmware 5.04.005
+ * The returned int v is days since year 2000
+ *
+ * \param[in] dev_handle a handle for the device to communicate with
+ * \param[out] v output location for the calibration date. Only populated if the return code is 0.
+ * \return 0 if successful else \ref liballuris_error.
+ * \sa liballuris_get_calibration
+ */
+int liballuris_get_calibration_date (libusb_device_handle *dev_handle, unsigned short* v)
+{
+  unsigned short words[CALIBRATION_WORDS];
+  int ret = calibration_block (dev_handle, words);
+  if (ret == LIBALLURIS_SUCCESS)
+    *v = words[0];
+  return ret;
+}
+
+//! Since firmware 5.04.005, see \ref liballuris_get_calibration
+int liballuris_get_calibration_number (libusb_device_handle *dev_handle, char* buf, size_t length)
+{
+  if (length > 40)
+    length = 40;
+  // needs to be multiple of 2bytes (words)
+  if (length % 2)
+    return LIBALLURIS_OUT_OF_RANGE;
+
+  unsigned short words[CALIBRATION_WORDS];
+  int ret = calibration_block (dev_handle, words);
+  if (ret == LIBALLURIS_SUCCESS)
+    memcpy (buf, words + 5, length);
+  return ret;
+}
+
+//! Since firmware 5.04.005, see \ref liballuris_get_calibration
+int liballuris_get_uncertainty (libusb_device_handle *dev_handle, double* v)
+{
+  unsigned short words[CALIBRATION_WORDS];
+  int ret = calibration_block (dev_handle, words);
+  if (ret == LIBALLURIS_SUCCESS)
+    memcpy (v, words + 1, sizeof (*v));
+  return ret;
+}
+
+/*!
+ * \brief Query the number of digits for the interpretation of the raw fixed-point numbers
+ *
+ * All liballuris_get_* functions return fixed-point numbers or strings. This function queries the number
+ * of digits after the radix point. For example if \ref liballuris_get_value returns 123 and digits returns 1
+ * the real value is 12.3. Use \ref liballuris_get_unit to get a meaningful measurement.
+ *
+ * Query this value is only possible if the measurement is not running,
+ * else LIBALLURIS_DEVICE_BUSY is returned.
+ *
+ * \param[in] dev_handle a handle for the device to communicate with
+ * \param[out] v output location for the returned number of digits. Only populated if the return code is 0.
+ * \return 0 if successful else \ref liballuris_error
+ * \sa liballuris_get_value
+ */
+int liballuris_get_digits (libusb_device_handle *dev_handle, int* v)
+{
+  unsigned char out_buf[3];
+  unsigned char in_buf[6];
+
+  out_buf[0] = 0x08;
+  out_buf[1] = 3;
+  out_buf[2] = 3;
+  int ret = liballuris_interrupt_transfer (dev_handle, __FUNCTION__,
+            out_buf, sizeof (out_buf), DEFAULT_SEND_TIMEOUT,
+            in_buf, sizeof (in_buf), DEFAULT_RECEIVE_TIMEOUT);
+  if (ret == LIBALLURIS_SUCCESS)
+    {
+      *v = char_to_int24 (in_buf + 3);
+      if (*v == -1)
+        return LIBALLURIS_DEVICE_BUSY;
+    }
+  return ret;
+}
+
+//! Internal mapping of \ref liballuris_variant to the product name
+static const char* variant_name (int v)
+{
+  switch (v)
+    {
+    case LIBALLURIS_VARIANT_S10:
+      return "FMI-S10";
+    case LIBALLURIS_VARIANT_S20:
+      return "FMI-S20";
+    case LIBALLURIS_VARIANT_S30:
+      return "FMI-S30";
+    case LIBALLURIS_VARIANT_W30:
+      return "FMT-W30";
+    case LIBALLURIS_VARIANT_W40:
+      return "FMT-W40";
+    case LIBALLURIS_VARIANT_S50:
+      return "FMI-S50";
+    case LIBALLURIS_VARIANT_W20:
+      return "FMI-W20";
+    case LIBALLURIS_VARIANT_W10:
+      return "FMT-W10";
+    case LIBALLURIS_VARIANT_B10:
+      return "FMI-B10";
+    case LIBALLURIS_VARIANT_B20:
+      return "FMI-B20";
+    case LIBALLURIS_VARIANT_B30:
+      return "FMI-B30";
+    case LIBALLURIS_VARIANT_B50:
+      return "FMI-B50";
+    case LIBALLURIS_VARIANT_FMT_315:
+      return "FMT-315";
+    case LIBALLURIS_VARIANT_CTT_200:
+      return "CTT-200";
+    case LIBALLURIS_VARIANT_CTT_300:
+      return "CTT-300";
+    case LIBALLURIS_VARIANT_TTT_200:
+      return "TTT-200";
+    case LIBALLURIS_VARIANT_TTT_300:
+      return "TTT-300";
+    }
+  return "unknown";
+}
+
+/*!
+ * \brief Query the variant
+ *
+ * Supported devices:
+ * 0x0000: FMI-S10
+ * 0x0001: FMI-S20
+ * 0x0002: FMI-S30
+ * 0x0003: FMI-W30
+ * 0x0004: FMI-W40
+ * 0x0005: FMI-S50
+ * 0x0006: FMI-W20
+ * 0x0007: FMT-W10
+ * 0x0010: FMI-B10
+ * 0x0011: FMI-B20
+ * 0x0012: FMI-B30
+ * 0x0015: FMI-B50
+ * 0x0020: FMT-315
+ * 0x0040: CTT-200
+ * 0x0080: CTT-300
+ * 0x0100: TTT-200
+ * 0x0200: TTT-300
+ *
+ * \param[in] dev_handle a handle for the device to communicate with
+ * \param[out] v output location for the returned variant. Only populated if the return code is 0.
+ * \return 0 if successful else \ref liballuris_error
+ * \sa liballuris_get_value
+ */
+int liballuris_get_variant (libusb_device_handle *dev_handle, char* buf, size_t length)
+{
+  unsigned char out_buf[3];
+  unsigned char in_buf[6];
+
+  out_buf[0] = 0x08;
+  out_buf[1] = 3;
+  out_buf[2] = 4;
+  int ret = liballuris_interrupt_transfer (dev_handle, __FUNCTION__,
+            out_buf, sizeof (out_buf), DEFAULT_SEND_TIMEOUT,
+            in_buf, sizeof (in_buf), DEFAULT_RECEIVE_TIMEOUT);
+  if (ret == LIBALLURIS_SUCCESS)
+    {
+      int v = char_to_int24 (in_buf + 3);
+      if (v == -1)
+        return LIBALLURIS_DEVICE_BUSY;
+
+      snprintf (buf, length, "%s", variant_name (v));
+    }
+  return ret;
+}
+
+/*!
+ * \brief Query the resolution
+ *
+ * Since firmware 5.04.005
+ *
+ * The resolution as floating point number is 10^(-get_digits) * get_resolution.
+ * Possible values for resolution are 1, 2, 5.
+ *
+ * Example: get_unit returns LIBALLURIS_UNIT_N, get_digit returns 2,
+ * get_resolution returns 5 -> real resolution of 0.05N
+ *
+ * Query this value is only possible if the measurement is not running,
+ * else LIBALLURIS_DEVICE_BUSY is returned.
+ *
+ * \param[in] dev_handle a handle for the device to communicate with
+ * \param[out] v output location for the returned resolution. Only populated if the return code is 0.
+ * \return 0 if successful else \ref liballuris_error
+ * \sa liballuris_get_digits
+ */
+
+int liballuris_get_resolution (libusb_device_handle *dev_handle, int* v)
+{
+  unsigned char out_buf[3];
+  unsigned char in_buf[6];
+
+  out_buf[0] = 0x08;
+  out_buf[1] = 3;
+  out_buf[2] = 16;
+  int ret = liballuris_interrupt_transfer (dev_handle, __FUNCTION__,
+            out_buf, sizeof (out_buf), DEFAULT_SEND_TIMEOUT,
+            in_buf, sizeof (in_buf), DEFAULT_RECEIVE_TIMEOUT);
+  if (ret == LIBALLURIS_SUCCESS)
+    {
+      *v = char_to_int24 (in_buf + 3);
+      if (*v == -1)
+        return LIBALLURIS_DEVICE_BUSY;
+    }
+  return ret;
+}
+
+/*!
+ * \brief Query the maximum force of the device
+ *
+ * Query this value is only possible if the measurement is not running,
+ * else LIBALLURIS_DEVICE_BUSY is returned.
+ *
+ * \param[in] dev_handle a handle for the device to communicate with
+ * \param[out] fmax output location for the returned max force. Only populated if the return code is 0.
+ * \return 0 if successful else \ref liballuris_error
+ * \sa liballuris_get_unit
+ * \sa liballuris_get_digits
+ */
+int liballuris_get_F_max (libusb_device_handle *dev_handle, int* fmax)
+{
+  unsigned char out_buf[3];
+  unsigned char in_buf[6];
 
   out_buf[0] = 0x08;
   out_buf[1] = 3;
+  out_buf[2] = 2;
+  int ret = liballuris_interrupt_transfer (dev_handle, __FUNCTION__,
+            out_buf, sizeof (out_buf), DEFAULT_SEND_TIMEOUT,
+            in_buf, sizeof (in_buf), DEFAULT_RECEIVE_TIMEOUT);
+  if (ret == LIBALLURIS_SUCCESS)
+    {
+      *fmax = char_to_int24 (in_buf + 3);
+      if (*fmax == -1)
+        return LIBALLURIS_DEVICE_BUSY;
+    }
+  return ret;
+}
+
+/*!
+ * \brief Query the current measurement value
+ *
+ * \param[in] dev_handle a handle for the device to communicate with
+ * \param[out] value output location for the measurement value. Only populated if the return code is 0.
+ * \return 0 if successful else \ref liballuris_error
+ * \sa liballuris_get_unit
+ * \sa liballuris_get_digits
+ */
+int liballuris_get_value (libusb_device_handle *dev_handle, int* value)
+{
+  unsigned char out_buf[3];
+  unsigned char in_buf[6];
+
+  out_buf[0] = 0x46;
+  out_buf[1] = 3;
   out_buf[2] = 3;
+  // worst execution time = 0.466s
+  // when P13=1Hz (effectively 2Hz) and mode=0 (10Hz)
+  int ret = liballuris_interrupt_transfer (dev_handle, __FUNCTION__,
+            out_buf, sizeof (out_buf), DEFAULT_SEND_TIMEOUT,
+            in_buf, sizeof (in_buf), DEFAULT_RECEIVE_TIMEOUT);
+  if (ret == LIBALLURIS_SUCCESS)
+    *value = char_to_int24 (in_buf + 3);
+  return ret;
+}
+
+/*!
+ * \brief Query positive peak value
+ *
+ * \param[in] dev_handle a handle for the device to communicate with
+ * \param[out] peak output location for the peak value. Only populated if the return code is 0.
+ * \return 0 if successful else \ref liballuris_error
+ * \sa liballuris_get_unit
+ * \sa liballuris_get_digits
+ */
+int liballuris_get_pos_peak (libusb_device_handle *dev_handle, int* peak)
+{
+  unsigned char out_buf[3];
+  unsigned char in_buf[6];
+
+  out_buf[0] = 0x46;
+  out_buf[1] = 3;
+  out_buf[2] = 4;
+  int ret = liballuris_interrupt_transfer (dev_handle, __FUNCTION__,
+            out_buf, sizeof (out_buf), DEFAULT_SEND_TIMEOUT,
+            in_buf, sizeof (in_buf), DEFAULT_RECEIVE_TIMEOUT);
+  if (ret == LIBALLURIS_SUCCESS)
+    *peak = char_to_int24 (in_buf + 3);
+  return ret;
+}
+
+/*!
+ * \brief Query negative peak value
+ *
+ * \param[in] dev_handle a handle for the device to communicate with
+ * \param[out] peak output location for the peak value. Only populated if the return code is 0.
+ * \return 0 if successful else \ref liballuris_error
+ * \sa liballuris_get_unit
+ * \sa liballuris_get_digits
+ */
+int liballuris_get_neg_peak (libusb_device_handle *dev_handle, int* peak)
+{
+  unsigned char out_buf[3];
+  unsigned char in_buf[6];
+
+  out_buf[0] = 0x46;
+  out_buf[1] = 3;
+  out_buf[2] = 5;
   int ret = liballuris_interrupt_transfer (dev_handle, __FUNCTION__,
             out_buf, sizeof (out_buf), DEFAULT_SEND_TIMEOUT,
             in_buf, sizeof (in_buf), DEFAULT_RECEIVE_TIMEOUT);
   if (ret == LIBALLURIS_SUCCESS)
+    *peak = char_to_int24 (in_buf + 3);
+  return ret;
+}
+
+/*!
+ * \brief Query the current state of the device
+ *
+ * \param[in] dev_handle a handle for the device to communicate with
+ * \param[out] state output location for the state. Only populated if the return code is 0.
+ * \return 0 if successful else \ref liballuris_error
+ */
+int liballuris_read_state (libusb_device_handle *dev_handle, struct liballuris_state* state, unsigned int timeout)
+{
+  unsigned char out_buf[3];
+  unsigned char in_buf[6];
+
+  out_buf[0] = 0x46;
+  out_buf[1] = 3;
+  out_buf[2] = 2;
+
+  // worst execution time = 0.47s
+  int ret = liballuris_interrupt_transfer (dev_handle, __FUNCTION__,
+            out_buf, sizeof (out_buf), DEFAULT_SEND_TIMEOUT,
+            in_buf, sizeof (in_buf), timeout);
+  if (ret == LIBALLURIS_SUCCESS)
+    {
+      if (   in_buf[3] == 0xff
+             && in_buf[4] == 0xff
+             && in_buf[5] == 0xff)
+        return LIBALLURIS_DEVICE_BUSY;
+
+      union __liballuris_state__ tmp;
+      tmp._int = char_to_int24 (in_buf + 3);
+      *state = tmp.bits;
+    }
+  return ret;
+}
+
+//! Print state to stdout
+void liballuris_print_state (struct liballuris_state state)
+{
+  printf ("[%c] upper limit exceeded\n",               (state.upper_limit_exceeded)? 'X': ' ');
+  printf ("[%c] lower limit underrun\n",               (state.lower_limit_underrun)? 'X': ' ');
+  printf ("[%c] peak  mode active\n",                  (state.some_peak_mode_active)? 'X': ' ');
+  printf ("[%c] peak+ mode active\n",                  (state.peak_plus_active)? 'X': ' ');
+  printf ("[%c] peak- mode active\n",                  (state.peak_minus_active)? 'X': ' ');
+  printf ("[%c] Store to memory in progress\n",        (state.mem_running)? 'X': ' ');
+  printf ("[%c] overload (abs(F) > 150%%)\n",          (state.overload)? 'X': ' ');
+  printf ("[%c] fracture detected (only W20/W40)\n",   (state.fracture)? 'X': ' ');
+  printf ("[%c] mem active (P21=1 or P21=2)\n",        (state.mem_active)? 'X': ' ');
+  printf ("[%c] mem-conti (store with displayrate)\n", (state.mem_conti)? 'X': ' ');
+  printf ("[%c] grenz_option\n",                       (state.grenz_option)? 'X': ' ');
+  printf ("[%c] measurement running\n",                (state.measuring)? 'X': ' ');
+}
+
+/*!
+ * \brief Enable or disable cyclic measurements
+ *
+ * \param[in] dev_handle a handle for the device to communicate with
+ * \param[in] enable
+ * \param[in] length 1..19
+ * \return 0 if successful else \ref liballuris_error
+ */
+int liballuris_cyclic_measurement (libusb_device_handle *dev_handle, char enable, size_t length)
+{
+  if (length < 1 || length > 19)
+    {
+      fprintf (stderr, "Error: packetlen %zu out of range 1..19.\n", length);
+      return LIBALLURIS_OUT_OF_RANGE;
+    }
+
+  unsigned char out_buf[4];
+
+  out_buf[0] = 0x01;
+  out_buf[1] = 4;
+  out_buf[2] = (enable)? 2:0;
+  out_buf[3] = length;
+
+  LOCK_HANDLE (dev_handle);
+
+  // samples queued by the demultiplexer belong to the previous configuration
+  struct handle_state* state = get_handle_state (dev_handle);
+  if (state)
+    {
+      pthread_mutex_lock (&state->queue_lock);
+      state->sample_count = 0;
+      pthread_mutex_unlock (&state->queue_lock);
+    }
+
+  //printf ("liballuris_cyclic_measurement enable=%i\n", enable);
+  int ret;
+  if (enable)
+    {
+      unsigned char in_buf[4];
+      ret = liballuris_interrupt_transfer (dev_handle, __FUNCTION__,
+                                           out_buf, sizeof (out_buf), DEFAULT_SEND_TIMEOUT,
+                                           in_buf, sizeof (in_buf), DEFAULT_RECEIVE_TIMEOUT);
+    }
+  else
+    {
+      ret = liballuris_interrupt_transfer (dev_handle, __FUNCTION__,
+                                           out_buf, sizeof (out_buf), DEFAULT_SEND_TIMEOUT, NULL, 0, 0);
+      liballuris_clear_RX (dev_handle, 100);
+      liballuris_clear_RX (dev_handle, 100);
+      liballuris_clear_RX (dev_handle, 100);
+    }
+
+  return ret;
+}
+
+/*!
+ * \brief Poll cyclic measurements
+ *
+ * Cyclic measurements have to be enabled before with liballuris_cyclic_measurement.
+ * Blocks which arrived while a command waited for its reply are returned first.
+ *
+ * \param[in] dev_handle a handle for the device to communicate with
+ * \param[in] buf output location for the measurements. Only populated if the return code is 0.
+ * \param[in] length of block 1..19, typically the same used with liballuris_cyclic_measurement
+ * \return 0 if successful else \ref liballuris_error
+ * \sa liballuris_cyclic_measurement
+ * \sa liballuris_get_unit
+ * \sa liballuris_get_digits
+ */
+int liballuris_poll_measurement (libusb_device_handle *dev_handle, int* buf, size_t length)
+{
+  size_t len = 5 + length * 3;
+  unsigned char in_buf[DEFAULT_RECV_BUF_LEN];
+  int actual;
+
+  /* Increased receive timeout:
+   * The sampling frequency can be selected between 10Hz and 900Hz
+   * Therefore the maximum delay until one measurement completes is 1/10Hz = 100ms.
+   * Since the block size can be up to 19 (see liballuris_cyclic_measurement) the typically delay
+   * in 10Hz mode and blocksize 19 is >1.9s
+   *
+   * Test case: "gadc --stop --set-mode 0 --start -s 19"
+  */
+
+  // worst execution time = 2.4s
+  int ret = LIBALLURIS_SUCCESS;
+  LOCK_HANDLE (dev_handle);
+  if (! pop_sample (get_handle_state (dev_handle), in_buf, &actual))
+    ret = liballuris_receive (dev_handle, __FUNCTION__, in_buf, &actual, 3600);
+  if (ret == LIBALLURIS_SUCCESS)
+    {
+      if (actual < (int) len)
+        {
+          fprintf (stderr, "Error: Malformed reply in '%s', expected %zu bytes but got %i\n", __FUNCTION__, len, actual);
+          return LIBALLURIS_MALFORMED_REPLY;
+        }
+      if (! sample_count_block (dev_handle, in_buf, actual))
+        return LIBALLURIS_MALFORMED_REPLY;
+
+      // decode straight from the receive buffer
+      decode_int24_block (in_buf + 5, buf, length);
+    }
+  return ret;
+}
+
+/*!
+ * \brief Poll cyclic measurements without waiting
+ *
+ * Cyclic measurements have to be enabled before with liballuris_cyclic_measurement.
+ * Blocks which arrived while a command waited for its reply are returned first.
+ *
+ * \param[in] dev_handle a handle for the device to communicate with
+ * \param[in] buf output location for the measurements. Only populated if the return code is 0.
+ * \param[in] length of block 1..19, typically the same used with liballuris_cyclic_measurement
+ * \return 0 if successful else \ref liballuris_error
+ * \sa liballuris_cyclic_measurement
+ * \sa liballuris_get_unit
+ * \sa liballuris_get_digits
+ */
+int liballuris_poll_measurement_no_wait (libusb_device_handle *dev_handle, int* buf, size_t length, size_t *actual_num_values)
+{
+  int actual=0;
+  int r = 0;
+
+  size_t len = 5 + length * 3;
+  unsigned char in_buf[PACKET_LEN];
+  *actual_num_values = 0;
+  LOCK_HANDLE (dev_handle);
+  if (! pop_sample (get_handle_state (dev_handle), in_buf, &actual))
+    r = libusb_interrupt_transfer (dev_handle, 0x81 | LIBUSB_ENDPOINT_IN, in_buf, len, &actual, 1);
+  //printf ("actual = %i, %s\n", actual, libusb_error_name(r));
+
+  if ((r == LIBUSB_SUCCESS || r == LIBUSB_ERROR_TIMEOUT ) && actual == (int) len)
+    {
+      if (! sample_count_block (dev_handle, in_buf, actual))
+        return LIBALLURIS_MALFORMED_REPLY;
+      *actual_num_values = (actual - 5) / 3;
+      decode_int24_block (in_buf + 5, buf, *actual_num_values);
+    }
+  else if (r == LIBUSB_ERROR_TIMEOUT && actual > 0)
+    {
+      // this isn't expected
+      fprintf (stderr, "Error in liballuris_poll_measurement_no_wait: LIBUSB_ERROR_TIMEOUT and actual = %i, len = %zu\n", actual, len);
+      fprintf (stderr, "It isn't expected that this could happen. Please file a bug report.\n");
+      return r;
+    }
+
+  return r;
+}
+
+/****************************************************************************************/
+
+/*
+ * Sample timestamps
+ *
+ * Every block is stamped with CLOCK_MONOTONIC when its transfer completes. The
+ * arrival times t_k over the number of samples n_k received until block k lie
+ * on a line with the true sample period as slope plus the USB delay, which is
+ * never negative. A weighted least squares fit with exponential forgetting
+ * tracks the period, the fit is shifted down to the least delayed arrivals.
+ * Arrivals which are delayed much more than usual, for example because the
+ * host was busy, are clipped so they don't tilt the fit.
+ *
+ * The ID_SAMPLE header has no sequence number. The device holds one block
+ * while the host doesn't poll and drops newer ones, the gap shows up as
+ * a block arriving whole block durations after its prediction. The blocks
+ * queued meanwhile arrive in a burst and are only delayed, so the gap is
+ * reported at the first block after the burst. If the block following the
+ * gap is still part of the burst, the gap is reported one block late.
+ * A burst while the fit starts means the first blocks were delayed, for
+ * example until the application handled events, the fit restarts then.
+ * The sums are kept relative to the newest block to preserve precision over
+ * long runs.
+ */
+
+//! Weight of a block in the sample rate fit is multiplied by this per newer block
+#define RATE_FORGET 0.999
+//! Number of blocks before the fitted period replaces the nominal one
+#define RATE_MIN_BLOCKS 8
+//! Blocks arriving closer than this many block durations after the previous one are part of a burst
+#define RATE_BURST_SPACING 0.25
+//! This many consecutive late blocks which don't fit a gap restart the fit
+#define RATE_RESYNC_BLOCKS 4
+//! Relative uncertainty of the period allowed when a late block is matched to a gap
+#define RATE_GAP_TOLERANCE 1e-3
+//! The minimum arrival delay rises this much per block to follow slow changes, in seconds
+#define RATE_ENVELOPE_RELAX 1e-6
+//! Arrivals are clipped to the prediction + RATE_CLIP_SPREAD * mean deviation
+#define RATE_CLIP_SPREAD 4
+//! Lower limit of the clipping in seconds
+#define RATE_CLIP_MIN 50e-6
+
+//! Internal online estimator of the sample period from block arrival times
+struct rate_estimator
+{
+  double prior;                 //!< period used until RATE_MIN_BLOCKS, 0 if unknown
+  double period;                //!< estimated sample period in seconds
+  double intercept;             //!< fitted arrival time at n0 relative to t0
+  double envelope;              //!< minimum deviation of the arrivals from the fit, <= 0
+  double spread;                //!< mean absolute deviation of the arrivals from the fit
+  int delayed;                  //!< consecutive late blocks which didn't follow a gap
+  unsigned long blocks;         //!< blocks since the last restart
+  unsigned long long n0;        //!< samples received until the newest block
+  double t0;                    //!< arrival of the newest block, clipped
+  double last;                  //!< arrival of the newest block
+  double sw, sx, sy, sxx, sxy;  //!< weighted sums of x = n - n0 and y = t - t0
+};
+
+//! Internal function to restart the fit at a block which completed n samples at time t
+static void rate_restart (struct rate_estimator* e, unsigned long long n, double t)
+{
+  if (e->blocks >= RATE_MIN_BLOCKS)
+    e->prior = e->period;
+  e->period = e->prior;
+  e->intercept = 0;
+  e->envelope = 0;
+  e->spread = 0;
+  e->delayed = 0;
+  e->blocks = 1;
+  e->n0 = n;
+  e->t0 = t;
+  e->last = t;
+  e->sw = 1;
+  e->sx = e->sy = e->sxx = e->sxy = 0;
+}
+
+/*!
+ * \brief Internal function to add a block of length samples which arrived at time t
+ *
+ * A block which arrives an integer number of block durations later than predicted
+ * follows a gap, the device dropped these blocks. Other late blocks were delayed
+ * on the host side and are clipped.
+ *
+ * \return number of samples missing before the block
+ */
+static unsigned long rate_add (struct rate_estimator* e, size_t length, double t)
+{
+  unsigned long long n = e->n0 + length;
+  if (! e->blocks)
+    {
+      rate_restart (e, n, t);
+      return 0;
+    }
+
+  double dx = n - e->n0;
+  double dy = t - e->t0;
+  double predicted = e->intercept + e->period * dx;
+  double residual = dy - predicted;
+
+  double clip = RATE_CLIP_SPREAD * e->spread;
+  if (clip < RATE_CLIP_MIN)
+    clip = RATE_CLIP_MIN;
+
+  // blocks which were queued while the host was busy arrive in a burst,
+  // only the first block after the burst can follow a gap
+  unsigned long missing = 0;
+  double block = length * e->period;
+  int burst = (t - e->last < block * RATE_BURST_SPACING);
+  if (burst && e->blocks < RATE_MIN_BLOCKS)
+    {
+      // the first blocks were delayed on the host side, start again at the newest
+      rate_restart (e, n, t);
+      return 0;
+    }
+  e->last = t;
+  if (burst)
+    ;
+  else if (block > 0 && residual > block / 2)
+    {
+      double lost = (double) (unsigned long) (residual / block + 0.5);
+      double deviation = residual - lost * block;
+      if (deviation < 0)
+        deviation = -deviation;
+      if (deviation <= clip + lost * block * RATE_GAP_TOLERANCE)
+        {
+          missing = lost * length;
+          n += missing;
+          dx += missing;
+          predicted += lost * block;
+          residual -= lost * block;
+          e->delayed = 0;
+        }
+      else if (++e->delayed >= RATE_RESYNC_BLOCKS)
+        {
+          // late without a consistent gap, the fit doesn't describe the device anymore
+          rate_restart (e, n, t);
+          return 0;
+        }
+    }
+  else
+    e->delayed = 0;
+
+  if (e->blocks >= RATE_MIN_BLOCKS && residual > clip)
+    dy = predicted + clip;
+  else
+    e->spread += (((residual < 0)? -residual : residual) - e->spread) / 32;
+
+  // move the origin to the new block, then forget and add it at (0, 0)
+  e->sxy = RATE_FORGET * (e->sxy - dx * e->sy - dy * e->sx + e->sw * dx * dy);
+  e->sxx = RATE_FORGET * (e->sxx - 2 * dx * e->sx + e->sw * dx * dx);
+  e->sx = RATE_FORGET * (e->sx - e->sw * dx);
+  e->sy = RATE_FORGET * (e->sy - e->sw * dy);
+  e->sw = RATE_FORGET * e->sw + 1;
+  e->n0 = n;
+  e->t0 += dy;
+  e->blocks++;
+
+  double den = e->sw * e->sxx - e->sx * e->sx;
+  if ((e->blocks >= RATE_MIN_BLOCKS || ! e->prior) && den > 0)
+    e->period = (e->sw * e->sxy - e->sx * e->sy) / den;
+  e->intercept = (e->sy - e->period * e->sx) / e->sw;
+
+  // deviation of the new block from the fit
+  residual = -e->intercept;
+  e->envelope += RATE_ENVELOPE_RELAX;
+  if (residual < e->envelope)
+    e->envelope = residual;
+  return missing;
+}
+
+//! Internal function to estimate when the sample with the zero based index completed
+static double rate_sample_time (const struct rate_estimator* e, unsigned long long index)
+{
+  return e->t0 + e->intercept + e->envelope + e->period * ((double) (index + 1) - (double) e->n0);
+}
+
+//! Internal timestamps of a queued block, fixed when it arrives
+struct block_time
+{
+  double arrival;               //!< CLOCK_MONOTONIC when the transfer completed
+  double first;                 //!< estimated completion of the first sample
+  double period;                //!< estimated sample period
+  unsigned long long index;     //!< index of the first sample
+  unsigned long missing;        //!< samples missing before the block, including dropped blocks
+};
+
+//! Internal state of the asynchronous streaming engine
+struct liballuris_stream
+{
+  libusb_context* ctx;                  //!< libusb context used for event handling
+  libusb_device_handle* dev_handle;     //!< device which is streaming
+  size_t length;                        //!< number of values per block
+  int num_transfers;                    //!< number of allocated transfers
+  struct libusb_transfer** transfers;   //!< transfers kept queued on endpoint 0x81
+  int active;                           //!< number of currently submitted transfers
+  char stopping;                        //!< set by liballuris_stream_close, don't resubmit
+  int error;                            //!< first error reported by a transfer callback
+  int* queue;                           //!< STREAM_QUEUE_LEN decoded blocks of length values
+  struct block_time* times;             //!< timestamps of each block in queue
+  size_t head;                          //!< index of the oldest block in queue
+  size_t count;                         //!< number of blocks in queue
+  unsigned long overflows;              //!< blocks dropped because the queue was full
+  unsigned long pending_missing;        //!< samples missing before the next queued block
+  struct rate_estimator rate;           //!< arrival times of all received blocks
+  struct handle_state* state;           //!< demultiplexer of dev_handle
+};
+
+//! Internal mapping of a transfer status to a libusb error code
+static int transfer_status_to_error (enum libusb_transfer_status status)
+{
+  switch (status)
+    {
+    case LIBUSB_TRANSFER_COMPLETED:
+      return LIBUSB_SUCCESS;
+    case LIBUSB_TRANSFER_TIMED_OUT:
+      return LIBUSB_ERROR_TIMEOUT;
+    case LIBUSB_TRANSFER_CANCELLED:
+      return LIBUSB_ERROR_INTERRUPTED;
+    case LIBUSB_TRANSFER_STALL:
+      return LIBUSB_ERROR_PIPE;
+    case LIBUSB_TRANSFER_NO_DEVICE:
+      return LIBUSB_ERROR_NO_DEVICE;
+    case LIBUSB_TRANSFER_OVERFLOW:
+      return LIBUSB_ERROR_OVERFLOW;
+    default:
+      return LIBUSB_ERROR_IO;
+    }
+}
+
+//! Internal function to decode an ID_SAMPLE packet into the stream queue, returns 0 if the queue is full
+static int stream_push_block (struct liballuris_stream* stream, const unsigned char* buf, int len)
+{
+  struct liballuris_sample_stats* stats = &stream->state->sample_stats;
+  if (! sample_header_ok (buf, len) || len != (int) (5 + stream->length * 3))
+    {
+      stats->malformed++;
+      if (state_debug_level (stream->state))
+        fprintf (stderr, "DEBUG-INFO: stream discarded packet 0x%02x with %i bytes\n", buf[0], len);
+      return 1;
+    }
+
+  // blocks dropped below also feed the estimator
+  double arrival = monotonic_time ();
+  unsigned long missing = rate_add (&stream->rate, stream->length, arrival);
+  unsigned long long first = stream->rate.n0 - stream->length;
+  stats->blocks++;
+  if (missing)
+    {
+      stats->gaps++;
+      stats->missing += missing;
+      if (state_debug_level (stream->state))
+        fprintf (stderr, "DEBUG-INFO: stream gap of %lu samples before sample %llu\n", missing, first);
+    }
+
+  stream->pending_missing += missing;
+  if (stream->count == STREAM_QUEUE_LEN)
+    {
+      stream->overflows++;
+      stream->pending_missing += stream->length;
+      return 0;
+    }
+
+  size_t tail = (stream->head + stream->count) % STREAM_QUEUE_LEN;
+  decode_int24_block (buf + 5, stream->queue + tail * stream->length, stream->length);
+  struct block_time* bt = stream->times + tail;
+  bt->arrival = arrival;
+  bt->first = rate_sample_time (&stream->rate, first);
+  bt->period = stream->rate.period;
+  bt->index = first;
+  bt->missing = stream->pending_missing;
+  stream->pending_missing = 0;
+  stream->count++;
+  return 1;
+}
+
+//! Internal function to process libusb events for up to timeout seconds
+static int stream_handle_events (struct liballuris_stream* stream, double timeout)
+{
+  struct timeval tv;
+  tv.tv_sec = (long) timeout;
+  tv.tv_usec = (long) ((timeout - tv.tv_sec) * 1.0e6);
+  int r = libusb_handle_events_timeout_completed (stream->ctx, &tv, NULL);
+  if (r && r != LIBUSB_ERROR_INTERRUPTED)
+    return r;
+  pthread_mutex_lock (&stream->state->queue_lock);
+  r = stream->error;
+  pthread_mutex_unlock (&stream->state->queue_lock);
+  return r;
+}
+
+//! Internal completion callback for the queued IN transfers of a stream
+static void LIBUSB_CALL stream_transfer_cb (struct libusb_transfer* transfer)
+{
+  struct liballuris_stream* stream = transfer->user_data;
+  struct handle_state* state = stream->state;
+
+  // samples go to the stream queue, replies to the waiting command
+  if (transfer->status == LIBUSB_TRANSFER_COMPLETED)
+    dispatch_packet (state, transfer->buffer, transfer->actual_length);
+
+  // the callback may run in any thread which handles the events of stream->ctx
+  pthread_mutex_lock (&state->queue_lock);
+  if (transfer->status != LIBUSB_TRANSFER_COMPLETED
+      && transfer->status != LIBUSB_TRANSFER_TIMED_OUT
+      && transfer->status != LIBUSB_TRANSFER_CANCELLED
+      && ! stream->error)
+    stream->error = transfer_status_to_error (transfer->status);
+  int resubmit = ! stream->stopping && ! stream->error;
+  pthread_mutex_unlock (&state->queue_lock);
+
+  int r = LIBUSB_SUCCESS;
+  if (resubmit)
+    {
+      r = libusb_submit_transfer (transfer);
+      if (r == LIBUSB_SUCCESS)
+        return;
+    }
+
+  pthread_mutex_lock (&state->queue_lock);
+  if (r && ! stream->error)
+    stream->error = r;
+  stream->active--;
+  pthread_mutex_unlock (&state->queue_lock);
+}
+
+//! Internal function to cancel all transfers of a stream and wait until they are returned
+static void stream_cancel_transfers (struct liballuris_stream* stream)
+{
+  int k;
+  pthread_mutex_lock (&stream->state->queue_lock);
+  stream->stopping = 1;
+  pthread_mutex_unlock (&stream->state->queue_lock);
+  for (k=0; k < stream->num_transfers; k++)
+    if (stream->transfers[k])
+      libusb_cancel_transfer (stream->transfers[k]);
+
+  // cancelled transfers are returned through the event handler
+  double deadline = monotonic_time () + 1.0;
+  for (;;)
+    {
+      pthread_mutex_lock (&stream->state->queue_lock);
+      int active = stream->active;
+      pthread_mutex_unlock (&stream->state->queue_lock);
+      if (active <= 0 || monotonic_time () >= deadline)
+        break;
+
+      struct timeval tv = {0, 100000};
+      libusb_handle_events_timeout_completed (stream->ctx, &tv, NULL);
+    }
+}
+
+//! Internal function to release all resources of a stream
+static void stream_free (struct liballuris_stream* stream)
+{
+  int k;
+  if (stream->transfers)
+    for (k=0; k < stream->num_transfers; k++)
+      if (stream->transfers[k])
+        {
+          free (stream->transfers[k]->buffer);
+          libusb_free_transfer (stream->transfers[k]);
+        }
+  free (stream->transfers);
+  free (stream->queue);
+  free (stream->times);
+  free (stream);
+}
+
+/*!
+ * \brief Start cyclic measurements with asynchronous transfers
+ *
+ * Enables cyclic measurements like \ref liballuris_cyclic_measurement but keeps num_transfers
+ * interrupt IN transfers queued on endpoint 0x81. Completed blocks are decoded and buffered
+ * for up to \ref STREAM_QUEUE_LEN blocks, so short stalls of the consumer don't cause gaps.
+ * The libusb events of ctx are processed within \ref liballuris_stream_read.
+ *
+ * Commands can be sent to the device while the stream is open, their replies
+ * are received by the stream transfers and passed to the waiting command.
+ *
+ * \param[in] ctx pointer to libusb context used to open dev_handle
+ * \param[in] dev_handle a handle for the device to communicate with
+ * \param[in] length of block 1..19
+ * \param[in] num_transfers number of queued transfers, typically \ref DEFAULT_STREAM_TRANSFERS
+ * \param[out] stream storage for the stream handle. Only populated if the return code is 0.
+ * \return 0 if successful else \ref liballuris_error
+ * \sa liballuris_stream_read
+ * \sa liballuris_stream_close
+ */
+int liballuris_stream_open (libusb_context* ctx, libusb_device_handle *dev_handle, size_t length, int num_transfers, struct liballuris_stream** stream)
+{
+  if (num_transfers < 1)
+    return LIBALLURIS_OUT_OF_RANGE;
+
+  LOCK_HANDLE (dev_handle);
+  struct handle_state* state = get_handle_state (dev_handle);
+  if (! state)
+    return LIBUSB_ERROR_NO_MEM;
+  if (state->stream)
+    return LIBUSB_ERROR_BUSY;
+
+  // nominal sample period for the first blocks, the estimator works without it
+  enum liballuris_measurement_mode mode;
+  double prior = 0;
+  if (! liballuris_get_mode (dev_handle, &mode))
+    prior = ((mode == LIBALLURIS_MODE_STANDARD)? 1 / 10.0 : 1 / 900.0)
+            * ((state->data_ratio > 1)? state->data_ratio : 1);
+
+  int ret = liballuris_cyclic_measurement (dev_handle, 1, length);
+  if (ret)
+    return ret;
+
+  struct liballuris_stream* s = calloc (1, sizeof (struct liballuris_stream));
+  if (! s)
+    {
+      liballuris_cyclic_measurement (dev_handle, 0, length);
+      return LIBUSB_ERROR_NO_MEM;
+    }
+
+  s->ctx = ctx;
+  s->dev_handle = dev_handle;
+  s->length = length;
+  s->num_transfers = num_transfers;
+  s->state = state;
+  s->queue = malloc (STREAM_QUEUE_LEN * length * sizeof (int));
+  s->times = malloc (STREAM_QUEUE_LEN * sizeof (struct block_time));
+  s->transfers = calloc (num_transfers, sizeof (struct libusb_transfer*));
+  s->rate.prior = prior;
+  s->rate.period = prior;
+  if (! s->queue || ! s->times || ! s->transfers)
+    ret = LIBUSB_ERROR_NO_MEM;
+  else
+    {
+      pthread_mutex_lock (&state->queue_lock);
+      state->stream = s;
+      pthread_mutex_unlock (&state->queue_lock);
+    }
+
+  int k;
+  for (k=0; k < num_transfers && ! ret; k++)
+    {
+      s->transfers[k] = libusb_alloc_transfer (0);
+      if (! s->transfers[k])
+        {
+          ret = LIBUSB_ERROR_NO_MEM;
+          break;
+        }
+      unsigned char* buf = malloc (DEFAULT_RECV_BUF_LEN);
+      if (! buf)
+        {
+          ret = LIBUSB_ERROR_NO_MEM;
+          break;
+        }
+      libusb_fill_interrupt_transfer (s->transfers[k], dev_handle, 0x81 | LIBUSB_ENDPOINT_IN,
+                                      buf, DEFAULT_RECV_BUF_LEN, stream_transfer_cb, s, 0);
+      // count the transfer first, it may complete in another thread before submit returns
+      pthread_mutex_lock (&state->queue_lock);
+      s->active++;
+      pthread_mutex_unlock (&state->queue_lock);
+      ret = libusb_submit_transfer (s->transfers[k]);
+      if (ret)
+        {
+          pthread_mutex_lock (&state->queue_lock);
+          s->active--;
+          pthread_mutex_unlock (&state->queue_lock);
+        }
+    }
+
+  if (ret)
+    {
+      stream_cancel_transfers (s);
+      pthread_mutex_lock (&state->queue_lock);
+      state->stream = NULL;
+      pthread_mutex_unlock (&state->queue_lock);
+      stream_free (s);
+      liballuris_cyclic_measurement (dev_handle, 0, length);
+      return ret;
+    }
+
+  if (state_debug_level (state))
+    fprintf (stderr, "DEBUG-INFO: liballuris_stream_open: %i transfers queued, block length %zu\n", num_transfers, length);
+
+  *stream = s;
+  return LIBALLURIS_SUCCESS;
+}
+
+/*!
+ * \brief Read the next block from a stream
+ *
+ * Returns the oldest buffered block or processes libusb events until a block
+ * completes or the timeout expires. With a timeout of 0 the call doesn't block and
+ * doesn't process events, this is intended for applications which call
+ * \ref liballuris_handle_events from their own event loop.
+ *
+ * \param[in] stream handle from \ref liballuris_stream_open
+ * \param[out] buf output location for the measurements. Only populated if the return code is 0.
+ * \param[in] length of block, has to be the same used with \ref liballuris_stream_open
+ * \param[in] timeout in milliseconds
+ * \return 0 if successful, LIBUSB_ERROR_TIMEOUT if no block completed in time else \ref liballuris_error
+ * \sa liballuris_stream_open
+ */
+int liballuris_stream_read (struct liballuris_stream* stream, int* buf, size_t length, unsigned int timeout)
+{
+  return liballuris_stream_read_timestamped (stream, buf, NULL, NULL, length, timeout);
+}
+
+/*!
+ * \brief Read the next block from a stream with timestamps
+ *
+ * Like \ref liballuris_stream_read. The timestamps are CLOCK_MONOTONIC seconds
+ * (see clock_gettime) when each sample completed in the device. They are
+ * reconstructed from the arrival times with an online estimate of the sample
+ * rate, see \ref liballuris_stream_get_sample_rate.
+ *
+ * The ID_SAMPLE header has no sequence number. If the host doesn't poll in time
+ * the device discards blocks, the next block then arrives whole block durations
+ * late. These gaps and blocks dropped because the stream queue was full are
+ * reported in info->missing and skipped in info->first_index and the timestamps.
+ *
+ * \param[in] stream handle from \ref liballuris_stream_open
+ * \param[out] buf output location for the measurements. Only populated if the return code is 0.
+ * \param[out] t output location for length timestamps or NULL
+ * \param[out] info output location for the arrival time and position of the block or NULL
+ * \param[in] length of block, has to be the same used with \ref liballuris_stream_open
+ * \param[in] timeout in milliseconds
+ * \return 0 if successful, LIBUSB_ERROR_TIMEOUT if no block completed in time else \ref liballuris_error
+ */
+int liballuris_stream_read_timestamped (struct liballuris_stream* stream, int* buf, double* t,
+                                        struct liballuris_block_info* info, size_t length, unsigned int timeout)
+{
+  if (length != stream->length)
+    return LIBALLURIS_OUT_OF_RANGE;
+
+  pthread_mutex_t* queue_lock = &stream->state->queue_lock;
+  double deadline = monotonic_time () + timeout / 1.0e3;
+  pthread_mutex_lock (queue_lock);
+  while (! stream->count && ! stream->error)
+    {
+      pthread_mutex_unlock (queue_lock);
+      double remaining = deadline - monotonic_time ();
+      if (remaining <= 0)
+        return LIBUSB_ERROR_TIMEOUT;
+
+      int r = stream_handle_events (stream, remaining);
+      pthread_mutex_lock (queue_lock);
+      if (r && ! stream->error)
+        {
+          pthread_mutex_unlock (queue_lock);
+          return r;
+        }
+    }
+
+  // deliver blocks which completed before an error occurred
+  int ret = stream->error;
+  if (stream->count)
+    {
+      memcpy (buf, stream->queue + stream->head * length, length * sizeof (int));
+      const struct block_time* bt = stream->times + stream->head;
+      size_t k;
+      if (t)
+        for (k=0; k < length; k++)
+          t[k] = bt->first + k * bt->period;
+      if (info)
+        {
+          info->arrival = bt->arrival;
+          info->first_index = bt->index;
+          info->missing = bt->missing;
+        }
+      stream->head = (stream->head + 1) % STREAM_QUEUE_LEN;
+      stream->count--;
+      ret = LIBALLURIS_SUCCESS;
+    }
+  pthread_mutex_unlock (queue_lock);
+  return ret;
+}
+
+/*!
+ * \brief Query the number of blocks which can be read without blocking
+ *
+ * \param[in] stream handle from \ref liballuris_stream_open
+ * \return number of buffered blocks
+ * \sa liballuris_stream_read
+ */
+size_t liballuris_stream_pending (struct liballuris_stream* stream)
+{
+  pthread_mutex_lock (&stream->state->queue_lock);
+  size_t ret = stream->count;
+  pthread_mutex_unlock (&stream->state->queue_lock);
+  return ret;
+}
+
+/*!
+ * \brief Query the number of blocks dropped because the stream queue was full
+ *
+ * \param[in] stream handle from \ref liballuris_stream_open
+ * \return number of dropped blocks since \ref liballuris_stream_open
+ */
+unsigned long liballuris_stream_get_overflows (struct liballuris_stream* stream)
+{
+  pthread_mutex_lock (&stream->state->queue_lock);
+  unsigned long ret = stream->overflows;
+  pthread_mutex_unlock (&stream->state->queue_lock);
+  return ret;
+}
+
+/*!
+ * \brief Query the estimated sample rate of a stream
+ *
+ * The rate is fitted to the arrival times of the blocks, so it includes the
+ * deviation of the device clock and the decimation of \ref liballuris_set_data_ratio.
+ * Until enough blocks arrived it is the nominal rate of the measurement mode.
+ *
+ * \param[in] stream handle from \ref liballuris_stream_open
+ * \return samples per second, 0 if not known yet
+ */
+double liballuris_stream_get_sample_rate (struct liballuris_stream* stream)
+{
+  pthread_mutex_lock (&stream->state->queue_lock);
+  double period = stream->rate.period;
+  pthread_mutex_unlock (&stream->state->queue_lock);
+  return (period > 0)? 1 / period : 0;
+}
+
+/*!
+ * \brief Cancel all transfers, disable cyclic measurements and free the stream
+ *
+ * \param[in] stream handle from \ref liballuris_stream_open
+ * \return 0 if successful else \ref liballuris_error
+ * \sa liballuris_stream_open
+ */
+int liballuris_stream_close (struct liballuris_stream* stream)
+{
+  libusb_device_handle* dev_handle = stream->dev_handle;
+  struct handle_state* state = stream->state;
+  size_t length = stream->length;
+  LOCK_HANDLE (dev_handle);
+
+  stream_cancel_transfers (stream);
+  pthread_mutex_lock (&state->queue_lock);
+  int active = stream->active;
+  if (active <= 0)
+    state->stream = NULL;
+  pthread_mutex_unlock (&state->queue_lock);
+  if (active > 0)
+    {
+      // a transfer still references its buffers, leak them rather than crash
+      fprintf (stderr, "Error: %i transfer(s) of stream couldn't be cancelled\n", active);
+      return LIBUSB_ERROR_BUSY;
+    }
+  stream_free (stream);
+
+  return liballuris_cyclic_measurement (dev_handle, 0, length);
+}
+
+/****************************************************************************************/
+/*
+ * Background reader
+ *
+ * A thread owned by the library reads the stream and copies the decoded values
+ * into a single-producer/single-consumer ring. Only the reader thread writes
+ * head and only the consumer writes tail, so neither side takes a lock and a
+ * stalled consumer never delays the USB side. If the ring is full the block
+ * is dropped and counted instead. Only a consumer waiting for an empty ring
+ * sleeps on a condition variable, the reader thread signals it after
+ * publishing head.
+ */
+
+//! Timeout of each stream read in the reader thread, bounds the latency of liballuris_reader_stop
+#define READER_STREAM_TIMEOUT 100
+
+//! Internal state of the background reader
+struct liballuris_reader
+{
+  struct liballuris_stream* stream;     //!< stream read by the thread
+  size_t length;                        //!< number of values per block
+  pthread_t thread;                     //!< reader thread
+  atomic_int stop;                      //!< set by liballuris_reader_stop
+  atomic_int error;                     //!< error which terminated the reader thread
+  int* ring;                            //!< capacity values
+  double* times;                        //!< capacity timestamps of the values in ring
+  size_t mask;                          //!< capacity - 1, capacity is a power of 2
+  // head and tail on separate cache lines, else each write stalls the other side
+  char pad0[64];
+  atomic_size_t head;                   //!< values written, only written by the reader thread
+  char pad1[64];
+  atomic_size_t tail;                   //!< values consumed, only written by the consumer
+  char pad2[64];
+  atomic_ulong dropped;                 //!< values dropped because the ring was full
+  atomic_int waiting;                   //!< the consumer waits for ready
+  pthread_mutex_t lock;                 //!< protects the wait for ready
+  pthread_cond_t ready;                 //!< signalled after head or error changed if waiting
+};
+
+//! Internal function to wake up a consumer waiting in liballuris_reader_read_timestamped
+static void reader_wake (struct liballuris_reader* reader)
+{
+  // pairs with the store of waiting before the consumer checks head again
+  if (atomic_load (&reader->waiting))
+    {
+      pthread_mutex_lock (&reader->lock);
+      pthread_cond_signal (&reader->ready);
+      pthread_mutex_unlock (&reader->lock);
+    }
+}
+
+//! Internal reader thread, moves blocks from the stream into the ring
+static void* reader_thread (void* arg)
+{
+  struct liballuris_reader* reader = arg;
+  size_t length = reader->length;
+  int buf[length];
+  double t[length];
+
+  while (! atomic_load_explicit (&reader->stop, memory_order_relaxed))
+    {
+      int r = liballuris_stream_read_timestamped (reader->stream, buf, t, NULL, length, READER_STREAM_TIMEOUT);
+      if (r == LIBUSB_ERROR_TIMEOUT)
+        continue;
+      if (r)
+        {
+          atomic_store (&reader->error, r);
+          reader_wake (reader);
+          break;
+        }
+
+      size_t head = atomic_load_explicit (&reader->head, memory_order_relaxed);
+      size_t tail = atomic_load_explicit (&reader->tail, memory_order_acquire);
+      if (reader->mask + 1 - (head - tail) < length)
+        {
+          atomic_fetch_add_explicit (&reader->dropped, length, memory_order_relaxed);
+          continue;
+        }
+
+      size_t k;
+      for (k=0; k < length; k++)
+        {
+          reader->ring[(head + k) & reader->mask] = buf[k];
+          reader->times[(head + k) & reader->mask] = t[k];
+        }
+      atomic_store (&reader->head, head + length);
+      reader_wake (reader);
+    }
+  return NULL;
+}
+
+/*!
+ * \brief Start a background thread which reads cyclic measurements into a ring
+ *
+ * Opens a stream like \ref liballuris_stream_open with \ref DEFAULT_STREAM_TRANSFERS
+ * transfers and starts a thread which processes its events and copies the values
+ * into a lock-free ring. The consumer fetches them with \ref liballuris_reader_read,
+ * so slow output doesn't delay reading the device. Values which don't fit into
+ * the ring are dropped and counted, see \ref liballuris_reader_get_overflows.
+ *
+ * Only one thread may call \ref liballuris_reader_read. Commands to dev_handle can
+ * be sent from other threads while the reader is running.
+ *
+ * \param[in] ctx pointer to libusb context used to open dev_handle
+ * \param[in] dev_handle a handle for the device to communicate with
+ * \param[in] length of block 1..19
+ * \param[in] capacity number of values the ring holds, rounded up to a power of 2,
+ *   typically \ref DEFAULT_READER_CAPACITY
+ * \param[out] reader storage for the reader handle. Only populated if the return code is 0.
+ * \return 0 if successful else \ref liballuris_error
+ * \sa liballuris_reader_stop
+ */
+int liballuris_reader_start (libusb_context* ctx, libusb_device_handle *dev_handle, size_t length, size_t capacity, struct liballuris_reader** reader)
+{
+  if (capacity < length || capacity > ((size_t) -1) / 2 / sizeof (int))
+    return LIBALLURIS_OUT_OF_RANGE;
+
+  size_t size = 1;
+  while (size < capacity)
+    size *= 2;
+
+  struct liballuris_reader* r = calloc (1, sizeof (struct liballuris_reader));
+  if (! r)
+    return LIBUSB_ERROR_NO_MEM;
+  r->ring = malloc (size * sizeof (int));
+  r->times = malloc (size * sizeof (double));
+  if (! r->ring || ! r->times)
+    {
+      free (r->ring);
+      free (r->times);
+      free (r);
+      return LIBUSB_ERROR_NO_MEM;
+    }
+  r->length = length;
+  r->mask = size - 1;
+  atomic_init (&r->stop, 0);
+  atomic_init (&r->error, LIBALLURIS_SUCCESS);
+  atomic_init (&r->head, 0);
+  atomic_init (&r->tail, 0);
+  atomic_init (&r->dropped, 0);
+  atomic_init (&r->waiting, 0);
+  pthread_mutex_init (&r->lock, NULL);
+  pthread_condattr_t attr;
+  pthread_condattr_init (&attr);
+  pthread_condattr_setclock (&attr, CLOCK_MONOTONIC);
+  pthread_cond_init (&r->ready, &attr);
+  pthread_condattr_destroy (&attr);
+
+  int ret = liballuris_stream_open (ctx, dev_handle, length, DEFAULT_STREAM_TRANSFERS, &r->stream);
+  if (! ret && pthread_create (&r->thread, NULL, reader_thread, r))
+    {
+      liballuris_stream_close (r->stream);
+      ret = LIBUSB_ERROR_OTHER;
+    }
+  if (ret)
+    {
+      pthread_cond_destroy (&r->ready);
+      pthread_mutex_destroy (&r->lock);
+      free (r->ring);
+      free (r->times);
+      free (r);
+      return ret;
+    }
+
+  *reader = r;
+  return LIBALLURIS_SUCCESS;
+}
+
+/*!
+ * \brief Read values from the ring of a background reader
+ *
+ * Copies up to length buffered values, whole blocks or parts of them, and waits
+ * up to timeout milliseconds if the ring is empty.
+ *
+ * \param[in] reader handle from \ref liballuris_reader_start
+ * \param[out] buf output location for the measurements
+ * \param[in] length size of buf
+ * \param[out] actual number of values copied into buf
+ * \param[in] timeout in milliseconds
+ * \return 0 if at least one value was copied, LIBUSB_ERROR_TIMEOUT if none arrived in time,
+ *   else the \ref liballuris_error which terminated the reader thread once the ring is empty
+ */
+int liballuris_reader_read (struct liballuris_reader* reader, int* buf, size_t length, size_t* actual, unsigned int timeout)
+{
+  return liballuris_reader_read_timestamped (reader, buf, NULL, length, actual, timeout);
+}
+
+/*!
+ * \brief Read values and their timestamps from the ring of a background reader
+ *
+ * Like \ref liballuris_reader_read, the timestamps are those of
+ * \ref liballuris_stream_read_timestamped.
+ *
+ * \param[in] reader handle from \ref liballuris_reader_start
+ * \param[out] buf output location for the measurements
+ * \param[out] t output location for the timestamps or NULL
+ * \param[in] length size of buf and t
+ * \param[out] actual number of values copied into buf
+ * \param[in] timeout in milliseconds
+ * \return 0 if at least one value was copied, LIBUSB_ERROR_TIMEOUT if none arrived in time,
+ *   else the \ref liballuris_error which terminated the reader thread once the ring is empty
+ */
+int liballuris_reader_read_timestamped (struct liballuris_reader* reader, int* buf, double* t, size_t length,
+                                        size_t* actual, unsigned int timeout)
+{
+  *actual = 0;
+  size_t tail = atomic_load_explicit (&reader->tail, memory_order_relaxed);
+  size_t head = atomic_load_explicit (&reader->head, memory_order_acquire);
+  if (head == tail)
+    {
+      struct timespec deadline;
+      cond_deadline (timeout, &deadline);
+      int r = 0, timed_out = 0;
+      // the reader thread signals if it sees waiting after publishing head or error
+      atomic_store (&reader->waiting, 1);
+      pthread_mutex_lock (&reader->lock);
+      for (;;)
+        {
+          // the error is stored before the thread ends, recheck head afterwards
+          r = atomic_load (&reader->error);
+          head = atomic_load (&reader->head);
+          if (head != tail || r || timed_out)
+            break;
+          timed_out = (pthread_cond_timedwait (&reader->ready, &reader->lock, &deadline) == ETIMEDOUT);
+        }
+      pthread_mutex_unlock (&reader->lock);
+      atomic_store (&reader->waiting, 0);
+      if (head == tail)
+        return (r)? r : LIBUSB_ERROR_TIMEOUT;
+    }
+
+  size_t n = head - tail;
+  if (n > length)
+    n = length;
+
+  // copy in up to two pieces, the ring wraps at capacity
+  size_t start = tail & reader->mask;
+  size_t first = reader->mask + 1 - start;
+  if (first > n)
+    first = n;
+  memcpy (buf, reader->ring + start, first * sizeof (int));
+  memcpy (buf + first, reader->ring, (n - first) * sizeof (int));
+  if (t)
+    {
+      memcpy (t, reader->times + start, first * sizeof (double));
+      memcpy (t + first, reader->times, (n - first) * sizeof (double));
+    }
+
+  atomic_store_explicit (&reader->tail, tail + n, memory_order_release);
+  *actual = n;
+  return LIBALLURIS_SUCCESS;
+}
+
+/*!
+ * \brief Query the number of values which can be read without blocking
+ *
+ * \param[in] reader handle from \ref liballuris_reader_start
+ * \return number of buffered values
+ */
+size_t liballuris_reader_pending (struct liballuris_reader* reader)
+{
+  return atomic_load (&reader->head) - atomic_load (&reader->tail);
+}
+
+/*!
+ * \brief Query the number of values dropped because the consumer was too slow
+ *
+ * Counts the values which didn't fit into the ring and those dropped by the
+ * stream queue, the latter only happens if the reader thread itself is starved.
+ *
+ * \param[in] reader handle from \ref liballuris_reader_start
+ * \return number of dropped values since \ref liballuris_reader_start
+ */
+unsigned long liballuris_reader_get_overflows (struct liballuris_reader* reader)
+{
+  return atomic_load (&reader->dropped)
+         + liballuris_stream_get_overflows (reader->stream) * reader->length;
+}
+
+/*!
+ * \brief Query the estimated sample rate of the stream of a background reader
+ *
+ * \param[in] reader handle from \ref liballuris_reader_start
+ * \return samples per second, see \ref liballuris_stream_get_sample_rate
+ */
+double liballuris_reader_get_sample_rate (struct liballuris_reader* reader)
+{
+  return liballuris_stream_get_sample_rate (reader->stream);
+}
+
+/*!
+ * \brief Stop the reader thread, close the stream and free the reader
+ *
+ * Values which weren't read yet are discarded.
+ *
+ * \param[in] reader handle from \ref liballuris_reader_start
+ * \return 0 if successful else the \ref liballuris_error which terminated the reader
+ *   thread or occurred while closing the stream
+ */
+int liballuris_reader_stop (struct liballuris_reader* reader)
+{
+  atomic_store (&reader->stop, 1);
+  pthread_join (reader->thread, NULL);
+
+  int ret = atomic_load (&reader->error);
+  int close_ret = liballuris_stream_close (reader->stream);
+  if (! ret)
+    ret = close_ret;
+
+  pthread_cond_destroy (&reader->ready);
+  pthread_mutex_destroy (&reader->lock);
+  free (reader->ring);
+  free (reader->times);
+  free (reader);
+  return ret;
+}
+
+/****************************************************************************************/
+/*
+ * Multi device acquisition
+ *
+ * One library owned thread waits in libusb_handle_events_timeout_completed
+ * for the stream transfers of all devices of a group, so it only wakes up
+ * when a block completed. It moves the blocks into a queue per device which
+ * is indexed by the sample index since the stream was opened. Row k consists
+ * of sample k of every device and is ready once all devices delivered it.
+ * A device which falls behind by more than half the capacity doesn't hold
+ * back the others, its samples in the delivered rows are missing.
+ */
+
+//! Timeout of each wait for events in the engine thread in seconds, bounds the latency of liballuris_group_stop
+#define GROUP_EVENT_TIMEOUT 0.1
+
+//! Internal queue and counters of one device of a group
+struct group_device
+{
+  struct liballuris_stream* stream;
+  int* values;                          //!< capacity samples at sample index & mask
+  double* times;                        //!< timestamps of values
+  unsigned long long head;              //!< index of the next sample expected
+  double last_time;                     //!< timestamp of sample head - 1
+  double period;                        //!< estimated sample period
+  unsigned long long received;
+  unsigned long long missing;
+  unsigned long long late;
+  double lag;
+  double max_lag;
+  int error;                            //!< error which ended the stream
+  unsigned long long cursor;            //!< resampling: newest sample at or before the next grid time
+};
+
+//! Internal state of an acquisition group
+struct liballuris_group
+{
+  libusb_context* ctx;
+  size_t num_devices;
+  size_t length;                        //!< values per block
+  size_t mask;                          //!< capacity - 1, capacity is a power of 2
+  struct group_device* devices;
+  pthread_t thread;                     //!< engine thread
+  atomic_int stop;                      //!< set by liballuris_group_stop
+  pthread_mutex_t lock;                 //!< protects the queues and counters
+  pthread_cond_t ready;                 //!< signalled after the engine thread queued blocks
+  unsigned long long tail;              //!< index of the next row delivered
+  unsigned long long rows;
+  unsigned long long dropped_rows;
+  unsigned long wakeups;
+  double start;                         //!< CLOCK_MONOTONIC of liballuris_group_start
+  double cpu_time;
+  int error;                            //!< error of the event handling, ends the engine thread
+  char resampling;                      //!< liballuris_group_read_resampled was used
+  char grid_started;                    //!< grid_next is valid
+  double grid_period;                   //!< 0 for the mean period of the devices
+  double grid_next;                     //!< host time of the next resampled row
+  double max_delay;                     //!< wait for late devices up to this many seconds
+};
+
+//! Internal timestamp of sample index of d, estimated if it didn't arrive yet
+static double group_sample_time (const struct liballuris_group* group, const struct group_device* d,
+                                 unsigned long long index)
+{
+  if (index < d->head)
+    return d->times[index & group->mask];
+  return d->last_time + (index - d->head + 1) * d->period;
+}
+
+//! Internal function to queue a block of d, call with group->lock held
+static void group_push (struct liballuris_group* group, struct group_device* d, const int* buf, const double* t,
+                        const struct liballuris_block_info* info)
+{
+  size_t capacity = group->mask + 1;
+  size_t k;
+  for (k=0; k < group->length; k++)
+    {
+      unsigned long long i = info->first_index + k;
+      if (i < group->tail)
+        {
+          d->late++;
+          continue;
+        }
+      // the consumer is too slow, give up the oldest rows
+      if (i - group->tail >= capacity)
+        {
+          unsigned long long tail = i - capacity + 1;
+          group->dropped_rows += tail - group->tail;
+          group->tail = tail;
+        }
+      // samples the device didn't send
+      unsigned long long h = (d->head > group->tail)? d->head : group->tail;
+      for (; h < i; h++)
+        {
+          d->values[h & group->mask] = LIBALLURIS_GROUP_MISSING;
+          d->times[h & group->mask] = t[k] - (i - h) * d->period;
+        }
+      d->values[i & group->mask] = buf[k];
+      d->times[i & group->mask] = t[k];
+      d->head = i + 1;
+      d->last_time = t[k];
+      d->received++;
+    }
+
+  d->lag = monotonic_time () - t[group->length - 1];
+  if (d->lag > d->max_lag)
+    d->max_lag = d->lag;
+}
+
+//! Internal end of the rows which can be delivered, call with group->lock held
+static unsigned long long group_ready_end (const struct liballuris_group* group)
+{
+  unsigned long long lead = group->tail, slowest = (unsigned long long) -1;
+  size_t j;
+  for (j=0; j < group->num_devices; j++)
+    {
+      const struct group_device* d = group->devices + j;
+      if (d->head > lead)
+        lead = d->head;
+      if (! d->error && d->head < slowest)
+        slowest = d->head;
+    }
+
+  // failed devices and devices far behind don't hold back the others
+  unsigned long long end = (slowest == (unsigned long long) -1)? lead : slowest;
+  unsigned long long half = (group->mask + 1) / 2;
+  if (lead > end + half)
+    end = lead - half;
+  return (end > group->tail)? end : group->tail;
+}
+
+//! Internal error which ends the group, call with group->lock held
+static int group_failed (const struct liballuris_group* group)
+{
+  if (group->error)
+    return group->error;
+  size_t j;
+  for (j=0; j < group->num_devices; j++)
+    if (! group->devices[j].error)
+      return LIBALLURIS_SUCCESS;
+  return group->devices[0].error;
+}
+
+//! Internal engine thread, sleeps until transfers complete and queues their blocks
+static void* group_thread (void* arg)
+{
+  struct liballuris_group* group = arg;
+  size_t length = group->length;
+  int buf[length];
+  double t[length];
+
+  while (! atomic_load_explicit (&group->stop, memory_order_relaxed))
+    {
+      struct timeval tv = {0, (long) (GROUP_EVENT_TIMEOUT * 1e6)};
+      int r = libusb_handle_events_timeout_completed (group->ctx, &tv, NULL);
+
+      pthread_mutex_lock (&group->lock);
+      group->wakeups++;
+      if (r && r != LIBUSB_ERROR_INTERRUPTED)
+        group->error = r;
+
+      size_t j;
+      for (j=0; j < group->num_devices && ! group->error; j++)
+        {
+          struct group_device* d = group->devices + j;
+          if (d->error)
+            continue;
+          double rate = liballuris_stream_get_sample_rate (d->stream);
+          if (rate > 0)
+            d->period = 1 / rate;
+          // the events were processed above, don't wait for more
+          struct liballuris_block_info info;
+          while (! (r = liballuris_stream_read_timestamped (d->stream, buf, t, &info, length, 0)))
+            group_push (group, d, buf, t, &info);
+          if (r != LIBUSB_ERROR_TIMEOUT)
+            {
+              d->error = r;
+              fprintf (stderr, "Error: stream of device %zu failed: %s\n", j, liballuris_error_name (r));
+            }
+        }
+
+      struct timespec ts;
+      clock_gettime (CLOCK_THREAD_CPUTIME_ID, &ts);
+      group->cpu_time = ts.tv_sec + ts.tv_nsec / 1.0e9;
+      int failed = group_failed (group);
+      pthread_cond_broadcast (&group->ready);
+      pthread_mutex_unlock (&group->lock);
+      if (failed)
+        break;
+    }
+  return NULL;
+}
+
+//! Internal arguments and result of group_open_thread
+struct group_open_job
+{
+  libusb_context* ctx;
+  libusb_device_handle* dev_handle;
+  size_t length;
+  struct group_device* d;
+  int ret;
+  pthread_t thread;
+  char started;
+};
+
+//! Internal thread function to open the stream of one device of a group
+static void* group_open_thread (void* arg)
+{
+  struct group_open_job* job = arg;
+  struct group_device* d = job->d;
+  job->ret = liballuris_stream_open (job->ctx, job->dev_handle, job->length, DEFAULT_STREAM_TRANSFERS, &d->stream);
+  if (! job->ret)
+    {
+      double rate = liballuris_stream_get_sample_rate (d->stream);
+      d->period = (rate > 0)? 1 / rate : 0;
+      d->last_time = monotonic_time ();
+    }
+  return NULL;
+}
+
+//! Internal function to close the streams and free a group, returns the first error of closing a stream
+static int group_free (struct liballuris_group* group)
+{
+  int ret = LIBALLURIS_SUCCESS;
+  size_t j;
+  if (group->devices)
+    for (j=0; j < group->num_devices; j++)
+      {
+        struct group_device* d = group->devices + j;
+        if (d->stream)
+          {
+            int r = liballuris_stream_close (d->stream);
+            if (! ret)
+              ret = r;
+          }
+        free (d->values);
+        free (d->times);
+      }
+  free (group->devices);
+  pthread_cond_destroy (&group->ready);
+  pthread_mutex_destroy (&group->lock);
+  free (group);
+  return ret;
+}
+
+/*!
+ * \brief Start streaming from several devices into row aligned queues
+ *
+ * Opens a stream like \ref liballuris_stream_open on every device, concurrently so
+ * that the streams start at about the same time, and starts a thread which sleeps
+ * in the libusb event handling of ctx until a transfer of any device completes.
+ * The blocks are queued per device, \ref liballuris_group_read
+ * returns rows with one sample of every device, sample k of all devices in row k.
+ * The thread uses no CPU time while no block arrives.
+ *
+ * Gaps in a stream (see \ref liballuris_stream_read_timestamped) are filled with
+ * \ref LIBALLURIS_GROUP_MISSING, so the rows stay aligned. A device which is more
+ * than half the capacity behind the fastest one or whose stream failed doesn't hold
+ * back the rows of the others, its samples in these rows are LIBALLURIS_GROUP_MISSING
+ * too. If the consumer doesn't keep up the oldest rows are dropped and counted.
+ *
+ * All handles have to be opened with ctx and must not have an open stream. Commands
+ * can be sent to the devices from other threads while the group is running.
+ *
+ * \param[in] ctx pointer to libusb context used to open the handles
+ * \param[in] handles devices to stream from, row element k belongs to handles[k]
+ * \param[in] num_devices number of elements in handles
+ * \param[in] length of block 1..19
+ * \param[in] capacity number of samples buffered per device, rounded up to a power of 2,
+ *   typically \ref DEFAULT_GROUP_CAPACITY
+ * \param[out] group storage for the group handle. Only populated if the return code is 0.
+ * \return 0 if successful else \ref liballuris_error
+ * \sa liballuris_group_read, liballuris_group_stop
+ */
+int liballuris_group_start (libusb_context* ctx, libusb_device_handle** handles, size_t num_devices,
+                            size_t length, size_t capacity, struct liballuris_group** group)
+{
+  if (! num_devices || capacity < 2 * length || capacity > ((size_t) -1) / 2 / sizeof (double))
+    return LIBALLURIS_OUT_OF_RANGE;
+
+  size_t size = 1;
+  while (size < capacity)
+    size *= 2;
+
+  struct liballuris_group* g = calloc (1, sizeof (struct liballuris_group));
+  if (! g)
+    return LIBUSB_ERROR_NO_MEM;
+  pthread_mutex_init (&g->lock, NULL);
+  pthread_condattr_t attr;
+  pthread_condattr_init (&attr);
+  pthread_condattr_setclock (&attr, CLOCK_MONOTONIC);
+  pthread_cond_init (&g->ready, &attr);
+  pthread_condattr_destroy (&attr);
+  atomic_init (&g->stop, 0);
+  g->ctx = ctx;
+  g->num_devices = num_devices;
+  g->length = length;
+  g->mask = size - 1;
+  g->max_delay = DEFAULT_RESAMPLE_DELAY;
+  g->devices = calloc (num_devices, sizeof (struct group_device));
+
+  int ret = (g->devices)? LIBALLURIS_SUCCESS : LIBUSB_ERROR_NO_MEM;
+  size_t j;
+  for (j=0; j < num_devices && ! ret; j++)
+    {
+      struct group_device* d = g->devices + j;
+      d->values = malloc (size * sizeof (int));
+      d->times = malloc (size * sizeof (double));
+      if (! d->values || ! d->times)
+        ret = LIBUSB_ERROR_NO_MEM;
+    }
+
+  // sample k of all devices completes at about the same time if the streams start together
+  struct group_open_job* jobs = (ret)? NULL : calloc (num_devices, sizeof (struct group_open_job));
+  if (! ret && ! jobs)
+    ret = LIBUSB_ERROR_NO_MEM;
+  for (j=0; jobs && j < num_devices; j++)
+    {
+      jobs[j].ctx = ctx;
+      jobs[j].dev_handle = handles[j];
+      jobs[j].length = length;
+      jobs[j].d = g->devices + j;
+      jobs[j].started = ! pthread_create (&jobs[j].thread, NULL, group_open_thread, jobs + j);
+      if (! jobs[j].started)
+        group_open_thread (jobs + j);
+    }
+  for (j=0; jobs && j < num_devices; j++)
+    {
+      if (jobs[j].started)
+        pthread_join (jobs[j].thread, NULL);
+      if (! ret)
+        ret = jobs[j].ret;
+    }
+  free (jobs);
+
+  g->start = monotonic_time ();
+  if (! ret && pthread_create (&g->thread, NULL, group_thread, g))
+    ret = LIBUSB_ERROR_OTHER;
+  if (ret)
+    {
+      group_free (g);
+      return ret;
+    }
+
+  if (context_debug_level (context_get (ctx, 0)))
+    fprintf (stderr, "DEBUG-INFO: liballuris_group_start: %zu devices, block length %zu, capacity %zu\n",
+             num_devices, length, size);
+
+  *group = g;
+  return LIBALLURIS_SUCCESS;
+}
+
+/*!
+ * \brief Read rows from an acquisition group
+ *
+ * Like \ref liballuris_group_read_timestamped without timestamps.
+ *
+ * \param[in] group handle from \ref liballuris_group_start
+ * \param[out] rows output location for num_rows * num_devices values
+ * \param[in] num_rows maximum number of rows to read
+ * \param[out] actual number of rows copied
+ * \param[in] timeout in milliseconds
+ * \return 0 if at least one row was copied, LIBUSB_ERROR_TIMEOUT if none became ready in time
+ *   else \ref liballuris_error
+ */
+int liballuris_group_read (struct liballuris_group* group, int* rows, size_t num_rows, size_t* actual, unsigned int timeout)
+{
+  return liballuris_group_read_timestamped (group, rows, NULL, num_rows, actual, timeout);
+}
+
+/*!
+ * \brief Read rows and their timestamps from an acquisition group
+ *
+ * Copies up to num_rows ready rows and waits up to timeout milliseconds if no row
+ * is ready. Row r is stored in rows[r * num_devices] to rows[r * num_devices + num_devices - 1].
+ * The timestamps are those of \ref liballuris_stream_read_timestamped, estimated for
+ * missing samples. They differ between the devices of a row because every device
+ * samples with its own clock.
+ *
+ * \param[in] group handle from \ref liballuris_group_start
+ * \param[out] rows output location for num_rows * num_devices values
+ * \param[out] t output location for num_rows * num_devices timestamps or NULL
+ * \param[in] num_rows maximum number of rows to read
+ * \param[out] actual number of rows copied
+ * \param[in] timeout in milliseconds
+ * \return 0 if at least one row was copied, LIBUSB_ERROR_TIMEOUT if none became ready in time,
+ *   LIBUSB_ERROR_BUSY if the group was switched to \ref liballuris_group_read_resampled,
+ *   else the \ref liballuris_error which ended the group once all rows are read
+ */
+int liballuris_group_read_timestamped (struct liballuris_group* group, int* rows, double* t, size_t num_rows,
+                                       size_t* actual, unsigned int timeout)
+{
+  *actual = 0;
+  struct timespec deadline;
+  cond_deadline (timeout, &deadline);
+
+  pthread_mutex_lock (&group->lock);
+  if (group->resampling)
+    {
+      pthread_mutex_unlock (&group->lock);
+      return LIBUSB_ERROR_BUSY;
+    }
+  unsigned long long end;
+  while ((end = group_ready_end (group)) == group->tail)
+    {
+      int r = group_failed (group);
+      if (! r && pthread_cond_timedwait (&group->ready, &group->lock, &deadline))
+        r = LIBUSB_ERROR_TIMEOUT;
+      if (r)
+        {
+          pthread_mutex_unlock (&group->lock);
+          return r;
+        }
+    }
+
+  size_t n = (end - group->tail < num_rows)? end - group->tail : num_rows;
+  size_t nd = group->num_devices;
+  size_t r, j;
+  for (r=0; r < n; r++)
+    for (j=0; j < nd; j++)
+      {
+        struct group_device* d = group->devices + j;
+        unsigned long long index = group->tail + r;
+        int v = (index < d->head)? d->values[index & group->mask] : LIBALLURIS_GROUP_MISSING;
+        if (v == LIBALLURIS_GROUP_MISSING)
+          d->missing++;
+        rows[r * nd + j] = v;
+        if (t)
+          t[r * nd + j] = group_sample_time (group, d, index);
+      }
+  group->tail += n;
+  group->rows += n;
+  pthread_mutex_unlock (&group->lock);
+
+  *actual = n;
+  return LIBALLURIS_SUCCESS;
+}
+
+/*!
+ * \brief Set the grid of \ref liballuris_group_read_resampled
+ *
+ * \param[in] group handle from \ref liballuris_group_start
+ * \param[in] period of the grid in seconds, 0 for the mean estimated sample period of the devices
+ * \param[in] max_delay seconds a device may be late with the block following a grid time
+ *   before it's given up for it, typically \ref DEFAULT_RESAMPLE_DELAY
+ * \return 0 if successful, LIBALLURIS_OUT_OF_RANGE if period or max_delay is negative
+ */
+int liballuris_group_set_timebase (struct liballuris_group* group, double period, double max_delay)
+{
+  if (period < 0 || max_delay < 0)
+    return LIBALLURIS_OUT_OF_RANGE;
+  pthread_mutex_lock (&group->lock);
+  group->grid_period = period;
+  group->max_delay = max_delay;
+  pthread_mutex_unlock (&group->lock);
+  return LIBALLURIS_SUCCESS;
+}
+
+//! Internal period of the resampling grid, call with group->lock held
+static double group_grid_period (const struct liballuris_group* group)
+{
+  if (group->grid_period > 0)
+    return group->grid_period;
+  double sum = 0;
+  size_t j, n = 0;
+  for (j=0; j < group->num_devices; j++)
+    if (group->devices[j].period > 0)
+      {
+        sum += group->devices[j].period;
+        n++;
+      }
+  return (n)? sum / n : 0;
+}
+
+//! Internal check whether the next grid time can be resampled, call with group->lock held
+static int group_grid_ready (struct liballuris_group* group, double now)
+{
+  size_t j;
+  if (! group->grid_started)
+    {
+      // start at the latest first sample, give up devices which don't send
+      // any within one block plus max_delay after the others
+      double start = 0, earliest = 0, block = 0;
+      int waiting = 0;
+      for (j=0; j < group->num_devices; j++)
+        {
+          const struct group_device* d = group->devices + j;
+          if (d->error)
+            continue;
+          if (d->head <= d->cursor)
+            {
+              waiting = 1;
+              continue;
+            }
+          double t0 = group_sample_time (group, d, d->cursor);
+          if (t0 > start)
+            start = t0;
+          if (! earliest || t0 < earliest)
+            earliest = t0;
+          if (d->period * group->length > block)
+            block = d->period * group->length;
+        }
+      if (! start || (waiting && now < earliest + block + group->max_delay) || group_grid_period (group) <= 0)
+        return 0;
+      group->grid_next = start;
+      group->grid_started = 1;
+    }
+
+  // the newest sample of every device has to be later than the grid time,
+  // unless the block with it is overdue by more than max_delay
+  for (j=0; j < group->num_devices; j++)
+    {
+      const struct group_device* d = group->devices + j;
+      if (! d->error && (! d->head || d->times[(d->head - 1) & group->mask] <= group->grid_next)
+          && now < group->grid_next + d->period * group->length + group->max_delay)
+        return 0;
+    }
+  return 1;
+}
+
+//! Internal linear interpolation of d at the host time t, NAN if not possible
+static double group_interpolate (const struct liballuris_group* group, struct group_device* d, double t)
+{
+  if (d->cursor < group->tail)
+    d->cursor = group->tail;
+  while (d->cursor + 1 < d->head && d->times[(d->cursor + 1) & group->mask] <= t)
+    d->cursor++;
+  if (d->cursor + 1 >= d->head)
+    return NAN;
+
+  size_t a = d->cursor & group->mask, b = (d->cursor + 1) & group->mask;
+  double ta = d->times[a], tb = d->times[b];
+  if (ta > t || tb <= ta || d->values[a] == LIBALLURIS_GROUP_MISSING || d->values[b] == LIBALLURIS_GROUP_MISSING)
+    return NAN;
+  return d->values[a] + (d->values[b] - d->values[a]) * (t - ta) / (tb - ta);
+}
+
+/*!
+ * \brief Read rows resampled onto a common host timebase
+ *
+ * Every device is interpolated linearly at the grid times t_k = t_0 + k * period
+ * (CLOCK_MONOTONIC seconds) with the timestamps of \ref liballuris_stream_read_timestamped,
+ * which follow the clock offset and rate of each device. So the values in a row belong
+ * to the same instant even though the device clocks drift apart. The grid starts at the
+ * latest first sample of all devices, the period is set with \ref liballuris_group_set_timebase.
+ *
+ * A row is ready once all devices sent a sample after its grid time. A device whose block
+ * is overdue by more than max_delay, which failed or has a gap there is NaN in the row,
+ * so the latency is bounded by one block plus max_delay. The first call switches the
+ * group to resampling, \ref liballuris_group_read isn't possible afterwards.
+ *
+ * \param[in] group handle from \ref liballuris_group_start
+ * \param[out] rows output location for num_rows * num_devices values in device units
+ *   (like \ref liballuris_poll_measurement) or NaN
+ * \param[out] t output location for num_rows grid times or NULL
+ * \param[in] num_rows maximum number of rows to read
+ * \param[out] actual number of rows copied
+ * \param[in] timeout in milliseconds
+ * \return 0 if at least one row was copied, LIBUSB_ERROR_TIMEOUT if none became ready in time,
+ *   else the \ref liballuris_error which ended the group
+ */
+int liballuris_group_read_resampled (struct liballuris_group* group, double* rows, double* t, size_t num_rows,
+                                     size_t* actual, unsigned int timeout)
+{
+  *actual = 0;
+  struct timespec deadline;
+  cond_deadline (timeout, &deadline);
+
+  pthread_mutex_lock (&group->lock);
+  size_t j, nd = group->num_devices;
+  if (! group->resampling)
+    {
+      for (j=0; j < nd; j++)
+        group->devices[j].cursor = group->tail;
+      group->resampling = 1;
+    }
+
+  size_t n = 0;
+  for (;;)
+    {
+      double now = monotonic_time ();
+      double period = group_grid_period (group);
+      while (n < num_rows && group_grid_ready (group, now))
+        {
+          for (j=0; j < nd; j++)
+            {
+              struct group_device* d = group->devices + j;
+              double v = group_interpolate (group, d, group->grid_next);
+              if (isnan (v))
+                d->missing++;
+              rows[n * nd + j] = v;
+            }
+          if (t)
+            t[n] = group->grid_next;
+          group->grid_next += period;
+          n++;
+        }
+      if (n)
+        break;
+
+      int r = group_failed (group);
+      if (! r && pthread_cond_timedwait (&group->ready, &group->lock, &deadline))
+        r = LIBUSB_ERROR_TIMEOUT;
+      if (r)
+        {
+          pthread_mutex_unlock (&group->lock);
+          return r;
+        }
+    }
+
+  // samples before the oldest read position of a working device aren't needed anymore
+  unsigned long long tail = (unsigned long long) -1;
+  for (j=0; j < nd; j++)
+    if (! group->devices[j].error && group->devices[j].cursor < tail)
+      tail = group->devices[j].cursor;
+  if (tail != (unsigned long long) -1 && tail > group->tail)
+    group->tail = tail;
+  group->rows += n;
+  pthread_mutex_unlock (&group->lock);
+
+  *actual = n;
+  return LIBALLURIS_SUCCESS;
+}
+
+/*!
+ * \brief Query the number of rows which can be read without blocking
+ *
+ * \param[in] group handle from \ref liballuris_group_start
+ * \return number of ready rows of \ref liballuris_group_read, 0 after switching to resampling
+ */
+size_t liballuris_group_pending (struct liballuris_group* group)
+{
+  pthread_mutex_lock (&group->lock);
+  size_t ret = (group->resampling)? 0 : group_ready_end (group) - group->tail;
+  pthread_mutex_unlock (&group->lock);
+  return ret;
+}
+
+/*!
+ * \brief Query the load of the engine thread of an acquisition group
+ *
+ * \param[in] group handle from \ref liballuris_group_start
+ * \param[out] stats output location
+ * \return 0 if successful
+ */
+int liballuris_group_get_stats (struct liballuris_group* group, struct liballuris_group_stats* stats)
+{
+  pthread_mutex_lock (&group->lock);
+  stats->elapsed = monotonic_time () - group->start;
+  stats->cpu_time = group->cpu_time;
+  stats->wakeups = group->wakeups;
+  stats->rows = group->rows;
+  stats->dropped_rows = group->dropped_rows;
+  pthread_mutex_unlock (&group->lock);
+  return LIBALLURIS_SUCCESS;
+}
+
+/*!
+ * \brief Query the counters and the latency of one device of an acquisition group
+ *
+ * \param[in] group handle from \ref liballuris_group_start
+ * \param[in] device index into the handles passed to \ref liballuris_group_start
+ * \param[out] stats output location
+ * \return 0 if successful, LIBALLURIS_OUT_OF_RANGE if device is invalid
+ */
+int liballuris_group_get_device_stats (struct liballuris_group* group, size_t device,
+                                       struct liballuris_group_device_stats* stats)
+{
+  if (device >= group->num_devices)
+    return LIBALLURIS_OUT_OF_RANGE;
+
+  pthread_mutex_lock (&group->lock);
+  const struct group_device* d = group->devices + device;
+  stats->received = d->received;
+  stats->missing = d->missing;
+  stats->late = d->late;
+  stats->pending = (d->head > group->tail)? d->head - group->tail : 0;
+  stats->lag = d->lag;
+  stats->max_lag = d->max_lag;
+  stats->error = d->error;
+  pthread_mutex_unlock (&group->lock);
+  return LIBALLURIS_SUCCESS;
+}
+
+/*!
+ * \brief Stop the engine thread, close the streams and free the group
+ *
+ * Rows which weren't read yet are discarded.
+ *
+ * \param[in] group handle from \ref liballuris_group_start
+ * \return 0 if successful else the \ref liballuris_error which ended the engine thread
+ *   or occurred while closing a stream
+ */
+int liballuris_group_stop (struct liballuris_group* group)
+{
+  atomic_store (&group->stop, 1);
+  pthread_join (group->thread, NULL);
+
+  int ret = group->error;
+  int close_ret = group_free (group);
+  return (ret)? ret : close_ret;
+}
+
+/****************************************************************************************/
+/*
+ * Framed streams
+ *
+ * Sample blocks packed to 24 bit in self delimiting frames, so a receiver of a
+ * pipe or TCP stream can find the next frame after lost or corrupted bytes.
+ * A frame is only accepted if its checksum matches, else the search for the
+ * sync bytes continues one byte after the rejected start.
+ *
+ * LIBALLURIS_FRAME_DELTA stores the first value of a frame as int32 and the
+ * differences to the previous value zigzag coded (0, -1, 1, -2 .. as 0, 1, 2, 3 ..)
+ * in groups of FRAME_DELTA_GROUP. Each group is the bit width, the smallest
+ * zigzag value as reference (LEB128) and the offsets to it packed LSB first.
+ * The unpacking doesn't branch per value, the compiler vectorises it.
+ */
+
+//! Number of differences which share the bit width and reference in LIBALLURIS_FRAME_DELTA
+#define FRAME_DELTA_GROUP 32
+
+//! Internal table of the CRC-32 of every byte, see frame_crc_init
+static uint32_t frame_crc_table[256];
+static pthread_once_t frame_crc_once = PTHREAD_ONCE_INIT;
+
+//! Internal function to fill frame_crc_table for the reflected polynomial 0xEDB88320
+static void frame_crc_init (void)
+{
+  uint32_t i, k;
+  for (i=0; i < 256; i++)
+    {
+      uint32_t c = i;
+      for (k=0; k < 8; k++)
+        c = (c & 1)? 0xEDB88320 ^ (c >> 1) : c >> 1;
+      frame_crc_table[i] = c;
+    }
+}
+
+//! Internal CRC-32 of the bytes of buf, the same as zlib's crc32
+static uint32_t frame_checksum (const unsigned char* buf, size_t size)
+{
+  pthread_once (&frame_crc_once, frame_crc_init);
+  uint32_t c = 0xFFFFFFFF;
+  while (size--)
+    c = frame_crc_table[(c ^ *buf++) & 0xFF] ^ (c >> 8);
+  return c ^ 0xFFFFFFFF;
+}
+
+//! Internal little-endian store of v in 4 bytes
+static void frame_put_uint32 (unsigned char* out, uint32_t v)
+{
+  out[0] = v & 0xFF;
+  out[1] = (v >> 8) & 0xFF;
+  out[2] = (v >> 16) & 0xFF;
+  out[3] = (v >> 24) & 0xFF;
+}
+
+//! Internal little-endian load of 4 bytes
+static uint32_t frame_get_uint32 (const unsigned char* in)
+{
+  return in[0] | (in[1] << 8) | (in[2] << 16) | ((uint32_t) in[3] << 24);
+}
+
+//! Internal function to write header and checksum around a payload, returns the size of the frame
+static size_t frame_finish (unsigned char* buf, unsigned char format, unsigned char device, uint32_t sequence,
+                            size_t count, size_t payload)
+{
+  memcpy (buf, LIBALLURIS_FRAME_SYNC, 2);
+  buf[2] = format;
+  buf[3] = device;
+  frame_put_uint32 (buf + 4, sequence);
+  buf[8] = count & 0xFF;
+  buf[9] = count >> 8;
+  buf[10] = payload & 0xFF;
+  buf[11] = payload >> 8;
+  unsigned char* trailer = buf + LIBALLURIS_FRAME_HEADER_SIZE + payload;
+  frame_put_uint32 (trailer, frame_checksum (buf + 2, trailer - buf - 2));
+  return LIBALLURIS_FRAME_HEADER_SIZE + payload + LIBALLURIS_FRAME_TRAILER_SIZE;
+}
+
+//! Internal largest payload of a LIBALLURIS_FRAME_DELTA frame with count samples
+static size_t frame_delta_max_payload (size_t count)
+{
+  size_t groups = (count + FRAME_DELTA_GROUP - 1) / FRAME_DELTA_GROUP;
+  // first value, width and reference of each group, 32 bit per difference
+  return 4 + groups * 6 + 4 * count;
+}
+
+//! Internal function to pack n <= FRAME_DELTA_GROUP zigzag coded differences, returns the end of the group
+static unsigned char* frame_delta_pack (const uint32_t* z, size_t n, unsigned char* out)
+{
+  uint32_t ref = z[0], bits = 0;
+  size_t k;
+  for (k=1; k < n; k++)
+    if (z[k] < ref)
+      ref = z[k];
+  for (k=0; k < n; k++)
+    bits |= z[k] - ref;
+  int width = (bits)? 32 - __builtin_clz (bits) : 0;
+
+  *out++ = width;
+  uint32_t r = ref;
+  for (; r >= 0x80; r >>= 7)
+    *out++ = (r & 0x7F) | 0x80;
+  *out++ = r;
+
+  uint64_t acc = 0;
+  int fill = 0;
+  for (k=0; k < n; k++)
+    {
+      acc |= (uint64_t) (z[k] - ref) << fill;
+      for (fill += width; fill >= 8; fill -= 8, acc >>= 8)
+        *out++ = acc & 0xFF;
+    }
+  if (fill)
+    *out++ = acc & 0xFF;
+  return out;
+}
+
+/*!
+ * Internal function to unpack a group of n differences and add them up starting with *prev.
+ * Returns the end of the group or NULL if it doesn't fit in the payload up to end.
+ */
+static const unsigned char* frame_delta_unpack (const unsigned char* in, const unsigned char* end, size_t n,
+                                                int* prev, int* out)
+{
+  if (in >= end || *in > 32)
+    return NULL;
+  int width = *in++;
+
+  uint32_t ref = 0;
+  int shift;
+  for (shift = 0; ; shift += 7)
+    {
+      if (in >= end || shift > 28)
+        return NULL;
+      ref |= (uint32_t) (*in & 0x7F) << shift;
+      if (! (*in++ & 0x80))
+        break;
+    }
+
+  size_t size = (n * width + 7) / 8;
+  if ((size_t) (end - in) < size)
+    return NULL;
+
+  // padded copy, so every value can be extracted with one 64 bit load
+  unsigned char packed[4 * FRAME_DELTA_GROUP + 8];
+  memcpy (packed, in, size);
+  memset (packed + size, 0, sizeof (packed) - size);
+
+  uint32_t mask = (width == 32)? 0xFFFFFFFF : (1u << width) - 1;
+  uint32_t z[FRAME_DELTA_GROUP];
+  size_t k;
+  for (k=0; k < FRAME_DELTA_GROUP; k++)
+    {
+      uint64_t w;
+      memcpy (&w, packed + ((k * width) >> 3), 8);
+      z[k] = ((uint32_t) (w >> ((k * width) & 7)) & mask) + ref;
+    }
+
+  uint32_t v = *prev;
+  for (k=0; k < n; k++)
+    {
+      v += (z[k] >> 1) ^ -(z[k] & 1);
+      out[k] = v;
+    }
+  *prev = v;
+  return in + size;
+}
+
+//! Internal function to unpack the payload of a LIBALLURIS_FRAME_DELTA frame, 0 if malformed
+static int frame_delta_decode (const unsigned char* in, size_t payload, size_t count, int* values)
+{
+  if (! count)
+    return ! payload;
+  const unsigned char* end = in + payload;
+  if (payload < 4)
+    return 0;
+  int prev = (int) frame_get_uint32 (in);
+  values[0] = prev;
+  in += 4;
+
+  size_t k;
+  for (k=1; k < count && in; k += FRAME_DELTA_GROUP)
+    {
+      size_t n = (count - k < FRAME_DELTA_GROUP)? count - k : FRAME_DELTA_GROUP;
+      in = frame_delta_unpack (in, end, n, &prev, values + k);
+    }
+  return in == end;
+}
+
+/*!
+ * \brief Size of a frame with count samples
+ *
+ * \param[in] count number of samples, up to \ref LIBALLURIS_FRAME_MAX_SAMPLES
+ * \return size in bytes of the frame \ref liballuris_frame_encode writes
+ */
+size_t liballuris_frame_size (size_t count)
+{
+  return LIBALLURIS_FRAME_HEADER_SIZE + 3 * count + LIBALLURIS_FRAME_TRAILER_SIZE;
+}
+
+/*!
+ * \brief Pack samples into a frame
+ *
+ * The frame uses \ref LIBALLURIS_FRAME_INT24, which needs 3 instead of 4 bytes per
+ * sample. The header carries device and sequence, so a receiver can tell several
+ * gauges apart and detect lost frames, see \ref liballuris_frame_info.
+ *
+ * \param[out] buf output location for the frame
+ * \param[in] size of buf in bytes, at least \ref liballuris_frame_size (count)
+ * \param[in] device 0..255 to identify the gauge at the receiver
+ * \param[in] sequence number of this frame, usually incremented for every frame
+ * \param[in] values samples as returned by \ref liballuris_poll_measurement
+ * \param[in] count number of values, up to \ref LIBALLURIS_FRAME_MAX_SAMPLES
+ * \param[out] written size of the frame in bytes
+ * \return 0 if successful, LIBUSB_ERROR_OVERFLOW if buf is too small,
+ *   LIBALLURIS_OUT_OF_RANGE if device, count or a value doesn't fit
+ */
+int liballuris_frame_encode (unsigned char* buf, size_t size, unsigned int device, uint32_t sequence,
+                             const int* values, size_t count, size_t* written)
+{
+  *written = 0;
+  if (device > 255 || count > LIBALLURIS_FRAME_MAX_SAMPLES)
+    return LIBALLURIS_OUT_OF_RANGE;
+  size_t frame_size = liballuris_frame_size (count);
+  if (size < frame_size)
+    return LIBUSB_ERROR_OVERFLOW;
+
+  unsigned char* p = buf + LIBALLURIS_FRAME_HEADER_SIZE;
+  size_t k;
+  for (k=0; k < count; k++, p += 3)
+    {
+      int v = values[k];
+      if (v < -0x800000 || v > 0x7FFFFF)
+        return LIBALLURIS_OUT_OF_RANGE;
+      p[0] = v & 0xFF;
+      p[1] = (v >> 8) & 0xFF;
+      p[2] = (v >> 16) & 0xFF;
+    }
+
+  *written = frame_finish (buf, LIBALLURIS_FRAME_INT24, device, sequence, count, 3 * count);
+  return LIBALLURIS_SUCCESS;
+}
+
+/*!
+ * \brief Find and unpack the next valid frame
+ *
+ * Bytes which don't start a valid frame are skipped, so after lost or corrupted
+ * data the decoder continues with the next intact frame. Call it repeatedly and
+ * discard the consumed bytes in between. If the buffer ends within a frame,
+ * only the bytes before it are consumed, append more data and call again.
+ *
+ * \param[in] buf received bytes
+ * \param[in] size of buf in bytes
+ * \param[out] info header of the decoded frame
+ * \param[out] values output location for info->count samples
+ * \param[in] length of values, \ref LIBALLURIS_FRAME_MAX_SAMPLES is always enough
+ * \param[out] consumed bytes of buf which can be discarded
+ * \return 0 if a frame was decoded, LIBUSB_ERROR_NOT_FOUND if buf holds no complete frame,
+ *   LIBUSB_ERROR_OVERFLOW if values is too small (the frame isn't consumed)
+ */
+int liballuris_frame_decode (const unsigned char* buf, size_t size, struct liballuris_frame_info* info,
+                             int* values, size_t length, size_t* consumed)
+{
+  size_t pos = 0;
+  for (;;)
+    {
+      // next sync candidate
+      while (pos + 1 < size && (buf[pos] != (unsigned char) LIBALLURIS_FRAME_SYNC[0]
+                                || buf[pos + 1] != (unsigned char) LIBALLURIS_FRAME_SYNC[1]))
+        pos++;
+      *consumed = pos;
+      if (size - pos < LIBALLURIS_FRAME_HEADER_SIZE)
+        {
+          // keep a possible start of a frame
+          if (pos + 1 == size && buf[pos] != (unsigned char) LIBALLURIS_FRAME_SYNC[0])
+            *consumed = size;
+          return LIBUSB_ERROR_NOT_FOUND;
+        }
+
+      const unsigned char* f = buf + pos;
+      size_t count = f[8] | (f[9] << 8);
+      size_t payload = f[10] | (f[11] << 8);
+      if (count > LIBALLURIS_FRAME_MAX_SAMPLES
+          || ! ((f[2] == LIBALLURIS_FRAME_INT24 && payload == 3 * count)
+                || (f[2] == LIBALLURIS_FRAME_DELTA && payload <= frame_delta_max_payload (count))))
+        {
+          pos++;
+          continue;
+        }
+
+      size_t frame_size = LIBALLURIS_FRAME_HEADER_SIZE + payload + LIBALLURIS_FRAME_TRAILER_SIZE;
+      if (size - pos < frame_size)
+        return LIBUSB_ERROR_NOT_FOUND;
+      const unsigned char* trailer = f + LIBALLURIS_FRAME_HEADER_SIZE + payload;
+      if (frame_get_uint32 (trailer) != frame_checksum (f + 2, trailer - f - 2))
+        {
+          pos++;
+          continue;
+        }
+
+      if (length < count)
+        return LIBUSB_ERROR_OVERFLOW;
+      if (f[2] == LIBALLURIS_FRAME_INT24)
+        decode_int24_block (f + LIBALLURIS_FRAME_HEADER_SIZE, values, count);
+      else if (! frame_delta_decode (f + LIBALLURIS_FRAME_HEADER_SIZE, payload, count, values))
+        {
+          // checksum matches but the sender packed it wrong
+          pos++;
+          continue;
+        }
+
+      info->sequence = frame_get_uint32 (f + 4);
+      info->device = f[3];
+      info->format = f[2];
+      info->count = count;
+      info->size = frame_size;
+      info->skipped = pos;
+      *consumed = pos + frame_size;
+      return LIBALLURIS_SUCCESS;
+    }
+}
+
+//! Internal state of a frame writer
+struct liballuris_frame_writer
+{
+  FILE* out;
+  unsigned char format;                 //!< enum liballuris_frame_format
+  unsigned char device;
+  size_t samples;                       //!< samples per frame
+  uint32_t sequence;                    //!< of the next frame
+  unsigned char* buf;                   //!< frame in progress, the payload starts after the header
+  size_t payload;                       //!< bytes of payload in buf
+  size_t count;                         //!< samples in the frame in progress
+  int prev;                             //!< LIBALLURIS_FRAME_DELTA: last sample
+  uint32_t group[FRAME_DELTA_GROUP];    //!< LIBALLURIS_FRAME_DELTA: zigzag coded differences not packed yet
+  size_t group_fill;
+  unsigned long long bytes;             //!< written so far
+};
+
+/*!
+ * \brief Create an encoder which writes samples as frames
+ *
+ * The samples are encoded as they are written, a frame is written to out as soon
+ * as it has the given number of samples. Every frame can be decoded on its own by
+ * \ref liballuris_frame_decode, so a receiver can start or resynchronise anywhere.
+ *
+ * \ref LIBALLURIS_FRAME_DELTA is lossless and needs few bits for slowly changing forces,
+ * often 1 byte per sample or less at 900Hz. It stores the difference to the previous
+ * sample zigzag coded (small positive and negative differences become small numbers)
+ * and packs every 32 differences with the bit width of the largest after subtracting
+ * the smallest (frame of reference).
+ *
+ * \param[in] out stream to write to, for example stdout
+ * \param[in] format enum liballuris_frame_format
+ * \param[in] device 0..255 to identify the gauge at the receiver
+ * \param[in] samples per frame 1..\ref LIBALLURIS_FRAME_MAX_SAMPLES, typically \ref DEFAULT_FRAME_SAMPLES
+ * \param[out] writer handle for the other liballuris_frame_writer functions
+ * \return 0 if successful, LIBALLURIS_OUT_OF_RANGE or LIBUSB_ERROR_NO_MEM
+ */
+int liballuris_frame_writer_new (FILE* out, enum liballuris_frame_format format, unsigned int device,
+                                 size_t samples, struct liballuris_frame_writer** writer)
+{
+  *writer = NULL;
+  if ((format != LIBALLURIS_FRAME_INT24 && format != LIBALLURIS_FRAME_DELTA)
+      || device > 255 || ! samples || samples > LIBALLURIS_FRAME_MAX_SAMPLES)
+    return LIBALLURIS_OUT_OF_RANGE;
+
+  struct liballuris_frame_writer* w = calloc (1, sizeof (struct liballuris_frame_writer));
+  if (! w)
+    return LIBUSB_ERROR_NO_MEM;
+  w->buf = malloc (LIBALLURIS_FRAME_HEADER_SIZE + frame_delta_max_payload (samples) + LIBALLURIS_FRAME_TRAILER_SIZE);
+  if (! w->buf)
+    {
+      free (w);
+      return LIBUSB_ERROR_NO_MEM;
+    }
+  w->out = out;
+  w->format = format;
+  w->device = device;
+  w->samples = samples;
+  *writer = w;
+  return LIBALLURIS_SUCCESS;
+}
+
+//! Internal function to pack the pending differences of a LIBALLURIS_FRAME_DELTA writer
+static void frame_writer_pack (struct liballuris_frame_writer* w)
+{
+  if (w->group_fill)
+    {
+      unsigned char* p = w->buf + LIBALLURIS_FRAME_HEADER_SIZE + w->payload;
+      w->payload = frame_delta_pack (w->group, w->group_fill, p) - (w->buf + LIBALLURIS_FRAME_HEADER_SIZE);
+      w->group_fill = 0;
+    }
+}
+
+/*!
+ * \brief Write the frame in progress even if it isn't full
+ *
+ * The stream out isn't flushed, use fflush for that.
+ *
+ * \param[in] writer handle from \ref liballuris_frame_writer_new
+ * \return 0 if successful, LIBUSB_ERROR_IO if writing failed
+ */
+int liballuris_frame_writer_flush (struct liballuris_frame_writer* writer)
+{
+  struct liballuris_frame_writer* w = writer;
+  if (! w->count)
+    return LIBALLURIS_SUCCESS;
+  frame_writer_pack (w);
+  size_t size = frame_finish (w->buf, w->format, w->device, w->sequence++, w->count, w->payload);
+  w->count = 0;
+  w->payload = 0;
+  if (fwrite (w->buf, 1, size, w->out) != size)
+    {
+      fprintf (stderr, "Error: writing frame failed: %s\n", strerror (errno));
+      return LIBUSB_ERROR_IO;
+    }
+  w->bytes += size;
+  return LIBALLURIS_SUCCESS;
+}
+
+/*!
+ * \brief Encode samples and write the completed frames
+ *
+ * \param[in] writer handle from \ref liballuris_frame_writer_new
+ * \param[in] values samples as returned by \ref liballuris_poll_measurement
+ * \param[in] count number of values
+ * \return 0 if successful, LIBALLURIS_OUT_OF_RANGE if a value doesn't fit in
+ *   \ref LIBALLURIS_FRAME_INT24 (it's skipped), LIBUSB_ERROR_IO if writing failed
+ */
+int liballuris_frame_writer_write (struct liballuris_frame_writer* writer, const int* values, size_t count)
+{
+  struct liballuris_frame_writer* w = writer;
+  int r = LIBALLURIS_SUCCESS;
+  size_t k;
+  for (k=0; k < count; k++)
+    {
+      int v = values[k];
+      unsigned char* p = w->buf + LIBALLURIS_FRAME_HEADER_SIZE + w->payload;
+      if (w->format == LIBALLURIS_FRAME_INT24)
+        {
+          if (v < -0x800000 || v > 0x7FFFFF)
+            {
+              r = LIBALLURIS_OUT_OF_RANGE;
+              continue;
+            }
+          p[0] = v & 0xFF;
+          p[1] = (v >> 8) & 0xFF;
+          p[2] = (v >> 16) & 0xFF;
+          w->payload += 3;
+        }
+      else if (! w->count)
+        {
+          frame_put_uint32 (p, v);
+          w->payload += 4;
+        }
+      else
+        {
+          // zigzag with wrap around, so any difference of two int32 works
+          uint32_t d = (uint32_t) v - (uint32_t) w->prev;
+          w->group[w->group_fill++] = (d << 1) ^ -(d >> 31);
+          if (w->group_fill == FRAME_DELTA_GROUP)
+            frame_writer_pack (w);
+        }
+      w->prev = v;
+
+      if (++w->count == w->samples)
+        {
+          int flush_ret = liballuris_frame_writer_flush (w);
+          if (flush_ret)
+            return flush_ret;
+        }
+    }
+  return r;
+}
+
+/*!
+ * \brief Number of bytes written
+ *
+ * \param[in] writer handle from \ref liballuris_frame_writer_new
+ * \return size of all frames written so far
+ */
+unsigned long long liballuris_frame_writer_get_bytes (struct liballuris_frame_writer* writer)
+{
+  return writer->bytes;
+}
+
+/*!
+ * \brief Write the frame in progress and free the writer
+ *
+ * \param[in] writer handle from \ref liballuris_frame_writer_new
+ * \return result of \ref liballuris_frame_writer_flush
+ */
+int liballuris_frame_writer_free (struct liballuris_frame_writer* writer)
+{
+  int r = liballuris_frame_writer_flush (writer);
+  free (writer->buf);
+  free (writer);
+  return r;
+}
+
+/****************************************************************************************/
+/*
+ * Output formatting
+ *
+ * printf parses its format string for every value and a stream flushed per
+ * block issues a write per block. The formatter converts integers with a
+ * table of digit pairs from the back into one large buffer which is written
+ * with a single fwrite when full or on flush.
+ */
+
+//! Size of the buffer of a formatter in bytes
+#define FORMATTER_BUFFER_SIZE (64 * 1024)
+//! Largest text of one value, sign, 10 digits, radix point, 9 decimals and separator
+#define FORMATTER_MAX_TEXT 24
+
+//! Internal state of a formatter
+struct liballuris_formatter
+{
+  FILE* out;
+  enum liballuris_output_format format;
+  size_t columns;
+  int* digits;                          //!< decimal places of every column
+  size_t column;                        //!< of the next value
+  char* buf;
+  size_t fill;
+};
+
+//! Internal table of the two digit numbers "00" .. "99"
+static const char formatter_pairs[] =
+  "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+  "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+  "8081828384858687888990919293949596979899";
+
+//! Internal function to write v as fixed-point number ending before end, returns its start
+static char* formatter_fixed (char* end, int v, int digits)
+{
+  uint32_t u = (v < 0)? - (uint32_t) v : (uint32_t) v;
+  char* p = end;
+  int k;
+  for (k=0; k < digits; k++)
     {
-      *v = char_to_int24 (in_buf + 3);
-      if (*v == -1)
-        return LIBALLURIS_DEVICE_BUSY;
+      *--p = '0' + u % 10;
+      u /= 10;
     }
-  return ret;
+  if (digits)
+    *--p = '.';
+  while (u >= 100)
+    {
+      const char* pair = formatter_pairs + 2 * (u % 100);
+      u /= 100;
+      *--p = pair[1];
+      *--p = pair[0];
+    }
+  if (u >= 10)
+    {
+      *--p = formatter_pairs[2 * u + 1];
+      *--p = formatter_pairs[2 * u];
+    }
+  else
+    *--p = '0' + u;
+  if (v < 0)
+    *--p = '-';
+  return p;
 }
 
 /*!
- * \brief Query the variant
+ * Convert string to enum liballuris_output_format
  *
- * Supported devices:
- * 0x0000: FMI-S10
- * 0x0001: FMI-S20
- * 0x0002: FMI-S30
- * 0x0003: FMI-W30
- * 0x0004: FMI-W40
- * 0x0005: FMI-S50
- * 0x0006: FMI-W20
- * 0x0007: FMT-W10
- * 0x0010: FMI-B10
- * 0x0011: FMI-B20
- * 0x0012: FMI-B30
- * 0x0015: FMI-B50
- * 0x0020: FMT-315
- * 0x0040: CTT-200
- * 0x0080: CTT-300
- * 0x0100: TTT-200
- * 0x0200: TTT-300
+ * \param str which can be raw, csv, tsv, binary
+ * \returns enum liballuris_output_format or -1 if unknown format
+ */
+enum liballuris_output_format liballuris_output_str2enum (const char *str)
+{
+  if (! strcmp (str, "raw"))
+    return LIBALLURIS_OUTPUT_RAW;
+  else if (! strcmp (str, "csv"))
+    return LIBALLURIS_OUTPUT_CSV;
+  else if (! strcmp (str, "tsv"))
+    return LIBALLURIS_OUTPUT_TSV;
+  else if (! strcmp (str, "binary"))
+    return LIBALLURIS_OUTPUT_BINARY;
+  else
+    return (enum liballuris_output_format) -1;
+}
+
+/*!
+ * \brief Create a buffered writer for rows of samples
+ *
+ * The values are formatted into a large buffer which is written to out when it's
+ * full or by \ref liballuris_formatter_flush, so a stream of millions of samples per
+ * second needs only few system calls. The output of \ref LIBALLURIS_OUTPUT_RAW with
+ * one column is the same as printf ("%i\n") per value.
+ *
+ * \param[in] out stream to write to, for example stdout
+ * \param[in] format enum liballuris_output_format
+ * \param[in] columns number of values per row, for example the devices of a group
+ * \param[in] digits decimal places 0..9 of every column (see \ref liballuris_get_digits)
+ *   or NULL for integers, not used by \ref LIBALLURIS_OUTPUT_BINARY
+ * \param[out] fmt handle for the other liballuris_formatter functions
+ * \return 0 if successful, LIBALLURIS_OUT_OF_RANGE or LIBUSB_ERROR_NO_MEM
+ */
+int liballuris_formatter_new (FILE* out, enum liballuris_output_format format, size_t columns, const int* digits,
+                              struct liballuris_formatter** fmt)
+{
+  *fmt = NULL;
+  if ((unsigned int) format > LIBALLURIS_OUTPUT_BINARY || ! columns)
+    return LIBALLURIS_OUT_OF_RANGE;
+  size_t k;
+  for (k=0; digits && k < columns; k++)
+    if (digits[k] < 0 || digits[k] > 9)
+      return LIBALLURIS_OUT_OF_RANGE;
+
+  struct liballuris_formatter* f = calloc (1, sizeof (struct liballuris_formatter));
+  if (! f)
+    return LIBUSB_ERROR_NO_MEM;
+  f->digits = calloc (columns, sizeof (int));
+  f->buf = malloc (FORMATTER_BUFFER_SIZE);
+  if (! f->digits || ! f->buf)
+    {
+      free (f->digits);
+      free (f->buf);
+      free (f);
+      return LIBUSB_ERROR_NO_MEM;
+    }
+  if (digits)
+    memcpy (f->digits, digits, columns * sizeof (int));
+  f->out = out;
+  f->format = format;
+  f->columns = columns;
+  *fmt = f;
+  return LIBALLURIS_SUCCESS;
+}
+
+/*!
+ * \brief Write the buffered output to the stream
+ *
+ * The stream out isn't flushed, use fflush for that.
+ *
+ * \param[in] fmt handle from \ref liballuris_formatter_new
+ * \return 0 if successful, LIBUSB_ERROR_IO if writing failed
+ */
+int liballuris_formatter_flush (struct liballuris_formatter* fmt)
+{
+  size_t fill = fmt->fill;
+  fmt->fill = 0;
+  if (fill && fwrite (fmt->buf, 1, fill, fmt->out) != fill)
+    {
+      fprintf (stderr, "Error: writing output failed: %s\n", strerror (errno));
+      return LIBUSB_ERROR_IO;
+    }
+  return LIBALLURIS_SUCCESS;
+}
+
+/*!
+ * \brief Format values into the buffer
+ *
+ * The values continue the row of the previous call, a row ends after columns values.
+ * \ref LIBALLURIS_GROUP_MISSING is written as missing value.
+ *
+ * \param[in] fmt handle from \ref liballuris_formatter_new
+ * \param[in] values samples as returned by \ref liballuris_poll_measurement or \ref liballuris_group_read
+ * \param[in] count number of values
+ * \return 0 if successful, LIBUSB_ERROR_IO if writing a full buffer failed
+ */
+int liballuris_formatter_write (struct liballuris_formatter* fmt, const int* values, size_t count)
+{
+  struct liballuris_formatter* f = fmt;
+  size_t k;
+  if (f->format == LIBALLURIS_OUTPUT_BINARY)
+    {
+      for (k=0; k < count; )
+        {
+          size_t n = (FORMATTER_BUFFER_SIZE - f->fill) / sizeof (int32_t);
+          if (! n)
+            {
+              int r = liballuris_formatter_flush (f);
+              if (r)
+                return r;
+              continue;
+            }
+          if (n > count - k)
+            n = count - k;
+          memcpy (f->buf + f->fill, values + k, n * sizeof (int32_t));
+          f->fill += n * sizeof (int32_t);
+          k += n;
+        }
+      return LIBALLURIS_SUCCESS;
+    }
+
+  const char separator = (f->format == LIBALLURIS_OUTPUT_CSV)? ',' : (f->format == LIBALLURIS_OUTPUT_TSV)? '\t' : ' ';
+  char text[FORMATTER_MAX_TEXT];
+  char* end = text + sizeof (text);
+  for (k=0; k < count; k++)
+    {
+      if (f->fill + FORMATTER_MAX_TEXT > FORMATTER_BUFFER_SIZE)
+        {
+          int r = liballuris_formatter_flush (f);
+          if (r)
+            return r;
+        }
+      char* p = f->buf + f->fill;
+      if (values[k] != LIBALLURIS_GROUP_MISSING)
+        {
+          char* start = formatter_fixed (end, values[k], f->digits[f->column]);
+          memcpy (p, start, end - start);
+          p += end - start;
+        }
+      else if (f->format == LIBALLURIS_OUTPUT_RAW)
+        *p++ = '-';
+
+      if (++f->column == f->columns)
+        {
+          *p++ = '\n';
+          f->column = 0;
+        }
+      else
+        *p++ = separator;
+      f->fill = p - f->buf;
+    }
+  return LIBALLURIS_SUCCESS;
+}
+
+/*!
+ * \brief Write the buffered output and free the formatter
+ *
+ * \param[in] fmt handle from \ref liballuris_formatter_new
+ * \return result of \ref liballuris_formatter_flush
+ */
+int liballuris_formatter_free (struct liballuris_formatter* fmt)
+{
+  int r = liballuris_formatter_flush (fmt);
+  free (fmt->digits);
+  free (fmt->buf);
+  free (fmt);
+  return r;
+}
+
+/****************************************************************************************/
+/*
+ * Capture files
+ *
+ * A struct liballuris_capture_header followed by fixed size records. The writer
+ * grows the file in steps and appends through a shared mapping, the header
+ * count is updated after each append. Readers map the file and index the
+ * records directly.
+ */
+
+#ifndef _WIN32
+
+//! Initial size of the record area of a new capture file in bytes
+#define CAPTURE_INITIAL_SIZE (1 << 20)
+//! Upper limit of a single growth step in bytes, below it the file size doubles
+#define CAPTURE_MAX_GROWTH (64 << 20)
+
+_Static_assert (sizeof (struct liballuris_capture_header) == LIBALLURIS_CAPTURE_HEADER_SIZE,
+                "capture header layout changed");
+
+//! Internal state of an open capture file
+struct liballuris_capture
+{
+  int fd;
+  char* path;                                   //!< for error messages
+  char writable;                                //!< created with liballuris_capture_create
+  unsigned char* map;                           //!< mapping of the whole file
+  size_t map_size;                              //!< size of the mapping and the file
+  struct liballuris_capture_header* header;     //!< start of map
+};
+
+//! Internal function to report a failed system call and map it to a liballuris error
+static int capture_error (const char* what, const char* path)
+{
+  fprintf (stderr, "Error: %s '%s' failed: %s\n", what, path, strerror (errno));
+  return (errno == ENOMEM)? LIBUSB_ERROR_NO_MEM : LIBUSB_ERROR_IO;
+}
+
+//! Internal function to grow the file and mapping to at least size bytes
+static int capture_grow (struct liballuris_capture* cap, size_t size)
+{
+  size_t new_size = cap->map_size + ((cap->map_size < CAPTURE_MAX_GROWTH)? cap->map_size : CAPTURE_MAX_GROWTH);
+  if (new_size < size)
+    new_size = size;
+
+  if (ftruncate (cap->fd, new_size))
+    return capture_error ("ftruncate", cap->path);
+
+  void* map = mmap (NULL, new_size, PROT_READ | PROT_WRITE, MAP_SHARED, cap->fd, 0);
+  if (map == MAP_FAILED)
+    return capture_error ("mmap", cap->path);
+
+  if (cap->map)
+    munmap (cap->map, cap->map_size);
+  cap->map = map;
+  cap->map_size = new_size;
+  cap->header = map;
+  return LIBALLURIS_SUCCESS;
+}
+
+/*!
+ * \brief Describe the measurement of a device for a capture header
+ *
+ * Populates digits, unit, mode, data_ratio and serial of info, all other fields
+ * are zeroed. Digits and unit can't be read while the measurement is running,
+ * they are taken from the cache of the handle then or stay -1, so call it before
+ * \ref liballuris_start_measurement.
  *
  * \param[in] dev_handle a handle for the device to communicate with
- * \param[out] v output location for the returned variant. Only populated if the return code is 0.
+ * \param[out] info header to populate for \ref liballuris_capture_create
  * \return 0 if successful else \ref liballuris_error
- * \sa liballuris_get_value
  */
-int liballuris_get_variant (libusb_device_handle *dev_handle, char* buf, size_t length)
+int liballuris_capture_describe (libusb_device_handle *dev_handle, struct liballuris_capture_header* info)
 {
-  unsigned char out_buf[3];
-  unsigned char in_buf[6];
+  memset (info, 0, sizeof (*info));
+  info->digits = -1;
+  info->unit = -1;
+  info->mode = -1;
+  info->data_ratio = -1;
+
+  LOCK_HANDLE (dev_handle);
+  struct device_cache* c = (handle_lock_)? &handle_lock_->cache : NULL;
+  if (handle_lock_)
+    info->data_ratio = handle_lock_->data_ratio;
+
+  // LIBALLURIS_DEVICE_BUSY while measuring leaves the field unknown
+  int ret = LIBALLURIS_SUCCESS;
+  int r;
+  if (c && (c->valid & CACHE_DIGITS))
+    info->digits = c->digits;
+  else if ((r = liballuris_get_digits (dev_handle, &info->digits)) && r != LIBALLURIS_DEVICE_BUSY)
+    ret = r;
+
+  if (c && (c->valid & CACHE_UNIT))
+    info->unit = c->unit;
+  else if (! ret)
+    {
+      enum liballuris_unit unit;
+      r = liballuris_get_unit (dev_handle, &unit);
+      if (! r)
+        info->unit = unit;
+      else if (r != LIBALLURIS_DEVICE_BUSY)
+        ret = r;
+    }
 
-  out_buf[0] = 0x08;
-  out_buf[1] = 3;
-  out_buf[2] = 4;
-  int ret = liballuris_interrupt_transfer (dev_handle, __FUNCTION__,
-            out_buf, sizeof (out_buf), DEFAULT_SEND_TIMEOUT,
-            in_buf, sizeof (in_buf), DEFAULT_RECEIVE_TIMEOUT);
-  if (ret == LIBALLURIS_SUCCESS)
+  if (! ret)
     {
-      int v = char_to_int24 (in_buf + 3);
-      if (v == -1)
-        return LIBALLURIS_DEVICE_BUSY;
+      enum liballuris_measurement_mode mode;
+      r = liballuris_get_mode (dev_handle, &mode);
+      if (! r)
+        info->mode = mode;
+      else if (r != LIBALLURIS_DEVICE_BUSY)
+        ret = r;
+    }
+
+  if (c && (c->valid & CACHE_SERIAL))
+    strcpy (info->serial, c->serial);
+  else if (! ret && (r = liballuris_get_serial_number (dev_handle, info->serial, sizeof (info->serial))))
+    {
+      info->serial[0] = 0;
+      if (r != LIBALLURIS_DEVICE_BUSY)
+        ret = r;
+    }
+
+  return ret;
+}
+
+/*!
+ * \brief Create a capture file for appending records
+ *
+ * Copies digits, unit, mode, data_ratio, serial and start_time_ns from info, the
+ * other header fields are set by liballuris. If start_time_ns is 0 the current
+ * time is used. An existing file is truncated.
+ *
+ * \param[in] path file name
+ * \param[in] info typically populated by \ref liballuris_capture_describe
+ * \param[out] cap storage for the capture handle. Only populated if the return code is 0.
+ * \return 0 if successful else \ref liballuris_error
+ * \sa liballuris_capture_append
+ * \sa liballuris_capture_close
+ */
+int liballuris_capture_create (const char* path, const struct liballuris_capture_header* info, struct liballuris_capture** cap)
+{
+  struct liballuris_capture* c = calloc (1, sizeof (struct liballuris_capture));
+  if (! c)
+    return LIBUSB_ERROR_NO_MEM;
+  c->path = strdup (path);
+  if (! c->path)
+    {
+      free (c);
+      return LIBUSB_ERROR_NO_MEM;
+    }
 
-      switch (v)
+  int ret = LIBALLURIS_SUCCESS;
+  c->fd = open (path, O_RDWR | O_CREAT | O_TRUNC, 0666);
+  if (c->fd < 0)
+    ret = capture_error ("open", path);
+  else
+    ret = capture_grow (c, LIBALLURIS_CAPTURE_HEADER_SIZE + CAPTURE_INITIAL_SIZE);
+  if (ret)
+    {
+      if (c->fd >= 0)
         {
-        case LIBALLURIS_VARIANT_S10:
-          snprintf (buf, length, "FMI-S10");
-          break;
-        case LIBALLURIS_VARIANT_S20:
-          snprintf (buf, length, "FMI-S20");
-          break;
-        case LIBALLURIS_VARIANT_S30:
-          snprintf (buf, length, "FMI-S30");
-          break;
-        case LIBALLURIS_VARIANT_W30:
-          snprintf (buf, length, "FMT-W30");
-          break;
-        case LIBALLURIS_VARIANT_W40:
-          snprintf (buf, length, "FMT-W40");
-          break;
-        case LIBALLURIS_VARIANT_S50:
-          snprintf (buf, length, "FMI-S50");
-          break;
-        case LIBALLURIS_VARIANT_W20:
-          snprintf (buf, length, "FMI-W20");
-          break;
-        case LIBALLURIS_VARIANT_W10:
-          snprintf (buf, length, "FMT-W10");
-          break;
-        case LIBALLURIS_VARIANT_B10:
-          snprintf (buf, length, "FMI-B10");
-          break;
-        case LIBALLURIS_VARIANT_B20:
-          snprintf (buf, length, "FMI-B20");
-          break;
-        case LIBALLURIS_VARIANT_B30:
-          snprintf (buf, length, "FMI-B30");
-          break;
-        case LIBALLURIS_VARIANT_B50:
-          snprintf (buf, length, "FMI-B50");
-          break;
-        case LIBALLURIS_VARIANT_FMT_315:
-          snprintf (buf, length, "FMT-315");
-          break;
-        case LIBALLURIS_VARIANT_CTT_200:
-          snprintf (buf, length, "CTT-200");
-          break;
-        case LIBALLURIS_VARIANT_CTT_300:
-          snprintf (buf, length, "CTT-300");
-          break;
-        case LIBALLURIS_VARIANT_TTT_200:
-          snprintf (buf, length, "TTT-200");
-          break;
-        case LIBALLURIS_VARIANT_TTT_300:
-          snprintf (buf, length, "TTT-300");
-          break;
-        default:
-          snprintf (buf, length, "unknown");
+          close (c->fd);
+          unlink (path);
+        }
+      free (c->path);
+      free (c);
+      return ret;
+    }
+  c->writable = 1;
+
+  struct liballuris_capture_header* h = c->header;
+  memcpy (h->magic, LIBALLURIS_CAPTURE_MAGIC, sizeof (h->magic));
+  h->version = LIBALLURIS_CAPTURE_VERSION;
+  h->header_size = LIBALLURIS_CAPTURE_HEADER_SIZE;
+  h->record_size = sizeof (int32_t);
+  h->digits = info->digits;
+  h->unit = info->unit;
+  h->mode = info->mode;
+  h->data_ratio = info->data_ratio;
+  h->start_time_ns = info->start_time_ns;
+  if (! h->start_time_ns)
+    {
+      struct timespec ts;
+      clock_gettime (CLOCK_REALTIME, &ts);
+      h->start_time_ns = ts.tv_sec * (int64_t) 1000000000 + ts.tv_nsec;
+    }
+  h->count = 0;
+  memcpy (h->serial, info->serial, sizeof (h->serial));
+  h->serial[sizeof (h->serial) - 1] = 0;
+
+  *cap = c;
+  return LIBALLURIS_SUCCESS;
+}
+
+/*!
+ * \brief Append values to a capture file
+ *
+ * \param[in] cap handle from \ref liballuris_capture_create
+ * \param[in] values measurements, for example from \ref liballuris_reader_read
+ * \param[in] length number of values
+ * \return 0 if successful else \ref liballuris_error
+ */
+int liballuris_capture_append (struct liballuris_capture* cap, const int* values, size_t length)
+{
+  if (! cap->writable)
+    return LIBALLURIS_OUT_OF_RANGE;
+
+  struct liballuris_capture_header* h = cap->header;
+  size_t end = h->header_size + (h->count + length) * h->record_size;
+  if (end > cap->map_size)
+    {
+      int ret = capture_grow (cap, end);
+      if (ret)
+        return ret;
+      h = cap->header;
+    }
+
+  memcpy (cap->map + h->header_size + h->count * h->record_size, values, length * sizeof (int32_t));
+  h->count += length;
+  return LIBALLURIS_SUCCESS;
+}
+
+/*!
+ * \brief Open a capture file for reading
+ *
+ * The file is mapped read-only, the records can be accessed randomly
+ * through \ref liballuris_capture_get_records without parsing.
+ *
+ * \param[in] path file name
+ * \param[out] cap storage for the capture handle. Only populated if the return code is 0.
+ * \return 0 if successful, LIBALLURIS_PARSE_ERROR if it isn't a valid capture file
+ * else \ref liballuris_error
+ */
+int liballuris_capture_open (const char* path, struct liballuris_capture** cap)
+{
+  struct liballuris_capture* c = calloc (1, sizeof (struct liballuris_capture));
+  if (! c)
+    return LIBUSB_ERROR_NO_MEM;
+  c->path = strdup (path);
+  if (! c->path)
+    {
+      free (c);
+      return LIBUSB_ERROR_NO_MEM;
+    }
+
+  int ret = LIBALLURIS_SUCCESS;
+  struct stat st;
+  c->fd = open (path, O_RDONLY);
+  if (c->fd < 0)
+    ret = capture_error ("open", path);
+  else if (fstat (c->fd, &st))
+    ret = capture_error ("fstat", path);
+  else if ((size_t) st.st_size < LIBALLURIS_CAPTURE_HEADER_SIZE)
+    ret = LIBALLURIS_PARSE_ERROR;
+  else
+    {
+      c->map_size = st.st_size;
+      c->map = mmap (NULL, c->map_size, PROT_READ, MAP_SHARED, c->fd, 0);
+      if (c->map == MAP_FAILED)
+        {
+          c->map = NULL;
+          ret = capture_error ("mmap", path);
+        }
+    }
+
+  if (! ret)
+    {
+      // the record size is fixed by the version, reject anything else
+      c->header = (struct liballuris_capture_header*) c->map;
+      const struct liballuris_capture_header* h = c->header;
+      if (memcmp (h->magic, LIBALLURIS_CAPTURE_MAGIC, sizeof (h->magic))
+          || h->version != LIBALLURIS_CAPTURE_VERSION
+          || h->header_size != LIBALLURIS_CAPTURE_HEADER_SIZE
+          || h->record_size != sizeof (int32_t)
+          || h->count > (c->map_size - h->header_size) / h->record_size)
+        ret = LIBALLURIS_PARSE_ERROR;
+    }
+
+  if (ret)
+    {
+      if (ret == LIBALLURIS_PARSE_ERROR)
+        fprintf (stderr, "Error: '%s' is no valid capture file\n", path);
+      liballuris_capture_close (c);
+      return ret;
+    }
+
+  *cap = c;
+  return LIBALLURIS_SUCCESS;
+}
+
+/*!
+ * \brief Header of an open capture file
+ *
+ * \param[in] cap handle from \ref liballuris_capture_open or \ref liballuris_capture_create
+ * \return pointer into the mapping, valid until \ref liballuris_capture_close
+ */
+const struct liballuris_capture_header* liballuris_capture_get_header (struct liballuris_capture* cap)
+{
+  return cap->header;
+}
+
+/*!
+ * \brief Records of an open capture file
+ *
+ * \param[in] cap handle from \ref liballuris_capture_open or \ref liballuris_capture_create
+ * \param[out] count number of records
+ * \return pointer into the mapping, valid until \ref liballuris_capture_close
+ * or the next \ref liballuris_capture_append
+ */
+const int32_t* liballuris_capture_get_records (struct liballuris_capture* cap, size_t* count)
+{
+  *count = cap->header->count;
+  return (const int32_t*) (cap->map + cap->header->header_size);
+}
+
+/*!
+ * \brief Close a capture file
+ *
+ * Files created with \ref liballuris_capture_create are truncated
+ * to the appended records and flushed.
+ *
+ * \param[in] cap handle from \ref liballuris_capture_open or \ref liballuris_capture_create
+ * \return 0 if successful else \ref liballuris_error
+ */
+int liballuris_capture_close (struct liballuris_capture* cap)
+{
+  int ret = LIBALLURIS_SUCCESS;
+  size_t size = cap->map_size;
+  if (cap->writable && cap->header)
+    {
+      size = cap->header->header_size + cap->header->count * cap->header->record_size;
+      if (msync (cap->map, size, MS_SYNC))
+        ret = capture_error ("msync", cap->path);
+    }
+  if (cap->map)
+    munmap (cap->map, cap->map_size);
+  if (cap->writable && ftruncate (cap->fd, size) && ! ret)
+    ret = capture_error ("ftruncate", cap->path);
+  if (cap->fd >= 0 && close (cap->fd) && ! ret)
+    ret = capture_error ("close", cap->path);
+  free (cap->path);
+  free (cap);
+  return ret;
+}
+
+#endif
+
+/****************************************************************************************/
+/*
+ * Event loop integration
+ *
+ * Applications which multiplex many devices on one thread watch the file
+ * descriptors of the libusb context in their own poll/epoll loop and call
+ * liballuris_handle_events when one is ready or the timeout expired. Completed
+ * stream transfers are decoded into the stream queues and can be fetched with
+ * liballuris_stream_read and a timeout of 0 without blocking.
+ */
+
+#ifndef _WIN32
+/*!
+ * \brief Query the file descriptors of a libusb context for poll or epoll
+ *
+ * The set of file descriptors only changes if devices are opened or closed,
+ * libusb_set_pollfd_notifiers reports such changes. The descriptors are level triggered.
+ * Not available on Windows where libusb doesn't use file descriptors.
+ *
+ * \param[in] ctx pointer to libusb context
+ * \param[out] fds output location, fd and events are populated and revents cleared
+ * \param[in] length number of elements in fds
+ * \return number of populated elements, LIBUSB_ERROR_OVERFLOW if length is too small
+ * or another libusb error
+ * \sa liballuris_get_next_timeout
+ * \sa liballuris_handle_events
+ */
+int liballuris_get_pollfds (libusb_context* ctx, struct pollfd* fds, size_t length)
+{
+  const struct libusb_pollfd** usb_fds = libusb_get_pollfds (ctx);
+  if (! usb_fds)
+    return LIBUSB_ERROR_OTHER;
+
+  size_t k;
+  int ret = 0;
+  for (k=0; usb_fds[k]; k++)
+    {
+      if (k == length)
+        {
+          ret = LIBUSB_ERROR_OVERFLOW;
           break;
         }
+      fds[k].fd = usb_fds[k]->fd;
+      fds[k].events = usb_fds[k]->events;
+      fds[k].revents = 0;
     }
-  return ret;
+  libusb_free_pollfds (usb_fds);
+  return (ret)? ret : (int) k;
 }
+#endif
 
 /*!
- * \brief Query the resolution
+ * \brief Query how long the application may wait for file descriptor activity
  *
- * Since firmware 5.04.005
+ * libusb handles transfer timeouts within \ref liballuris_handle_events. On platforms
+ * where no file descriptor signals expired timeouts it has to be called in time.
  *
- * The resolution as floating point number is 10^(-get_digits) * get_resolution.
- * Possible values for resolution are 1, 2, 5.
+ * \param[in] ctx pointer to libusb context
+ * \return timeout in milliseconds, -1 if the application may wait for file descriptor activity only
+ * \sa liballuris_get_pollfds
+ */
+int liballuris_get_next_timeout (libusb_context* ctx)
+{
+  if (libusb_pollfds_handle_timeouts (ctx))
+    return -1;
+
+  struct timeval tv;
+  int r = libusb_get_next_timeout (ctx, &tv);
+  if (r == 0)
+    return -1;
+  if (r < 0)
+    return 0;
+
+  // round up, waking up too early only costs an empty liballuris_handle_events
+  return tv.tv_sec * 1000 + (tv.tv_usec + 999) / 1000;
+}
+
+/*!
+ * \brief Process pending libusb events without blocking
  *
- * Example: get_unit returns LIBALLURIS_UNIT_N, get_digit returns 2,
- * get_resolution returns 5 -> real resolution of 0.05N
+ * Runs the completion callbacks of all transfers which completed since the last call.
+ * Call this when a file descriptor from \ref liballuris_get_pollfds is ready or the
+ * timeout from \ref liballuris_get_next_timeout expired.
  *
- * Query this value is only possible if the measurement is not running,
- * else LIBALLURIS_DEVICE_BUSY is returned.
+ * \param[in] ctx pointer to libusb context
+ * \return 0 if successful else \ref liballuris_error
+ * \sa liballuris_stream_pending
+ */
+int liballuris_handle_events (libusb_context* ctx)
+{
+  struct timeval tv = {0, 0};
+  int r = libusb_handle_events_timeout_completed (ctx, &tv, NULL);
+  return (r == LIBUSB_ERROR_INTERRUPTED)? LIBUSB_SUCCESS : r;
+}
+
+/****************************************************************************************/
+
+//! Internal decoders for batch replies
+enum batch_decoder
+{
+  BATCH_INFO,          //!< int24 at in_buf+3, -1 means busy
+  BATCH_INT24,         //!< int24 at in_buf+3
+  BATCH_MEMORY,        //!< int24 at in_buf+2
+  BATCH_FLASH,         //!< little endian word at in_buf+4
+  BATCH_BYTE,          //!< byte at in_buf+2
+  BATCH_STATE,         //!< struct liballuris_state at in_buf+3
+  BATCH_SERIAL,        //!< serial number string
+  BATCH_FIRMWARE,      //!< firmware string
+  BATCH_VARIANT,       //!< variant string
+  BATCH_UNIT,          //!< unit, depends on F_max entry
+  BATCH_LIMIT          //!< int24 at in_buf+3, depends on state entry
+};
+
+//! Internal representation of one queued command
+struct batch_entry
+{
+  unsigned char out_buf[4];
+  int send_len;
+  int reply_len;
+  unsigned char in_buf[20];
+  enum batch_decoder decoder;
+  void* dest;            //!< output location of the caller
+  size_t dest_len;       //!< length of dest for strings
+  int dep;               //!< index of the entry this one depends on or -1
+  int value;             //!< storage for internal entries
+  struct liballuris_state state;
+  int error;             //!< found when queued, the command isn't sent
+  char sent;
+  char done;
+  int status;
+  double t_sent;         //!< monotonic time the write completed
+  double send_time;      //!< duration of the write
+};
+
+//! Internal state of a command batch
+struct liballuris_batch
+{
+  libusb_device_handle* dev_handle;
+  int depth;                   //!< maximum number of commands in flight
+  struct batch_entry* entries;
+  size_t num_entries;
+  size_t capacity;
+};
+
+/*!
+ * \brief Create an empty command batch
+ *
+ * Getters queued with liballuris_batch_* are sent back to back with at most depth
+ * commands in flight by \ref liballuris_batch_run. Replies are matched to their
+ * requests by the command byte. The device answers commands in order, so several
+ * requests with the same command byte are matched first in, first out.
  *
  * \param[in] dev_handle a handle for the device to communicate with
- * \param[out] v output location for the returned resolution. Only populated if the return code is 0.
+ * \param[in] depth maximum number of commands in flight, typically \ref DEFAULT_PIPELINE_DEPTH.
+ *            A depth of 1 performs the same round trips as the single getters.
+ * \param[out] batch storage for the batch. Only populated if the return code is 0.
  * \return 0 if successful else \ref liballuris_error
- * \sa liballuris_get_digits
+ * \sa liballuris_batch_run
+ * \sa liballuris_batch_free
  */
+int liballuris_batch_new (libusb_device_handle *dev_handle, int depth, struct liballuris_batch** batch)
+{
+  if (depth < 1)
+    return LIBALLURIS_OUT_OF_RANGE;
 
-int liballuris_get_resolution (libusb_device_handle *dev_handle, int* v)
+  struct liballuris_batch* b = calloc (1, sizeof (struct liballuris_batch));
+  if (! b)
+    return LIBUSB_ERROR_NO_MEM;
+  b->dev_handle = dev_handle;
+  b->depth = depth;
+  *batch = b;
+  return LIBALLURIS_SUCCESS;
+}
+
+//! Free a batch created with \ref liballuris_batch_new
+void liballuris_batch_free (struct liballuris_batch* batch)
 {
-  unsigned char out_buf[3];
-  unsigned char in_buf[6];
+  if (batch)
+    free (batch->entries);
+  free (batch);
+}
 
-  out_buf[0] = 0x08;
-  out_buf[1] = 3;
-  out_buf[2] = 16;
-  int ret = liballuris_interrupt_transfer (dev_handle, __FUNCTION__,
-            out_buf, sizeof (out_buf), DEFAULT_SEND_TIMEOUT,
-            in_buf, sizeof (in_buf), DEFAULT_RECEIVE_TIMEOUT);
-  if (ret == LIBALLURIS_SUCCESS)
+//! Remove all queued commands to reuse the batch
+void liballuris_batch_clear (struct liballuris_batch* batch)
+{
+  batch->num_entries = 0;
+}
+
+//! Internal function to append a command, returns the index or a negative libusb error
+static int batch_add (struct liballuris_batch* b, unsigned char cmd, int send_len, int arg, int reply_len,
+                      enum batch_decoder decoder, void* dest, size_t dest_len, int dep)
+{
+  if (b->num_entries == b->capacity)
     {
-      *v = char_to_int24 (in_buf + 3);
-      if (*v == -1)
+      size_t capacity = (b->capacity)? 2 * b->capacity : 16;
+      struct batch_entry* tmp = realloc (b->entries, capacity * sizeof (struct batch_entry));
+      if (! tmp)
+        return LIBUSB_ERROR_NO_MEM;
+      b->entries = tmp;
+      b->capacity = capacity;
+    }
+
+  struct batch_entry* e = b->entries + b->num_entries;
+  memset (e, 0, sizeof (struct batch_entry));
+  e->out_buf[0] = cmd;
+  e->out_buf[1] = send_len;
+  e->out_buf[2] = arg & 0xFF;
+  e->out_buf[3] = (arg >> 8) & 0xFF;
+  e->send_len = send_len;
+  e->reply_len = reply_len;
+  e->decoder = decoder;
+  e->dest = dest;
+  e->dest_len = dest_len;
+  e->dep = dep;
+  e->status = LIBALLURIS_TIMEOUT;
+  return b->num_entries++;
+}
+
+//! Internal function to decode a received reply into the output location
+static int batch_decode (struct liballuris_batch* b, struct batch_entry* e)
+{
+  struct batch_entry* dep = (e->dep >= 0)? b->entries + e->dep : NULL;
+  if (dep && dep->status)
+    return dep->status;
+
+  switch (e->decoder)
+    {
+    case BATCH_INFO:
+    {
+      int v = char_to_int24 (e->in_buf + 3);
+      if (v == -1)
         return LIBALLURIS_DEVICE_BUSY;
+      if (e->dest)
+        *(int*) e->dest = v;
+      else
+        e->value = v;
+      break;
     }
-  return ret;
+    case BATCH_INT24:
+      *(int*) e->dest = char_to_int24 (e->in_buf + 3);
+      break;
+    case BATCH_MEMORY:
+      *(int*) e->dest = char_to_int24 (e->in_buf + 2);
+      break;
+    case BATCH_FLASH:
+      *(unsigned short*) e->dest = e->in_buf[4] | (e->in_buf[5] << 8);
+      break;
+    case BATCH_BYTE:
+      *(int*) e->dest = e->in_buf[2];
+      break;
+    case BATCH_STATE:
+    {
+      if (e->in_buf[3] == 0xff && e->in_buf[4] == 0xff && e->in_buf[5] == 0xff)
+        return LIBALLURIS_DEVICE_BUSY;
+      union __liballuris_state__ tmp;
+      tmp._int = char_to_int24 (e->in_buf + 3);
+      e->state = tmp.bits;
+      if (e->dest)
+        *(struct liballuris_state*) e->dest = tmp.bits;
+      break;
+    }
+    case BATCH_SERIAL:
+    {
+      unsigned short tmp = char_to_uint16 (e->in_buf + 3);
+      if (tmp == 65535)
+        return LIBALLURIS_DEVICE_BUSY;
+      snprintf (e->dest, e->dest_len, "%c.%i", e->in_buf[5] + 'A', tmp);
+      break;
+    }
+    case BATCH_FIRMWARE:
+      snprintf (e->dest, e->dest_len, "V%i.%02i.%03i", e->in_buf[5], e->in_buf[4], e->in_buf[3]);
+      break;
+    case BATCH_VARIANT:
+    {
+      int v = char_to_int24 (e->in_buf + 3);
+      if (v == -1)
+        return LIBALLURIS_DEVICE_BUSY;
+      snprintf (e->dest, e->dest_len, "%s", variant_name (v));
+      break;
+    }
+    case BATCH_UNIT:
+    {
+      // mapping from chapter 3.15.3, see liballuris_get_unit
+      enum liballuris_unit unit = (enum liballuris_unit) e->in_buf[2];
+      if (dep->value <= 10 && (unit == 2 || unit == 4))
+        unit = (enum liballuris_unit)((int)(unit) + 1);
+      *(enum liballuris_unit*) e->dest = unit;
+      break;
+    }
+    case BATCH_LIMIT:
+      if (dep->state.measuring)
+        return LIBALLURIS_DEVICE_BUSY;
+      *(int*) e->dest = char_to_int24 (e->in_buf + 3);
+      break;
+    }
+  return LIBALLURIS_SUCCESS;
 }
 
 /*!
- * \brief Query the maximum force of the device
+ * \brief Send all queued commands pipelined and collect the replies
  *
- * Query this value is only possible if the measurement is not running,
- * else LIBALLURIS_DEVICE_BUSY is returned.
+ * ID_SAMPLE packets which arrive in between (if streaming is active) are queued
+ * like in the single getters, see \ref liballuris_get_lost_blocks.
+ * The batch can be run again, for example to poll the same values periodically.
  *
- * \param[in] dev_handle a handle for the device to communicate with
- * \param[out] fmax output location for the returned max force. Only populated if the return code is 0.
- * \return 0 if successful else \ref liballuris_error
- * \sa liballuris_get_unit
- * \sa liballuris_get_digits
+ * \param[in] batch created with \ref liballuris_batch_new
+ * \return 0 if all queued commands succeeded, else the \ref liballuris_error of the
+ * first failing command in queue order. Use \ref liballuris_batch_status for details.
  */
-int liballuris_get_F_max (libusb_device_handle *dev_handle, int* fmax)
+int liballuris_batch_run (struct liballuris_batch* batch)
 {
-  unsigned char out_buf[3];
-  unsigned char in_buf[6];
+  size_t n = batch->num_entries;
+  size_t next = 0;     // next entry to send
+  size_t done = 0;
+  int in_flight = 0;
+  int ret = LIBALLURIS_SUCCESS;
+  size_t k;
+  // replies of other threads' commands would be mismatched
+  LOCK_HANDLE (batch->dev_handle);
+
+  // pipelined round trips include the queueing, only the ceiling and fast-fail apply
+  struct handle_state* s = handle_lock_;
+  unsigned int timeout = DEFAULT_RECEIVE_TIMEOUT;
+  if (s && timeout > s->timeout_ceiling)
+    timeout = s->timeout_ceiling;
+  if (s && s->fast_fail && s->unresponsive)
+    timeout = MIN_ADAPTIVE_TIMEOUT;
+
+  for (k=0; k < n; k++)
+    {
+      struct batch_entry* e = batch->entries + k;
+      e->sent = 0;
+      e->done = (e->error != 0);
+      e->status = (e->error)? e->error : LIBALLURIS_TIMEOUT;
+      done += e->done;
+      if (s && ! e->error)
+        drain_late_replies (batch->dev_handle, __FUNCTION__, s, e->out_buf[0], timeout);
+    }
 
-  out_buf[0] = 0x08;
-  out_buf[1] = 3;
-  out_buf[2] = 2;
-  int ret = liballuris_interrupt_transfer (dev_handle, __FUNCTION__,
-            out_buf, sizeof (out_buf), DEFAULT_SEND_TIMEOUT,
-            in_buf, sizeof (in_buf), DEFAULT_RECEIVE_TIMEOUT);
-  if (ret == LIBALLURIS_SUCCESS)
+  double deadline = monotonic_time () + timeout / 1.0e3;
+  while (done < n && ! ret)
     {
-      *fmax = char_to_int24 (in_buf + 3);
-      if (*fmax == -1)
-        return LIBALLURIS_DEVICE_BUSY;
+      while (in_flight < batch->depth && next < n && ! ret)
+        {
+          struct batch_entry* e = batch->entries + next++;
+          if (e->error)
+            continue;
+          double t0 = monotonic_time ();
+          ret = liballuris_send (batch->dev_handle, __FUNCTION__, e->out_buf, e->send_len, DEFAULT_SEND_TIMEOUT);
+          e->t_sent = monotonic_time ();
+          e->send_time = e->t_sent - t0;
+          e->sent = ! ret;
+          in_flight++;
+          if (ret && s)
+            stats_error (s, &s->stats[e->out_buf[0]].send_errors);
+        }
+      if (ret)
+        break;
+
+      if (monotonic_time () > deadline)
+        {
+          ret = LIBUSB_ERROR_TIMEOUT;
+          break;
+        }
+
+      unsigned char in_buf[DEFAULT_RECV_BUF_LEN];
+      int actual;
+      ret = receive_reply (batch->dev_handle, __FUNCTION__, in_buf, &actual, timeout);
+      if (ret == LIBUSB_ERROR_TIMEOUT && s)
+        {
+          s->unresponsive = 1;
+          for (k=0; k < next; k++)
+            if (! batch->entries[k].done)
+              stats_error (s, &s->stats[batch->entries[k].out_buf[0]].timeouts);
+        }
+      if (ret)
+        break;
+      if (s)
+        s->unresponsive = 0;
+
+      // oldest outstanding request with the same command byte
+      struct batch_entry* e = NULL;
+      for (k=0; k < next && ! e; k++)
+        if (! batch->entries[k].done && batch->entries[k].out_buf[0] == in_buf[0])
+          e = batch->entries + k;
+
+      if (! e)
+        {
+          if (s && s->late_replies[in_buf[0]])
+            {
+              s->late_replies[in_buf[0]]--;
+              stats_error (s, &s->stats[in_buf[0]].late_replies);
+            }
+          if (state_debug_level (s))
+            fprintf (stderr, "DEBUG-INFO: %s discarded unexpected reply 0x%02x\n", __FUNCTION__, in_buf[0]);
+          continue;
+        }
+
+      e->done = 1;
+      in_flight--;
+      done++;
+      deadline = monotonic_time () + timeout / 1.0e3;
+      if (in_buf[1] != e->reply_len || actual < e->reply_len)
+        {
+          fprintf (stderr, "Error: Malformed reply to command 0x%02X in '%s' (recv_len=%i != reply_len=%i)\n", in_buf[0], __FUNCTION__, in_buf[1], e->reply_len);
+          e->status = LIBALLURIS_MALFORMED_REPLY;
+          if (s)
+            stats_error (s, &s->stats[in_buf[0]].malformed);
+        }
+      else
+        {
+          memcpy (e->in_buf, in_buf, e->reply_len);
+          e->status = LIBALLURIS_SUCCESS;
+          // the reply time includes waiting behind the other requests in flight
+          if (s)
+            stats_add (s, in_buf[0], e->send_time, monotonic_time () - e->t_sent);
+        }
     }
-  return ret;
+
+  // the replies to the commands still in flight arrive during the next command
+  if (s)
+    for (k=0; k < next; k++)
+      {
+        struct batch_entry* e = batch->entries + k;
+        if (e->sent && ! e->done && s->late_replies[e->out_buf[0]] < 255)
+          s->late_replies[e->out_buf[0]]++;
+      }
+
+  // decode in queue order so that dependencies are resolved first
+  for (k=0; k < n; k++)
+    {
+      struct batch_entry* e = batch->entries + k;
+      if (! e->done)
+        e->status = (ret)? ret : LIBALLURIS_TIMEOUT;
+      else if (! e->status)
+        e->status = batch_decode (batch, e);
+    }
+
+  for (k=0; k < n; k++)
+    if (batch->entries[k].status)
+      return batch->entries[k].status;
+  return LIBALLURIS_SUCCESS;
 }
 
 /*!
- * \brief Query the current measurement value
+ * \brief Query the result of a single command after \ref liballuris_batch_run
  *
- * \param[in] dev_handle a handle for the device to communicate with
- * \param[out] value output location for the measurement value. Only populated if the return code is 0.
+ * \param[in] batch created with \ref liballuris_batch_new
+ * \param[in] index returned from the liballuris_batch_* function which queued the command
  * \return 0 if successful else \ref liballuris_error
- * \sa liballuris_get_unit
- * \sa liballuris_get_digits
  */
-int liballuris_get_value (libusb_device_handle *dev_handle, int* value)
+int liballuris_batch_status (struct liballuris_batch* batch, int index)
 {
-  unsigned char out_buf[3];
-  unsigned char in_buf[6];
-
-  out_buf[0] = 0x46;
-  out_buf[1] = 3;
-  out_buf[2] = 3;
-  // worst execution time = 0.466s
-  // when P13=1Hz (effectively 2Hz) and mode=0 (10Hz)
-  int ret = liballuris_interrupt_transfer (dev_handle, __FUNCTION__,
-            out_buf, sizeof (out_buf), DEFAULT_SEND_TIMEOUT,
-            in_buf, sizeof (in_buf), DEFAULT_RECEIVE_TIMEOUT);
-  if (ret == LIBALLURIS_SUCCESS)
-    *value = char_to_int24 (in_buf + 3);
-  return ret;
+  if (index < 0 || (size_t) index >= batch->num_entries)
+    return LIBALLURIS_OUT_OF_RANGE;
+  return batch->entries[index].status;
 }
 
 /*!
- * \brief Query positive peak value
- *
- * \param[in] dev_handle a handle for the device to communicate with
- * \param[out] peak output location for the peak value. Only populated if the return code is 0.
- * \return 0 if successful else \ref liballuris_error
- * \sa liballuris_get_unit
- * \sa liballuris_get_digits
+ * \brief Queue \ref liballuris_get_serial_number
+ * \return index of the command for \ref liballuris_batch_status or a negative libusb error
  */
-int liballuris_get_pos_peak (libusb_device_handle *dev_handle, int* peak)
+int liballuris_batch_get_serial_number (struct liballuris_batch* batch, char* buf, size_t length)
 {
-  unsigned char out_buf[3];
-  unsigned char in_buf[6];
+  return batch_add (batch, 0x08, 3, 6, 6, BATCH_SERIAL, buf, length, -1);
+}
 
-  out_buf[0] = 0x46;
-  out_buf[1] = 3;
-  out_buf[2] = 4;
-  int ret = liballuris_interrupt_transfer (dev_handle, __FUNCTION__,
-            out_buf, sizeof (out_buf), DEFAULT_SEND_TIMEOUT,
-            in_buf, sizeof (in_buf), DEFAULT_RECEIVE_TIMEOUT);
-  if (ret == LIBALLURIS_SUCCESS)
-    *peak = char_to_int24 (in_buf + 3);
-  return ret;
+//! Queue \ref liballuris_get_firmware, see \ref liballuris_batch_get_serial_number
+int liballuris_batch_get_firmware (struct liballuris_batch* batch, int dev, char* buf, size_t length)
+{
+  if (dev < 0 || dev > 1)
+    return LIBALLURIS_OUT_OF_RANGE;
+  return batch_add (batch, 0x08, 3, dev, 6, BATCH_FIRMWARE, buf, length, -1);
+}
+
+//! Queue \ref liballuris_get_next_calibration_date, see \ref liballuris_batch_get_serial_number
+int liballuris_batch_get_next_calibration_date (struct liballuris_batch* batch, int* v)
+{
+  return batch_add (batch, 0x08, 3, 7, 6, BATCH_INFO, v, 0, -1);
+}
+
+//! Queue \ref liballuris_get_digits, see \ref liballuris_batch_get_serial_number
+int liballuris_batch_get_digits (struct liballuris_batch* batch, int* v)
+{
+  return batch_add (batch, 0x08, 3, 3, 6, BATCH_INFO, v, 0, -1);
+}
+
+//! Queue \ref liballuris_get_resolution, see \ref liballuris_batch_get_serial_number
+int liballuris_batch_get_resolution (struct liballuris_batch* batch, int* v)
+{
+  return batch_add (batch, 0x08, 3, 16, 6, BATCH_INFO, v, 0, -1);
+}
+
+//! Queue \ref liballuris_get_F_max, see \ref liballuris_batch_get_serial_number
+int liballuris_batch_get_F_max (struct liballuris_batch* batch, int* fmax)
+{
+  return batch_add (batch, 0x08, 3, 2, 6, BATCH_INFO, fmax, 0, -1);
+}
+
+//! Queue \ref liballuris_get_variant, see \ref liballuris_batch_get_serial_number
+int liballuris_batch_get_variant (struct liballuris_batch* batch, char* buf, size_t length)
+{
+  return batch_add (batch, 0x08, 3, 4, 6, BATCH_VARIANT, buf, length, -1);
+}
+
+//! Queue \ref liballuris_get_value, see \ref liballuris_batch_get_serial_number
+int liballuris_batch_get_value (struct liballuris_batch* batch, int* value)
+{
+  return batch_add (batch, 0x46, 3, 3, 6, BATCH_INT24, value, 0, -1);
+}
+
+//! Queue \ref liballuris_get_pos_peak, see \ref liballuris_batch_get_serial_number
+int liballuris_batch_get_pos_peak (struct liballuris_batch* batch, int* peak)
+{
+  return batch_add (batch, 0x46, 3, 4, 6, BATCH_INT24, peak, 0, -1);
+}
+
+//! Queue \ref liballuris_get_neg_peak, see \ref liballuris_batch_get_serial_number
+int liballuris_batch_get_neg_peak (struct liballuris_batch* batch, int* peak)
+{
+  return batch_add (batch, 0x46, 3, 5, 6, BATCH_INT24, peak, 0, -1);
+}
+
+//! Queue \ref liballuris_read_state, see \ref liballuris_batch_get_serial_number
+int liballuris_batch_read_state (struct liballuris_batch* batch, struct liballuris_state* state)
+{
+  return batch_add (batch, 0x46, 3, 2, 6, BATCH_STATE, state, 0, -1);
+}
+
+//! Queue \ref liballuris_get_upper_limit, see \ref liballuris_batch_get_serial_number
+int liballuris_batch_get_upper_limit (struct liballuris_batch* batch, int* limit)
+{
+  int dep = batch_add (batch, 0x46, 3, 2, 6, BATCH_STATE, NULL, 0, -1);
+  if (dep < 0)
+    return dep;
+  return batch_add (batch, 0x19, 3, 0, 6, BATCH_LIMIT, limit, 0, dep);
+}
+
+//! Queue \ref liballuris_get_lower_limit, see \ref liballuris_batch_get_serial_number
+int liballuris_batch_get_lower_limit (struct liballuris_batch* batch, int* limit)
+{
+  int dep = batch_add (batch, 0x46, 3, 2, 6, BATCH_STATE, NULL, 0, -1);
+  if (dep < 0)
+    return dep;
+  return batch_add (batch, 0x19, 3, 1, 6, BATCH_LIMIT, limit, 0, dep);
+}
+
+//! Queue \ref liballuris_get_mode, see \ref liballuris_batch_get_serial_number
+int liballuris_batch_get_mode (struct liballuris_batch* batch, enum liballuris_measurement_mode* mode)
+{
+  // enum liballuris_measurement_mode has the size of int
+  return batch_add (batch, 0x05, 2, 0, 3, BATCH_BYTE, mode, 0, -1);
+}
+
+//! Queue \ref liballuris_get_unit, see \ref liballuris_batch_get_serial_number
+int liballuris_batch_get_unit (struct liballuris_batch* batch, enum liballuris_unit* unit)
+{
+  // F_max dependent mapping
+  int dep = batch_add (batch, 0x08, 3, 2, 6, BATCH_INFO, NULL, 0, -1);
+  if (dep < 0)
+    return dep;
+  return batch_add (batch, 0x1B, 2, 0, 3, BATCH_UNIT, unit, 0, dep);
+}
+
+//! Queue \ref liballuris_get_digout, see \ref liballuris_batch_get_serial_number
+int liballuris_batch_get_digout (struct liballuris_batch* batch, int* v)
+{
+  return batch_add (batch, 0x22, 2, 0, 3, BATCH_BYTE, v, 0, -1);
+}
+
+//! Queue \ref liballuris_get_digin, see \ref liballuris_batch_get_serial_number
+int liballuris_batch_get_digin (struct liballuris_batch* batch, int* v)
+{
+  return batch_add (batch, 0x27, 2, 0, 3, BATCH_BYTE, v, 0, -1);
+}
+
+//! Queue \ref liballuris_get_mem_count, see \ref liballuris_batch_get_serial_number
+int liballuris_batch_get_mem_count (struct liballuris_batch* batch, int* v)
+{
+  return batch_add (batch, 0x08, 3, 5, 6, BATCH_INFO, v, 0, -1);
 }
 
 /*!
- * \brief Query negative peak value
+ * \brief Queue \ref liballuris_read_memory, see \ref liballuris_batch_get_serial_number
  *
- * \param[in] dev_handle a handle for the device to communicate with
- * \param[out] peak output location for the peak value. Only populated if the return code is 0.
- * \return 0 if successful else \ref liballuris_error
- * \sa liballuris_get_unit
- * \sa liballuris_get_digits
+ * An address out of range isn't sent, its status is LIBALLURIS_OUT_OF_RANGE after
+ * \ref liballuris_batch_run like the return code of \ref liballuris_read_memory.
  */
-int liballuris_get_neg_peak (libusb_device_handle *dev_handle, int* peak)
+int liballuris_batch_read_memory (struct liballuris_batch* batch, int adr, int* mem_value)
 {
-  unsigned char out_buf[3];
-  unsigned char in_buf[6];
+  int index = batch_add (batch, 0x06, 4, adr, 5, BATCH_MEMORY, mem_value, 0, -1);
+  // reported by liballuris_batch_run like liballuris_read_memory does
+  if (index >= 0 && (adr < 0 || adr > 999))
+    batch->entries[index].error = LIBALLURIS_OUT_OF_RANGE;
+  return index;
+}
 
-  out_buf[0] = 0x46;
-  out_buf[1] = 3;
-  out_buf[2] = 5;
-  int ret = liballuris_interrupt_transfer (dev_handle, __FUNCTION__,
-            out_buf, sizeof (out_buf), DEFAULT_SEND_TIMEOUT,
-            in_buf, sizeof (in_buf), DEFAULT_RECEIVE_TIMEOUT);
-  if (ret == LIBALLURIS_SUCCESS)
-    *peak = char_to_int24 (in_buf + 3);
-  return ret;
+//! Queue \ref liballuris_read_flash, see \ref liballuris_batch_read_memory
+int liballuris_batch_read_flash (struct liballuris_batch* batch, int adr, unsigned short* v)
+{
+  int index = batch_add (batch, 0x72, 4, adr, 6, BATCH_FLASH, v, 0, -1);
+  if (index >= 0 && (adr < 0 || adr > 0xFFFF))
+    batch->entries[index].error = LIBALLURIS_OUT_OF_RANGE;
+  return index;
+}
+
+//! Queue \ref liballuris_get_peak_level, see \ref liballuris_batch_get_serial_number
+int liballuris_batch_get_peak_level (struct liballuris_batch* batch, int* v)
+{
+  return batch_add (batch, 0x32, 2, 0, 3, BATCH_BYTE, v, 0, -1);
+}
+
+//! Queue \ref liballuris_get_autostop, see \ref liballuris_batch_get_serial_number
+int liballuris_batch_get_autostop (struct liballuris_batch* batch, int* v)
+{
+  return batch_add (batch, 0x34, 2, 0, 3, BATCH_BYTE, v, 0, -1);
 }
 
+/****************************************************************************************/
+
+//! Internal state of a device session
+struct liballuris_device
+{
+  libusb_device_handle* dev_handle;
+  struct handle_state* state;       //!< holds the cache, shared with calls on dev_handle
+};
+
 /*!
- * \brief Query the current state of the device
+ * \brief Open a device session and fetch its static properties
  *
- * \param[in] dev_handle a handle for the device to communicate with
- * \param[out] state output location for the state. Only populated if the return code is 0.
+ * The session caches digits, resolution, F_max, unit, variant, firmware and serial number.
+ * Properties which can't be read because the measurement is running are fetched on first use.
+ * The cache is kept for the lifetime of the handle and invalidated by \ref liballuris_set_unit
+ * and \ref liballuris_restore_factory_defaults, also if they are called with the handle
+ * from \ref liballuris_device_handle.
+ *
+ * \param[in] ctx pointer to libusb context
+ * \param[in] serial_or_bus_id serial or bus_id,device_id or NULL, see \ref liballuris_open_if_not_opened
+ * \param[out] dev storage for the session. Only populated if the return code is 0.
  * \return 0 if successful else \ref liballuris_error
+ * \sa liballuris_device_close
  */
-int liballuris_read_state (libusb_device_handle *dev_handle, struct liballuris_state* state, unsigned int timeout)
+int liballuris_device_open (libusb_context* ctx, const char* serial_or_bus_id, struct liballuris_device** dev)
 {
-  unsigned char out_buf[3];
-  unsigned char in_buf[6];
-
-  out_buf[0] = 0x46;
-  out_buf[1] = 3;
-  out_buf[2] = 2;
+  libusb_device_handle* h = NULL;
+  int ret = liballuris_open_if_not_opened (ctx, serial_or_bus_id, &h);
+  if (ret)
+    {
+      if (h)
+        libusb_close (h);
+      return ret;
+    }
 
-  // worst execution time = 0.47s
-  int ret = liballuris_interrupt_transfer (dev_handle, __FUNCTION__,
-            out_buf, sizeof (out_buf), DEFAULT_SEND_TIMEOUT,
-            in_buf, sizeof (in_buf), timeout);
-  if (ret == LIBALLURIS_SUCCESS)
+  struct liballuris_device* d = calloc (1, sizeof (struct liballuris_device));
+  struct handle_state* s = get_handle_state (h);
+  if (! d || ! s)
     {
-      if (   in_buf[3] == 0xff
-             && in_buf[4] == 0xff
-             && in_buf[5] == 0xff)
-        return LIBALLURIS_DEVICE_BUSY;
+      free (d);
+      liballuris_close_device (h);
+      return LIBUSB_ERROR_NO_MEM;
+    }
+  d->dev_handle = h;
+  d->state = s;
 
-      union __liballuris_state__ tmp;
-      tmp._int = char_to_int24 (in_buf + 3);
-      *state = tmp.bits;
+  // a running measurement isn't an error, the missing properties are fetched later
+  ret = liballuris_device_reload (d);
+  if (ret && ret != LIBALLURIS_DEVICE_BUSY)
+    {
+      liballuris_device_close (d);
+      return ret;
     }
-  return ret;
+
+  *dev = d;
+  return LIBALLURIS_SUCCESS;
 }
 
-//! Print state to stdout
-void liballuris_print_state (struct liballuris_state state)
+//! Close the session and the device
+void liballuris_device_close (struct liballuris_device* dev)
 {
-  printf ("[%c] upper limit exceeded\n",               (state.upper_limit_exceeded)? 'X': ' ');
-  printf ("[%c] lower limit underrun\n",               (state.lower_limit_underrun)? 'X': ' ');
-  printf ("[%c] peak  mode active\n",                  (state.some_peak_mode_active)? 'X': ' ');
-  printf ("[%c] peak+ mode active\n",                  (state.peak_plus_active)? 'X': ' ');
-  printf ("[%c] peak- mode active\n",                  (state.peak_minus_active)? 'X': ' ');
-  printf ("[%c] Store to memory in progress\n",        (state.mem_running)? 'X': ' ');
-  printf ("[%c] overload (abs(F) > 150%%)\n",          (state.overload)? 'X': ' ');
-  printf ("[%c] fracture detected (only W20/W40)\n",   (state.fracture)? 'X': ' ');
-  printf ("[%c] mem active (P21=1 or P21=2)\n",        (state.mem_active)? 'X': ' ');
-  printf ("[%c] mem-conti (store with displayrate)\n", (state.mem_conti)? 'X': ' ');
-  printf ("[%c] grenz_option\n",                       (state.grenz_option)? 'X': ' ');
-  printf ("[%c] measurement running\n",                (state.measuring)? 'X': ' ');
+  if (dev)
+    liballuris_close_device (dev->dev_handle);
+  free (dev);
+}
+
+//! Handle of the session for all other liballuris functions
+libusb_device_handle* liballuris_device_handle (struct liballuris_device* dev)
+{
+  return dev->dev_handle;
 }
 
 /*!
- * \brief Enable or disable cyclic measurements
+ * \brief Fetch all properties which aren't cached with one pipelined request
  *
- * \param[in] dev_handle a handle for the device to communicate with
- * \param[in] enable
- * \param[in] length 1..19
- * \return 0 if successful else \ref liballuris_error
+ * \param[in] dev session from \ref liballuris_device_open
+ * \return 0 if successful else \ref liballuris_error, LIBALLURIS_DEVICE_BUSY if some
+ * properties can't be read because the measurement is running
  */
-int liballuris_cyclic_measurement (libusb_device_handle *dev_handle, char enable, size_t length)
+int liballuris_device_reload (struct liballuris_device* dev)
 {
-  if (length < 1 || length > 19)
+  struct device_cache* c = &dev->state->cache;
+  struct device_cache tmp;
+  int idx[CACHE_NUM_PROPERTIES];
+  struct liballuris_batch* b;
+  int k;
+  LOCK_HANDLE (dev->dev_handle);
+
+  int ret = liballuris_batch_new (dev->dev_handle, DEFAULT_PIPELINE_DEPTH, &b);
+  if (ret)
+    return ret;
+
+  for (k=0; k < CACHE_NUM_PROPERTIES; k++)
+    idx[k] = -1;
+  if (! (c->valid & CACHE_DIGITS))
+    idx[0] = liballuris_batch_get_digits (b, &tmp.digits);
+  if (! (c->valid & CACHE_RESOLUTION))
+    idx[1] = liballuris_batch_get_resolution (b, &tmp.resolution);
+  if (! (c->valid & CACHE_F_MAX))
+    idx[2] = liballuris_batch_get_F_max (b, &tmp.F_max);
+  if (! (c->valid & CACHE_UNIT))
+    idx[3] = liballuris_batch_get_unit (b, &tmp.unit);
+  if (! (c->valid & CACHE_VARIANT))
+    idx[4] = liballuris_batch_get_variant (b, tmp.variant, sizeof (tmp.variant));
+  if (! (c->valid & CACHE_FIRMWARE))
     {
-      fprintf (stderr, "Error: packetlen %zu out of range 1..19.\n", length);
-      return LIBALLURIS_OUT_OF_RANGE;
+      idx[5] = liballuris_batch_get_firmware (b, 0, tmp.firmware[0], sizeof (tmp.firmware[0]));
+      idx[6] = liballuris_batch_get_firmware (b, 1, tmp.firmware[1], sizeof (tmp.firmware[1]));
     }
+  if (! (c->valid & CACHE_SERIAL))
+    idx[7] = liballuris_batch_get_serial_number (b, tmp.serial, sizeof (tmp.serial));
 
-  unsigned char out_buf[4];
+  for (k=0; k < CACHE_NUM_PROPERTIES; k++)
+    if (idx[k] < -1)
+      {
+        liballuris_batch_free (b);
+        return idx[k];
+      }
 
-  out_buf[0] = 0x01;
-  out_buf[1] = 4;
-  out_buf[2] = (enable)? 2:0;
-  out_buf[3] = length;
+  liballuris_batch_run (b);
 
-  //printf ("liballuris_cyclic_measurement enable=%i\n", enable);
-  int ret;
-  if (enable)
+  ret = LIBALLURIS_SUCCESS;
+  for (k=0; k < CACHE_NUM_PROPERTIES; k++)
+    if (idx[k] >= 0)
+      {
+        int r = liballuris_batch_status (b, idx[k]);
+        if (r && ! ret)
+          ret = r;
+      }
+
+  if (idx[0] >= 0 && ! liballuris_batch_status (b, idx[0]))
     {
-      unsigned char in_buf[4];
-      ret = liballuris_interrupt_transfer (dev_handle, __FUNCTION__,
-                                           out_buf, sizeof (out_buf), DEFAULT_SEND_TIMEOUT,
-                                           in_buf, sizeof (in_buf), DEFAULT_RECEIVE_TIMEOUT);
+      c->digits = tmp.digits;
+      c->valid |= CACHE_DIGITS;
     }
-  else
+  if (idx[1] >= 0 && ! liballuris_batch_status (b, idx[1]))
     {
-      ret = liballuris_interrupt_transfer (dev_handle, __FUNCTION__,
-                                           out_buf, sizeof (out_buf), DEFAULT_SEND_TIMEOUT, NULL, 0, 0);
-      liballuris_clear_RX (dev_handle, 100);
-      liballuris_clear_RX (dev_handle, 100);
-      liballuris_clear_RX (dev_handle, 100);
+      c->resolution = tmp.resolution;
+      c->valid |= CACHE_RESOLUTION;
+    }
+  if (idx[2] >= 0 && ! liballuris_batch_status (b, idx[2]))
+    {
+      c->F_max = tmp.F_max;
+      c->valid |= CACHE_F_MAX;
+    }
+  if (idx[3] >= 0 && ! liballuris_batch_status (b, idx[3]))
+    {
+      c->unit = tmp.unit;
+      c->valid |= CACHE_UNIT;
+    }
+  if (idx[4] >= 0 && ! liballuris_batch_status (b, idx[4]))
+    {
+      strcpy (c->variant, tmp.variant);
+      c->valid |= CACHE_VARIANT;
+    }
+  // the measurement processor doesn't answer while measuring
+  if (idx[5] >= 0 && ! liballuris_batch_status (b, idx[5]) && ! liballuris_batch_status (b, idx[6])
+      && strcmp (tmp.firmware[1], "V255.255.255"))
+    {
+      memcpy (c->firmware, tmp.firmware, sizeof (c->firmware));
+      c->valid |= CACHE_FIRMWARE;
+    }
+  if (idx[7] >= 0 && ! liballuris_batch_status (b, idx[7]))
+    {
+      strcpy (c->serial, tmp.serial);
+      c->valid |= CACHE_SERIAL;
     }
 
+  liballuris_batch_free (b);
   return ret;
 }
 
-/*!
- * \brief Poll cyclic measurements
- *
- * Cyclic measurements have to be enabled before with liballuris_cyclic_measurement.
- *
- * \param[in] dev_handle a handle for the device to communicate with
- * \param[in] buf output location for the measurements. Only populated if the return code is 0.
- * \param[in] length of block 1..19, typically the same used with liballuris_cyclic_measurement
- * \return 0 if successful else \ref liballuris_error
- * \sa liballuris_cyclic_measurement
- * \sa liballuris_get_unit
- * \sa liballuris_get_digits
- */
-int liballuris_poll_measurement (libusb_device_handle *dev_handle, int* buf, size_t length)
+//! Internal function to make sure that the properties in mask are cached
+static int device_fetch (struct liballuris_device* dev, unsigned int mask)
 {
-  size_t len = 5 + length * 3;
-  unsigned char in_buf[len];
+  LOCK_HANDLE (dev->dev_handle);
+  if ((dev->state->cache.valid & mask) == mask)
+    return LIBALLURIS_SUCCESS;
+  int ret = liballuris_device_reload (dev);
+  if ((dev->state->cache.valid & mask) == mask)
+    return LIBALLURIS_SUCCESS;
+  return (ret)? ret : LIBALLURIS_DEVICE_BUSY;
+}
 
-  /* Increased receive timeout:
-   * The sampling frequency can be selected between 10Hz and 900Hz
-   * Therefore the maximum delay until one measurement completes is 1/10Hz = 100ms.
-   * Since the block size can be up to 19 (see liballuris_cyclic_measurement) the typically delay
-   * in 10Hz mode and blocksize 19 is >1.9s
-   *
-   * Test case: "gadc --stop --set-mode 0 --start -s 19"
-  */
+//! Cached \ref liballuris_get_digits
+int liballuris_device_get_digits (struct liballuris_device* dev, int* v)
+{
+  LOCK_HANDLE (dev->dev_handle);
+  int ret = device_fetch (dev, CACHE_DIGITS);
+  if (! ret)
+    *v = dev->state->cache.digits;
+  return ret;
+}
 
-  // worst execution time = 2.4s
-  int ret = liballuris_interrupt_transfer (dev_handle, __FUNCTION__, NULL, 0, 0, in_buf, len, 3600);
-  size_t k;
-  for (k=0; k<length; k++)
-    buf[k] = char_to_int24 (in_buf + 5 + k*3);
+//! Cached \ref liballuris_get_resolution
+int liballuris_device_get_resolution (struct liballuris_device* dev, int* v)
+{
+  LOCK_HANDLE (dev->dev_handle);
+  int ret = device_fetch (dev, CACHE_RESOLUTION);
+  if (! ret)
+    *v = dev->state->cache.resolution;
+  return ret;
+}
+
+//! Cached \ref liballuris_get_F_max
+int liballuris_device_get_F_max (struct liballuris_device* dev, int* fmax)
+{
+  LOCK_HANDLE (dev->dev_handle);
+  int ret = device_fetch (dev, CACHE_F_MAX);
+  if (! ret)
+    *fmax = dev->state->cache.F_max;
+  return ret;
+}
+
+//! Cached \ref liballuris_get_unit
+int liballuris_device_get_unit (struct liballuris_device* dev, enum liballuris_unit* unit)
+{
+  LOCK_HANDLE (dev->dev_handle);
+  int ret = device_fetch (dev, CACHE_UNIT);
+  if (! ret)
+    *unit = dev->state->cache.unit;
+  return ret;
+}
+
+//! Cached \ref liballuris_get_variant
+int liballuris_device_get_variant (struct liballuris_device* dev, char* buf, size_t length)
+{
+  LOCK_HANDLE (dev->dev_handle);
+  int ret = device_fetch (dev, CACHE_VARIANT);
+  if (! ret)
+    snprintf (buf, length, "%s", dev->state->cache.variant);
+  return ret;
+}
+
+//! Cached \ref liballuris_get_firmware
+int liballuris_device_get_firmware (struct liballuris_device* dev, int processor, char* buf, size_t length)
+{
+  if (processor < 0 || processor > 1)
+    return LIBALLURIS_OUT_OF_RANGE;
+  LOCK_HANDLE (dev->dev_handle);
+  int ret = device_fetch (dev, CACHE_FIRMWARE);
+  if (! ret)
+    snprintf (buf, length, "%s", dev->state->cache.firmware[processor]);
+  return ret;
+}
 
+//! Cached \ref liballuris_get_serial_number
+int liballuris_device_get_serial_number (struct liballuris_device* dev, char* buf, size_t length)
+{
+  LOCK_HANDLE (dev->dev_handle);
+  int ret = device_fetch (dev, CACHE_SERIAL);
+  if (! ret)
+    snprintf (buf, length, "%s", dev->state->cache.serial);
   return ret;
 }
 
 /*!
- * \brief Poll cyclic measurements without waiting
+ * \brief Convert a raw fixed-point value to a floating point value in the current unit
  *
- * Cyclic measurements have to be enabled before with liballuris_cyclic_measurement.
+ * Uses the cached number of digits, no communication with the device is necessary
+ * once the digits are cached.
  *
- * \param[in] dev_handle a handle for the device to communicate with
- * \param[in] buf output location for the measurements. Only populated if the return code is 0.
- * \param[in] length of block 1..19, typically the same used with liballuris_cyclic_measurement
+ * \param[in] dev session from \ref liballuris_device_open
+ * \param[in] raw value for example from \ref liballuris_poll_measurement
+ * \param[out] value output location. Only populated if the return code is 0.
  * \return 0 if successful else \ref liballuris_error
- * \sa liballuris_cyclic_measurement
- * \sa liballuris_get_unit
- * \sa liballuris_get_digits
+ * \sa liballuris_device_get_unit
  */
-int liballuris_poll_measurement_no_wait (libusb_device_handle *dev_handle, int* buf, size_t length, size_t *actual_num_values)
+int liballuris_device_scale (struct liballuris_device* dev, int raw, double* value)
 {
-  int actual=0;
-  int r = 0;
-
-  size_t len = 5 + length * 3;
-  unsigned char in_buf[len];
-  *actual_num_values = 0;
-  r = libusb_interrupt_transfer (dev_handle, 0x81 | LIBUSB_ENDPOINT_IN, in_buf, len, &actual, 1);
-  //printf ("actual = %i, %s\n", actual, libusb_error_name(r));
-
-  if ((r == LIBUSB_SUCCESS || r == LIBUSB_ERROR_TIMEOUT ) && actual == (int) len)
+  int digits;
+  int ret = liballuris_device_get_digits (dev, &digits);
+  if (! ret)
     {
-      size_t k;
-      *actual_num_values = (actual - 5) / 3;
-      for (k=0; k < (*actual_num_values); k++)
-        buf[k] = char_to_int24 (in_buf + 5 + k*3);
-    }
-  else if (r == LIBUSB_ERROR_TIMEOUT && actual > 0)
-    {
-      // this isn't expected
-      fprintf (stderr, "Error in liballuris_poll_measurement_no_wait: LIBUSB_ERROR_TIMEOUT and actual = %i, len = %zu\n", actual, len);
-      fprintf (stderr, "It isn't expected that this could happen. Please file a bug report.\n");
-      return r;
+      double v = raw;
+      while (digits-- > 0)
+        v /= 10;
+      *value = v;
     }
-
-  return r;
+  return ret;
 }
 
 /*!
@@ -1284,9 +6702,62 @@ int liballuris_clear_neg_peak (libusb_device_handle *dev_handle)
                                         in_buf, sizeof (in_buf), DEFAULT_RECEIVE_TIMEOUT);
 }
 
+//! First interval between state polls while starting or stopping in seconds
+#define STATE_POLL_INTERVAL 0.01
+//! Upper limit of the exponential backoff between state polls in seconds
+#define STATE_POLL_MAX_INTERVAL 0.1
+//! Give up if the measurement state doesn't change within this time in seconds
+#define STATE_POLL_TIMEOUT 3.0
+
+/*!
+ * \brief Internal function to poll the state until measuring matches
+ *
+ * Polls from earliest on with exponential backoff between
+ * STATE_POLL_INTERVAL and STATE_POLL_MAX_INTERVAL. LIBALLURIS_DEVICE_BUSY
+ * while the measurement processor is being configured is treated as "not yet".
+ *
+ * \param[in] dev_handle a handle for the device to communicate with
+ * \param[in] measuring expected state
+ * \param[in] earliest monotonic time of the first poll
+ * \param[out] polls number of read_state commands
+ * \return 0 if the state was reached, LIBALLURIS_TIMEOUT if not within STATE_POLL_TIMEOUT else \ref liballuris_error
+ */
+static int wait_for_measuring (libusb_device_handle* dev_handle, char measuring, double earliest, int* polls)
+{
+  double deadline = monotonic_time () + STATE_POLL_TIMEOUT;
+  double interval = STATE_POLL_INTERVAL;
+  *polls = 0;
+
+  sleep_seconds (earliest - monotonic_time ());
+  for (;;)
+    {
+      struct liballuris_state state;
+      int ret = liballuris_read_state (dev_handle, &state, DEFAULT_RECEIVE_TIMEOUT);
+      (*polls)++;
+      if (ret == LIBALLURIS_SUCCESS && state.measuring == measuring)
+        return LIBALLURIS_SUCCESS;
+      if (ret && ret != LIBALLURIS_DEVICE_BUSY)
+        return ret;
+      if (monotonic_time () + interval > deadline)
+        return LIBALLURIS_TIMEOUT;
+
+      sleep_seconds (interval);
+      interval *= 2;
+      if (interval > STATE_POLL_MAX_INTERVAL)
+        interval = STATE_POLL_MAX_INTERVAL;
+    }
+}
+
 /*!
  * \brief Start measurement
  *
+ * Returns as soon as the device reports that the measurement is running.
+ * The state is polled with increasing intervals, see \ref liballuris_get_start_latency.
+ *
+ * Firmware <= V5.04.010 (V4.04.010) returns BUSY to state queries while the measurement
+ * processor is configured and may not deliver values afterwards. For these and unknown
+ * firmware versions the state isn't queried during the first 600ms after the start command.
+ *
  * You may have to wait up to 500ms until you can read stable values with
  * liballuris_get_value() due to "auto tare" if enabled.
  *
@@ -1296,12 +6767,25 @@ int liballuris_clear_neg_peak (libusb_device_handle *dev_handle)
  */
 int liballuris_start_measurement (libusb_device_handle *dev_handle)
 {
+  LOCK_HANDLE (dev_handle);
   unsigned char out_buf[3];
   unsigned char in_buf[3];
 
+  // the firmware is readable only while stopped, query it before starting
+  int fw;
+  int quiet_time = 1;
+  if (cached_firmware_version (dev_handle, &fw) == LIBALLURIS_SUCCESS)
+    {
+      int major = fw / FIRMWARE_VERSION (1, 0, 0);
+      int minor_patch = fw % FIRMWARE_VERSION (1, 0, 0);
+      if (major > 5 || ((major == 4 || major == 5) && minor_patch > FIRMWARE_VERSION (0, 4, 10)))
+        quiet_time = 0;
+    }
+
   out_buf[0] = 0x1C;
   out_buf[1] = 3;
   out_buf[2] = 1; //start
+  double t0 = monotonic_time ();
   int ret = liballuris_interrupt_transfer (dev_handle, __FUNCTION__,
             out_buf, sizeof (out_buf), DEFAULT_SEND_TIMEOUT,
             in_buf, sizeof (in_buf), DEFAULT_RECEIVE_TIMEOUT);
@@ -1309,30 +6793,47 @@ int liballuris_start_measurement (libusb_device_handle *dev_handle)
   if (ret == LIBALLURIS_SUCCESS)
     {
       // WORKAROUND for <= V5.04.010
-      // sleep at least 600ms to avoid BUSY from read_state
-      usleep (600e3);
-
-      // wait until measurement processor is configured and running
-      struct liballuris_state state;
-      ret = liballuris_read_state (dev_handle, &state, 3000);
-      if (ret)
-        return ret;
-
-      if (! state.measuring)
-        return LIBALLURIS_TIMEOUT;
+      // don't query the state during the first 600ms to avoid BUSY from read_state
+      int polls;
+      ret = wait_for_measuring (dev_handle, 1, t0 + ((quiet_time)? 0.6 : 0), &polls);
+
+      double latency = monotonic_time () - t0;
+      if (handle_lock_)
+        handle_lock_->start_latency = (ret)? 0 : latency;
+      if (state_debug_level (handle_lock_))
+        fprintf (stderr, "DEBUG-INFO: %s: %s after %.1f ms and %i state queries (firmware workaround %s)\n",
+                 __FUNCTION__, (ret)? "failed" : "measuring", latency * 1e3, polls, (quiet_time)? "on" : "off");
     }
   return ret;
 }
 
+/*!
+ * \brief Query the duration of the last successful start
+ *
+ * Time from sending the start command until the device reported that the measurement
+ * is running, measured by the last \ref liballuris_start_measurement on dev_handle.
+ *
+ * \param[in] dev_handle a handle for the device to communicate with
+ * \return latency in milliseconds, 0 if no start succeeded yet
+ */
+double liballuris_get_start_latency (libusb_device_handle *dev_handle)
+{
+  LOCK_HANDLE (dev_handle);
+  return (handle_lock_)? handle_lock_->start_latency * 1e3 : 0;
+}
+
 /*!
  * \brief Stop measurement
  *
+ * Returns as soon as the device reports that the measurement is stopped.
+ *
  * \param[in] dev_handle a handle for the device to communicate with
  * \return 0 if successful else \ref liballuris_error
  * \sa liballuris_start_measurement
  */
 int liballuris_stop_measurement (libusb_device_handle *dev_handle)
 {
+  LOCK_HANDLE (dev_handle);
   unsigned char out_buf[3];
   unsigned char in_buf[3];
 
@@ -1346,13 +6847,8 @@ int liballuris_stop_measurement (libusb_device_handle *dev_handle)
   if (ret == LIBALLURIS_SUCCESS)
     {
       // wait until measurement processor is stopped
-      struct liballuris_state state;
-      ret = liballuris_read_state (dev_handle, &state, 3000);
-      if (ret)
-        return ret;
-
-      if (state.measuring)
-        return LIBALLURIS_TIMEOUT;
+      int polls;
+      ret = wait_for_measuring (dev_handle, 0, 0, &polls);
     }
   return ret;
 }
@@ -1525,6 +7021,7 @@ int liballuris_set_motor_stopp (libusb_device_handle *dev_handle, char state)
  */
 int liballuris_set_upper_limit (libusb_device_handle *dev_handle, int limit)
 {
+  LOCK_HANDLE (dev_handle);
   struct liballuris_state state;
   int ret = liballuris_read_state (dev_handle, &state, 700);
   if (ret)
@@ -1569,6 +7066,7 @@ int liballuris_set_upper_limit (libusb_device_handle *dev_handle, int limit)
  */
 int liballuris_set_lower_limit (libusb_device_handle *dev_handle, int limit)
 {
+  LOCK_HANDLE (dev_handle);
   struct liballuris_state state;
   int ret = liballuris_read_state (dev_handle, &state, 700);
   if (ret)
@@ -1608,6 +7106,7 @@ int liballuris_set_lower_limit (libusb_device_handle *dev_handle, int limit)
  */
 int liballuris_get_upper_limit (libusb_device_handle *dev_handle, int* limit)
 {
+  LOCK_HANDLE (dev_handle);
   struct liballuris_state state;
   int ret = liballuris_read_state (dev_handle, &state, 700);
   if (ret)
@@ -1645,6 +7144,7 @@ int liballuris_get_upper_limit (libusb_device_handle *dev_handle, int* limit)
  */
 int liballuris_get_lower_limit (libusb_device_handle *dev_handle, int* limit)
 {
+  LOCK_HANDLE (dev_handle);
   struct liballuris_state state;
   int ret = liballuris_read_state (dev_handle, &state, 700);
   if (ret)
@@ -1769,6 +7269,7 @@ int liballuris_set_mem_mode (libusb_device_handle *dev_handle, enum liballuris_m
  */
 int liballuris_get_mem_mode (libusb_device_handle *dev_handle, enum liballuris_memory_mode *mode)
 {
+  LOCK_HANDLE (dev_handle);
   unsigned char out_buf[2];
   unsigned char in_buf[3];
 
@@ -1814,6 +7315,7 @@ int liballuris_get_mem_mode (libusb_device_handle *dev_handle, enum liballuris_m
  */
 int liballuris_set_unit (libusb_device_handle *dev_handle, enum liballuris_unit unit)
 {
+  LOCK_HANDLE (dev_handle);
   if (unit < 0 || unit > 5)
     {
       fprintf (stderr, "Error: unit %i out of range 0..5\n", unit);
@@ -1822,7 +7324,7 @@ int liballuris_set_unit (libusb_device_handle *dev_handle, enum liballuris_unit
 
   // F_max dependent mapping
   int fmax;
-  int ret = liballuris_get_F_max (dev_handle, &fmax);
+  int ret = cached_F_max (dev_handle, &fmax);
   if (ret)
     return ret;
 
@@ -1843,6 +7345,8 @@ int liballuris_set_unit (libusb_device_handle *dev_handle, enum liballuris_unit
     return LIBALLURIS_OUT_OF_RANGE;
 
   out_buf[2] = unit;
+  // the number of digits depends on the unit
+  invalidate_cache (dev_handle, CACHE_UNIT | CACHE_DIGITS | CACHE_RESOLUTION);
   // worst execution time = 0.482s
   ret = liballuris_interrupt_transfer (dev_handle, __FUNCTION__,
                                        out_buf, sizeof (out_buf), DEFAULT_SEND_TIMEOUT,
@@ -1866,9 +7370,10 @@ int liballuris_set_unit (libusb_device_handle *dev_handle, enum liballuris_unit
  */
 int liballuris_get_unit (libusb_device_handle *dev_handle, enum liballuris_unit *unit)
 {
+  LOCK_HANDLE (dev_handle);
   // F_max dependent mapping
   int fmax;
-  int ret = liballuris_get_F_max (dev_handle, &fmax);
+  int ret = cached_F_max (dev_handle, &fmax);
   if (ret)
     return ret;
 
@@ -1984,6 +7489,7 @@ int liballuris_restore_factory_defaults (libusb_device_handle *dev_handle)
   out_buf[0] = 0x16;
   out_buf[1] = 3;
   out_buf[2] = 1;
+  invalidate_cache (dev_handle, CACHE_UNIT | CACHE_DIGITS | CACHE_RESOLUTION);
   // worst execution time = 2.34s (on TTT)
   // Long receive timeout because device performs many slow EEPROM write operations
   int ret = liballuris_interrupt_transfer (dev_handle, __FUNCTION__,
@@ -2040,6 +7546,62 @@ int liballuris_read_memory (libusb_device_handle *dev_handle, int adr, int* mem_
   return ret;
 }
 
+/*!
+ * \brief Read consecutive addresses of the measurement memory
+ *
+ * Only the addresses below \ref liballuris_get_mem_count are read. While measuring
+ * the device doesn't report the count, then all length addresses up to 999 are read.
+ * The requests are pipelined with \ref DEFAULT_PIPELINE_DEPTH in flight, see \ref liballuris_batch_run.
+ *
+ * \param[in] dev_handle a handle for the device to communicate with
+ * \param[in] adr first address 0..999
+ * \param[out] buf output location for up to length values
+ * \param[in] length maximum number of values to read
+ * \param[out] actual number of values stored in buf, also if an error occurred
+ * \return 0 if successful else \ref liballuris_error
+ * \sa liballuris_read_memory
+ */
+int liballuris_read_memory_range (libusb_device_handle *dev_handle, int adr, int* buf, size_t length, size_t* actual)
+{
+  *actual = 0;
+  if (adr < 0 || adr > 999)
+    return LIBALLURIS_OUT_OF_RANGE;
+
+  // no other command may change the memory in between
+  LOCK_HANDLE (dev_handle);
+  int count;
+  int ret = liballuris_get_mem_count (dev_handle, &count);
+  if (ret == LIBALLURIS_DEVICE_BUSY)
+    count = 1000;
+  else if (ret)
+    return ret;
+  if (count <= adr)
+    return LIBALLURIS_SUCCESS;
+  if (length > (size_t) (count - adr))
+    length = count - adr;
+
+  struct liballuris_batch* batch;
+  ret = liballuris_batch_new (dev_handle, DEFAULT_PIPELINE_DEPTH, &batch);
+  if (ret)
+    return ret;
+  size_t k;
+  for (k=0; k < length; k++)
+    {
+      int index = liballuris_batch_read_memory (batch, adr + k, buf + k);
+      if (index < 0)
+        {
+          liballuris_batch_free (batch);
+          return index;
+        }
+    }
+
+  ret = liballuris_batch_run (batch);
+  while (*actual < length && ! liballuris_batch_status (batch, *actual))
+    (*actual)++;
+  liballuris_batch_free (batch);
+  return ret;
+}
+
 /*!
  * \brief Delete the measurement memory
  *
@@ -2104,6 +7666,7 @@ int liballuris_get_mem_count (libusb_device_handle *dev_handle, int* v)
  */
 int liballuris_get_mem_statistics (libusb_device_handle *dev_handle, int* stats, size_t length)
 {
+  LOCK_HANDLE (dev_handle);
   unsigned char out_buf[2];
   unsigned char in_buf[20];
 
@@ -2256,16 +7819,53 @@ int liballuris_set_data_ratio (libusb_device_handle *dev_handle, int v)
   out_buf[1] = 3;
   out_buf[2] = v;
 
+  LOCK_HANDLE (dev_handle);
   int ret = liballuris_interrupt_transfer (dev_handle, __FUNCTION__,
             out_buf, sizeof (out_buf), DEFAULT_SEND_TIMEOUT,
             in_buf, sizeof (in_buf), DEFAULT_RECEIVE_TIMEOUT);
   if (in_buf[2] != v)
     return LIBALLURIS_DEVICE_BUSY;
 
+  // there is no command to read it back, remember it for liballuris_capture_describe
+  if (! ret && handle_lock_)
+    handle_lock_->data_ratio = v;
   return ret;
 }
 
+/*!
+ * \brief Set the default debug level
+ * \deprecated Use \ref liballuris_set_context_debug_level
+ *
+ * Used by contexts without their own level and by handles not opened with liballuris_open_*.
+ */
 void liballuris_set_debug_level (int l)
 {
   liballuris_debug_level = l;
 }
+
+/*!
+ * \brief Set the debug level of a libusb context
+ *
+ * Applies to the device lookups on ctx and to the handles opened on ctx with
+ * liballuris_open_*. Set it before other threads use ctx. Release it with
+ * \ref liballuris_release_registry before libusb_exit.
+ *
+ * \param[in] ctx pointer to libusb context
+ * \param[in] level see \ref liballuris_debug_level, -1 returns to liballuris_debug_level
+ * \return 0 if successful else LIBUSB_ERROR_NO_MEM
+ */
+int liballuris_set_context_debug_level (libusb_context* ctx, int level)
+{
+  struct liballuris_context* lc = context_get (ctx, 1);
+  if (! lc)
+    return LIBUSB_ERROR_NO_MEM;
+
+  pthread_mutex_lock (&contexts.lock);
+  if (lc->debug_level < 0 && level >= 0)
+    atomic_fetch_add (&own_debug_levels, 1);
+  else if (lc->debug_level >= 0 && level < 0)
+    atomic_fetch_sub (&own_debug_levels, 1);
+  lc->debug_level = (level < 0)? -1 : level;
+  pthread_mutex_unlock (&contexts.lock);
+  return LIBALLURIS_SUCCESS;
+}
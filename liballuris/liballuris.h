@@ -31,6 +31,17 @@ If not, see <http://www.gnu.org/licenses/>.
  *
  * - \ref liballuris.h
  * - \ref liballuris.c
+ *
+ * \section threads Threads
+ *
+ * Different device handles can be used concurrently from different threads.
+ * Calls on the same handle are serialized, a command and its reply are never
+ * interleaved with another thread's command. A handle must not be closed
+ * while other threads still use it.
+ *
+ * \ref liballuris_reader_start runs a library owned thread which reads the
+ * measurements of one handle, so the consumer can write them to slow outputs
+ * without losing samples.
  */
 
 #include <stdlib.h>
@@ -38,7 +49,11 @@ If not, see <http://www.gnu.org/licenses/>.
 #include <string.h>
 #include <assert.h>
 #include <unistd.h>
+#include <stdint.h>
 #include <libusb-1.0/libusb.h>
+#ifndef _WIN32
+#include <poll.h>
+#endif
 
 #ifndef liballuris_h
 #define liballuris_h
@@ -47,10 +62,17 @@ If not, see <http://www.gnu.org/licenses/>.
  * 0 = no debugging
  * 1 = print called functions and timing
  * 2 = print low level communication
+ *
+ * Default for contexts without their own level and for handles not opened with
+ * liballuris_open_*, set it before other threads call into liballuris.
+ * \deprecated Use \ref liballuris_set_context_debug_level
  */
 extern int liballuris_debug_level;
 
-//! Number of device which can be enumerated and simultaneously opened
+/*!
+ * \brief Number of devices which fit in the array of \ref liballuris_get_device_list
+ * \deprecated More devices can be connected, use \ref liballuris_get_device_array instead.
+ */
 #define MAX_NUM_DEVICES 8
 
 //! Default timeout in milliseconds while writing to the device
@@ -59,9 +81,48 @@ extern int liballuris_debug_level;
 //! Default timeout in milliseconds while reading from the device (>800ms)
 #define DEFAULT_RECEIVE_TIMEOUT 4000
 
+//! Lower limit of adaptive timeouts in milliseconds, see \ref liballuris_set_timeout_policy
+#define MIN_ADAPTIVE_TIMEOUT 20
+
+//! Deadline in milliseconds for reading the serial number of one device during enumeration
+#define ENUMERATION_TIMEOUT 500
+
+//! Maximum number of devices which are opened and queried at the same time during enumeration
+#define ENUMERATION_THREADS 16
+
+//! Number of buckets of the latency histograms, see \ref liballuris_command_stats
+#define LATENCY_BUCKETS 16
+
+//! Upper end of the first latency bucket in milliseconds, bucket k ends at LATENCY_BUCKET_BASE * 2^k
+#define LATENCY_BUCKET_BASE 0.25
+
 //! Default receive buffer size. Should be multiple of wMaxPacketSize
 #define DEFAULT_RECV_BUF_LEN 256
 
+//! Default number of interrupt IN transfers kept queued by \ref liballuris_stream_open
+#define DEFAULT_STREAM_TRANSFERS 8
+
+//! Number of decoded blocks a stream buffers until the consumer fetches them
+#define STREAM_QUEUE_LEN 64
+
+//! Default number of values the ring of \ref liballuris_reader_start holds (73s at 900Hz)
+#define DEFAULT_READER_CAPACITY 65536
+
+//! Default number of samples per device an acquisition group buffers (9s at 900Hz)
+#define DEFAULT_GROUP_CAPACITY 8192
+
+//! Value in a row of \ref liballuris_group_read for a sample the device didn't deliver
+#define LIBALLURIS_GROUP_MISSING INT32_MIN
+
+//! Default time in seconds \ref liballuris_group_read_resampled waits for a late device
+#define DEFAULT_RESAMPLE_DELAY 0.25
+
+//! Number of sample blocks queued per handle while commands wait for their reply
+#define SAMPLE_QUEUE_LEN 64
+
+//! Default number of commands in flight for \ref liballuris_batch_run
+#define DEFAULT_PIPELINE_DEPTH 4
+
 //! liballuris specific errors
 enum liballuris_error
 {
@@ -186,7 +247,7 @@ union __liballuris_state__
  *
  * product and serial_number should help to identify a specific Alluris device if more than one
  * device is connected via USB.
- * \sa get_alluris_device_list, open_alluris_device, free_alluris_device_list
+ * \sa liballuris_get_device_array, liballuris_open_device, liballuris_free_device_array
  */
 struct alluris_device_description
 {
@@ -195,6 +256,246 @@ struct alluris_device_description
   char serial_number[30]; //!< serial number of device, for example "P.25412"
 };
 
+/*!
+ * \brief Latency histograms and error counters of one command type
+ *
+ * Bucket k of the histograms counts latencies up to LATENCY_BUCKET_BASE * 2^k milliseconds,
+ * the last bucket also everything above.
+ * \sa liballuris_get_command_stats, liballuris_latency_percentile
+ */
+struct liballuris_command_stats
+{
+  unsigned long replies;                //!< commands which completed
+  unsigned long send_errors;            //!< failed writes
+  unsigned long timeouts;               //!< commands without reply within their timeout
+  unsigned long malformed;              //!< replies with wrong command byte or length
+  unsigned long late_replies;           //!< replies discarded because their command timed out before
+  unsigned int send[LATENCY_BUCKETS];   //!< duration of the write
+  unsigned int reply[LATENCY_BUCKETS];  //!< from the completed write until the reply
+  unsigned int total[LATENCY_BUCKETS];  //!< send + reply
+};
+
+/*!
+ * \brief Calibration data stored in the flash of the measurement processor
+ * \sa liballuris_get_calibration
+ */
+struct liballuris_calibration
+{
+  unsigned short date;                  //!< calibration date, days since 1.1.2000
+  double uncertainty;                   //!< measurement uncertainty
+  char number[41];                      //!< calibration number, NUL terminated
+};
+
+/*!
+ * \brief Integrity counters of the received ID_SAMPLE blocks
+ *
+ * The ID_SAMPLE header carries no sequence number. Gaps are detected by the
+ * arrival time of a block, see \ref liballuris_stream_read_timestamped,
+ * and therefore only while a stream is open.
+ * \sa liballuris_get_sample_stats
+ */
+struct liballuris_sample_stats
+{
+  unsigned long blocks;                 //!< valid blocks received
+  unsigned long malformed;              //!< blocks with wrong header or length, discarded
+  unsigned long gaps;                   //!< discontinuities detected before a block
+  unsigned long missing;                //!< samples the device didn't send in these gaps
+  unsigned long dropped;                //!< blocks received but discarded because a queue was full
+};
+
+/*!
+ * \brief Position of a block read from a stream
+ * \sa liballuris_stream_read_timestamped
+ */
+struct liballuris_block_info
+{
+  double arrival;                       //!< CLOCK_MONOTONIC seconds when the block was received
+  unsigned long long first_index;       //!< zero based index of the first sample since the stream was opened
+  unsigned long missing;                //!< samples missing between the previous block read and this one
+};
+
+/*!
+ * \brief Asynchronous streaming engine for cyclic measurements
+ *
+ * Opaque handle which keeps several interrupt IN transfers queued on endpoint 0x81
+ * so that the host controller polls the device even while the application is busy.
+ * \sa liballuris_stream_open, liballuris_stream_read, liballuris_stream_close
+ */
+struct liballuris_stream;
+
+/*!
+ * \brief Background reader for cyclic measurements
+ *
+ * Opaque handle of a library owned thread which reads a stream into a
+ * lock-free single-producer/single-consumer ring.
+ * \sa liballuris_reader_start, liballuris_reader_read, liballuris_reader_stop
+ */
+struct liballuris_reader;
+
+/*!
+ * \brief Acquisition engine for several gauges
+ *
+ * Opaque handle of a library owned thread which streams from several devices
+ * and combines their samples into rows.
+ * \sa liballuris_group_start, liballuris_group_read, liballuris_group_stop
+ */
+struct liballuris_group;
+
+/*!
+ * \brief Load of the engine thread of an acquisition group
+ * \sa liballuris_group_get_stats
+ */
+struct liballuris_group_stats
+{
+  double elapsed;                       //!< seconds since liballuris_group_start
+  double cpu_time;                      //!< CPU seconds used by the engine thread
+  unsigned long wakeups;                //!< times the engine thread returned from waiting for events
+  unsigned long long rows;              //!< rows delivered by liballuris_group_read
+  unsigned long long dropped_rows;      //!< oldest rows discarded because the consumer was too slow
+};
+
+/*!
+ * \brief Per device counters and latency of an acquisition group
+ * \sa liballuris_group_get_device_stats
+ */
+struct liballuris_group_device_stats
+{
+  unsigned long long received;          //!< samples received
+  unsigned long long missing;           //!< samples delivered as LIBALLURIS_GROUP_MISSING or NaN
+  unsigned long long late;              //!< samples discarded because their row was delivered already
+  size_t pending;                       //!< samples received but not delivered yet
+  double lag;                           //!< seconds from completion of the last received sample until it was queued
+  double max_lag;                       //!< largest lag since liballuris_group_start
+  int error;                            //!< error which ended the stream of the device
+};
+
+//! First two bytes of a frame of \ref liballuris_frame_encode
+#define LIBALLURIS_FRAME_SYNC "\xa5\x5a"
+//! Size of the frame header, the payload follows it
+#define LIBALLURIS_FRAME_HEADER_SIZE 12
+//! Size of the checksum after the payload
+#define LIBALLURIS_FRAME_TRAILER_SIZE 4
+//! Largest number of samples in a frame
+#define LIBALLURIS_FRAME_MAX_SAMPLES 4096
+//! Samples per frame of fstream and gadc, 5 blocks or about 0.1s at 900Hz
+#define DEFAULT_FRAME_SAMPLES 95
+
+/*!
+ * \brief Encoding of the samples in the payload of a frame
+ */
+enum liballuris_frame_format
+{
+  LIBALLURIS_FRAME_INT24 = 0,   //!< 3 bytes per sample, little endian two's complement
+  LIBALLURIS_FRAME_DELTA = 1    //!< lossless, differences zigzag coded and bit packed, see \ref liballuris_frame_writer_new
+};
+
+/*!
+ * \brief Header of a decoded frame
+ *
+ * A frame is stored as
+ *
+ * | bytes | content                                                   |
+ * |-------|-----------------------------------------------------------|
+ * | 2     | \ref LIBALLURIS_FRAME_SYNC                                |
+ * | 1     | format, enum liballuris_frame_format                      |
+ * | 1     | device                                                    |
+ * | 4     | sequence                                                  |
+ * | 2     | count                                                     |
+ * | 2     | payload size in bytes                                     |
+ * | n     | payload                                                   |
+ * | 4     | CRC-32 (as zlib) of format up to the end of payload       |
+ *
+ * All numbers are little endian.
+ * \sa liballuris_frame_encode, liballuris_frame_decode
+ */
+struct liballuris_frame_info
+{
+  uint32_t sequence;            //!< incremented by the sender for every frame
+  uint8_t device;               //!< chosen by the sender to tell several gauges apart
+  uint8_t format;               //!< enum liballuris_frame_format
+  uint16_t count;               //!< number of samples
+  size_t size;                  //!< size of the whole frame in bytes
+  size_t skipped;               //!< bytes before the frame which didn't belong to a valid frame
+};
+
+//! First bytes of a capture file
+#define LIBALLURIS_CAPTURE_MAGIC "ALLURIS\x1a"
+//! Version of the capture file format
+#define LIBALLURIS_CAPTURE_VERSION 1
+//! Size of struct liballuris_capture_header, the first record follows it
+#define LIBALLURIS_CAPTURE_HEADER_SIZE 128
+
+/*!
+ * \brief Header of a capture file
+ *
+ * A capture file is this header followed by count records. In version 1 a
+ * record is one int32 value as returned by \ref liballuris_poll_measurement,
+ * record k starts at header_size + k * record_size. All fields are stored in
+ * host byte order, fields which weren't known when writing are -1 (serial empty).
+ * \sa liballuris_capture_create, liballuris_capture_open
+ */
+struct liballuris_capture_header
+{
+  char magic[8];                //!< \ref LIBALLURIS_CAPTURE_MAGIC
+  uint32_t version;             //!< \ref LIBALLURIS_CAPTURE_VERSION
+  uint32_t header_size;         //!< offset of the first record
+  uint32_t record_size;         //!< size of a record in bytes
+  int32_t digits;               //!< number of decimal places, see \ref liballuris_get_digits
+  int32_t unit;                 //!< enum liballuris_unit
+  int32_t mode;                 //!< enum liballuris_measurement_mode
+  int32_t data_ratio;           //!< divider of the 900Hz or 10Hz base frequency, 0 or 1 = none
+  uint32_t reserved0;
+  int64_t start_time_ns;        //!< nanoseconds since 1970-01-01 UTC
+  uint64_t count;               //!< number of records, updated by the writer after each append
+  char serial[32];              //!< serial number of device, for example "P.25412"
+  char reserved[40];
+};
+
+/*!
+ * \brief Text or binary representation of \ref liballuris_formatter_new
+ */
+enum liballuris_output_format
+{
+  LIBALLURIS_OUTPUT_RAW    = 0, //!< numbers separated by space, missing values as "-"
+  LIBALLURIS_OUTPUT_CSV    = 1, //!< numbers separated by comma, missing values empty
+  LIBALLURIS_OUTPUT_TSV    = 2, //!< numbers separated by tab, missing values empty
+  LIBALLURIS_OUTPUT_BINARY = 3  //!< int32 in host byte order like \ref liballuris_capture_get_records
+};
+
+/*!
+ * \brief Buffered writer of rows of samples as text or binary
+ * \sa liballuris_formatter_new, liballuris_formatter_free
+ */
+struct liballuris_formatter;
+
+/*!
+ * \brief Encoder which writes samples as frames to a FILE
+ * \sa liballuris_frame_writer_new, liballuris_frame_writer_free
+ */
+struct liballuris_frame_writer;
+
+/*!
+ * \brief Capture file opened for appending or reading
+ * \sa liballuris_capture_create, liballuris_capture_open, liballuris_capture_close
+ */
+struct liballuris_capture;
+
+/*!
+ * \brief Queue of commands which are sent pipelined
+ *
+ * Opaque handle. Replies are matched to the queued commands by their command byte.
+ * \sa liballuris_batch_new, liballuris_batch_run, liballuris_batch_free
+ */
+struct liballuris_batch;
+
+/*!
+ * \brief Session of an opened device which caches its static properties
+ *
+ * Opaque handle. The cached properties are invalidated by the matching set calls.
+ * \sa liballuris_device_open, liballuris_device_handle, liballuris_device_close
+ */
+struct liballuris_device;
+
 #ifdef __cplusplus
 extern "C"
 {
@@ -204,19 +505,44 @@ const char * liballuris_error_name (int error_code);
 const char * liballuris_unit_enum2str (enum liballuris_unit unit);
 enum liballuris_unit liballuris_unit_str2enum (const char *str);
 
+/* decoding of packed 24bit sample blocks */
+void liballuris_decode_int24 (const unsigned char* in, int* out, size_t length);
+const char* liballuris_decoder_name (void);
+
+ssize_t liballuris_get_device_array (libusb_context* ctx, struct alluris_device_description** list, char read_serial);
+void liballuris_free_device_array (struct alluris_device_description* list);
 int liballuris_get_device_list (libusb_context* ctx, struct alluris_device_description* alluris_devs, size_t length, char read_serial);
 int liballuris_open_device (libusb_context* ctx, const char* serial_number, libusb_device_handle** h);
 int liballuris_open_device_with_id (libusb_context* ctx, int bus, int device, libusb_device_handle** h);
 int liballuris_open_if_not_opened (libusb_context* ctx, const char* serial_or_bus_id, libusb_device_handle** h);
 void liballuris_free_device_list (struct alluris_device_description* alluris_devs, size_t length);
+void liballuris_release_registry (libusb_context* ctx);
 void liballuris_print_device_list (FILE *sink, libusb_context* ctx);
+void liballuris_close_device (libusb_device_handle* h);
 
 void liballuris_clear_RX (libusb_device_handle* dev_handle, unsigned int timeout);
 
+/* device session with cached properties */
+int liballuris_device_open (libusb_context* ctx, const char* serial_or_bus_id, struct liballuris_device** dev);
+void liballuris_device_close (struct liballuris_device* dev);
+libusb_device_handle* liballuris_device_handle (struct liballuris_device* dev);
+int liballuris_device_reload (struct liballuris_device* dev);
+int liballuris_device_get_digits (struct liballuris_device* dev, int* v);
+int liballuris_device_get_resolution (struct liballuris_device* dev, int* v);
+int liballuris_device_get_F_max (struct liballuris_device* dev, int* fmax);
+int liballuris_device_get_unit (struct liballuris_device* dev, enum liballuris_unit* unit);
+int liballuris_device_get_variant (struct liballuris_device* dev, char* buf, size_t length);
+int liballuris_device_get_firmware (struct liballuris_device* dev, int processor, char* buf, size_t length);
+int liballuris_device_get_serial_number (struct liballuris_device* dev, char* buf, size_t length);
+int liballuris_device_scale (struct liballuris_device* dev, int raw, double* value);
+
 int liballuris_get_serial_number (libusb_device_handle *dev_handle, char* buf, size_t length);
 int liballuris_get_firmware (libusb_device_handle *dev_handle, int dev, char* buf, size_t length);
 int liballuris_get_next_calibration_date (libusb_device_handle *dev_handle, int* v);
 int liballuris_read_flash (libusb_device_handle *dev_handle, int adr, unsigned short *v);
+int liballuris_read_flash_range (libusb_device_handle *dev_handle, int adr, unsigned short* buf, size_t length);
+int liballuris_get_calibration (libusb_device_handle *dev_handle, struct liballuris_calibration* cal);
+void liballuris_clear_calibration_cache (libusb_context* ctx);
 int liballuris_get_calibration_date (libusb_device_handle *dev_handle, unsigned short* v);
 int liballuris_get_calibration_number (libusb_device_handle *dev_handle, char* buf, size_t length);
 int liballuris_get_uncertainty (libusb_device_handle *dev_handle, double* v);
@@ -237,6 +563,119 @@ void liballuris_print_state (struct liballuris_state state);
 int liballuris_cyclic_measurement (libusb_device_handle *dev_handle, char enable, size_t length);
 int liballuris_poll_measurement (libusb_device_handle *dev_handle, int* buf, size_t length);
 int liballuris_poll_measurement_no_wait (libusb_device_handle *dev_handle, int* buf, size_t length, size_t *actual_num_values);
+unsigned long liballuris_get_lost_blocks (libusb_device_handle* dev_handle);
+int liballuris_get_sample_stats (libusb_device_handle* dev_handle, struct liballuris_sample_stats* stats);
+
+int liballuris_set_timeout_policy (libusb_device_handle* dev_handle, char adaptive, unsigned int ceiling, char fast_fail);
+unsigned int liballuris_get_adaptive_timeout (libusb_device_handle* dev_handle, unsigned char cmd);
+
+int liballuris_get_command_stats (libusb_device_handle* dev_handle, unsigned char cmd, struct liballuris_command_stats* stats);
+void liballuris_reset_command_stats (libusb_device_handle* dev_handle);
+void liballuris_print_command_stats (FILE *sink, libusb_device_handle* dev_handle);
+double liballuris_latency_percentile (const unsigned int* histogram, double p);
+
+int liballuris_stream_open (libusb_context* ctx, libusb_device_handle *dev_handle, size_t length, int num_transfers, struct liballuris_stream** stream);
+int liballuris_stream_read (struct liballuris_stream* stream, int* buf, size_t length, unsigned int timeout);
+int liballuris_stream_read_timestamped (struct liballuris_stream* stream, int* buf, double* t,
+                                        struct liballuris_block_info* info, size_t length, unsigned int timeout);
+size_t liballuris_stream_pending (struct liballuris_stream* stream);
+unsigned long liballuris_stream_get_overflows (struct liballuris_stream* stream);
+double liballuris_stream_get_sample_rate (struct liballuris_stream* stream);
+int liballuris_stream_close (struct liballuris_stream* stream);
+
+/* background reader */
+int liballuris_reader_start (libusb_context* ctx, libusb_device_handle *dev_handle, size_t length, size_t capacity, struct liballuris_reader** reader);
+int liballuris_reader_read (struct liballuris_reader* reader, int* buf, size_t length, size_t* actual, unsigned int timeout);
+int liballuris_reader_read_timestamped (struct liballuris_reader* reader, int* buf, double* t, size_t length,
+                                        size_t* actual, unsigned int timeout);
+size_t liballuris_reader_pending (struct liballuris_reader* reader);
+unsigned long liballuris_reader_get_overflows (struct liballuris_reader* reader);
+double liballuris_reader_get_sample_rate (struct liballuris_reader* reader);
+int liballuris_reader_stop (struct liballuris_reader* reader);
+
+/* multi device acquisition */
+int liballuris_group_start (libusb_context* ctx, libusb_device_handle** handles, size_t num_devices,
+                            size_t length, size_t capacity, struct liballuris_group** group);
+int liballuris_group_read (struct liballuris_group* group, int* rows, size_t num_rows, size_t* actual, unsigned int timeout);
+int liballuris_group_read_timestamped (struct liballuris_group* group, int* rows, double* t, size_t num_rows,
+                                       size_t* actual, unsigned int timeout);
+int liballuris_group_set_timebase (struct liballuris_group* group, double period, double max_delay);
+int liballuris_group_read_resampled (struct liballuris_group* group, double* rows, double* t, size_t num_rows,
+                                     size_t* actual, unsigned int timeout);
+size_t liballuris_group_pending (struct liballuris_group* group);
+int liballuris_group_get_stats (struct liballuris_group* group, struct liballuris_group_stats* stats);
+int liballuris_group_get_device_stats (struct liballuris_group* group, size_t device,
+                                       struct liballuris_group_device_stats* stats);
+int liballuris_group_stop (struct liballuris_group* group);
+
+/* framed streams */
+size_t liballuris_frame_size (size_t count);
+int liballuris_frame_encode (unsigned char* buf, size_t size, unsigned int device, uint32_t sequence,
+                             const int* values, size_t count, size_t* written);
+int liballuris_frame_decode (const unsigned char* buf, size_t size, struct liballuris_frame_info* info,
+                             int* values, size_t length, size_t* consumed);
+int liballuris_frame_writer_new (FILE* out, enum liballuris_frame_format format, unsigned int device,
+                                 size_t samples, struct liballuris_frame_writer** writer);
+int liballuris_frame_writer_write (struct liballuris_frame_writer* writer, const int* values, size_t count);
+int liballuris_frame_writer_flush (struct liballuris_frame_writer* writer);
+unsigned long long liballuris_frame_writer_get_bytes (struct liballuris_frame_writer* writer);
+int liballuris_frame_writer_free (struct liballuris_frame_writer* writer);
+
+/* output formatting */
+enum liballuris_output_format liballuris_output_str2enum (const char *str);
+int liballuris_formatter_new (FILE* out, enum liballuris_output_format format, size_t columns, const int* digits,
+                              struct liballuris_formatter** fmt);
+int liballuris_formatter_write (struct liballuris_formatter* fmt, const int* values, size_t count);
+int liballuris_formatter_flush (struct liballuris_formatter* fmt);
+int liballuris_formatter_free (struct liballuris_formatter* fmt);
+
+/* capture files */
+#ifndef _WIN32
+int liballuris_capture_describe (libusb_device_handle *dev_handle, struct liballuris_capture_header* info);
+int liballuris_capture_create (const char* path, const struct liballuris_capture_header* info, struct liballuris_capture** cap);
+int liballuris_capture_append (struct liballuris_capture* cap, const int* values, size_t length);
+int liballuris_capture_open (const char* path, struct liballuris_capture** cap);
+const struct liballuris_capture_header* liballuris_capture_get_header (struct liballuris_capture* cap);
+const int32_t* liballuris_capture_get_records (struct liballuris_capture* cap, size_t* count);
+int liballuris_capture_close (struct liballuris_capture* cap);
+#endif
+
+/* event loop integration */
+#ifndef _WIN32
+int liballuris_get_pollfds (libusb_context* ctx, struct pollfd* fds, size_t length);
+#endif
+int liballuris_get_next_timeout (libusb_context* ctx);
+int liballuris_handle_events (libusb_context* ctx);
+
+/* pipelined commands */
+int liballuris_batch_new (libusb_device_handle *dev_handle, int depth, struct liballuris_batch** batch);
+void liballuris_batch_free (struct liballuris_batch* batch);
+void liballuris_batch_clear (struct liballuris_batch* batch);
+int liballuris_batch_run (struct liballuris_batch* batch);
+int liballuris_batch_status (struct liballuris_batch* batch, int index);
+
+int liballuris_batch_get_serial_number (struct liballuris_batch* batch, char* buf, size_t length);
+int liballuris_batch_get_firmware (struct liballuris_batch* batch, int dev, char* buf, size_t length);
+int liballuris_batch_get_next_calibration_date (struct liballuris_batch* batch, int* v);
+int liballuris_batch_get_digits (struct liballuris_batch* batch, int* v);
+int liballuris_batch_get_resolution (struct liballuris_batch* batch, int* v);
+int liballuris_batch_get_F_max (struct liballuris_batch* batch, int* fmax);
+int liballuris_batch_get_variant (struct liballuris_batch* batch, char* buf, size_t length);
+int liballuris_batch_get_value (struct liballuris_batch* batch, int* value);
+int liballuris_batch_get_pos_peak (struct liballuris_batch* batch, int* peak);
+int liballuris_batch_get_neg_peak (struct liballuris_batch* batch, int* peak);
+int liballuris_batch_read_state (struct liballuris_batch* batch, struct liballuris_state* state);
+int liballuris_batch_get_upper_limit (struct liballuris_batch* batch, int* limit);
+int liballuris_batch_get_lower_limit (struct liballuris_batch* batch, int* limit);
+int liballuris_batch_get_mode (struct liballuris_batch* batch, enum liballuris_measurement_mode* mode);
+int liballuris_batch_get_unit (struct liballuris_batch* batch, enum liballuris_unit* unit);
+int liballuris_batch_get_digout (struct liballuris_batch* batch, int* v);
+int liballuris_batch_get_digin (struct liballuris_batch* batch, int* v);
+int liballuris_batch_get_mem_count (struct liballuris_batch* batch, int* v);
+int liballuris_batch_read_memory (struct liballuris_batch* batch, int adr, int* mem_value);
+int liballuris_batch_read_flash (struct liballuris_batch* batch, int adr, unsigned short* v);
+int liballuris_batch_get_peak_level (struct liballuris_batch* batch, int* v);
+int liballuris_batch_get_autostop (struct liballuris_batch* batch, int* v);
 
 int liballuris_tare (libusb_device_handle *dev_handle);
 int liballuris_clear_pos_peak (libusb_device_handle *dev_handle);
@@ -244,6 +683,7 @@ int liballuris_clear_neg_peak (libusb_device_handle *dev_handle);
 
 int liballuris_start_measurement (libusb_device_handle *dev_handle);
 int liballuris_stop_measurement (libusb_device_handle *dev_handle);
+double liballuris_get_start_latency (libusb_device_handle *dev_handle);
 
 int liballuris_set_upper_limit (libusb_device_handle *dev_handle, int limit);
 int liballuris_set_lower_limit (libusb_device_handle *dev_handle, int limit);
@@ -269,6 +709,7 @@ int liballuris_restore_factory_defaults (libusb_device_handle *dev_handle);
 int liballuris_power_off (libusb_device_handle *dev_handle);
 
 int liballuris_read_memory (libusb_device_handle *dev_handle, int adr, int* mem_value);
+int liballuris_read_memory_range (libusb_device_handle *dev_handle, int adr, int* buf, size_t length, size_t* actual);
 int liballuris_delete_memory (libusb_device_handle *dev_handle);
 int liballuris_get_mem_count (libusb_device_handle *dev_handle, int* v);
 
@@ -297,6 +738,7 @@ int liballuris_set_motor_stopp (libusb_device_handle *dev_handle, char state);
 int liballuris_set_data_ratio (libusb_device_handle *dev_handle, int v);
 
 void liballuris_set_debug_level (int l);
+int liballuris_set_context_debug_level (libusb_context* ctx, int level);
 
 #ifdef __cplusplus
 }
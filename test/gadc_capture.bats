@@ -0,0 +1,39 @@
+#!/usr/bin/env bats
+
+## Tests gadc --capture, the file is checked with examples/capture_dump
+
+GADC=../cli/gadc
+DUMP=../examples/capture_dump
+CAPTURE=/tmp/gadc_capture_test.cap
+
+@test "Capture 100 values in peak mode" {
+  rm -f $CAPTURE
+  run $GADC --stop --set-mode 1 --capture=$CAPTURE --start -s 100 --stop
+  [ "$status" -eq 0 ]
+  [ "$output" == "" ]
+  [ "$(stat -c %s $CAPTURE)" -eq 528 ]
+}
+
+@test "Capture header records digits, unit and mode" {
+  digits=$($GADC --digits)
+  unit=$($GADC --get-unit)
+  run $DUMP $CAPTURE 0 0
+  [ "$status" -eq 0 ]
+  [ "${lines[2]}" == "# digits     $digits" ]
+  [ "${lines[3]}" == "# unit       $unit" ]
+  [ "${lines[4]}" == "# mode       1" ]
+  [ "${lines[6]}" == "# values     100" ]
+}
+
+@test "Capture while measuring has unknown digits" {
+  run $GADC --start --capture=$CAPTURE -s 10 --stop
+  [ "$status" -eq 0 ]
+  run $DUMP $CAPTURE 0 0
+  [ "${lines[2]}" == "# digits     -1" ]
+  [ "${lines[6]}" == "# values     10" ]
+}
+
+@test "No capture file" {
+  run $DUMP /dev/null
+  [ "$status" -eq 1 ]
+}
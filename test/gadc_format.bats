@@ -0,0 +1,37 @@
+#!/usr/bin/env bats
+
+## Tests gadc --format
+
+GADC=../cli/gadc
+OUT=/tmp/gadc_format_test.bin
+
+@test "Format raw prints one integer per line" {
+  run $GADC --stop --set-mode 1 --format=raw --start -s 50 --stop
+  [ "$status" -eq 0 ]
+  [ "${#lines[@]}" -eq 50 ]
+  [[ "${lines[0]}" =~ ^-?[0-9]+$ ]]
+}
+
+@test "Format csv uses the digits of the device" {
+  digits=$($GADC --digits)
+  run $GADC --stop --format=csv --start -s 50 --stop
+  [ "$status" -eq 0 ]
+  [ "${#lines[@]}" -eq 50 ]
+  if [ "$digits" -eq 0 ]; then
+    [[ "${lines[49]}" =~ ^-?[0-9]+$ ]]
+  else
+    [[ "${lines[49]}" =~ ^-?[0-9]+\.[0-9]{$digits}$ ]]
+  fi
+}
+
+@test "Format binary writes int32" {
+  rm -f $OUT
+  run bash -c "$GADC --stop --format=binary --start -s 100 --stop > $OUT"
+  [ "$status" -eq 0 ]
+  [ "$(stat -c %s $OUT)" -eq 400 ]
+}
+
+@test "Unknown format" {
+  run $GADC --format=xml
+  [ "$status" -eq 4 ]
+}
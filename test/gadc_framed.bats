@@ -0,0 +1,48 @@
+#!/usr/bin/env bats
+
+## Tests gadc --framed and --compress, the stream is checked with examples/frame_dump
+
+GADC=../cli/gadc
+DUMP=../examples/frame_dump
+FRAMES=/tmp/gadc_framed_test.bin
+
+@test "Stream 100 values as frames in peak mode" {
+  rm -f $FRAMES
+  run bash -c "$GADC --stop --set-mode 1 --start --framed=7 -s 100 --stop > $FRAMES"
+  [ "$status" -eq 0 ]
+  # two frames with 95 and 5 values, 16 bytes header and checksum each
+  [ "$(stat -c %s $FRAMES)" -eq 332 ]
+}
+
+@test "Frames carry device id and all values" {
+  run bash -c "$DUMP -d $FRAMES 2>/dev/null"
+  [ "$status" -eq 0 ]
+  [ "${#lines[@]}" -eq 100 ]
+  [ "${lines[0]%% *}" == "7" ]
+  [ "${lines[99]%% *}" == "7" ]
+}
+
+@test "Frames resynchronise after corrupted bytes" {
+  printf 'garbage' | cat - $FRAMES > $FRAMES.bad
+  run bash -c "$DUMP $FRAMES.bad 2>&1 >/dev/null"
+  [ "$status" -eq 0 ]
+  [ "${lines[0]}" == "Warning: skipped 7 corrupted byte(s) before frame 0" ]
+  [ "${lines[1]}" == "# 2 frame(s), 0 lost, 7 byte(s) skipped" ]
+  rm -f $FRAMES.bad
+}
+
+@test "Stream 1000 compressed values" {
+  run bash -c "$GADC --stop --set-mode 1 --start --framed=3 --compress -s 1000 --stop > $FRAMES"
+  [ "$status" -eq 0 ]
+  # less than the 3168 bytes of int24 frames
+  [ "$(stat -c %s $FRAMES)" -lt 3168 ]
+  run bash -c "$DUMP -d $FRAMES 2>/dev/null"
+  [ "$status" -eq 0 ]
+  [ "${#lines[@]}" -eq 1000 ]
+  [ "${lines[999]%% *}" == "3" ]
+}
+
+@test "Frame device id out of range" {
+  run $GADC --framed=256 -s 1
+  [ "$status" -eq 4 ]
+}
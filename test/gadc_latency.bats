@@ -0,0 +1,19 @@
+#!/usr/bin/env bats
+
+## Tests gadc --latency
+
+GADC=../cli/gadc
+
+@test "No commands, only the header" {
+  run $GADC --latency
+  [ "$status" -eq 0 ]
+  [ "${#lines[@]}" -eq 1 ]
+  [ "${lines[0]:0:4}" == "#cmd" ]
+}
+
+@test "Three values and the mode" {
+  run $GADC -v -v -v --get-mode --latency
+  [ "$status" -eq 0 ]
+  [ "${lines[5]:0:15}" == "0x05        1  " ]
+  [ "${lines[6]:0:41}" == "0x46        3      0      0      0      0" ]
+}
@@ -30,3 +30,11 @@ GADC=../cli/gadc
 }
 
 
+
+@test "Read whole memory stops at the memory count" {
+  run $GADC --read-memory -1
+  [ "$status" -eq 0 ]
+  [ "${#lines[@]}" -eq 2 ]
+  [ "${lines[0]}" -eq "$($GADC --read-memory 0)" ]
+  [ "${lines[1]}" -eq "$($GADC --read-memory 1)" ]
+}
@@ -0,0 +1,54 @@
+#!/usr/bin/env bats
+
+GADC=../cli/gadc
+
+@test "Stop measurement before pipelined getters" {
+  run $GADC --stop
+  [ "$status" -eq 0 ]
+}
+
+@test "Set unit N and auto stop (P14) = 15" {
+  run $GADC --set-unit N --set-auto-stop 15
+  [ "$status" -eq 0 ]
+}
+
+@test "Multiple getters in one call are printed in command line order" {
+  run $GADC --get-unit --get-auto-stop --digits --fmax --variant --get-firmware
+  [ "$status" -eq 0 ]
+  [ "${lines[0]}" == "N" ]
+  [ "${lines[1]}" -eq 15 ]
+  [ "${lines[2]}" -eq "$($GADC --digits)" ]
+  [ "${lines[3]}" -eq "$($GADC --fmax)" ]
+  [ "${lines[4]}" == "$($GADC --variant)" ]
+  [ "${lines[5]}" == "$($GADC --get-firmware)" ]
+}
+
+@test "Same getter twice in one call" {
+  run $GADC --get-auto-stop --get-unit --get-auto-stop
+  [ "$status" -eq 0 ]
+  [ "${lines[0]}" -eq 15 ]
+  [ "${lines[1]}" == "N" ]
+  [ "${lines[2]}" -eq 15 ]
+}
+
+@test "Setter between getters is applied in order" {
+  run $GADC --get-auto-stop --set-auto-stop 30 --get-auto-stop
+  [ "$status" -eq 0 ]
+  [ "${lines[0]}" -eq 15 ]
+  [ "${lines[1]}" -eq 30 ]
+}
+
+@test "Set 10Hz mode and start to measure for pipelined getters" {
+  run $GADC --set-mode 0 --start --sleep 300
+  [ "$status" -eq 0 ]
+}
+
+@test "Pipelined upper limit while running, check for LIBALLURIS_DEVICE_BUSY" {
+  run $GADC --get-auto-stop --get-upper-limit --digits
+  [ "$status" -eq 2 ]
+}
+
+@test "Stop measurement after pipelined getters" {
+  run $GADC --stop
+  [ "$status" -eq 0 ]
+}